@@ -1,16 +1,28 @@
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <deque>
+#include <limits>
 #include <memory>
-#include <queue>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 
 #include "Common.h"
 #include "Compat.h"
+#include "TDatagramBundle.h"
+#include "TDeadReckoning.h"
+#include "TInboundLimiter.h"
+#include "TLinkEstimator.h"
+#include "TPacketSchema.h"
+#include "TReliableChannel.h"
 #include "VehicleData.h"
 
 class TServer;
+class TStateReader;
+class TStateWriter;
 
 class TClient final {
 public:
@@ -21,6 +33,40 @@ public:
         std::unique_lock<std::mutex> Lock;
     };
 
+    // optional protocol features a client announces after its version, like "VC2.0;resume"
+    enum TCapability : uint32_t {
+        // understands resume tokens (TResumeToken & co.)
+        CapResume = 1 << 0,
+        // sends its ID in the wide form, see WideIDMarker
+        CapWideID = 1 << 1,
+        // numbers its UDP packets: <id>;<sequence, 2 bytes big endian><packet> instead of <id>:<packet>
+        CapUDPSequence = 1 << 2,
+        // takes several unreliable packets in one datagram, see TDatagramBundle
+        CapBundle = 1 << 3,
+        // takes reliable packets over UDP, see TReliableChannel
+        CapReliableUDP = 1 << 4,
+    };
+    // UDP packets start with the sender's ID + 1 in a single byte and the download socket handshake
+    // has the ID in a single byte. Clients with CapWideID send this marker followed by the ID in
+    // two bytes (big endian) instead. Old clients only get IDs up to MaxLegacyID, so they never send it.
+    static constexpr uint8_t WideIDMarker = 0xff;
+    static constexpr int MaxLegacyID = 253;
+    static constexpr int MaxWideID = 0xffff;
+    // a server which takes relays (RelaySecret) keeps the top RelayLegacyIDs legacy IDs and the
+    // wide ones from FirstRelayWideID free, a relay hands out only those to its own players
+    static constexpr int RelayLegacyIDs = 16;
+    static constexpr int FirstRelayWideID = 0xf000;
+    static int ReadWideID(const char* Data) { return (int(uint8_t(Data[0])) << 8) | uint8_t(Data[1]); }
+    // comma separated capability names, unknown ones are ignored
+    static uint32_t ParseCapabilities(std::string_view List);
+
+    struct TQueuedPacket {
+        std::string Data;
+        // the first character of the packet before it was compressed, 0 if unknown
+        char Code;
+        bool IsVehiclePacket;
+    };
+
     explicit TClient(TServer& Server);
     TClient(const TClient&) = delete;
     TClient& operator=(const TClient&) = delete;
@@ -28,7 +74,7 @@ public:
     void AddNewCar(int Ident, const std::string& Data);
     void SetCarData(int Ident, const std::string& Data);
     TVehicleDataLockPair GetAllCars();
-    void SetName(const std::string& Name) { mName = Name; }
+    void SetName(const std::string& Name);
     void SetRoles(const std::string& Role) { mRole = Role; }
     void AddIdentifier(const std::string& ID) { mIdentifiers.insert(ID); };
     std::string GetCarData(int Ident);
@@ -57,29 +103,71 @@ public:
     [[nodiscard]] bool IsSyncing() const { return mIsSyncing; }
     [[nodiscard]] bool IsGuest() const { return mIsGuest; }
     void SetIsGuest(bool NewIsGuest) { mIsGuest = NewIsGuest; }
+    void SetCapabilities(uint32_t Capabilities) { mCapabilities = Capabilities; }
+    [[nodiscard]] uint32_t Capabilities() const { return mCapabilities; }
+    [[nodiscard]] bool HasCapability(TCapability Capability) const { return (mCapabilities & Capability) != 0; }
     void SetIsSynced(bool NewIsSynced) { mIsSynced = NewIsSynced; }
     void SetIsSyncing(bool NewIsSyncing) { mIsSyncing = NewIsSyncing; }
+    // the room's name, only TServer reads or changes it (with its client mutex locked)
+    [[nodiscard]] const std::string& GetRoom() const { return mRoom; }
+    void SetRoom(const std::string& Room) { mRoom = Room; }
+    // got told which map to load, it can't change rooms to another map after this
+    [[nodiscard]] bool IsMapSent() const { return mIsMapSent; }
+    void SetIsMapSent(bool NewIsMapSent) { mIsMapSent = NewIsMapSent; }
+    // queues a reliable packet in the queue PacketSchema::PriorityOf picks for it
     void EnqueuePacket(const std::string& Packet);
-    [[nodiscard]] std::queue<std::string>& MissedPacketQueue() { return mPacketsSync; }
-    [[nodiscard]] const std::queue<std::string>& MissedPacketQueue() const { return mPacketsSync; }
-    [[nodiscard]] size_t MissedPacketQueueSize() const { return mPacketsSync.size(); }
+    // for packets which were classified before they were compressed, Code is the packet's first
+    // character before that. vehicle ('O') packets stay in order, even if that means waiting
+    // behind a spawn in the bulk queue.
+    void EnqueuePacket(std::string Packet, PacketSchema::TPriority Priority, char Code);
+    // the next packet to send, the priority classes take turns weighted by PriorityQuantum.
+    // nothing if it's bigger than MaxSize, the queues stay as they are then.
+    [[nodiscard]] std::optional<TQueuedPacket> DequeuePacket(size_t MaxSize = std::numeric_limits<size_t>::max());
+    [[nodiscard]] size_t MissedPacketQueueSize() const { return mQueuedPackets; }
     [[nodiscard]] std::mutex& MissedPacketQueueMutex() const { return mMissedPacketsMutex; }
     void SetIsConnected(bool NewIsConnected) { mIsConnected = NewIsConnected; }
+    [[nodiscard]] TInboundLimiter& InboundLimiter() { return mInboundLimiter; }
+    [[nodiscard]] TLinkEstimator& Link() { return mLink; }
+    [[nodiscard]] TDatagramBundle& Bundle() { return mBundle; }
+    [[nodiscard]] TReliableChannel& Reliable() { return mReliable; }
+    [[nodiscard]] TDeadReckoning& DeadReckoning() { return mDeadReckoning; }
     [[nodiscard]] TServer& Server() const;
     void UpdatePingTime();
     int SecondsSinceLastPing();
+    // everything about the client except its sockets, for another process to take it over (see THotUpgrade)
+    void Save(TStateWriter& Writer);
+    // takes over a saved client, before it's inserted. throws if the state is cut short.
+    void Restore(TStateReader& Reader);
 
 private:
     void InsertVehicle(int ID, const std::string& Data);
+    void EnqueuePacket(TQueuedPacket Packet, PacketSchema::TPriority Priority);
 
     TServer& mServer;
     bool mIsConnected = false;
     bool mIsSynced = false;
     bool mIsSyncing = false;
+    bool mIsMapSent = false;
+    // TServer::DefaultRoom
+    std::string mRoom { "default" };
+    // bytes a priority class may send per turn (control, gameplay, bulk)
+    static constexpr std::array<size_t, PacketSchema::PriorityCount> PriorityQuantum { 8 * KB, 4 * KB, 1 * KB };
+
     mutable std::mutex mMissedPacketsMutex;
-    std::queue<std::string> mPacketsSync;
+    std::array<std::deque<TQueuedPacket>, PacketSchema::PriorityCount> mPacketQueues;
+    std::array<size_t, PacketSchema::PriorityCount> mDeficits {};
+    size_t mCurrentQueue = 0;
+    size_t mQueuedPackets = 0;
+    // vehicle packets waiting in each queue, the next ones have to queue up behind them
+    std::array<size_t, PacketSchema::PriorityCount> mVehiclePackets {};
     std::set<std::string> mIdentifiers;
     bool mIsGuest = false;
+    uint32_t mCapabilities = 0;
+    TInboundLimiter mInboundLimiter;
+    TLinkEstimator mLink;
+    TDatagramBundle mBundle;
+    TReliableChannel mReliable;
+    TDeadReckoning mDeadReckoning;
     std::mutex mVehicleDataMutex;
     TSetOfVehicleData mVehicleData;
     std::string mName = "Unknown Client";
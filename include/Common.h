@@ -5,8 +5,11 @@ extern TSentry Sentry;
 
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 
@@ -32,7 +35,22 @@ public:
             , DebugModeEnabled(false)
             , Port(30814)
             , SendErrors(true)
-            , SendErrorsMessageEnabled(true) { }
+            , SendErrorsMessageEnabled(true)
+            , AuthCacheTTL(300)
+            , AuthCacheSize(512)
+            , AuthCachePersist(false)
+            , AuthProvider("remote")
+            , AuthAllowlist("Allowlist.txt")
+            , AuthHttpHost("localhost")
+            , AuthHttpPort(8080)
+            , AuthHttpTls(false)
+            , MaxPendingHandshakesPerIP(8)
+            , ResumeGracePeriod(20)
+            , DeadReckoningThreshold(0)
+            , DeadReckoningKeyframe(1000)
+            , RoomAssignment("manual")
+            , ClusterWorkers(0)
+            , Standby(false) { }
         std::string ServerName;
         std::string ServerDesc;
         std::string Resource;
@@ -46,9 +64,46 @@ public:
         std::string CustomIP;
         bool SendErrors;
         bool SendErrorsMessageEnabled;
+        // seconds a successful auth result is reused for reconnects of the same key, 0 disables the cache
+        int AuthCacheTTL;
+        int AuthCacheSize;
+        bool AuthCachePersist;
+        // who decides whether a player may join: "remote" (BeamMP backend), "allowlist", "lua" or "http"
+        std::string AuthProvider;
+        std::string AuthAllowlist;
+        // where the "http" provider sends /pkToUser requests
+        std::string AuthHttpHost;
+        int AuthHttpPort;
+        // whether it speaks https, a stand-in on the same machine or network usually doesn't
+        bool AuthHttpTls;
+        // connections from one address which may be in the handshake at once, 0 for no limit
+        int MaxPendingHandshakesPerIP;
+        // seconds a dropped player's session is kept for them to resume it, 0 disables resuming
+        int ResumeGracePeriod;
+        // meters a client's extrapolation of a vehicle may be off before it gets the next position update, 0 sends all of them
+        double DeadReckoningThreshold;
+        // ms after which a vehicle's position is sent anyway
+        int DeadReckoningKeyframe;
+        // room name -> map, in addition to the "default" room with MapName
+        std::map<std::string, std::string> Rooms;
+        // which room new players join: "manual" (the default room, unless lua moves them) or "balanced" (the emptiest one)
+        std::string RoomAssignment;
+        // worker processes the players are spread across behind this one's port (linux only), 0 runs a single process
+        int ClusterWorkers;
+        // unix socket the cluster's processes talk over, empty for one in /tmp named after the port
+        std::string ClusterSocket;
+        // what relays have to send to get this server's world streamed to them, empty to take no relays
+        std::string RelaySecret;
+        // "host:port" of the server this one relays to its own, read-only, players. empty for a normal server
+        std::string RelayUpstream;
+        // what this relay sends to RelayUpstream, that server's RelaySecret
+        std::string RelayUpstreamSecret;
+        // keep a standby process which takes the players over if this one crashes (linux only)
+        bool Standby;
         [[nodiscard]] bool HasCustomIP() const { return !CustomIP.empty(); }
     };
     using TShutdownHandler = std::function<void()>;
+    using TUpgradeHandler = std::function<void()>;
 
     // methods
     Application() = delete;
@@ -57,11 +112,24 @@ public:
     static void RegisterShutdownHandler(const TShutdownHandler& Handler);
     // Causes all threads to finish up and exit gracefull gracefully
     static void GracefullyShutdown();
+    // 'Handler' is called, on its own thread, when HotUpgrade is called
+    static void SetUpgradeHandler(const TUpgradeHandler& Handler);
+    // Hands the server over to a new start of its binary (see THotUpgrade)
+    static void HotUpgrade();
     static TConsole& Console() { return *mConsole; }
     static std::string ServerVersion() { return "2.3.2"; }
     static std::string ClientVersion() { return "2.0"; }
-    static std::string PPS() { return mPPS; }
-    static void SetPPS(const std::string& NewPPS) { mPPS = NewPPS; }
+    static std::string PPS();
+    // changes about every second, so it's no change of state, the heartbeats which are
+    // due anyway take it along
+    static void SetPPS(const std::string& NewPPS);
+    // Call whenever something the server advertises to the backend (settings,
+    // players, mods) has changed. Wakes up everyone waiting in WaitForStateChange.
+    static void NotifyStateChanged();
+    static uint64_t StateVersion() { return mStateVersion; }
+    // Waits until the state version differs from 'Seen' or 'Deadline' is reached.
+    // Returns true if the state changed.
+    static bool WaitForStateChange(uint64_t Seen, std::chrono::steady_clock::time_point Deadline);
 
     static inline TSettings Settings {};
 
@@ -75,10 +143,16 @@ public:
     static bool IsOutdated(const std::array<int, 3>& Current, const std::array<int, 3>& Newest);
 
 private:
+    // guarded by mStateMutex
     static inline std::string mPPS;
+    static inline std::atomic<uint64_t> mStateVersion { 0 };
+    static inline std::mutex mStateMutex {};
+    static inline std::condition_variable mStateChanged {};
     static std::unique_ptr<TConsole> mConsole;
     static inline std::mutex mShutdownHandlersMutex {};
     static inline std::deque<TShutdownHandler> mShutdownHandlers {};
+    static inline std::mutex mUpgradeHandlerMutex {};
+    static inline TUpgradeHandler mUpgradeHandler {};
 };
 
 std::string ThreadName(bool DebugModeOverride = false);
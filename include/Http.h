@@ -1,11 +1,33 @@
 #pragma once
 
+#include <functional>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
 namespace Http {
+// lets another thread abort a request which is in flight, its connection is closed then
+class TCancellation {
+public:
+    void Cancel();
+    [[nodiscard]] bool IsCancelled() const;
+    // for the client: Abort is called on Cancel until Detach, false if it's cancelled already
+    bool Attach(std::function<void()> Abort);
+    // true if it was cancelled meanwhile
+    bool Detach();
+
+private:
+    mutable std::mutex mMutex;
+    bool mCancelled { false };
+    std::function<void()> mAbort;
+};
+
 std::string GET(const std::string& host, int port, const std::string& target, unsigned int* status = nullptr);
-std::string POST(const std::string& host, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status = nullptr);
+std::string POST(const std::string& host, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status = nullptr, TCancellation* cancel = nullptr);
+// with tls = false it's plain http, for a server on the same machine or network
+std::string POST(const std::string& host, int port, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status = nullptr, TCancellation* cancel = nullptr, bool tls = true);
+// closes all pooled keep-alive connections and forgets cached TLS sessions and DNS results
+void ResetConnectionPool();
 namespace Status {
     std::string ToString(int code);
 }
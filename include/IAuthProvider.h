@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+#include <variant>
+
+// what we know about a player after their key was looked up
+struct TAuthResult {
+    std::string Name;
+    std::string Roles;
+    bool IsGuest { false };
+    std::set<std::string> Identifiers;
+};
+
+// decides who a player's key belongs to, and whether they may join at all
+class IAuthProvider {
+public:
+    // either who the player is, or the reason to kick them with
+    using TVerdict = std::variant<TAuthResult, std::string>;
+
+    virtual ~IAuthProvider() = default;
+    // called from the auth workers, may block but has to be thread safe
+    virtual TVerdict Authenticate(const std::string& Key) = 0;
+    // whether asking is slow enough to keep the results in the TAuthCache
+    [[nodiscard]] virtual bool IsRemote() const = 0;
+};
+
+// creates the provider selected by the AuthProvider setting
+std::unique_ptr<IAuthProvider> CreateAuthProvider();
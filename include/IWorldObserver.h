@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+class TClient;
+
+// is told about every change to who plays and which vehicles they have, to keep
+// a copy of that elsewhere. Called from the network threads, has to be thread safe
+// and shouldn't block.
+class IWorldObserver {
+public:
+    virtual ~IWorldObserver() = default;
+    // the player is in game now (synced), or moved to another room
+    virtual void OnPlayerUpdated(const TClient& Client) = 0;
+    // together with all of their vehicles
+    virtual void OnPlayerRemoved(int PlayerID) = 0;
+    // spawned or edited, Data is the vehicle's spawn packet as a joining player gets it
+    virtual void OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) = 0;
+    virtual void OnVehicleRemoved(int PlayerID, int VehicleID) = 0;
+    // a packet for the players in Sender's room, or for everyone if Sender is null
+    virtual void OnBroadcast(const TClient* /* Sender */, const std::string& /* Data */, bool /* Rel */) { }
+    // the client got a new token to resume its session with (see TSessionStore)
+    virtual void OnSessionIssued(const TClient& /* Client */, const std::string& /* Token */) { }
+};
@@ -7,3 +7,39 @@
 #include "rapidjson/prettywriter.h"
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
+
+#include "TScratchArena.h"
+
+// rapidjson allocator which takes its memory from the calling thread's TScratchArena.
+// Everything allocated with it is gone once the current TScratchArena::TScope ends,
+// so only use it for documents which don't outlive the packet they belong to.
+class TArenaJsonAllocator final {
+public:
+    static const bool kNeedFree = false;
+    // stateless, so one instance can be shared by everyone
+    static TArenaJsonAllocator* Get() {
+        static TArenaJsonAllocator Allocator;
+        return &Allocator;
+    }
+    void* Malloc(size_t Size) {
+        return Size ? TScratchArena::ThreadLocal().Allocate(Size) : nullptr;
+    }
+    void* Realloc(void* Ptr, size_t OldSize, size_t NewSize) {
+        return NewSize ? TScratchArena::ThreadLocal().Reallocate(Ptr, OldSize, NewSize) : nullptr;
+    }
+    static void Free(void*) { }
+};
+
+class TArenaJsonDocument final : public rapidjson::GenericDocument<rapidjson::UTF8<>, TArenaJsonAllocator, TArenaJsonAllocator> {
+public:
+    TArenaJsonDocument()
+        : GenericDocument(TArenaJsonAllocator::Get(), 1024, TArenaJsonAllocator::Get()) { }
+};
+
+class TArenaJsonStringBuffer final : public rapidjson::GenericStringBuffer<rapidjson::UTF8<>, TArenaJsonAllocator> {
+public:
+    TArenaJsonStringBuffer()
+        : GenericStringBuffer(TArenaJsonAllocator::Get()) { }
+};
+
+using TArenaJsonWriter = rapidjson::Writer<rapidjson::GenericStringBuffer<rapidjson::UTF8<>, TArenaJsonAllocator>, rapidjson::UTF8<>, rapidjson::UTF8<>, TArenaJsonAllocator>;
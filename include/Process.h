@@ -0,0 +1,26 @@
+#pragma once
+
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// what the processes this server starts of itself share: the cluster workers, the new
+// process of a hot upgrade and the standby. Apart from ReadVariable, linux only.
+namespace Process {
+// the non-negative number the environment variable is set to, like a passed fd
+std::optional<int> ReadVariable(const char* Name);
+// this process' environment without the given variables
+std::vector<std::string> Environment(std::initializer_list<std::string_view> Without);
+// what this process was started with
+std::vector<std::string> CommandLine();
+// for execve, they point into Strings and end with a null
+std::vector<char*> Pointers(std::vector<std::string>& Strings);
+// the fds which are open right now
+std::vector<int> OpenFds();
+// in a child between fork and exec: lets every fd above stderr but the Kept ones close on
+// exec, also those another thread opened without CLOEXEC after OpenFds. Listed is what
+// OpenFds said before the fork, for kernels which can't do it all at once.
+void CloseOnExec(const std::vector<int>& Listed, std::initializer_list<int> Kept);
+}
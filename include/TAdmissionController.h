@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Common.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class TClient;
+class TServer;
+
+/*
+ * Paces how many clients are in the expensive phases of joining at once: the resource
+ * sync (mod downloads) and the world sync (all existing vehicles). When everyone
+ * reconnects at once, for example after a restart, the rest waits in line instead of
+ * everyone competing for CPU and upload.
+ *
+ * How many clients may be in a phase at once adapts to the send backlog, which is
+ * the number of reliable packets queued up for all clients. It's halved when the
+ * backlog gets too big and grows by one at a time while it's small.
+ */
+class TAdmissionController final {
+public:
+    enum class TPhase {
+        ResourceSync = 0,
+        WorldSync = 1,
+    };
+    // called with the client's position in line (1 is next) whenever it changes
+    using TPositionFn = std::function<void(size_t Position)>;
+
+    // a client's slot in a phase, given back when this is destroyed
+    class TTicket final {
+    public:
+        TTicket() = default;
+        TTicket(TAdmissionController& Controller, TPhase Phase);
+        TTicket(TTicket&& Other) noexcept;
+        TTicket& operator=(TTicket&&) = delete;
+        TTicket(const TTicket&) = delete;
+        TTicket& operator=(const TTicket&) = delete;
+        ~TTicket();
+
+        explicit operator bool() const { return mController != nullptr; }
+
+    private:
+        TAdmissionController* mController { nullptr };
+        TPhase mPhase { TPhase::ResourceSync };
+    };
+
+    explicit TAdmissionController(TServer& Server);
+    TAdmissionController(const TAdmissionController&) = delete;
+    TAdmissionController& operator=(const TAdmissionController&) = delete;
+
+    // waits in line until the client may enter the phase. returns an empty ticket if
+    // the client disconnected or the server shuts down in the meantime.
+    [[nodiscard]] TTicket Enter(TPhase Phase, TClient& Client, const TPositionFn& OnPosition);
+
+private:
+    struct TPhaseState {
+        size_t Capacity { InitialCapacity };
+        size_t Active { 0 };
+        // ticket numbers of the waiting clients, in order
+        std::deque<uint64_t> Queue;
+    };
+
+    static constexpr size_t InitialCapacity = 4;
+    static constexpr size_t MinCapacity = 1;
+    static constexpr size_t MaxCapacity = 32;
+    // queued reliable packets (all clients together)
+    static constexpr size_t HighBacklog = 5000;
+    static constexpr size_t LowBacklog = 1000;
+    static constexpr auto AdaptInterval = std::chrono::seconds(1);
+
+    void Leave(TPhase Phase);
+    // needs mMutex locked, unlocks it while looking at the clients
+    void AdaptIfDue(std::unique_lock<std::mutex>& Lock);
+    size_t Backlog();
+
+    TServer& mServer;
+    bool mShutdown { false };
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::array<TPhaseState, 2> mPhases {};
+    uint64_t mNextTicket { 0 };
+    std::chrono::steady_clock::time_point mLastAdapt {};
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "IAuthProvider.h"
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Remembers successful auth results for a while, so a player who reconnects
+ * (after a crash, a map change, a server restart) doesn't have to be looked up
+ * with the (remote) auth provider again.
+ *
+ * Entries are keyed by a SHA-256 of the player's key, the key itself is never stored.
+ * TTL and size come from the AuthCacheTTL and AuthCacheSize settings, if AuthCachePersist
+ * is set, the cache is written to disk on shutdown and loaded again on startup.
+ */
+class TAuthCache final {
+public:
+    TAuthCache();
+    TAuthCache(const TAuthCache&) = delete;
+    TAuthCache& operator=(const TAuthCache&) = delete;
+
+    [[nodiscard]] std::optional<TAuthResult> Get(const std::string& Key);
+    void Put(const std::string& Key, const TAuthResult& Result);
+
+private:
+    using TClock = std::chrono::system_clock;
+    struct TEntry {
+        TAuthResult Result;
+        TClock::time_point Expiry;
+        // position in mRecentlyUsed
+        std::list<std::string>::iterator Position;
+    };
+
+    static std::string Hash(const std::string& Key);
+    static bool Enabled();
+    // needs mMutex locked
+    void Insert(const std::string& Hash, const TAuthResult& Result, TClock::time_point Expiry);
+    void Load();
+    void Save();
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, TEntry> mEntries;
+    // hashes, most recently used first
+    std::list<std::string> mRecentlyUsed;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Common.h"
+#include "Compat.h"
+#include "IAuthProvider.h"
+#include "TAuthCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class TClient;
+class TNetwork;
+class TServer;
+
+/*
+ * Runs the handshake of freshly accepted connections, without tying up a thread per connection.
+ *
+ * Each connection goes through a few stages, every one with its own deadline:
+ *  - Code:       the first byte, 'C' for a game connection, 'D' for a download socket or 'R' for a relay
+ *  - DownloadID: the client ID a download socket belongs to, in a single byte or the wide form (see TClient)
+ *  - RelayKey:   the RelaySecret of a relay, which then gets the world streamed to it (see TRelayHub)
+ *  - Version:    the client's version packet
+ *  - Key:        the player's key, or a resume token to take over a parked session (see TSessionStore)
+ *  - Lookup:     looking the key up with the IAuthProvider, unless it's in the TAuthCache
+ *  - Verdict:    asking the Lua plugins (onPlayerAuth) whether the player may join
+ *
+ * The network stages are driven by a single thread polling all pending sockets at once.
+ * The lookup and the Lua verdict are blocking, those run on a few worker threads.
+ * How many handshakes may be pending at once is limited, in total and per address, so
+ * a flood of connections which never finish their handshake can't eat up the server.
+ * Once a client is admitted, it gets its own connection thread (TNetwork::TCPClient) as before.
+ */
+class TAuthPipeline final {
+public:
+    TAuthPipeline(TNetwork& Network, TServer& Server);
+    TAuthPipeline(const TAuthPipeline&) = delete;
+    TAuthPipeline& operator=(const TAuthPipeline&) = delete;
+
+    // takes over a freshly accepted socket, or closes it right away if there are too many pending handshakes
+    void Submit(SOCKET Sock, const sockaddr_in& Address);
+
+private:
+    enum class TStage {
+        Code,
+        DownloadID,
+        RelayKey,
+        Version,
+        Key,
+        Lookup,
+        Verdict,
+    };
+
+    struct THandshake {
+        THandshake(TAuthPipeline& Owner, SOCKET Sock, uint32_t Address);
+        // gives back the pending slot of the address
+        ~THandshake();
+        THandshake(const THandshake&) = delete;
+        THandshake& operator=(const THandshake&) = delete;
+
+        TAuthPipeline& Owner;
+        SOCKET Sock;
+        // IPv4 address in network byte order
+        uint32_t Address;
+        TStage Stage { TStage::Code };
+        std::chrono::steady_clock::time_point Deadline;
+        // bytes received so far in the current stage
+        std::string Buffer;
+        std::string Key;
+        // exists from the Version stage on, so the client can be kicked with a reason
+        std::shared_ptr<TClient> Client;
+    };
+    using THandshakePtr = std::unique_ptr<THandshake>;
+
+    static constexpr size_t WorkerCount = 4;
+    static constexpr size_t MaxPendingHandshakes = 1024;
+    // version and key packets are tiny, anything bigger is garbage
+    static constexpr int32_t MaxHandshakePacketSize = 4 * KB;
+    static constexpr auto PollInterval = std::chrono::milliseconds(50);
+
+    static std::chrono::seconds StageTimeout(TStage Stage);
+    static void EnterStage(THandshake& Handshake, TStage Stage);
+    static bool IsExpired(const THandshake& Handshake);
+
+    void LoopMain();
+    void WorkerMain();
+    // handles a readable socket, resets 'Slot' once the handshake leaves the poll loop
+    void OnReadable(THandshakePtr& Slot);
+    void OnExpired(THandshakePtr& Slot);
+    // reads up to 'Want' bytes into the buffer in total, false if the connection is gone
+    static bool Receive(THandshake& Handshake, size_t Want);
+    // false if the connection is gone or misbehaves, 'Packet' is set once a whole packet arrived
+    static bool ReceivePacket(THandshake& Handshake, std::optional<std::string>& Packet);
+    // takes the connection over into the parked session the token belongs to, if there is one
+    void Resume(THandshakePtr& Slot, const std::string& Token);
+    void Kick(THandshakePtr& Slot, const std::string& Reason);
+    static void Drop(THandshakePtr& Slot);
+
+    void Authenticate(THandshake& Handshake);
+    std::optional<TAuthResult> LookupKey(THandshake& Handshake);
+    void Admit(THandshake& Handshake);
+
+    TNetwork& mNetwork;
+    TServer& mServer;
+    std::unique_ptr<IAuthProvider> mAuthProvider;
+    TAuthCache mAuthCache;
+    std::atomic<bool> mShutdown { false };
+
+    std::mutex mIncomingMutex;
+    std::condition_variable mIncomingCondition;
+    std::vector<THandshakePtr> mIncoming;
+
+    std::mutex mJobsMutex;
+    std::condition_variable mJobsCondition;
+    std::deque<THandshakePtr> mJobs;
+
+    // pending handshakes per address
+    std::mutex mPendingMutex;
+    std::unordered_map<uint32_t, size_t> mPendingPerAddress;
+    size_t mPendingTotal { 0 };
+
+    std::thread mLoopThread;
+    std::vector<std::thread> mWorkers;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "IAuthProvider.h"
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// asks an auth server via /pkToUser, which is the BeamMP backend by default ("remote"),
+// or a stand-in server, for example on localhost ("http"), which may speak plain http
+class TRemoteAuthProvider final : public IAuthProvider {
+public:
+    TRemoteAuthProvider(std::string Host, int Port, bool Tls);
+    TVerdict Authenticate(const std::string& Key) override;
+    [[nodiscard]] bool IsRemote() const override { return true; }
+
+private:
+    std::string mHost;
+    int mPort;
+    bool mTls;
+};
+
+/*
+ * Lets in the players listed in a file ("allowlist"), one per line:
+ *
+ *     <key> <name> [roles]
+ *
+ * A line with '*' as the key lets in every key, the name is used as a prefix
+ * for generated names then. Lines starting with '#' are comments.
+ */
+class TAllowlistAuthProvider final : public IAuthProvider {
+public:
+    explicit TAllowlistAuthProvider(const std::string& FileName);
+    TVerdict Authenticate(const std::string& Key) override;
+    [[nodiscard]] bool IsRemote() const override { return false; }
+
+private:
+    void Load(const std::string& FileName);
+
+    std::unordered_map<std::string, TAuthResult> mEntries;
+    std::optional<TAuthResult> mWildcard;
+};
+
+// leaves the decision to the Lua plugins ("lua"): the onPlayerKey event gets the key,
+// a handler returns the player's name to let them in
+class TLuaAuthProvider final : public IAuthProvider {
+public:
+    TVerdict Authenticate(const std::string& Key) override;
+    [[nodiscard]] bool IsRemote() const override { return false; }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Compat.h"
+#include "TUnixChannel.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * The front of the cluster mode (ClusterWorkers > 0, linux only). It owns the server's
+ * public port and runs ClusterWorkers copies of the server as worker processes, which
+ * share the players between them (see TClusterWorker). A new player's connection goes to
+ * the worker with the fewest players, over the cluster socket with SCM_RIGHTS, a download
+ * connection to the worker of the player it's for. Datagrams go to the worker of the
+ * player ID in front of them. The workers send their own datagrams through the same UDP
+ * socket, the front never sees those. Workers which die are started again, the others
+ * catch them up on their players and vehicles once they're back.
+ */
+class TClusterFront final {
+public:
+    // Argv is what this process was started with, the workers are started the same way
+    explicit TClusterFront(char** Argv);
+    ~TClusterFront();
+    TClusterFront(const TClusterFront&) = delete;
+    TClusterFront& operator=(const TClusterFront&) = delete;
+
+private:
+    using TClock = std::chrono::steady_clock;
+
+    struct TWorker {
+        // null while the worker isn't connected
+        std::shared_ptr<TUnixChannel> Channel;
+        int Pid { -1 };
+        // as the worker last reported it, plus who was sent there since
+        size_t Players { 0 };
+    };
+    // a connection of which it's not known yet which worker it's for
+    struct TPending {
+        SOCKET Sock;
+        sockaddr_in Addr;
+        TClock::time_point Deadline;
+    };
+
+    // how long a new connection has to say what it is
+    static constexpr auto HandshakeTimeout = std::chrono::seconds(10);
+    static constexpr size_t MaxPending = 256;
+
+    // stops the workers and threads, once
+    void Stop();
+    void SpawnWorker(size_t Index);
+    // takes the workers' connections on the cluster socket
+    void ListenMain();
+    void WorkerMain(std::shared_ptr<TUnixChannel> Channel);
+    void TCPMain();
+    void UDPMain();
+    // starts workers again which exited
+    void ReapMain();
+    // false if the connection isn't complete yet
+    bool Route(const TPending& Pending);
+    void SendToWorker(size_t Index, const std::string& Message, const std::vector<int>& Fds = {});
+    [[nodiscard]] size_t LeastLoadedWorker();
+
+    std::vector<std::string> mArgv;
+    std::string mSocketPath;
+    SOCKET mTCPSock { -1 };
+    SOCKET mUDPSock { -1 };
+    int mClusterSock { -1 };
+    std::atomic<bool> mShutdown { false };
+    std::mutex mStopMutex;
+    std::mutex mWorkersMutex;
+    std::vector<TWorker> mWorkers;
+    std::thread mListenThread;
+    std::thread mTCPThread;
+    std::thread mUDPThread;
+    std::thread mReapThread;
+    std::mutex mWorkerThreadsMutex;
+    std::vector<std::thread> mWorkerThreads;
+    // of the ones in mWorkerThreads which are done, joined by the next connection
+    std::vector<std::thread::id> mFinishedWorkerThreads;
+};
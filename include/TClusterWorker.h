@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Compat.h"
+#include "IWorldObserver.h"
+#include "TUnixChannel.h"
+#include "TWorldPublisher.h"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+class TClient;
+class TNetwork;
+class TServer;
+class TWorldMirror;
+
+// what the front and its workers tell each other, each message starts with one of these
+namespace ClusterMessage {
+// worker -> front: "H<index>", the first message of a worker
+constexpr char Hello = 'H';
+// worker -> front: "N<players>"
+constexpr char Load = 'N';
+// worker <-> front: "B<TWorldPublisher message>", the front passes it on to all other workers
+constexpr char Bus = 'B';
+// front -> worker: "U" with the UDP socket
+constexpr char UDPSocket = 'U';
+// front -> worker: "T<sockaddr_in>" with a new TCP connection
+constexpr char Connection = 'T';
+// front -> worker: "D<sockaddr_in><datagram>"
+constexpr char Datagram = 'D';
+// front -> worker: "X<index>", that worker is gone
+constexpr char WorkerLost = 'X';
+// front -> worker: "J<index>", that worker (re)connected and needs to be caught up
+constexpr char WorkerJoined = 'J';
+// worker -> front: "C<index>\n<TWorldPublisher message>", the front passes it on to that worker only
+constexpr char Catchup = 'C';
+}
+
+/*
+ * A worker process of the cluster mode (see TClusterFront). Every worker hands out the
+ * player IDs with ID % ClusterWorkers == its index, which is how the front knows whose
+ * packet a datagram is. What happens on a worker, broadcasts included, goes to the other
+ * workers (TWorldPublisher), which keep a copy of it (TWorldMirror) and pass the
+ * broadcasts on to their players in the same room, so everyone still plays in one world.
+ */
+class TClusterWorker final : public IWorldObserver {
+public:
+    // set for the worker processes, to their index
+    static constexpr const char* IndexVariable = "BEAMMP_CLUSTER_WORKER";
+
+    // this process' worker index, nothing if it isn't a worker
+    static std::optional<int> Index();
+    // where the front listens for its workers
+    static std::string SocketPath();
+
+    // connects to the front, throws if that fails. Mirror gets the other workers' world.
+    TClusterWorker(TServer& Server, TNetwork& Network, TWorldMirror& Mirror, int Index);
+    ~TClusterWorker() override;
+    TClusterWorker(const TClusterWorker&) = delete;
+    TClusterWorker& operator=(const TClusterWorker&) = delete;
+
+    // the front's UDP socket, the worker sends its datagrams through it
+    [[nodiscard]] SOCKET UDPSocket() const { return mUDPSock; }
+    // starts taking connections and datagrams from the front
+    void Start();
+    [[nodiscard]] bool OwnsID(int ID) const;
+    // the first ID this worker may hand out, the next ones are ClusterWorkers apart
+    [[nodiscard]] int FirstID() const { return mIndex; }
+
+    void OnPlayerUpdated(const TClient& Client) override;
+    void OnPlayerRemoved(int PlayerID) override;
+    void OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) override;
+    void OnVehicleRemoved(int PlayerID, int VehicleID) override;
+    void OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) override;
+
+private:
+    void ReceiveMain();
+    void Publish(const std::string& Message);
+    // sends the worker which (re)connected what it missed of this one's world
+    void CatchUp(int Index);
+    // how many players this worker has, for the front to balance new ones
+    void ReportLoad(size_t Players);
+
+    TServer& mServer;
+    TNetwork& mNetwork;
+    TWorldMirror& mMirror;
+    int mIndex;
+    int mWorkers;
+    std::unique_ptr<TUnixChannel> mChannel;
+    TWorldPublisher mPublisher;
+    SOCKET mUDPSock { -1 };
+    std::thread mThread;
+    std::atomic<bool> mShutdown { false };
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+/*
+ * Lets the network threads be stopped in between two packets, so another process can take
+ * the connections over without anyone having read half of one (see THotUpgrade). A thread
+ * holds a pass while it handles something, closing the gate waits for all passes to be
+ * given back and keeps new ones from being handed out. While the gate is open, getting
+ * and giving back a pass is an atomic increment and decrement. TLuaEngine has one of its
+ * own, for every call into lua.
+ */
+class TConnectionGate final {
+public:
+    class TPass final {
+    public:
+        TPass() = default;
+        ~TPass() { Reset(); }
+        TPass(TPass&& Other) noexcept
+            : mGate(std::exchange(Other.mGate, nullptr)) { }
+        TPass& operator=(TPass&& Other) noexcept {
+            if (this != &Other) {
+                Reset();
+                mGate = std::exchange(Other.mGate, nullptr);
+            }
+            return *this;
+        }
+        TPass(const TPass&) = delete;
+        TPass& operator=(const TPass&) = delete;
+
+        [[nodiscard]] explicit operator bool() const { return mGate != nullptr; }
+        void Reset();
+
+    private:
+        friend class TConnectionGate;
+        explicit TPass(TConnectionGate* Gate)
+            : mGate(Gate) { }
+
+        TConnectionGate* mGate { nullptr };
+    };
+
+    TConnectionGate() = default;
+    TConnectionGate(const TConnectionGate&) = delete;
+    TConnectionGate& operator=(const TConnectionGate&) = delete;
+
+    // waits while the gate is closed
+    [[nodiscard]] TPass Enter();
+    // a pass even while the gate is closing, only for a thread which holds one already,
+    // for work it hands on to another thread
+    [[nodiscard]] TPass Join();
+    // closes the gate once all passes are given back, false if that takes longer than
+    // Timeout, then it's open again
+    bool Close(std::chrono::milliseconds Timeout);
+    void Open();
+
+private:
+    void Leave();
+
+    std::atomic<size_t> mActive { 0 };
+    std::atomic<bool> mClosed { false };
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+};
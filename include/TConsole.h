@@ -13,6 +13,8 @@ public:
     void Write(const std::string& str);
     void WriteRaw(const std::string& str);
     void InitializeLuaConsole(TLuaEngine& Engine);
+    // a standby which takes over logs to Server.log, and gets the console the server had
+    void TakeOverFromServer();
 
 private:
     std::unique_ptr<TLuaFile> mLuaConsole { nullptr };
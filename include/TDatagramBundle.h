@@ -0,0 +1,40 @@
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * Collects the unreliable packets going to one client with the "bundle" capability, so
+ * several of them go out in one datagram instead of one each (see PacketSchema::TBundle):
+ *
+ *     B<length, 2 bytes big endian><packet><length><packet>...
+ *
+ * A bundle goes out once the next packet doesn't fit anymore, or when it's flushed,
+ * which TNetwork does every few milliseconds.
+ */
+class TDatagramBundle final {
+public:
+    // what's left of a common MTU after the IP and UDP headers, with some room to spare
+    static constexpr size_t MaxSize = 1200;
+
+    TDatagramBundle() = default;
+    TDatagramBundle(const TDatagramBundle&) = delete;
+    TDatagramBundle& operator=(const TDatagramBundle&) = delete;
+
+    // packets bigger than this go out on their own
+    static bool Fits(std::string_view Packet);
+    // adds a packet. if it didn't fit anymore, the full bundle is returned and has to be sent first.
+    // 'WasEmpty' is set if this starts a new bundle, which has to be flushed later on.
+    [[nodiscard]] std::optional<std::string> Add(std::string_view Packet, bool& WasEmpty);
+    // the bundle so far, if it has anything in it
+    [[nodiscard]] std::optional<std::string> Take();
+
+private:
+    static constexpr size_t HeaderSize = 1;
+    static constexpr size_t LengthSize = 2;
+
+    std::mutex mMutex;
+    std::string mPending;
+};
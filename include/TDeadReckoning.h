@@ -0,0 +1,47 @@
+#pragma once
+
+#include "TVehicleTransform.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+/*
+ * Decides which position updates a client can do without. Per vehicle, it remembers the
+ * last update the client got and extrapolates it with its velocity, like the client does.
+ * A new update is only needed once the extrapolation is off by more than
+ * DeadReckoningThreshold meters, the vehicle turned, or DeadReckoningKeyframe ms passed.
+ * A car cruising down the highway needs few updates that way.
+ */
+class TDeadReckoning final {
+public:
+    TDeadReckoning() = default;
+    TDeadReckoning(const TDeadReckoning&) = delete;
+    TDeadReckoning& operator=(const TDeadReckoning&) = delete;
+
+    [[nodiscard]] bool NeedsUpdate(const TVehicleTransform& Transform) const;
+    // the update was sent, the client extrapolates from this one now
+    void OnSent(const TVehicleTransform& Transform);
+
+private:
+    using TClock = std::chrono::steady_clock;
+
+    struct TSent {
+        TVehicleTransform Transform;
+        TClock::time_point SentAt;
+    };
+
+    // radians the vehicle may have turned since the last update
+    static constexpr double RotationThreshold = 0.05;
+    // vehicles which weren't updated for this long are forgotten (deleted, owner left)
+    static constexpr auto ForgetAfter = std::chrono::seconds(30);
+
+    static uint64_t Key(const TVehicleTransform& Transform) {
+        return (uint64_t(uint32_t(Transform.PlayerID)) << 32) | uint32_t(Transform.VehicleID);
+    }
+
+    mutable std::mutex mMutex;
+    std::unordered_map<uint64_t, TSent> mSent;
+    TClock::time_point mLastCleanup { TClock::now() };
+};
@@ -1,21 +1,75 @@
 #pragma once
 
 #include "Common.h"
+#include "Http.h"
 #include "IThreaded.h"
+#include "TNetwork.h"
 #include "TResourceManager.h"
 #include "TServer.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 class THeartbeatThread : public IThreaded {
 public:
-    THeartbeatThread(TResourceManager& ResourceManager, TServer& Server);
+    THeartbeatThread(TResourceManager& ResourceManager, TServer& Server, TNetwork& Network);
     //~THeartbeatThread();
     void operator()() override;
 
 private:
+    // smoothed latency per backend host, decides which host is asked first
+    struct THostStats {
+        void Record(const std::string& Host, double LatencyMs);
+        std::mutex Mutex;
+        std::unordered_map<std::string, double> AverageLatencyMs;
+    };
+    struct TAttempt {
+        std::string Url;
+        std::string Response;
+        int ResponseCode { -1 };
+        bool Valid { false };
+        bool Done { false };
+    };
+    // one heartbeat, shared with the request threads
+    struct TRound {
+        std::mutex Mutex;
+        std::condition_variable Condition;
+        std::vector<TAttempt> Attempts;
+        // one per attempt, the ones still running once there's an answer are cancelled
+        std::vector<std::unique_ptr<Http::TCancellation>> Cancellations;
+        std::optional<size_t> Winner;
+        size_t Finished { 0 };
+    };
+    struct THedgedResult {
+        std::optional<TAttempt> Winner;
+        // hosts which answered, but not with a valid response
+        std::vector<TAttempt> Failed;
+    };
+
+    static constexpr auto DefaultHedgeDelay = std::chrono::milliseconds(1000);
+    static constexpr auto MinHedgeDelay = std::chrono::milliseconds(200);
+    static constexpr auto MaxHedgeDelay = std::chrono::milliseconds(3000);
+    // what a failed request counts as in the latency stats
+    static constexpr auto FailedRequestPenalty = std::chrono::milliseconds(5000);
+
     std::string GenerateCall();
     std::string GetPlayers();
+    std::vector<std::string> OrderedHosts() const;
+    std::chrono::milliseconds HedgeDelay(const std::string& Host) const;
+    // asks the next host as well whenever the previous one takes longer than usual,
+    // returns with the first valid response or once every host failed. the requests
+    // which are still running then are cancelled, none of them outlives this.
+    THedgedResult PostHedged(const std::string& Target, const std::string& Body);
 
+    std::shared_ptr<THostStats> mHostStats { std::make_shared<THostStats>() };
     bool mShutdown = false;
     TResourceManager& mResourceManager;
     TServer& mServer;
+    TNetwork& mNetwork;
 };
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+class TLuaEngine;
+class TNetwork;
+class TServer;
+
+// what the old and the new process tell each other, each message starts with one of these
+namespace UpgradeMessage {
+// new -> old: "H<format version>", the new process is up and understands the state
+constexpr char Hello = 'H';
+// old -> new: "S" with the listening TCP socket and the UDP socket
+constexpr char Sockets = 'S';
+// old -> new: "C<client state>" with the client's TCP and, if it has one, download socket
+constexpr char Client = 'C';
+// old -> new: "E", that was everyone
+constexpr char End = 'E';
+// new -> old: "K", the new process has it all, the old one may go
+constexpr char Ack = 'K';
+// old -> new: "A", the upgrade is off, the new process exits
+constexpr char Abort = 'A';
+}
+
+/*
+ * Replaces the running server with a new start of its binary (linux only), on the
+ * "upgrade" console command or SIGUSR2, without the players noticing. The binary is
+ * started again, like the cluster workers are, with a unix socket to this process. Once
+ * it's up, the network threads, the auth pipeline, the relay link, the heartbeat and lua
+ * are stopped in between two packets or calls (TConnectionGate) and the listening sockets, the players' connections and everything about the players which
+ * is needed to carry on with them (see TClient::Save) go over to the new process. Players
+ * who are still joining are kicked, they can just join again.
+ *
+ * The old process then becomes a stub which only waits for the new one and passes
+ * signals on to it, so whatever started the server (a terminal, systemd, docker) still
+ * has its process and sees the new one's exit code. Lua starts over in the new process.
+ */
+class THotUpgrade final {
+public:
+    // set for the new process, to its end of the unix socket
+    static constexpr const char* ChannelVariable = "BEAMMP_UPGRADE_CHANNEL";
+    // set for the stub, to the new process' pid
+    static constexpr const char* SuccessorVariable = "BEAMMP_UPGRADE_SUCCESSOR";
+
+    // the socket to the process this one takes over from, nothing for a normal start
+    static std::optional<int> Channel();
+    // whether this process is what's left of one which handed over
+    static bool IsStub();
+    // in the stub: waits for the new process and returns its exit code, nothing otherwise
+    static std::optional<int> WaitForSuccessor();
+
+    // takes over from the old process if this is the new one, shuts down if that fails.
+    // Argv is what this process was started with, the new one is started the same way.
+    THotUpgrade(char** Argv, TServer& Server, TNetwork& Network, TLuaEngine& LuaEngine);
+    THotUpgrade(const THotUpgrade&) = delete;
+    THotUpgrade& operator=(const THotUpgrade&) = delete;
+
+private:
+    static constexpr int FormatVersion = 3;
+    // how long the network threads and lua may take to finish what they're doing
+    static constexpr auto PauseTimeout = std::chrono::seconds(5);
+    // how long the new process may take until it has it all, lua plugins included
+    static constexpr auto HandOverTimeout = std::chrono::seconds(60);
+
+    void TakeOver(int Fd);
+    void HandOver();
+    // the new process, -1 if it couldn't be started
+    int Spawn(int ChannelFd);
+    // replaces this process with the stub, only returns if that fails
+    void BecomeStub(int Successor);
+
+    std::vector<std::string> mArgv;
+    TServer& mServer;
+    TNetwork& mNetwork;
+    TLuaEngine& mLuaEngine;
+    // one upgrade at a time
+    std::mutex mMutex;
+};
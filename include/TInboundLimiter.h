@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+
+// what a client sends, grouped by how much of it it may send
+enum class TInboundClass : size_t {
+    Position = 0, // V..Z, vehicle updates
+    Vehicle, // O, spawns, edits, deletes and resets
+    Event, // E, N and J
+    Chat, // C
+    Compressed, // ABG:, can't be told apart without decompressing them first
+    Control, // everything else
+    Count,
+};
+
+/*
+ * Per-client token buckets, one per TInboundClass, checked before a packet is parsed.
+ * Each class refills at its own rate and can take short bursts. Unreliable packets over
+ * the limit are dropped and counted. Reliable ones are never dropped, the client's
+ * connection isn't read from for a while instead (Throttle), so it has to slow down.
+ * A client which is throttled most of the time is flooding and gets kicked.
+ */
+class TInboundLimiter final {
+public:
+    TInboundLimiter();
+    TInboundLimiter(const TInboundLimiter&) = delete;
+    TInboundLimiter& operator=(const TInboundLimiter&) = delete;
+
+    static TInboundClass Classify(std::string_view Packet);
+    static std::string_view ClassName(TInboundClass Class);
+
+    // takes a token of the class, false if the packet has to be dropped
+    [[nodiscard]] bool Allow(TInboundClass Class);
+    // takes a token of the class, even if there is none left. returns how long the client
+    // shouldn't be read from, so the bucket can refill
+    [[nodiscard]] std::chrono::steady_clock::duration Throttle(TInboundClass Class);
+    // whether the client was throttled for most of the last minute
+    [[nodiscard]] bool IsFlooding() const;
+    // a packet was dropped because too many of the client's packets were waiting to be handled
+    void CountQueueDrop() { ++mQueueDrops; }
+    [[nodiscard]] uint64_t Drops(TInboundClass Class) const { return mDrops[size_t(Class)]; }
+    [[nodiscard]] uint64_t QueueDrops() const { return mQueueDrops; }
+    [[nodiscard]] uint64_t Throttles(TInboundClass Class) const { return mThrottles[size_t(Class)]; }
+
+private:
+    struct TLimit {
+        // packets per second
+        double Rate;
+        double Burst;
+    };
+    struct TBucket {
+        double Tokens;
+        std::chrono::steady_clock::time_point LastRefill;
+    };
+
+    // seconds of throttling, which fade over about a minute, above which a client is flooding
+    static constexpr double FloodThreshold = 30;
+
+    static const TLimit& LimitOf(TInboundClass Class);
+    // takes a token and refills the bucket first, needs mMutex locked. the tokens left.
+    double Take(TInboundClass Class, std::chrono::steady_clock::time_point Now);
+
+    mutable std::mutex mMutex;
+    std::array<TBucket, size_t(TInboundClass::Count)> mBuckets;
+    double mThrottledSeconds { 0 };
+    std::chrono::steady_clock::time_point mThrottledUpdate;
+    std::array<std::atomic<uint64_t>, size_t(TInboundClass::Count)> mDrops {};
+    std::array<std::atomic<uint64_t>, size_t(TInboundClass::Count)> mThrottles {};
+    std::atomic<uint64_t> mQueueDrops { 0 };
+};
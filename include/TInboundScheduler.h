@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Common.h"
+#include "TConnectionGate.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+class TClient;
+class TNetwork;
+class TPPSMonitor;
+
+/*
+ * Handles the packets which arrive over UDP on a thread of its own, taking turns between
+ * the clients (deficit round robin): each turn, a client may have up to Quantum bytes of
+ * packets handled, the rest waits for its next turn. That way a client sending a lot can
+ * only delay its own packets, not everyone else's. It can't block the UDP socket either.
+ *
+ * A client with more than MaxQueuedPackets waiting loses the new unreliable ones, which is
+ * counted in its TInboundLimiter.
+ *
+ * Packets waiting to be handled hold a pass of the TConnectionGate, they're handled
+ * before another process takes the connections over.
+ */
+class TInboundScheduler final {
+public:
+    TInboundScheduler(TNetwork& Network, TPPSMonitor& PPSMonitor, TConnectionGate& Gate);
+    TInboundScheduler(const TInboundScheduler&) = delete;
+    TInboundScheduler& operator=(const TInboundScheduler&) = delete;
+
+    // the caller has to hold a pass of the gate. Reliable packets are never dropped.
+    void Submit(const std::shared_ptr<TClient>& Client, std::string Packet, bool Reliable = false);
+
+private:
+    struct TQueue {
+        // keeps the client (and so the key of the queue) alive while packets wait
+        std::shared_ptr<TClient> Client;
+        std::deque<std::string> Packets;
+        size_t Deficit { 0 };
+    };
+
+    // about one full datagram per turn
+    static constexpr size_t Quantum = 1500;
+    static constexpr size_t MaxQueuedPackets = 256;
+
+    void Loop();
+
+    TNetwork& mNetwork;
+    TPPSMonitor& mPPSMonitor;
+    TConnectionGate& mGate;
+    bool mShutdown { false };
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::unordered_map<const TClient*, TQueue> mQueues;
+    // clients with packets waiting, in the order of their turns
+    std::deque<const TClient*> mTurns;
+    // held while there are packets waiting or being handled
+    TConnectionGate::TPass mBusy;
+    std::thread mThread;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Compat.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+/*
+ * Estimates what a client's connection can take, and how much of the position updates
+ * of other players it should get because of that.
+ *
+ * Once a second, the TCP connection is sampled (RTT, retransmissions and the bytes still
+ * waiting in the socket's send buffer, linux only). Clients with the "udpseq" capability also
+ * number their UDP packets, gaps in those count as loss. The link is congested when there's
+ * loss, a growing send backlog or the RTT is inflated way above its minimum. While congested,
+ * the rate scale drops multiplicatively, otherwise it grows back slowly (AIMD). Relayed
+ * position updates are thinned out to that fraction, evenly per sender.
+ */
+class TLinkEstimator final {
+public:
+    struct TStats {
+        double RttMs { 0 };
+        double Loss { 0 };
+        size_t Backlog { 0 };
+        // bytes per second which made it out of the send buffer
+        double Bandwidth { 0 };
+        double RateScale { 1 };
+    };
+
+    TLinkEstimator();
+    TLinkEstimator(const TLinkEstimator&) = delete;
+    TLinkEstimator& operator=(const TLinkEstimator&) = delete;
+
+    void CountSent(size_t Bytes, bool Reliable);
+    void OnUDPSequence(uint16_t Sequence);
+    // samples the connection and adapts the rate scale, call about once a second.
+    // true if the link became congested or recovered.
+    bool Update(SOCKET TCPSock);
+    // false if the next position update of this sender should be skipped
+    [[nodiscard]] bool ShouldSendPosition(int SenderID);
+    [[nodiscard]] TStats Stats() const;
+    [[nodiscard]] bool IsCongested() const;
+
+private:
+    static constexpr double MinRateScale = 0.1;
+    static constexpr double DecreaseFactor = 0.7;
+    static constexpr double IncreaseStep = 0.1;
+    static constexpr double CongestedLoss = 0.05;
+    // packets/segments a loss ratio needs to be based on, fewer say nothing
+    static constexpr size_t MinLossSamples = 20;
+    static constexpr size_t CongestedBacklog = 64 * 1024;
+    // an RTT this much above the minimum means queues are building up somewhere
+    static constexpr double CongestedRttFactor = 2.0;
+    static constexpr double CongestedRttSlackMs = 50.0;
+
+    mutable std::mutex mMutex;
+    std::chrono::steady_clock::time_point mLastUpdate;
+    TStats mStats;
+    bool mCongested { false };
+    double mMinRttMs { 0 };
+    size_t mSentSinceUpdate { 0 };
+    size_t mReliableSentSinceUpdate { 0 };
+    bool mHasTcpSample { false };
+    uint32_t mLastRetransmissions { 0 };
+    bool mHasSequence { false };
+    uint16_t mLastSequence { 0 };
+    uint32_t mSequenceExpected { 0 };
+    uint32_t mSequenceReceived { 0 };
+    // position updates owed to each sender, one is sent whenever this reaches 1
+    std::unordered_map<int, double> mPositionCredit;
+};
@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "IThreaded.h"
+#include "TConnectionGate.h"
 #include "TLuaFile.h"
 #include "TServer.h"
 #include <lua.hpp>
@@ -24,6 +25,9 @@ public:
     [[nodiscard]] const TNetwork& Network() const { return mNetwork; }
 
     std::optional<std::reference_wrapper<TLuaFile>> GetScript(lua_State* L);
+    // every bit of lua which runs holds a pass, a hot upgrade closes it so no plugin
+    // changes the players while they're handed over
+    [[nodiscard]] TConnectionGate& Gate() { return mGate; }
 
 private:
     void FolderList(const std::string& Path, bool HotSwap);
@@ -36,4 +40,5 @@ private:
     bool mShutdown { false };
     TSetOfLuaFile mLuaFiles;
     std::mutex mListMutex;
+    TConnectionGate mGate;
 };
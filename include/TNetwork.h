@@ -1,8 +1,19 @@
 #pragma once
 
 #include "Compat.h"
+#include "TAdmissionController.h"
+#include "TAuthPipeline.h"
+#include "TClusterWorker.h"
+#include "TConnectionGate.h"
+#include "TInboundScheduler.h"
+#include "TRelayHub.h"
+#include "TRelayLink.h"
+#include "TReliableChannel.h"
 #include "TResourceManager.h"
 #include "TServer.h"
+#include "TSessionStore.h"
+#include "TStandbyFeed.h"
+#include "TWorldMirror.h"
 
 class TNetwork {
 public:
@@ -15,33 +26,136 @@ public:
     std::string TCPRcv(TClient& c);
     void ClientKick(TClient& c, const std::string& R);
     [[nodiscard]] bool SyncClient(const std::weak_ptr<TClient>& c);
-    void Identify(SOCKET TCPSock);
-    void Authentication(SOCKET TCPSock);
+    // hooks up a download socket ('D' handshake) to the client with the given ID
+    void HandleDownload(SOCKET TCPSock, int ID);
+    // runs the connection of an authenticated client until it disconnects
+    void TCPClient(const std::weak_ptr<TClient>& c, bool Resumed = false);
+    // the parked client the resume token belongs to, null if there is none (anymore)
+    [[nodiscard]] std::shared_ptr<TClient> TakeParkedClient(const std::string& Token);
+    // hands a parked client its new connection, it carries on where it left off
+    void ResumeClient(const std::shared_ptr<TClient>& Client, SOCKET TCPSock);
+    // removes a parked client from the game right away, false if it isn't parked
+    bool EndParkedSession(const std::shared_ptr<TClient>& Client);
+    // removes parked clients whose grace period is over from the game
+    void ExpireParkedClients();
     [[nodiscard]] bool CheckBytes(TClient& c, int32_t BytesRcv);
     void SyncResources(TClient& c);
     [[nodiscard]] bool UDPSend(TClient& Client, std::string Data) const;
-    void SendToAll(TClient* c, const std::string& Data, bool Self, bool Rel);
+    // like UDPSend, but packs the packet into a bundle with others if the client takes those
+    [[nodiscard]] bool UDPSendBundled(const std::shared_ptr<TClient>& Client, const std::string& Data);
+    // sends a reliable packet over the client's TReliableChannel
+    [[nodiscard]] bool ReliableUDPSend(const std::shared_ptr<TClient>& Client, TReliableChannel::TStream Stream, const std::string& Data);
+    // Transform is what a position packet was decoded to, if it was
+    // to the clients in c's room, or to everyone on the server if c is null
+    void SendToAll(TClient* c, const std::string& Data, bool Self, bool Rel, const TVehicleTransform* Transform = nullptr);
+    // takes the client's vehicles out of its room and into the other one, and gets it the
+    // vehicles of the new room. the room has to exist and have the map the client has loaded.
+    void MoveToRoom(const std::shared_ptr<TClient>& Client, const std::string& Room);
     void UpdatePlayer(TClient& Client);
+    // a new TCP connection, for the auth pipeline
+    void AcceptConnection(SOCKET TCPSock, const sockaddr_in& Addr);
+    // a datagram from the UDP socket
+    void HandleDatagram(const sockaddr_in& Addr, std::string Data);
+    // a broadcast of another cluster worker or the relay upstream, to the clients here in the room (everyone if Room is null)
+    void DeliverBroadcast(int SenderID, const std::string* Room, const std::string& Data, bool Rel);
+    // reads the sender ID and sequence number in front of a datagram's packet, Start is where the packet starts
+    static bool ReadUDPHeader(std::string_view Data, int& ID, size_t& Start, std::optional<uint16_t>& Sequence);
+    // takes over the socket of a relay which sent the right RelaySecret, false if this server takes no relays
+    bool AddRelaySubscriber(SOCKET Sock);
+    // a relay's players only watch, they don't get to change the world
+    [[nodiscard]] bool IsReadOnly() const { return mRelayLink != nullptr; }
+
+    // for a hot upgrade (see THotUpgrade): stops the connection threads in between two packets,
+    // false if they didn't all get there within Timeout
+    [[nodiscard]] bool PauseConnections(std::chrono::milliseconds Timeout) { return mGate.Close(Timeout); }
+    void ResumeConnections() { mGate.Open(); }
+    // what else changes the players' state (the auth pipeline, a relay link, the heartbeat)
+    // holds a pass of this as well, so it's stopped with the network threads
+    [[nodiscard]] TConnectionGate& Gate() { return mGate; }
+    [[nodiscard]] SOCKET TCPListener() const { return mTCPListener; }
+    [[nodiscard]] SOCKET UDPSocket() const { return mUDPSock; }
+    [[nodiscard]] std::optional<TSessionStore::TSavedSession> SaveSession(const TClient& Client) { return mSessions.Save(Client); }
+    // starts serving on the sockets of the process this one took over from
+    void AdoptSockets(SOCKET TCPListener, SOCKET UDPSock);
+    // carries on with a client of the process this one took over from
+    void AdoptClient(const std::shared_ptr<TClient>& Client, const std::optional<TSessionStore::TSavedSession>& Session);
+    // tells the standby, if there is one, that it isn't needed anymore
+    void StopStandby() {
+        if (mStandby) {
+            mStandby->Stop();
+        }
+    }
 
 private:
     void UDPServerMain();
     void TCPServerMain();
+    // sends out the bundles which started filling up since the last time, and
+    // retransmits what reliable UDP channels are missing acks for
+    void UDPTimerMain();
 
     TServer& mServer;
     TPPSMonitor& mPPSMonitor;
     SOCKET mUDPSock {};
+    SOCKET mTCPListener { -1 };
     bool mShutdown { false };
     TResourceManager& mResourceManager;
     std::thread mUDPThread;
     std::thread mTCPThread;
+    std::thread mUDPTimerThread;
+    // clients with a bundle which has to be flushed
+    std::mutex mBundleMutex;
+    std::vector<std::weak_ptr<TClient>> mPendingBundles;
+    // clients which use a reliable UDP channel
+    std::mutex mReliableMutex;
+    std::vector<std::weak_ptr<TClient>> mReliableClients;
+    // the connection threads hold a pass while they handle a packet
+    TConnectionGate mGate;
+    TAdmissionController mAdmission;
+    TSessionStore mSessions;
+    TInboundScheduler mInbound;
+    TAuthPipeline mAuthPipeline;
+    // the world of the other cluster workers or the relay upstream, if there is one
+    std::unique_ptr<TWorldMirror> mMirror;
+    // set if relays may subscribe to this server (RelaySecret)
+    std::unique_ptr<TRelayHub> mRelayHub;
+    // set if this server is a relay (RelayUpstream)
+    std::unique_ptr<TRelayLink> mRelayLink;
+    // set in the worker processes of a cluster, then the front owns the ports
+    std::unique_ptr<TClusterWorker> mCluster;
+    // set if this server keeps a standby process (Standby)
+    std::unique_ptr<TStandbyFeed> mStandby;
+
+    // how long an unfinished bundle may wait for more packets, also how often
+    // reliable UDP channels are checked for retransmissions
+    static constexpr auto UDPTimerInterval = std::chrono::milliseconds(5);
 
     std::string UDPRcvFromClient(sockaddr_in& client) const;
-    void HandleDownload(SOCKET TCPSock);
     void OnConnect(const std::weak_ptr<TClient>& c);
-    void TCPClient(const std::weak_ptr<TClient>& c);
     void Looper(const std::weak_ptr<TClient>& c);
-    int OpenID();
+    // waits until the client sent a whole packet, the gate is only entered once it did
+    static void WaitForPacket(TClient& c);
+    // SendToAll without passing it on to other cluster workers. SenderID is c's, or the remote sender's
+    void SendToClients(TClient* c, int SenderID, const std::string* Room, const std::string& Data, bool Self, bool Rel, const TVehicleTransform* Transform);
+    // Wide if the client takes IDs above MaxLegacyID, MaxWideID + 1 if there is none left
+    int OpenID(bool Wide);
     void OnDisconnect(const std::weak_ptr<TClient>& ClientPtr, bool kicked);
+    void RemoveFromGame(const std::shared_ptr<TClient>& Client, bool Kicked);
+    // a new resume token for the client, which the observers are told about
+    std::string IssueSession(const std::shared_ptr<TClient>& Client);
+    // checks the client's rate limit for an unreliable packet, false if it has to be dropped
+    static bool AllowInbound(TClient& Client, std::string_view Packet);
+    // counts a reliable packet towards the client's rate limit, returns how long the client
+    // shouldn't be read from. kicks it if it keeps going over the limit.
+    std::chrono::steady_clock::duration ThrottleInbound(TClient& Client, std::string_view Packet);
+    // the client's queued packets may go over its reliable UDP channel instead of TCP,
+    // once it's in game and its UDP address is known
+    static bool UsesReliableUDP(TClient& Client);
+    // everything sent to the client over TCP has been acked
+    static bool IsTCPDrained(TClient& Client);
+    // how big a packet may be to be sent to the client over TCP without blocking
+    static size_t TCPSendRoom(TClient& Client);
+    // handles data and ack datagrams of the client's reliable UDP channel, false for other packets
+    bool HandleReliableUDP(const std::shared_ptr<TClient>& Client, const std::string& Packet);
     void Parse(TClient& c, const std::string& Packet);
     void SendFile(TClient& c, const std::string& Name);
     static bool TCPSendRaw(TClient& C, SOCKET socket, char* Data, int32_t Size);
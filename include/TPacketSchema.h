@@ -0,0 +1,481 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Compile-time description of the packets which clients and server exchange.
+ *
+ * Every packet is declared once below, with its prefix (opcode, plus separator if it
+ * has fields), its reliability class, the size above which it's compressed, the send queue
+ * it waits in and its fields. Parse<>() and Serialize<>() are generated from that, as is the
+ * per-opcode table behind Info(), which the send path uses to pick TCP or UDP and to decide
+ * on compression, PriorityOf(), which picks the send queue, and Dispatch<>(), which hands a
+ * received packet to the handler for its schema.
+ *
+ * Parsing doesn't allocate; string fields are views into the parsed packet.
+ * The wire format itself lives in the Encoding (TTextEncoding by default), so an
+ * alternate encoding can be plugged in without touching the declarations.
+ */
+namespace PacketSchema {
+
+enum class TReliability {
+    // goes over UDP, unless the sender explicitly asks for it to be reliable
+    Unreliable,
+    // always goes over TCP
+    Reliable,
+};
+
+// which queue a reliable packet waits in on its way to a client, see TClient::DequeuePacket
+enum class TPriority {
+    // session control: kicks, IDs, join/leave messages, vehicle deletes
+    Control = 0,
+    // everything happening in the game: chat, events, vehicle edits
+    Gameplay = 1,
+    // big transfers, like vehicle spawns, which may wait a bit
+    Bulk = 2,
+};
+static constexpr size_t PriorityCount = 3;
+
+// reliable packets bigger than this are compressed, unless the packet says otherwise
+static constexpr size_t DefaultCompressAbove = 1000;
+// unreliable packets bigger than this are compressed
+static constexpr size_t UnreliableCompressAbove = 400;
+
+// ======================= FIELDS =======================
+
+// non-negative decimal integer
+struct TInt {
+    using Value = int;
+};
+// text up to the next separator (or the end)
+struct TString {
+    using Value = std::string_view;
+};
+// everything up to the end of the packet, only valid as the last field
+struct TRest {
+    using Value = std::string_view;
+};
+struct TVehicleIDValue {
+    int PlayerID;
+    int VehicleID;
+};
+// "<player id>-<vehicle id>"
+struct TVehicleID {
+    using Value = TVehicleIDValue;
+};
+
+template <typename... Fields>
+struct TFields { };
+
+// ====================== ENCODINGS ======================
+
+// the text encoding all clients speak: "<prefix><field>:<field>:..."
+struct TTextEncoding {
+    static constexpr char FieldSeparator = ':';
+    static constexpr char IDSeparator = '-';
+
+    static bool Read(TInt, std::string_view In, int& Out) {
+        if (In.empty() || In.front() == '-') {
+            return false;
+        }
+        auto [Ptr, Err] = std::from_chars(In.data(), In.data() + In.size(), Out);
+        return Err == std::errc() && Ptr == In.data() + In.size();
+    }
+    static bool Read(TString, std::string_view In, std::string_view& Out) {
+        Out = In;
+        return true;
+    }
+    static bool Read(TRest, std::string_view In, std::string_view& Out) {
+        Out = In;
+        return true;
+    }
+    static bool Read(TVehicleID, std::string_view In, TVehicleIDValue& Out) {
+        auto Pos = In.find(IDSeparator);
+        if (Pos == std::string_view::npos) {
+            return false;
+        }
+        return Read(TInt {}, In.substr(0, Pos), Out.PlayerID) && Read(TInt {}, In.substr(Pos + 1), Out.VehicleID);
+    }
+
+    static void Write(TInt, std::string& Out, int Value) {
+        std::array<char, 12> Buf {};
+        auto [Ptr, Err] = std::to_chars(Buf.data(), Buf.data() + Buf.size(), Value);
+        (void)Err; // can't fail, the buffer fits any int
+        Out.append(Buf.data(), Ptr);
+    }
+    static void Write(TString, std::string& Out, std::string_view Value) { Out += Value; }
+    static void Write(TRest, std::string& Out, std::string_view Value) { Out += Value; }
+    static void Write(TVehicleID, std::string& Out, const TVehicleIDValue& Value) {
+        Write(TInt {}, Out, Value.PlayerID);
+        Out += IDSeparator;
+        Write(TInt {}, Out, Value.VehicleID);
+    }
+
+    static constexpr size_t SizeHint(TInt, int) { return 11; }
+    static constexpr size_t SizeHint(TString, std::string_view Value) { return Value.size(); }
+    static constexpr size_t SizeHint(TRest, std::string_view Value) { return Value.size(); }
+    static constexpr size_t SizeHint(TVehicleID, const TVehicleIDValue&) { return 23; }
+};
+
+// ======================= PACKETS =======================
+
+template <TReliability ReliabilityClass, size_t CompressAboveSize = DefaultCompressAbove, TPriority PriorityClass = TPriority::Gameplay>
+struct TPacket {
+    static constexpr TReliability Reliability = ReliabilityClass;
+    static constexpr size_t CompressAbove = CompressAboveSize;
+    static constexpr TPriority Priority = PriorityClass;
+};
+
+// client -> server
+
+// client is done loading and wants the world
+struct TSyncRequest : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "H";
+    using Fields = TFields<>;
+};
+struct TPing : TPacket<TReliability::Unreliable> {
+    static constexpr std::string_view Prefix = "p";
+    using Fields = TFields<>;
+};
+// <slot>:<vehicle json>
+struct TVehicleSpawnRequest : TPacket<TReliability::Reliable, 400, TPriority::Bulk> {
+    static constexpr std::string_view Prefix = "Os:";
+    using Fields = TFields<TString, TRest>;
+};
+// <pid>-<vid>:<vehicle json>
+struct TVehicleEdit : TPacket<TReliability::Reliable, 400> {
+    static constexpr std::string_view Prefix = "Oc:";
+    using Fields = TFields<TVehicleID, TRest>;
+};
+// <pid>-<vid>
+struct TVehicleDelete : TPacket<TReliability::Reliable, 400, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Od:";
+    using Fields = TFields<TVehicleID>;
+};
+// <pid>-<vid>:<reset json>
+struct TVehicleReset : TPacket<TReliability::Reliable, 400> {
+    static constexpr std::string_view Prefix = "Or:";
+    using Fields = TFields<TVehicleID, TRest>;
+};
+// relayed as-is
+struct TVehicleOther : TPacket<TReliability::Reliable, 400> {
+    static constexpr std::string_view Prefix = "Ot";
+    using Fields = TFields<TRest>;
+};
+// <sender name>:<message>
+struct TChat : TPacket<TReliability::Reliable> {
+    static constexpr std::string_view Prefix = "C:";
+    using Fields = TFields<TString, TRest>;
+};
+// <event name>:<data>
+struct TEvent : TPacket<TReliability::Reliable> {
+    static constexpr std::string_view Prefix = "E:";
+    using Fields = TFields<TString, TString>;
+};
+// relayed as-is
+struct TNotification : TPacket<TReliability::Reliable> {
+    static constexpr std::string_view Prefix = "N";
+    using Fields = TFields<TRest>;
+};
+// V..Z, relayed as-is, only some of them are always reliable
+template <char Code, TReliability ReliabilityClass>
+struct TVehicleUpdate : TPacket<ReliabilityClass> {
+    static constexpr char PrefixData[] = { Code };
+    static constexpr std::string_view Prefix { PrefixData, 1 };
+    using Fields = TFields<TRest>;
+};
+using TVehicleUpdateV = TVehicleUpdate<'V', TReliability::Reliable>;
+using TVehicleUpdateW = TVehicleUpdate<'W', TReliability::Reliable>;
+using TVehicleUpdateX = TVehicleUpdate<'X', TReliability::Unreliable>;
+using TVehicleUpdateY = TVehicleUpdate<'Y', TReliability::Reliable>;
+using TVehicleUpdateZ = TVehicleUpdate<'Z', TReliability::Unreliable>;
+// relayed as-is. Goes over UDP unless the sender asks for TCP, and then it's compressed
+// like the vehicle packets
+struct TOther : TPacket<TReliability::Unreliable, 400> {
+    static constexpr std::string_view Prefix = "T";
+    using Fields = TFields<TRest>;
+};
+// <file name>
+struct TFileRequest : TPacket<TReliability::Reliable> {
+    static constexpr std::string_view Prefix = "f";
+    using Fields = TFields<TRest>;
+};
+struct TModListRequest : TPacket<TReliability::Reliable> {
+    static constexpr std::string_view Prefix = "SR";
+    using Fields = TFields<>;
+};
+// <resume token>, sent instead of the key to take over a session which dropped a moment ago
+struct TResumeRequest : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Rq:";
+    using Fields = TFields<TRest>;
+};
+
+// server -> client
+
+// <roles>:<name>:<pid>-<vid>:<vehicle json>
+struct TVehicleSpawn : TPacket<TReliability::Reliable, 400, TPriority::Bulk> {
+    static constexpr std::string_view Prefix = "Os:";
+    using Fields = TFields<TString, TString, TVehicleID, TRest>;
+};
+// <message>
+struct TJoinMessage : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "J";
+    using Fields = TFields<TRest>;
+};
+// <reason>
+struct TKick : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "E";
+    using Fields = TFields<TRest>;
+};
+// <message>
+struct TLeaveMessage : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "L";
+    using Fields = TFields<TRest>;
+};
+// <map>
+struct TMap : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "M";
+    using Fields = TFields<TRest>;
+};
+// <player id>
+struct TPlayerID : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "P";
+    using Fields = TFields<TInt>;
+};
+// <player name>
+struct TPlayerName : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Sn";
+    using Fields = TFields<TRest>;
+};
+// <count>/<max>:<name>,<name>,...
+struct TPlayerList : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Ss";
+    using Fields = TFields<TString, TRest>;
+};
+// several unreliable packets in one datagram, only sent to clients which announced the
+// "bundle" capability: <length, 2 bytes big endian><packet>, repeated (see TDatagramBundle)
+struct TBundle : TPacket<TReliability::Unreliable> {
+    static constexpr std::string_view Prefix = "B";
+    using Fields = TFields<TRest>;
+};
+// <resume token>, only sent to clients which announced the "resume" capability
+struct TResumeToken : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Rt:";
+    using Fields = TFields<TRest>;
+};
+// <player id>, the session was resumed, missed packets follow
+struct TResumeAccepted : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Ra:";
+    using Fields = TFields<TInt>;
+};
+// the session is gone, the client has to send its key and join as usual
+struct TResumeRejected : TPacket<TReliability::Reliable, DefaultCompressAbove, TPriority::Control> {
+    static constexpr std::string_view Prefix = "Rx";
+    using Fields = TFields<>;
+};
+
+// ===================== GENERATED ======================
+
+template <typename Fields>
+struct TValuesOf;
+template <typename... Fields>
+struct TValuesOf<TFields<Fields...>> {
+    using Type = std::tuple<typename Fields::Value...>;
+};
+// the parsed fields of a packet, in order of declaration
+template <typename Schema>
+using TValues = typename TValuesOf<typename Schema::Fields>::Type;
+
+namespace Detail {
+    template <typename Encoding, typename Field>
+    bool ReadField(std::string_view& In, bool IsFirst, typename Field::Value& Out) {
+        if (!IsFirst) {
+            if (In.empty() || In.front() != Encoding::FieldSeparator) {
+                return false;
+            }
+            In.remove_prefix(1);
+        }
+        std::string_view Token = In;
+        if constexpr (!std::is_same_v<Field, TRest>) {
+            Token = In.substr(0, In.find(Encoding::FieldSeparator));
+        }
+        In.remove_prefix(Token.size());
+        return Encoding::Read(Field {}, Token, Out);
+    }
+
+    template <typename Encoding, typename... Fields, size_t... I>
+    bool ReadFields([[maybe_unused]] std::string_view In, [[maybe_unused]] std::tuple<typename Fields::Value...>& Out, std::index_sequence<I...>) {
+        return (ReadField<Encoding, Fields>(In, I == 0, std::get<I>(Out)) && ...);
+    }
+
+    template <typename Encoding, typename... Fields>
+    bool ReadAll(std::string_view In, std::tuple<typename Fields::Value...>& Out, TFields<Fields...>) {
+        return ReadFields<Encoding, Fields...>(In, Out, std::index_sequence_for<Fields...> {});
+    }
+
+    template <typename Encoding, typename... Fields, size_t... I>
+    void WriteFields(std::string& Out, [[maybe_unused]] const std::tuple<typename Fields::Value...>& Values, std::index_sequence<I...>) {
+        size_t Size = Out.size();
+        ((Size += Encoding::SizeHint(Fields {}, std::get<I>(Values)) + 1), ...);
+        Out.reserve(Size);
+        ((I == 0 ? void() : void(Out += Encoding::FieldSeparator), Encoding::Write(Fields {}, Out, std::get<I>(Values))), ...);
+    }
+
+    template <typename Encoding, typename... Fields>
+    void WriteAll(std::string& Out, const std::tuple<typename Fields::Value...>& Values, TFields<Fields...>) {
+        WriteFields<Encoding, Fields...>(Out, Values, std::index_sequence_for<Fields...> {});
+    }
+}
+
+// Parses Packet as a Schema packet. Returns nullopt if the prefix doesn't match
+// or a field is malformed. The returned views point into Packet.
+template <typename Schema, typename Encoding = TTextEncoding>
+std::optional<TValues<Schema>> Parse(std::string_view Packet) {
+    if (Packet.substr(0, Schema::Prefix.size()) != Schema::Prefix) {
+        return std::nullopt;
+    }
+    Packet.remove_prefix(Schema::Prefix.size());
+    TValues<Schema> Values {};
+    if (!Detail::ReadAll<Encoding>(Packet, Values, typename Schema::Fields {})) {
+        return std::nullopt;
+    }
+    return Values;
+}
+
+// Builds a Schema packet out of its field values, in order of declaration.
+template <typename Schema, typename Encoding = TTextEncoding, typename... Args>
+std::string Serialize(Args&&... Values) {
+    static_assert(sizeof...(Args) == std::tuple_size_v<TValues<Schema>>, "wrong number of fields for this packet");
+    std::string Out(Schema::Prefix);
+    Detail::WriteAll<Encoding>(Out, TValues<Schema>(std::forward<Args>(Values)...), typename Schema::Fields {});
+    return Out;
+}
+
+// what the send path needs to know about an opcode (first byte of a packet)
+struct TOpcodeInfo {
+    TReliability Reliability { TReliability::Unreliable };
+    size_t CompressAbove { DefaultCompressAbove };
+};
+
+template <typename... Schemas>
+struct TSchemaList { };
+
+using TAllPackets = TSchemaList<
+    TSyncRequest, TPing, TVehicleSpawnRequest, TVehicleEdit, TVehicleDelete, TVehicleReset, TVehicleOther,
+    TChat, TEvent, TNotification,
+    TVehicleUpdateV, TVehicleUpdateW, TVehicleUpdateX, TVehicleUpdateY, TVehicleUpdateZ, TOther,
+    TFileRequest, TModListRequest, TResumeRequest,
+    TVehicleSpawn, TJoinMessage, TKick, TLeaveMessage, TMap, TPlayerID, TPlayerName, TPlayerList,
+    TBundle, TResumeToken, TResumeAccepted, TResumeRejected>;
+
+namespace Detail {
+    // packets which share their first byte ("Os:", "Od:", ...) share one entry of the opcode
+    // table, so they have to agree on what's in it
+    template <typename... Schemas>
+    constexpr bool OpcodesAgree(TSchemaList<Schemas...>) {
+        std::array<bool, 256> Seen {};
+        std::array<TOpcodeInfo, 256> Table {};
+        bool Agree = true;
+        auto Add = [&](char Code, TReliability Reliability, size_t CompressAbove) {
+            auto& Entry = Table[uint8_t(Code)];
+            if (Seen[uint8_t(Code)] && (Entry.Reliability != Reliability || Entry.CompressAbove != CompressAbove)) {
+                Agree = false;
+            }
+            Seen[uint8_t(Code)] = true;
+            Entry = TOpcodeInfo { Reliability, CompressAbove };
+        };
+        (Add(Schemas::Prefix[0], Schemas::Reliability, Schemas::CompressAbove), ...);
+        return Agree;
+    }
+
+    // index in the list of the schema with the longest prefix Packet starts with ("E:" events
+    // vs. "E" kicks), the size of the list if there's none
+    template <typename... Schemas>
+    constexpr size_t LongestMatch(std::string_view Packet, TSchemaList<Schemas...>) {
+        constexpr std::array<std::string_view, sizeof...(Schemas)> Prefixes { Schemas::Prefix... };
+        size_t Result = Prefixes.size();
+        for (size_t i = 0; i < Prefixes.size(); ++i) {
+            if (Packet.substr(0, Prefixes[i].size()) == Prefixes[i] && (Result == Prefixes.size() || Prefixes[i].size() > Prefixes[Result].size())) {
+                Result = i;
+            }
+        }
+        return Result;
+    }
+
+    template <typename... Schemas>
+    constexpr TPriority PriorityAt(size_t Index, TSchemaList<Schemas...>) {
+        constexpr std::array<TPriority, sizeof...(Schemas)> Priorities { Schemas::Priority... };
+        return Index < Priorities.size() ? Priorities[Index] : TPriority::Gameplay;
+    }
+
+    template <typename Schema, typename Encoding, typename Handler>
+    bool ParseAndHandle(std::string_view Packet, Handler& Handle) {
+        auto Values = Parse<Schema, Encoding>(Packet);
+        if (!Values) {
+            return false;
+        }
+        Handle(Schema {}, *Values);
+        return true;
+    }
+}
+
+static_assert(Detail::OpcodesAgree(TAllPackets {}), "packets with the same first byte have to agree on reliability and compression");
+
+template <typename... Schemas>
+constexpr std::array<TOpcodeInfo, 256> MakeOpcodeTable(TSchemaList<Schemas...>) {
+    std::array<TOpcodeInfo, 256> Table {};
+    ((Table[uint8_t(Schemas::Prefix[0])] = TOpcodeInfo { Schemas::Reliability, Schemas::CompressAbove }), ...);
+    return Table;
+}
+
+inline constexpr auto OpcodeTable = MakeOpcodeTable(TAllPackets {});
+
+constexpr const TOpcodeInfo& Info(char Code) {
+    return OpcodeTable[uint8_t(Code)];
+}
+
+// which send queue a reliable packet belongs in. compressed packets are bulk, unless the
+// sender classified them before compressing.
+constexpr TPriority PriorityOf(std::string_view Packet) {
+    if (Packet.substr(0, 4) == "ABG:") {
+        return TPriority::Bulk;
+    }
+    return Detail::PriorityAt(Detail::LongestMatch(Packet, TAllPackets {}), TAllPackets {});
+}
+
+// a set of lambdas as one handler for Dispatch, one lambda per schema:
+// THandlers { [&](TChat, const TValues<TChat>& Chat) { ... }, ... }
+template <typename... Lambdas>
+struct THandlers : Lambdas... {
+    using Lambdas::operator()...;
+};
+template <typename... Lambdas>
+THandlers(Lambdas...) -> THandlers<Lambdas...>;
+
+// Parses Packet as the schema of List with the longest prefix it starts with, and calls
+// Handle(Schema {}, Values) with it, through a table of one entry per schema. Returns false
+// if no schema's prefix matches or a field is malformed, Handle isn't called then.
+template <typename Encoding = TTextEncoding, typename... Schemas, typename Handler>
+bool Dispatch(std::string_view Packet, TSchemaList<Schemas...> List, Handler&& Handle) {
+    using THandler = std::remove_reference_t<Handler>;
+    static constexpr std::array<bool (*)(std::string_view, THandler&), sizeof...(Schemas)> Table {
+        &Detail::ParseAndHandle<Schemas, Encoding, THandler>...
+    };
+    size_t Index = Detail::LongestMatch(Packet, List);
+    return Index < Table.size() && Table[Index](Packet, Handle);
+}
+
+// whether a packet with this opcode has to go over TCP
+constexpr bool IsReliable(char Code, bool RequestedReliable) {
+    return RequestedReliable || Info(Code).Reliability == TReliability::Reliable;
+}
+
+}
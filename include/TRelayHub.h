@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Compat.h"
+#include "IWorldObserver.h"
+#include "TWorldPublisher.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TServer;
+
+/*
+ * Streams this server's world to the relays subscribed to it (RelaySecret, see TRelayLink).
+ * A relay first gets a snapshot of the world, then every change and broadcast, as
+ * TWorldPublisher messages with an int32 length in front. Each relay has its own queue and
+ * thread, so a slow one doesn't hold up the game. One which falls too far behind is dropped,
+ * it connects again and starts over with a fresh snapshot.
+ */
+class TRelayHub final : public IWorldObserver {
+public:
+    explicit TRelayHub(TServer& Server);
+    ~TRelayHub() override;
+    TRelayHub(const TRelayHub&) = delete;
+    TRelayHub& operator=(const TRelayHub&) = delete;
+
+    // takes over the (blocking) socket of a relay which passed the handshake
+    void Subscribe(SOCKET Sock);
+
+    void OnPlayerUpdated(const TClient& Client) override;
+    void OnPlayerRemoved(int PlayerID) override;
+    void OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) override;
+    void OnVehicleRemoved(int PlayerID, int VehicleID) override;
+    void OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) override;
+
+private:
+    struct TSubscriber {
+        SOCKET Sock;
+        std::mutex Mutex;
+        std::condition_variable Condition;
+        std::deque<std::string> Queue;
+        size_t QueuedBytes { 0 };
+        // nothing is sent before the snapshot is queued
+        bool Ready { false };
+        bool Closed { false };
+        std::thread Thread;
+    };
+
+    // how much may be waiting for a relay before it's dropped
+    static constexpr size_t MaxBacklog = 64 * 1024 * 1024;
+
+    void Publish(const std::string& Message);
+    // stops the subscribers' threads, once
+    void Stop();
+    // closes the subscriber's socket once everything queued went out, or it's closed
+    static void SenderMain(std::shared_ptr<TSubscriber> Subscriber);
+    static void Close(TSubscriber& Subscriber);
+
+    TWorldPublisher mPublisher;
+    std::mutex mSubscribersMutex;
+    std::vector<std::shared_ptr<TSubscriber>> mSubscribers;
+    bool mShutdown { false };
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Compat.h"
+#include "TConnectionGate.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+class TWorldMirror;
+
+/*
+ * The connection of a relay (RelayUpstream) to the server it relays. It subscribes with
+ * the code 'R' and the RelayUpstreamSecret, then feeds what the upstream's TRelayHub streams into
+ * the TWorldMirror, which hands it on to the players here. When the upstream goes away,
+ * its players leave and the link keeps trying to connect again.
+ */
+class TRelayLink final {
+public:
+    // throws if Upstream isn't "host:port". what comes in is applied with a pass of Gate.
+    TRelayLink(TWorldMirror& Mirror, TConnectionGate& Gate, const std::string& Upstream);
+    ~TRelayLink();
+    TRelayLink(const TRelayLink&) = delete;
+    TRelayLink& operator=(const TRelayLink&) = delete;
+
+private:
+    static constexpr auto RetryInterval = std::chrono::seconds(5);
+    // a message is a vehicle's data at most, anything bigger is garbage
+    static constexpr int32_t MaxMessageSize = 16 * 1024 * 1024;
+
+    void LinkMain();
+    // the connected and subscribed socket, nothing if that didn't work out
+    std::optional<SOCKET> Connect();
+    // applies what comes in until the connection is gone
+    void Receive(SOCKET Sock);
+    // stops the link's thread, once
+    void Stop();
+
+    TWorldMirror& mMirror;
+    TConnectionGate& mGate;
+    std::string mHost;
+    std::string mPort;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mShutdown { false };
+    SOCKET mSock { SOCKET(-1) };
+    std::thread mThread;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class TStateReader;
+class TStateWriter;
+
+/*
+ * Reliable, ordered delivery over UDP for clients with the "rudp" capability, with a few
+ * independent streams, so a lost datagram only holds up its own stream instead of
+ * everything behind it, like one lost TCP segment does.
+ *
+ * Datagrams, in both directions:
+ *
+ *     U<stream, 1 byte><sequence, 2 bytes><flags, 1 byte><payload>
+ *     K<stream, 1 byte><next expected sequence, 2 bytes><bitmap, 4 bytes>
+ *
+ * Numbers are big endian. The 'More' flag means the packet continues in the next sequence
+ * number, packets too big for one datagram are split up that way. An ack covers everything
+ * before the next expected sequence number, bit i of the bitmap acks next + 1 + i on top.
+ * Unacked datagrams are retransmitted after an RTO based on the measured RTT, with backoff.
+ */
+class TReliableChannel final {
+public:
+    using TClock = std::chrono::steady_clock;
+
+    enum TStream : uint8_t {
+        // chat and join/leave messages (C, J, L)
+        Messages,
+        // lua events (E, N)
+        Events,
+        // vehicle spawns, edits and deletes (O)
+        Vehicles,
+        StreamCount,
+    };
+    // payload bytes per datagram, so it stays below common MTUs
+    static constexpr size_t MaxPayload = 1100;
+
+    // the stream for packets starting with Code, none if they stay on TCP
+    static std::optional<TStream> StreamOf(char Code);
+
+    TReliableChannel() = default;
+    TReliableChannel(const TReliableChannel&) = delete;
+    TReliableChannel& operator=(const TReliableChannel&) = delete;
+
+    // splits the packet into datagrams, returns the ones which may go out right away.
+    // the others are sent by TakeDue() once acks make room.
+    [[nodiscard]] std::vector<std::string> Send(TStream Stream, std::string_view Packet);
+    void OnAck(std::string_view Datagram);
+    // takes a data datagram, appends the packets which are complete and next in order to
+    // 'Delivered' and returns the ack to send back (empty if the datagram is garbage)
+    [[nodiscard]] std::string OnData(std::string_view Datagram, std::vector<std::string>& Delivered);
+    // datagrams to retransmit, and waiting ones which fit in the window now
+    [[nodiscard]] std::vector<std::string> TakeDue(TClock::time_point Now);
+    // gave up on a datagram after MaxRetries retransmissions
+    [[nodiscard]] bool Failed() const;
+    // starts over, for a new connection of the same client
+    void Reset();
+    // true the first time only, to register the client for TakeDue() polling once
+    [[nodiscard]] bool Activate();
+    // whether the stream's packets go over this channel. a stream only moves here from TCP
+    // once, when nothing sent over TCP can be overtaken anymore, and stays until Reset.
+    [[nodiscard]] bool Carries(TStream Stream) const;
+    void Carry(TStream Stream);
+    // the sequence numbers and unacked datagrams, for another process to carry on with (see THotUpgrade)
+    void Save(TStateWriter& Writer) const;
+    // picks up where the saved channel left off, its unacked datagrams are due right away.
+    // throws if the state is cut short. the channel isn't active after this.
+    void Restore(TStateReader& Reader);
+
+private:
+    enum TFlags : uint8_t {
+        More = 1 << 0,
+    };
+    struct TOutgoing {
+        uint16_t Sequence;
+        std::string Datagram;
+        TClock::time_point SentAt;
+        TClock::time_point Due;
+        int Retries;
+    };
+    struct TSendStream {
+        // moved over from TCP, see Carries
+        bool Carried { false };
+        uint16_t NextSequence { 0 };
+        std::deque<TOutgoing> InFlight;
+        // numbered already, waiting for room in the window
+        std::deque<TOutgoing> Waiting;
+    };
+    struct TIncoming {
+        uint8_t Flags;
+        std::string Payload;
+    };
+    struct TReceiveStream {
+        uint16_t NextExpected { 0 };
+        std::unordered_map<uint16_t, TIncoming> Received;
+        // the parts of a split packet so far
+        std::string Partial;
+    };
+
+    // sequence numbers a receiver accepts ahead of the next one it's waiting for
+    static constexpr uint16_t Window = 256;
+    static constexpr int MaxRetries = 10;
+    static constexpr size_t MaxPacketSize = 1024 * 1024;
+    static constexpr std::chrono::milliseconds MinRto { 50 };
+    static constexpr std::chrono::milliseconds MaxRto { 2000 };
+
+    static bool IsBefore(uint16_t A, uint16_t B) { return int16_t(uint16_t(A - B)) < 0; }
+    // the receiver only takes sequence numbers up to a Window after the oldest unacked one
+    static bool FitsWindow(const TSendStream& State, uint16_t Sequence) {
+        return State.InFlight.empty() || uint16_t(Sequence - State.InFlight.front().Sequence) < Window;
+    }
+    // needs mMutex locked
+    TClock::duration Rto(int Retries) const;
+    void SampleRtt(TClock::duration Rtt);
+
+    mutable std::mutex mMutex;
+    TSendStream mSend[StreamCount];
+    TReceiveStream mReceive[StreamCount];
+    std::optional<double> mSrttMs;
+    double mRttVarMs { 0 };
+    bool mFailed { false };
+    bool mActive { false };
+};
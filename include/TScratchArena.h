@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*
+ * A per-thread monotonic arena for short-lived allocations which happen while
+ * a single packet (or heartbeat, or auth response) is being handled, like rapidjson
+ * documents and their parse stacks.
+ *
+ * Allocation is a pointer bump, deallocation is a no-op. Everything is released at
+ * once when the outermost TScratchArena::TScope of the thread ends. The memory itself
+ * is kept around, so once a thread's arena has grown to its high-water mark, the json
+ * work of further packets doesn't touch the global allocator anymore. Strings which
+ * outlive the packet (vehicle data, Lua event arguments) are still on the heap.
+ * The "arena" console command shows the high-water mark.
+ */
+class TScratchArena final {
+public:
+    // Open one of these around the handling of a packet. Scopes may be nested,
+    // only the outermost one resets the arena when it ends.
+    class TScope final {
+    public:
+        TScope();
+        ~TScope();
+        TScope(const TScope&) = delete;
+        TScope& operator=(const TScope&) = delete;
+
+    private:
+        TScratchArena& mArena;
+    };
+
+    TScratchArena(const TScratchArena&) = delete;
+    TScratchArena& operator=(const TScratchArena&) = delete;
+
+    // the arena of the calling thread
+    static TScratchArena& ThreadLocal();
+    // biggest amount of memory any thread's arena has needed so far
+    static size_t GlobalHighWaterMark() { return mGlobalHighWaterMark; }
+
+    [[nodiscard]] void* Allocate(size_t Size, size_t Align = alignof(std::max_align_t));
+    // grows the allocation in place if it's the last one made, otherwise moves it
+    [[nodiscard]] void* Reallocate(void* Ptr, size_t OldSize, size_t NewSize);
+    // invalidates everything allocated since the last reset
+    void Reset();
+
+    [[nodiscard]] size_t Used() const { return mUsedInPreviousBlocks + mOffset; }
+    [[nodiscard]] size_t Capacity() const;
+    [[nodiscard]] size_t HighWaterMark() const { return mHighWaterMark; }
+
+private:
+    struct TBlock {
+        std::unique_ptr<std::byte[]> Data;
+        size_t Size;
+    };
+
+    TScratchArena() = default;
+    void AddBlock(size_t MinSize);
+
+    static constexpr size_t InitialBlockSize = 64 * 1024;
+    static inline std::atomic<size_t> mGlobalHighWaterMark { 0 };
+
+    std::vector<TBlock> mBlocks;
+    size_t mCurrentBlock { 0 };
+    size_t mOffset { 0 };
+    size_t mUsedInPreviousBlocks { 0 };
+    size_t mHighWaterMark { 0 };
+    void* mLastAllocation { nullptr };
+    int mScopeDepth { 0 };
+};
@@ -1,11 +1,19 @@
 #pragma once
 
 #include "IThreaded.h"
+#include "IWorldObserver.h"
 #include "RWMutex.h"
+#include "TVehicleTransformCache.h"
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 class TClient;
 class TNetwork;
@@ -14,6 +22,15 @@ class TPPSMonitor;
 class TServer final {
 public:
     using TClientSet = std::unordered_set<std::shared_ptr<TClient>>;
+    // the player list in the formats it's sent out in, built once per change of the list
+    struct TPlayerListSnapshot {
+        uint64_t Version;
+        int MaxPlayers;
+        // "Ss<count>/<max>:name,name,...", the reply to a ping
+        std::string Packet;
+        // "name;name;...", for the heartbeat
+        std::string HeartbeatList;
+    };
 
     TServer(int argc, char** argv);
 
@@ -23,6 +40,42 @@ public:
     // in Fn, return true to continue, return false to break
     void ForEachClient(const std::function<bool(std::weak_ptr<TClient>)>& Fn);
     size_t ClientCount() const;
+    // players on the other processes of a cluster, they're only in the player list
+    void SetRemotePlayer(int ID, const std::string& Name);
+    void RemoveRemotePlayer(int ID);
+    // ClientCount plus the remote players
+    size_t PlayerCount() const;
+    // the client with this ID, or null if there is none
+    std::shared_ptr<TClient> FindClient(int ID) const;
+
+    // players only see and hear the players in their room. Each room has its own map, the
+    // default one has MapName, the others are configured in Rooms.
+    static constexpr std::string_view DefaultRoom = "default";
+    // the map of the room, nothing if there is no such room
+    static std::optional<std::string> RoomMap(const std::string& Room);
+    std::string RoomOf(const TClient& Client) const;
+    // the room has to exist. doesn't tell anyone, see TNetwork::MoveToRoom
+    void SetClientRoom(const std::shared_ptr<TClient>& Client, const std::string& Room);
+    // like ForEachClient, but only for the clients in the same room as Client
+    void ForEachClientInRoom(const TClient& Client, const std::function<bool(std::weak_ptr<TClient>)>& Fn);
+    void ForEachClientInRoom(const std::string& Room, const std::function<bool(std::weak_ptr<TClient>)>& Fn);
+    // the room with the fewest players in it
+    std::string EmptiestRoom() const;
+    // rebuilds the snapshot if the list changed since it was last built, otherwise returns the cached one
+    std::shared_ptr<const TPlayerListSnapshot> GetPlayerList();
+    // call when a client's name changes, joins and leaves are tracked already
+    void InvalidatePlayerList();
+    [[nodiscard]] uint64_t PlayerListVersion() const { return mPlayerListVersion; }
+    // where the vehicles are, as of their last position update
+    [[nodiscard]] TVehicleTransformCache& VehicleTransforms() { return mVehicleTransforms; }
+    // has to be added before the first client connects, and outlive the server
+    void AddObserver(IWorldObserver& Observer) { mObservers.push_back(&Observer); }
+    // tell the observers, see IWorldObserver
+    void NotifyPlayerUpdated(const TClient& Client);
+    void NotifyVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data);
+    void NotifyVehicleRemoved(int PlayerID, int VehicleID);
+    void NotifyBroadcast(const TClient* Sender, const std::string& Data, bool Rel);
+    void NotifySessionIssued(const TClient& Client, const std::string& Token);
 
     static void GlobalParser(const std::weak_ptr<TClient>& Client, std::string Packet, TPPSMonitor& PPSMonitor, TNetwork& Network);
     static void HandleEvent(TClient& c, const std::string& Data);
@@ -30,8 +83,17 @@ public:
 private:
     TClientSet mClients;
     mutable RWMutex mClientsMutex;
+    // room name -> its clients, guarded by mClientsMutex like mClients
+    std::unordered_map<std::string, TClientSet> mRooms;
+    // ID -> name, guarded by mClientsMutex too
+    std::unordered_map<int, std::string> mRemotePlayers;
+    std::atomic<uint64_t> mPlayerListVersion { 0 };
+    std::mutex mPlayerListMutex;
+    std::shared_ptr<const TPlayerListSnapshot> mPlayerList;
+    TVehicleTransformCache mVehicleTransforms;
+    std::vector<IWorldObserver*> mObservers;
     static void ParseVehicle(TClient& c, const std::string& Pckt, TNetwork& Network);
-    static bool ShouldSpawn(TClient& c, const std::string& CarJson, int ID);
-    static bool IsUnicycle(TClient& c, const std::string& CarJson);
+    static bool ShouldSpawn(TClient& c, std::string_view CarJson, int ID);
+    static bool IsUnicycle(TClient& c, std::string_view CarJson);
     static void Apply(TClient& c, int VID, const std::string& pckt);
 };
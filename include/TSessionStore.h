@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TClient;
+
+/*
+ * Keeps the sessions of players whose connection dropped around for a little while
+ * (ResumeGracePeriod), so they can pick up where they left off when they reconnect.
+ *
+ * Synced clients which announced the "resume" capability get a random resume token.
+ * When such a client's connection drops, it's parked instead of removed: it stays in
+ * the game with its vehicles, and reliable packets keep queueing up for it. If it comes
+ * back with its token in time, it gets the queued packets instead of a full resync.
+ * Each token works once, a resumed client gets a new one.
+ */
+class TSessionStore final {
+public:
+    // a client's session, for another process to take it over (see THotUpgrade)
+    struct TSavedSession {
+        std::string Token;
+        bool Parked;
+        // what's left of the grace period, if it's parked
+        std::chrono::milliseconds Remaining;
+    };
+
+    TSessionStore() = default;
+    TSessionStore(const TSessionStore&) = delete;
+    TSessionStore& operator=(const TSessionStore&) = delete;
+
+    // a new resume token for the client, its previous one stops working
+    [[nodiscard]] std::string Issue(const std::shared_ptr<TClient>& Client);
+    // starts the grace period of a client which lost its connection, false if it has no token
+    bool Park(const TClient& Client);
+    // the parked client the token belongs to, or null if there is none (anymore)
+    [[nodiscard]] std::shared_ptr<TClient> Resume(const std::string& Token);
+    // takes the client out of the store if it's parked, false if it isn't
+    bool Unpark(const TClient& Client);
+    // parked clients whose grace period is over, they're taken out of the store
+    [[nodiscard]] std::vector<std::shared_ptr<TClient>> TakeExpired();
+    // the client left for good
+    void Forget(const TClient& Client);
+    // the client's session, nothing if it has no token
+    [[nodiscard]] std::optional<TSavedSession> Save(const TClient& Client);
+    void Restore(const std::shared_ptr<TClient>& Client, const TSavedSession& Session);
+    // a token nobody can guess
+    static std::string GenerateToken();
+
+private:
+    struct TSession {
+        std::weak_ptr<TClient> Client;
+        bool Parked { false };
+        std::chrono::steady_clock::time_point Expiry {};
+    };
+
+    // needs mMutex locked
+    void EraseToken(const TClient& Client);
+
+    std::mutex mMutex;
+    std::unordered_map<std::string, TSession> mSessions;
+    // current token of each client
+    std::unordered_map<const TClient*, std::string> mTokens;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Compat.h"
+#include "TUnixChannel.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TNetwork;
+class TServer;
+class TStateReader;
+
+// what the server tells its standby, each message starts with one of these, the rest is
+// a TStateWriter's data
+namespace StandbyMessage {
+// "T" with the listening TCP socket
+constexpr char TCPListener = 'T';
+// "U" with the UDP socket
+constexpr char UDPSocket = 'U';
+// "P<id, name, roles, guest, identifiers, capabilities, room>", the player is in game
+constexpr char Player = 'P';
+// "L<id>", the player left, with all their vehicles
+constexpr char Left = 'L';
+// "V<id, vehicle id, unicycle, spawn>", the vehicle was spawned or edited
+constexpr char Vehicle = 'V';
+// "R<id, vehicle id>", the vehicle was deleted
+constexpr char Removed = 'R';
+// "K<id, token>", the player's resume token
+constexpr char Session = 'K';
+// "Q", the server shuts down on purpose, the standby exits
+constexpr char Quit = 'Q';
+}
+
+/*
+ * The standby process of a server with Standby = true (see TStandbyFeed). Until the server
+ * is gone it does nothing but keep a copy of who plays with which vehicles, and the
+ * server's listening sockets, so connections which come in meanwhile wait in the backlog.
+ * If the server crashes, the standby starts up as the server in its place. The players come
+ * back as parked sessions (see TSessionStore), a client with the "resume" capability
+ * reconnects and carries on with its vehicles, no rejoin or respawn. Who can't resume is
+ * gone once the next parked sessions expire, like after a normal disconnect.
+ */
+class TStandby final {
+public:
+    // set for the standby, to its end of the socket to the server
+    static constexpr const char* ChannelVariable = "BEAMMP_STANDBY_CHANNEL";
+    // set for the standby, to a copy of the server's stdin, its console once it takes over
+    static constexpr const char* ConsoleVariable = "BEAMMP_STANDBY_CONSOLE";
+
+    // the socket to the server, nothing if this process isn't a standby
+    static std::optional<int> Channel();
+
+    explicit TStandby(int Fd);
+    TStandby(const TStandby&) = delete;
+    TStandby& operator=(const TStandby&) = delete;
+
+    // keeps the copy up to date until the server is gone. true if it crashed and this
+    // process has to take over, false if it shut down.
+    bool WaitForFailover();
+    // serves on the server's sockets and brings its players back
+    void TakeOver(TServer& Server, TNetwork& Network);
+
+private:
+    struct TPlayer {
+        std::string Name;
+        std::string Roles;
+        bool Guest { false };
+        std::vector<std::string> Identifiers;
+        uint32_t Capabilities { 0 };
+        std::string Room;
+        // empty if the player can't resume
+        std::string Token;
+        int UnicycleID { -1 };
+        // spawn packets by vehicle ID
+        std::map<int, std::string> Vehicles;
+    };
+
+    void Apply(char Code, TStateReader& Reader);
+
+    std::unique_ptr<TUnixChannel> mChannel;
+    SOCKET mTCPListener { -1 };
+    SOCKET mUDPSock { -1 };
+    std::unordered_map<int, TPlayer> mPlayers;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Compat.h"
+#include "IWorldObserver.h"
+#include "TUnixChannel.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TNetwork;
+class TServer;
+
+/*
+ * Keeps a standby process for the server (Standby = true, linux only), which takes over if
+ * this one crashes (see TStandby). The standby is a start of the same binary, like the
+ * cluster workers, with a unix socket to this process. It gets the listening sockets and
+ * every change to who plays with which vehicles, and their resume tokens. Position updates
+ * aren't part of it, the clients send them again as soon as they're back. A standby which
+ * exits is started again, with a snapshot of where the world is right then.
+ *
+ * The observers only queue, a thread of its own writes to the standby, so a standby which
+ * hangs can't hold the server up. One which falls too far behind, or can't be written to,
+ * is killed and started again, its copy would be wrong otherwise.
+ */
+class TStandbyFeed final : public IWorldObserver {
+public:
+    // starts the standby
+    TStandbyFeed(TServer& Server, TNetwork& Network);
+    ~TStandbyFeed() override;
+    TStandbyFeed(const TStandbyFeed&) = delete;
+    TStandbyFeed& operator=(const TStandbyFeed&) = delete;
+
+    // the server's sockets, once they're listening
+    void ShareTCPListener(SOCKET Listener);
+    void ShareUDPSocket(SOCKET UDPSock);
+    // tells the standby to exit instead of taking over, once, and kills it if it doesn't
+    void Stop();
+
+    void OnPlayerUpdated(const TClient& Client) override;
+    void OnPlayerRemoved(int PlayerID) override;
+    void OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) override;
+    void OnVehicleRemoved(int PlayerID, int VehicleID) override;
+    void OnSessionIssued(const TClient& Client, const std::string& Token) override;
+
+private:
+    // how long to wait before a standby which exited is started again
+    static constexpr auto RespawnDelay = std::chrono::seconds(5);
+    // how long Stop waits for the standby to exit
+    static constexpr auto StopTimeout = std::chrono::seconds(5);
+    // messages which may wait for the standby, it's restarted if it falls further behind
+    static constexpr size_t MaxQueued = 16384;
+
+    struct TOutgoing {
+        std::string Data;
+        // only borrowed, the sockets of mNetwork
+        std::vector<int> Fds;
+    };
+
+    // starts a standby, needs mMutex locked. false if it couldn't be started.
+    bool Spawn();
+    // the world as it is now, for a standby to catch up with
+    std::vector<TOutgoing> Snapshot();
+    // waits for the standby to exit, and starts it again
+    void WatchMain();
+    // sends what's queued
+    void WriteMain();
+    // queues the message, needs mMutex locked
+    void Send(std::string Message, std::vector<int> Fds = {});
+    // kills the standby, which is started again with a fresh snapshot, needs mMutex locked
+    void Restart(const std::string& Reason);
+    [[nodiscard]] std::string PlayerMessage(const TClient& Client) const;
+    [[nodiscard]] static std::string VehicleMessage(const TClient& Client, int VehicleID, const std::string& Data);
+
+    TServer& mServer;
+    TNetwork& mNetwork;
+    std::vector<std::string> mArgv;
+    std::mutex mMutex;
+    // on shutdown and once the standby is gone
+    std::condition_variable mStopped;
+    std::condition_variable mQueued;
+    // null while there's no standby, what happens meanwhile is in the next snapshot
+    std::shared_ptr<TUnixChannel> mChannel;
+    std::deque<TOutgoing> mQueue;
+    // the snapshot isn't queued yet, nothing may go out before it
+    bool mCatchingUp { false };
+    int mPid { -1 };
+    SOCKET mTCPListener { -1 };
+    SOCKET mUDPSock { -1 };
+    std::atomic<bool> mShutdown { false };
+    std::thread mThread;
+    std::thread mWriter;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * A flat form of the server's state, to hand it to another process on the same
+ * machine (see THotUpgrade). Integers are 8 bytes in the machine's byte order,
+ * strings are their length followed by their bytes.
+ */
+class TStateWriter final {
+public:
+    void Int(int64_t Value);
+    void Bool(bool Value) { Int(Value ? 1 : 0); }
+    void String(std::string_view Value);
+    [[nodiscard]] const std::string& Data() const { return mData; }
+
+private:
+    std::string mData;
+};
+
+class TStateReader final {
+public:
+    explicit TStateReader(std::string_view Data)
+        : mData(Data) { }
+
+    // these throw std::runtime_error if the state ends early
+    int64_t Int();
+    bool Bool() { return Int() != 0; }
+    std::string String();
+    [[nodiscard]] bool AtEnd() const { return mData.empty(); }
+
+private:
+    std::string_view mData;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Messages between processes on the same machine, over a unix stream socket. A message
+ * can take file descriptors (sockets) along, the receiving process gets its own copies
+ * of them (SCM_RIGHTS). Only on linux, elsewhere connecting and listening always fail.
+ *
+ * Any thread may send, only one may receive.
+ */
+class TUnixChannel final {
+public:
+    struct TMessage {
+        std::string Data;
+        // the receiver owns them and has to close them
+        std::vector<int> Fds;
+    };
+
+    // takes ownership of the connected socket
+    explicit TUnixChannel(int Fd);
+    ~TUnixChannel();
+    TUnixChannel(const TUnixChannel&) = delete;
+    TUnixChannel& operator=(const TUnixChannel&) = delete;
+
+    // null if nothing listens at the path
+    static std::unique_ptr<TUnixChannel> Connect(const std::string& Path);
+    // a listening socket at the path (replacing a stale one), -1 on failure
+    static int Listen(const std::string& Path);
+    // the next connection on a socket from Listen, null once it's closed
+    static std::unique_ptr<TUnixChannel> Accept(int ListenFd);
+
+    // the fds are only borrowed, the caller still has to close its copies
+    [[nodiscard]] bool Send(std::string_view Data, const std::vector<int>& Fds = {});
+    // waits for the next message, nothing once the other side is gone
+    std::optional<TMessage> Receive();
+    // makes Receive return, from any thread
+    void Shutdown();
+
+private:
+    // a bigger length can only come from a broken stream
+    static constexpr size_t MaxMessageSize = 256 * 1024 * 1024;
+    static constexpr size_t MaxFds = 16;
+
+    int mFd;
+    std::mutex mSendMutex;
+};
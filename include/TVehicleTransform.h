@@ -0,0 +1,27 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string_view>
+
+/*
+ * What a position packet says about a vehicle:
+ *
+ *     Zp:<player id>-<vehicle id>:{"pos":[x,y,z],"vel":[x,y,z],"rot":[x,y,z,w],"tim":<seconds>,...}
+ *
+ * The server relays these as-is, this is for the few places which need to look inside.
+ */
+struct TVehicleTransform {
+    int PlayerID { -1 };
+    int VehicleID { -1 };
+    std::array<double, 3> Position {};
+    std::array<double, 3> Velocity {};
+    // quaternion
+    std::array<double, 4> Rotation { 0, 0, 0, 1 };
+    // the sender's clock in seconds, if it sent it
+    std::optional<double> Time;
+
+    // nothing for other packets and broken ones. Parses into the thread's
+    // TScratchArena, so only call it within a TScratchArena::TScope.
+    static std::optional<TVehicleTransform> Parse(std::string_view Packet);
+};
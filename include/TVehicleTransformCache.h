@@ -0,0 +1,114 @@
+#pragma once
+
+#include "TVehicleTransform.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * Where every vehicle is, from the position packets which pass through the server, and
+ * those of the players on other cluster workers (see TWorldMirror).
+ *
+ * Updates go into a working copy under a mutex. Readers don't lock anything, they read one
+ * of two snapshot buffers, which the cache's own thread refills and flips at most every
+ * PublishInterval, so neither a plugin asking where vehicles are nor packet handling pays
+ * for building it. A reader counts itself in on the buffer it reads (see TPin), the
+ * publisher only refills the other one once nobody reads it anymore, which is a short wait
+ * at most, as a read doesn't take long. The snapshot has each room's vehicles in a spatial
+ * hash of CellSize sized cells on the ground plane, for radius queries which don't have to
+ * look at every vehicle.
+ */
+class TVehicleTransformCache final {
+public:
+    // player ID, vehicle ID
+    using TVehicleID = std::pair<int, int>;
+
+    TVehicleTransformCache();
+    ~TVehicleTransformCache();
+    TVehicleTransformCache(const TVehicleTransformCache&) = delete;
+    TVehicleTransformCache& operator=(const TVehicleTransformCache&) = delete;
+
+    // Room is the one of the vehicle's owner
+    void Update(const TVehicleTransform& Transform, const std::string& Room);
+    void Remove(int PlayerID, int VehicleID);
+    void RemovePlayer(int PlayerID);
+
+    [[nodiscard]] std::optional<TVehicleTransform> Find(int PlayerID, int VehicleID) const;
+    // vehicles in the room at most Radius meters away from the position
+    [[nodiscard]] std::vector<TVehicleID> FindInRadius(const std::string& Room, const std::array<double, 3>& Position, double Radius) const;
+
+private:
+    using TClock = std::chrono::steady_clock;
+
+    struct TEntry {
+        TVehicleTransform Transform;
+        std::string Room;
+        TClock::time_point UpdatedAt;
+    };
+    struct TRoom {
+        // vehicle keys
+        std::vector<uint64_t> Vehicles;
+        // cell key -> vehicle keys
+        std::unordered_map<uint64_t, std::vector<uint64_t>> Cells;
+    };
+    struct TSnapshot {
+        std::unordered_map<uint64_t, TVehicleTransform> Vehicles;
+        std::unordered_map<std::string, TRoom> Rooms;
+    };
+    // the current snapshot, which isn't refilled for as long as this lives
+    class TPin final {
+    public:
+        explicit TPin(const TVehicleTransformCache& Cache);
+        ~TPin();
+        TPin(const TPin&) = delete;
+        TPin& operator=(const TPin&) = delete;
+        const TSnapshot* operator->() const { return mSnapshot; }
+
+    private:
+        std::atomic<uint32_t>* mReaders;
+        const TSnapshot* mSnapshot;
+    };
+
+    static constexpr double CellSize = 64.0;
+    static constexpr auto PublishInterval = std::chrono::milliseconds(50);
+    // vehicles which didn't move for this long are left out, their owner stopped
+    // sending (or a late packet came in after they were deleted)
+    static constexpr auto StaleAfter = std::chrono::seconds(10);
+
+    static uint64_t Key(int PlayerID, int VehicleID) {
+        return (uint64_t(uint32_t(PlayerID)) << 32) | uint32_t(VehicleID);
+    }
+    static int64_t CellOf(double Coordinate);
+    static uint64_t CellKey(int64_t X, int64_t Y) {
+        return (uint64_t(uint32_t(X)) << 32) | uint32_t(Y);
+    }
+    // publishes the updates, at most every PublishInterval
+    void PublishMain();
+    // needs mMutex locked, which keeps two publishers from refilling the same buffer
+    void PublishLocked(TClock::time_point Now);
+
+    std::mutex mMutex;
+    std::condition_variable mUpdated;
+    std::unordered_map<uint64_t, TEntry> mEntries;
+    TClock::time_point mLastCleanup;
+    bool mDirty { false };
+    bool mShutdown { false };
+    TClock::time_point mLastPublish;
+    std::array<TSnapshot, 2> mSnapshots;
+    // which of mSnapshots readers read
+    std::atomic<uint32_t> mCurrent { 0 };
+    // readers of each of mSnapshots
+    mutable std::array<std::atomic<uint32_t>, 2> mReaders {};
+    std::thread mThread;
+};
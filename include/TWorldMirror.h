@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class TNetwork;
+class TServer;
+
+/*
+ * The players and vehicles of another process, kept up to date with the messages of its
+ * TWorldPublisher. The players show up in this server's player list, the vehicles in the
+ * world sync of players joining here, and the broadcasts go out to the players here.
+ */
+class TWorldMirror final {
+public:
+    struct TVehicle {
+        int PlayerID;
+        int VehicleID;
+        // the spawn packet
+        std::string Data;
+    };
+
+    TWorldMirror(TServer& Server, TNetwork& Network);
+    TWorldMirror(const TWorldMirror&) = delete;
+    TWorldMirror& operator=(const TWorldMirror&) = delete;
+
+    void Apply(std::string_view Message);
+    // the mirrored vehicles in the room
+    [[nodiscard]] std::vector<TVehicle> Vehicles(const std::string& Room) const;
+    // removes the players Fn returns true for, and tells the players here in their room
+    // what the players' own server would have told them. Their name is followed by Reason.
+    void RemovePlayers(const std::function<bool(int PlayerID)>& Fn, const std::string& Reason);
+
+private:
+    struct TPlayer {
+        std::string Name;
+        std::string Room;
+    };
+    struct TMirroredVehicle {
+        std::string Room;
+        std::string Data;
+    };
+
+    TServer& mServer;
+    TNetwork& mNetwork;
+    mutable std::mutex mMutex;
+    std::unordered_map<int, TPlayer> mPlayers;
+    // ordered, so a player's vehicles are next to each other
+    std::map<std::pair<int, int>, TMirroredVehicle> mVehicles;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "IWorldObserver.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class TServer;
+
+/*
+ * Turns what happens in the world into messages for a TWorldMirror in another process.
+ * A message is fields separated by '\n', the last field is the rest of the message:
+ *  - P, player ID, room, name:              the player is in game, or moved rooms
+ *  - L, player ID:                          the player left, with all their vehicles
+ *  - V, player ID, vehicle ID, room, spawn: the vehicle was spawned or edited
+ *  - R, player ID, vehicle ID:              the vehicle was deleted
+ *  - S, reliable, sender ID, room scoped, room, packet: a broadcast (only with Broadcasts)
+ * The sender ID of a broadcast of the server itself is -1, and it's not room scoped.
+ */
+class TWorldPublisher final : public IWorldObserver {
+public:
+    using TSink = std::function<void(const std::string& Message)>;
+
+    // Sink gets every message, from the thread the change happened on
+    TWorldPublisher(TServer& Server, bool Broadcasts, TSink Sink);
+
+    // the messages which get a new mirror to where the world is right now
+    [[nodiscard]] std::vector<std::string> Snapshot();
+
+    void OnPlayerUpdated(const TClient& Client) override;
+    void OnPlayerRemoved(int PlayerID) override;
+    void OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) override;
+    void OnVehicleRemoved(int PlayerID, int VehicleID) override;
+    void OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) override;
+
+private:
+    [[nodiscard]] std::string PlayerMessage(const TClient& Client) const;
+    [[nodiscard]] std::string VehicleMessage(const TClient& Client, int VehicleID, const std::string& Data) const;
+
+    TServer& mServer;
+    bool mBroadcasts;
+    TSink mSink;
+};
@@ -1,23 +1,50 @@
 #include "Client.h"
 
 #include "CustomAssert.h"
+#include "TServer.h"
+#include "TStateBuffer.h"
+#include <cstring>
 #include <memory>
 
 // FIXME: add debug prints
 
+uint32_t TClient::ParseCapabilities(std::string_view List) {
+    uint32_t Capabilities = 0;
+    while (!List.empty()) {
+        auto Name = List.substr(0, List.find(','));
+        List.remove_prefix(std::min(List.size(), Name.size() + 1));
+        if (Name == "resume") {
+            Capabilities |= CapResume;
+        } else if (Name == "wideid") {
+            Capabilities |= CapWideID;
+        } else if (Name == "udpseq") {
+            Capabilities |= CapUDPSequence;
+        } else if (Name == "bundle") {
+            Capabilities |= CapBundle;
+        } else if (Name == "rudp") {
+            Capabilities |= CapReliableUDP;
+        }
+    }
+    return Capabilities;
+}
+
 void TClient::DeleteCar(int Ident) {
+    mServer.VehicleTransforms().Remove(GetID(), Ident);
     std::unique_lock lock(mVehicleDataMutex);
     auto iter = std::find_if(mVehicleData.begin(), mVehicleData.end(), [&](auto& elem) {
         return Ident == elem.ID();
     });
     if (iter != mVehicleData.end()) {
         mVehicleData.erase(iter);
+        lock.unlock();
+        mServer.NotifyVehicleRemoved(GetID(), Ident);
     } else {
         debug("tried to erase a vehicle that doesn't exist (not an error)");
     }
 }
 
 void TClient::ClearCars() {
+    mServer.VehicleTransforms().RemovePlayer(GetID());
     std::unique_lock lock(mVehicleDataMutex);
     mVehicleData.clear();
 }
@@ -38,8 +65,11 @@ int TClient::GetOpenCarID() const {
 }
 
 void TClient::AddNewCar(int Ident, const std::string& Data) {
-    std::unique_lock lock(mVehicleDataMutex);
-    mVehicleData.emplace_back(Ident, Data);
+    {
+        std::unique_lock lock(mVehicleDataMutex);
+        mVehicleData.emplace_back(Ident, Data);
+    }
+    mServer.NotifyVehicleUpdated(*this, Ident, Data);
 }
 
 TClient::TVehicleDataLockPair TClient::GetAllCars() {
@@ -65,6 +95,8 @@ void TClient::SetCarData(int Ident, const std::string& Data) {
         for (auto& v : mVehicleData) {
             if (v.ID() == Ident) {
                 v.SetData(Data);
+                lock.unlock();
+                mServer.NotifyVehicleUpdated(*this, Ident, Data);
                 return;
             }
         }
@@ -76,13 +108,85 @@ int TClient::GetCarCount() const {
     return int(mVehicleData.size());
 }
 
+void TClient::SetName(const std::string& Name) {
+    mName = Name;
+    mServer.InvalidatePlayerList();
+}
+
 TServer& TClient::Server() const {
     return mServer;
 }
 
 void TClient::EnqueuePacket(const std::string& Packet) {
+    // a compressed packet may be a vehicle packet, too
+    bool IsCompressed = Packet.compare(0, 4, "ABG:") == 0;
+    bool MaybeVehiclePacket = !Packet.empty() && (Packet.front() == 'O' || IsCompressed);
+    char Code = Packet.empty() || IsCompressed ? 0 : Packet.front();
+    EnqueuePacket(TQueuedPacket { Packet, Code, MaybeVehiclePacket }, PacketSchema::PriorityOf(Packet));
+}
+
+void TClient::EnqueuePacket(std::string Packet, PacketSchema::TPriority Priority, char Code) {
+    EnqueuePacket(TQueuedPacket { std::move(Packet), Code, Code == 'O' }, Priority);
+}
+
+void TClient::EnqueuePacket(TQueuedPacket Packet, PacketSchema::TPriority Priority) {
     std::unique_lock Lock(mMissedPacketsMutex);
-    mPacketsSync.push(Packet);
+    if (Packet.IsVehiclePacket) {
+        // a delete must not overtake the spawn or edit it belongs to, so it goes into the
+        // lowest priority queue which still holds a vehicle packet, if that's lower than its own
+        for (size_t i = PacketSchema::PriorityCount; i-- > size_t(Priority) + 1;) {
+            if (mVehiclePackets[i] > 0) {
+                Priority = PacketSchema::TPriority(i);
+                break;
+            }
+        }
+        ++mVehiclePackets[size_t(Priority)];
+    }
+    mPacketQueues[size_t(Priority)].push_back(std::move(Packet));
+    ++mQueuedPackets;
+}
+
+std::optional<TClient::TQueuedPacket> TClient::DequeuePacket(size_t MaxSize) {
+    std::unique_lock Lock(mMissedPacketsMutex);
+    if (mQueuedPackets == 0) {
+        return std::nullopt;
+    }
+    // deficit round robin: a class sends while its deficit covers the next packet, then it's
+    // the next class's turn, which gets its quantum added. packets bigger than a quantum
+    // go out once the class saved up enough turns. the turns are taken on a copy, which
+    // is only kept if a packet comes out.
+    auto Current = mCurrentQueue;
+    auto Deficits = mDeficits;
+    while (true) {
+        auto& Queue = mPacketQueues[Current];
+        auto& Deficit = Deficits[Current];
+        if (!Queue.empty() && Queue.front().Data.size() <= Deficit) {
+            if (Queue.front().Data.size() > MaxSize) {
+                return std::nullopt;
+            }
+            Deficit -= Queue.front().Data.size();
+            auto Packet = std::move(Queue.front());
+            Queue.pop_front();
+            --mQueuedPackets;
+            if (Packet.IsVehiclePacket) {
+                --mVehiclePackets[Current];
+            }
+            if (Queue.empty()) {
+                // an idle class doesn't save up turns
+                Deficit = 0;
+            }
+            mCurrentQueue = Current;
+            mDeficits = Deficits;
+            return Packet;
+        }
+        if (Queue.empty()) {
+            Deficit = 0;
+        }
+        Current = (Current + 1) % PacketSchema::PriorityCount;
+        if (!mPacketQueues[Current].empty()) {
+            Deficits[Current] += PriorityQuantum[Current];
+        }
+    }
 }
 
 TClient::TClient(TServer& Server)
@@ -99,3 +203,94 @@ int TClient::SecondsSinceLastPing() {
                        .count();
     return int(seconds);
 }
+
+void TClient::Save(TStateWriter& Writer) {
+    Writer.Int(mID);
+    Writer.String(mName);
+    Writer.String(mRole);
+    Writer.Bool(mIsGuest);
+    Writer.Int(int64_t(mIdentifiers.size()));
+    for (const auto& Identifier : mIdentifiers) {
+        Writer.String(Identifier);
+    }
+    Writer.Int(mCapabilities);
+    Writer.String(mRoom);
+    Writer.Bool(mIsMapSent);
+    Writer.Bool(mIsSynced);
+    Writer.Bool(mIsConnected);
+    Writer.Int(mStatus);
+    Writer.Int(mUnicycleID);
+    Writer.String(std::string_view(reinterpret_cast<const char*>(&mUDPAddress), sizeof(mUDPAddress)));
+    { // Vehicle Data Lock Scope
+        std::unique_lock Lock(mVehicleDataMutex);
+        Writer.Int(int64_t(mVehicleData.size()));
+        for (auto& v : mVehicleData) {
+            Writer.Int(v.ID());
+            Writer.String(v.Data());
+        }
+    } // End Vehicle Data Lock Scope
+    { // locked context
+        std::unique_lock Lock(mMissedPacketsMutex);
+        for (size_t i = 0; i < PacketSchema::PriorityCount; ++i) {
+            Writer.Int(int64_t(mDeficits[i]));
+            Writer.Int(int64_t(mPacketQueues[i].size()));
+            for (const auto& Packet : mPacketQueues[i]) {
+                Writer.String(Packet.Data);
+                Writer.Int(Packet.Code);
+                Writer.Bool(Packet.IsVehiclePacket);
+            }
+        }
+        Writer.Int(int64_t(mCurrentQueue));
+    } // end locked context
+    mReliable.Save(Writer);
+}
+
+void TClient::Restore(TStateReader& Reader) {
+    mID = int(Reader.Int());
+    mName = Reader.String();
+    mRole = Reader.String();
+    mIsGuest = Reader.Bool();
+    for (auto Count = Reader.Int(); Count > 0; --Count) {
+        mIdentifiers.insert(Reader.String());
+    }
+    mCapabilities = uint32_t(Reader.Int());
+    mRoom = Reader.String();
+    mIsMapSent = Reader.Bool();
+    mIsSynced = Reader.Bool();
+    mIsConnected = Reader.Bool();
+    mStatus = int(Reader.Int());
+    mUnicycleID = int(Reader.Int());
+    auto Address = Reader.String();
+    if (Address.size() == sizeof(mUDPAddress)) {
+        std::memcpy(&mUDPAddress, Address.data(), sizeof(mUDPAddress));
+    }
+    { // Vehicle Data Lock Scope
+        std::unique_lock Lock(mVehicleDataMutex);
+        mVehicleData.clear();
+        for (auto Count = Reader.Int(); Count > 0; --Count) {
+            int ID = int(Reader.Int());
+            mVehicleData.emplace_back(ID, Reader.String());
+        }
+    } // End Vehicle Data Lock Scope
+    { // locked context
+        std::unique_lock Lock(mMissedPacketsMutex);
+        mQueuedPackets = 0;
+        for (size_t i = 0; i < PacketSchema::PriorityCount; ++i) {
+            mDeficits[i] = size_t(Reader.Int());
+            mPacketQueues[i].clear();
+            mVehiclePackets[i] = 0;
+            for (auto Count = Reader.Int(); Count > 0; --Count) {
+                TQueuedPacket Packet;
+                Packet.Data = Reader.String();
+                Packet.Code = char(Reader.Int());
+                Packet.IsVehiclePacket = Reader.Bool();
+                mVehiclePackets[i] += Packet.IsVehiclePacket ? 1 : 0;
+                mPacketQueues[i].push_back(std::move(Packet));
+                ++mQueuedPackets;
+            }
+        }
+        mCurrentQueue = size_t(Reader.Int()) % PacketSchema::PriorityCount;
+    } // end locked context
+    mReliable.Restore(Reader);
+    UpdatePingTime();
+}
@@ -46,6 +46,43 @@ void Application::GracefullyShutdown() {
     }
 }
 
+void Application::SetUpgradeHandler(const TUpgradeHandler& Handler) {
+    std::unique_lock Lock(mUpgradeHandlerMutex);
+    mUpgradeHandler = Handler;
+}
+
+void Application::HotUpgrade() {
+    std::unique_lock Lock(mUpgradeHandlerMutex);
+    if (!mUpgradeHandler) {
+        warn("hot upgrades aren't available here, restart the server instead");
+        return;
+    }
+    std::thread(mUpgradeHandler).detach();
+}
+
+std::string Application::PPS() {
+    std::unique_lock Lock(mStateMutex);
+    return mPPS;
+}
+
+void Application::SetPPS(const std::string& NewPPS) {
+    std::unique_lock Lock(mStateMutex);
+    mPPS = NewPPS;
+}
+
+void Application::NotifyStateChanged() {
+    {
+        std::unique_lock Lock(mStateMutex);
+        ++mStateVersion;
+    }
+    mStateChanged.notify_all();
+}
+
+bool Application::WaitForStateChange(uint64_t Seen, std::chrono::steady_clock::time_point Deadline) {
+    std::unique_lock Lock(mStateMutex);
+    return mStateChanged.wait_until(Lock, Deadline, [&] { return mStateVersion != Seen; });
+}
+
 std::array<int, 3> Application::VersionStrToInts(const std::string& str) {
     std::array<int, 3> Version;
     std::stringstream ss(str);
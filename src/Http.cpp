@@ -7,7 +7,13 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace beast = boost::beast; // from <boost/beast.hpp>
 namespace http = beast::http; // from <boost/beast/http.hpp>
@@ -15,77 +21,339 @@ namespace net = boost::asio; // from <boost/asio.hpp>
 namespace ssl = net::ssl; // from <boost/asio/ssl.hpp>
 using tcp = net::ip::tcp; // from <boost/asio/ip/tcp.hpp>
 
-std::string Http::GET(const std::string& host, int port, const std::string& target, unsigned int* status) {
-    try {
-        // Check command line arguments.
-        int version = 11;
-
-        // The io_context is required for all I/O
-        net::io_context ioc;
-
-        // The SSL context is required, and holds certificates
-        ssl::context ctx(ssl::context::tlsv12_client);
+/*
+ * All backend requests (heartbeat, auth, update checks) go through one shared client,
+ * which keeps connections alive between requests instead of doing DNS + TCP + TLS for
+ * every single one of them:
+ *
+ * - idle keep-alive connections are pooled per host:port and reused
+ * - the TLS session of the last handshake with a host is kept, so new connections
+ *   to the same host can resume it instead of doing a full handshake
+ * - resolved addresses are cached for a while
+ *
+ * A connection is checked out exclusively for the duration of one request, so
+ * concurrent requests to the same host simply open more connections. Each connection
+ * has its own io_context, which only runs while the request is in flight. All socket
+ * operations are asynchronous, because the stream's timeout only applies to those.
+ * Resolving runs on a thread of the client's own, a lookup which hangs is given up on
+ * after the same timeout, or once the request is cancelled, and left to finish there.
+ */
+namespace {
+
+using TStream = beast::ssl_stream<beast::tcp_stream>;
+
+constexpr auto kTimeout = std::chrono::seconds(5);
+// servers usually close idle keep-alive connections after some time, don't bother with older ones
+constexpr auto kIdleTimeout = std::chrono::seconds(30);
+constexpr auto kDnsTtl = std::chrono::minutes(5);
+constexpr size_t kMaxIdlePerHost = 4;
+
+struct TSessionDeleter {
+    void operator()(SSL_SESSION* Session) const { SSL_SESSION_free(Session); }
+};
+using TSession = std::unique_ptr<SSL_SESSION, TSessionDeleter>;
+
+struct TConnection {
+    // plain http without a Ctx
+    explicit TConnection(ssl::context* Ctx) {
+        if (Ctx) {
+            Tls = std::make_unique<TStream>(Io, *Ctx);
+        } else {
+            Plain = std::make_unique<beast::tcp_stream>(Io);
+        }
+    }
+    beast::tcp_stream& Socket() { return Tls ? beast::get_lowest_layer(*Tls) : *Plain; }
+    // calls Fn with whichever stream this connection has
+    template <typename FnT>
+    void WithStream(FnT&& Fn) {
+        if (Tls) {
+            Fn(*Tls);
+        } else {
+            Fn(*Plain);
+        }
+    }
+    net::io_context Io;
+    // one of them is set
+    std::unique_ptr<TStream> Tls;
+    std::unique_ptr<beast::tcp_stream> Plain;
+    beast::flat_buffer Buffer;
+    std::chrono::steady_clock::time_point LastUsed;
+};
 
-        // This holds the root certificate used for verification
-        // we don't do / have this
-        // load_root_certificates(ctx);
+class THttpClient final {
+public:
+    THttpClient()
+        : mCtx(ssl::context::tls_client)
+        , mWork(net::make_work_guard(mIo)) {
+        // we don't have / check root certificates
+        mCtx.set_verify_mode(ssl::verify_none);
+        SSL_CTX_set_session_cache_mode(mCtx.native_handle(), SSL_SESS_CACHE_CLIENT);
+        mResolverThread = std::thread([this] { mIo.run(); });
+    }
+    ~THttpClient() {
+        mWork.reset();
+        mIo.stop();
+        mResolverThread.join();
+    }
 
-        // Verify the remote server's certificate
-        ctx.set_verify_mode(ssl::verify_none);
+    template <typename RequestT>
+    http::response<http::string_body> Request(const std::string& Host, int Port, RequestT& Req, Http::TCancellation* Cancel = nullptr, bool Tls = true) {
+        // plain and tls connections to the same place mustn't be mixed up
+        const auto Key = (Tls ? "https://" : "http://") + Host + ":" + std::to_string(Port);
+        Req.keep_alive(true);
+        bool Written = false;
+        if (auto Conn = Acquire(Key)) {
+            // the server may have closed the connection while it was idle, which we only
+            // notice once we use it. retry those on a fresh connection once, but only if
+            // none of the request went out, a POST mustn't arrive twice.
+            try {
+                return Send(Key, std::move(Conn), Req, Written, Cancel);
+            } catch (const std::exception&) {
+                if (Written || (Cancel && Cancel->IsCancelled())) {
+                    throw;
+                }
+            }
+        }
+        return Send(Key, Connect(Host, Port, Key, Tls, Cancel), Req, Written, Cancel);
+    }
 
-        // These objects perform our I/O
-        tcp::resolver resolver(ioc);
-        beast::ssl_stream<beast::tcp_stream> stream(ioc, ctx);
+    void Reset() {
+        std::unique_lock Lock(mMutex);
+        mIdle.clear();
+        mSessions.clear();
+        mDns.clear();
+    }
 
-        // Set SNI Hostname (many hosts need this to handshake successfully)
-        if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str())) {
-            beast::error_code ec { static_cast<int>(::ERR_get_error()), net::error::get_ssl_category() };
+private:
+    // runs the operation which was just started on Conn until it's done, timed out or
+    // cancelled, throws if it failed
+    static void Run(TConnection& Conn, const beast::error_code& ec, Http::TCancellation* Cancel) {
+        bool Cancelled = false;
+        if (Cancel) {
+            // posted, the stream may only be touched from the thread which runs Io
+            Cancelled = !Cancel->Attach([&Conn] {
+                net::post(Conn.Io, [&Conn] { Conn.Socket().close(); });
+            });
+        }
+        if (!Cancelled) {
+            Conn.Io.restart();
+            Conn.Io.run();
+        }
+        if (Cancel && Cancel->Detach()) {
+            // the close may still be queued, the connection is no good anymore
+            throw beast::system_error { net::error::operation_aborted };
+        }
+        if (ec) {
             throw beast::system_error { ec };
         }
+    }
+
+    // Written is set once any of the request went out
+    template <typename RequestT>
+    http::response<http::string_body> Send(const std::string& Key, std::unique_ptr<TConnection> Conn, RequestT& Req, bool& Written, Http::TCancellation* Cancel) {
+        beast::error_code ec;
+        Conn->Socket().expires_after(kTimeout);
+        Conn->WithStream([&](auto& Stream) {
+            http::async_write(Stream, Req, [&](beast::error_code Error, size_t Bytes) {
+                ec = Error;
+                Written = Bytes > 0;
+            });
+        });
+        Run(*Conn, ec, Cancel);
+        http::response<http::string_body> Res;
+        Conn->Socket().expires_after(kTimeout);
+        Conn->WithStream([&](auto& Stream) {
+            http::async_read(Stream, Conn->Buffer, Res, [&](beast::error_code Error, size_t) { ec = Error; });
+        });
+        Run(*Conn, ec, Cancel);
+        // with TLS 1.3 the session ticket arrives after the handshake, so grab it now
+        if (SSL_SESSION* Session = Conn->Tls ? SSL_get1_session(Conn->Tls->native_handle()) : nullptr) {
+            std::unique_lock Lock(mMutex);
+            mSessions[Key] = TSession(Session);
+        }
+        if (Res.keep_alive()) {
+            Release(Key, std::move(Conn));
+        } else if (Conn->Tls) {
+            Conn->Socket().expires_after(kTimeout);
+            Conn->Tls->async_shutdown([](beast::error_code) {
+                // IGNORING ec
+            });
+            Conn->Io.restart();
+            Conn->Io.run();
+        } else {
+            beast::error_code Ignored;
+            Conn->Socket().socket().shutdown(tcp::socket::shutdown_both, Ignored);
+        }
+        return Res;
+    }
 
-        // Look up the domain name
-        auto const results = resolver.resolve(host.c_str(), std::to_string(port));
+    std::unique_ptr<TConnection> Acquire(const std::string& Key) {
+        std::unique_lock Lock(mMutex);
+        auto Iter = mIdle.find(Key);
+        if (Iter == mIdle.end()) {
+            return nullptr;
+        }
+        auto& Idle = Iter->second;
+        const auto Now = std::chrono::steady_clock::now();
+        while (!Idle.empty()) {
+            auto Conn = std::move(Idle.back());
+            Idle.pop_back();
+            if (Now - Conn->LastUsed < kIdleTimeout && IsOpen(*Conn)) {
+                return Conn;
+            }
+        }
+        return nullptr;
+    }
 
-        // Make the connection on the IP address we get from a lookup
-        beast::get_lowest_layer(stream).connect(results);
+    // an idle connection has nothing to read, unless the server closed it meanwhile
+    static bool IsOpen(TConnection& Conn) {
+        auto& Socket = Conn.Socket().socket();
+        beast::error_code ec;
+        char Byte;
+        Socket.non_blocking(true, ec);
+        Socket.receive(net::buffer(&Byte, 1), tcp::socket::message_peek, ec);
+        bool Open = ec == net::error::would_block;
+        Socket.non_blocking(false, ec);
+        return Open;
+    }
 
-        // Perform the SSL handshake
-        stream.handshake(ssl::stream_base::client);
+    void Release(const std::string& Key, std::unique_ptr<TConnection> Conn) {
+        Conn->LastUsed = std::chrono::steady_clock::now();
+        Conn->Socket().expires_never();
+        std::unique_lock Lock(mMutex);
+        auto& Idle = mIdle[Key];
+        if (Idle.size() < kMaxIdlePerHost) {
+            Idle.push_back(std::move(Conn));
+        }
+    }
 
-        // Set up an HTTP GET request message
-        http::request<http::string_body> req { http::verb::get, target, version };
-        req.set(http::field::host, host);
+    // shared with the resolver's handler, which may finish long after nobody waits anymore
+    struct TLookup {
+        std::mutex Mutex;
+        std::condition_variable Condition;
+        bool Finished { false };
+        bool Cancelled { false };
+        beast::error_code Error;
+        tcp::resolver::results_type Results;
+    };
+
+    tcp::resolver::results_type Resolve(const std::string& Host, int Port, const std::string& Key, Http::TCancellation* Cancel) {
+        {
+            std::unique_lock Lock(mMutex);
+            auto Iter = mDns.find(Key);
+            if (Iter != mDns.end() && std::chrono::steady_clock::now() < Iter->second.Expiry) {
+                return Iter->second.Results;
+            }
+        }
+        auto Lookup = std::make_shared<TLookup>();
+        auto Resolver = std::make_shared<tcp::resolver>(mIo);
+        // IPv6 has caused trouble with the backend before, so stick to IPv4
+        Resolver->async_resolve(tcp::v4(), Host, std::to_string(Port), [Lookup, Resolver](beast::error_code Error, tcp::resolver::results_type Results) {
+            std::unique_lock Lock(Lookup->Mutex);
+            Lookup->Error = Error;
+            Lookup->Results = std::move(Results);
+            Lookup->Finished = true;
+            Lookup->Condition.notify_all();
+        });
+        bool Cancelled = Cancel && !Cancel->Attach([Lookup] {
+            std::unique_lock Lock(Lookup->Mutex);
+            Lookup->Cancelled = true;
+            Lookup->Condition.notify_all();
+        });
+        bool Finished = false;
+        if (!Cancelled) {
+            std::unique_lock Lock(Lookup->Mutex);
+            Lookup->Condition.wait_for(Lock, kTimeout, [&] { return Lookup->Finished || Lookup->Cancelled; });
+            Finished = Lookup->Finished;
+        }
+        if (Cancel && Cancel->Detach()) {
+            Cancelled = true;
+        }
+        if (!Finished) {
+            // the lookup itself can't be interrupted, its result is just dropped
+            net::post(mIo, [Resolver] { Resolver->cancel(); });
+            throw beast::system_error { Cancelled ? net::error::operation_aborted : net::error::timed_out };
+        }
+        if (Lookup->Error) {
+            throw beast::system_error { Lookup->Error };
+        }
+        std::unique_lock Lock(mMutex);
+        mDns[Key] = { Lookup->Results, std::chrono::steady_clock::now() + kDnsTtl };
+        return Lookup->Results;
+    }
 
-        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    std::unique_ptr<TConnection> Connect(const std::string& Host, int Port, const std::string& Key, bool Tls, Http::TCancellation* Cancel) {
+        auto Results = Resolve(Host, Port, Key, Cancel);
+        auto Conn = std::make_unique<TConnection>(Tls ? &mCtx : nullptr);
+        if (Tls) {
+            auto* Ssl = Conn->Tls->native_handle();
+            // Set SNI Hostname (many hosts need this to handshake successfully)
+            if (!SSL_set_tlsext_host_name(Ssl, Host.c_str())) {
+                beast::error_code ec { static_cast<int>(::ERR_get_error()), net::error::get_ssl_category() };
+                throw beast::system_error { ec };
+            }
+            std::unique_lock Lock(mMutex);
+            auto Iter = mSessions.find(Key);
+            if (Iter != mSessions.end()) {
+                SSL_set_session(Ssl, Iter->second.get());
+            }
+        }
+        auto& Socket = Conn->Socket();
+        beast::error_code ec;
+        Socket.expires_after(kTimeout);
+        Socket.async_connect(Results, [&](beast::error_code Error, const tcp::endpoint&) { ec = Error; });
+        try {
+            Run(*Conn, ec, Cancel);
+        } catch (const std::exception&) {
+            // the cached address might be stale
+            std::unique_lock Lock(mMutex);
+            mDns.erase(Key);
+            throw;
+        }
+        if (Tls) {
+            Socket.expires_after(kTimeout);
+            Conn->Tls->async_handshake(ssl::stream_base::client, [&](beast::error_code Error) { ec = Error; });
+            Run(*Conn, ec, Cancel);
+        }
+        return Conn;
+    }
 
-        // Send the HTTP request to the remote host
-        http::write(stream, req);
+    struct TDnsEntry {
+        tcp::resolver::results_type Results;
+        std::chrono::steady_clock::time_point Expiry;
+    };
+
+    // for the resolver, run by mResolverThread
+    net::io_context mIo;
+    ssl::context mCtx;
+    net::executor_work_guard<net::io_context::executor_type> mWork;
+    std::thread mResolverThread;
+    std::mutex mMutex;
+    std::unordered_map<std::string, TDnsEntry> mDns;
+    std::unordered_map<std::string, TSession> mSessions;
+    // declared last, connections have to go before the contexts they use
+    std::unordered_map<std::string, std::vector<std::unique_ptr<TConnection>>> mIdle;
+};
 
-        // This buffer is used for reading and must be persisted
-        beast::flat_buffer buffer;
+THttpClient& Client() {
+    static THttpClient Instance;
+    return Instance;
+}
 
-        // Declare a container to hold the response
-        http::response<http::string_body> res;
+}
 
-        // Receive the HTTP response
-        http::read(stream, buffer, res);
+std::string Http::GET(const std::string& host, int port, const std::string& target, unsigned int* status) {
+    try {
+        // Set up an HTTP GET request message
+        http::request<http::string_body> req { http::verb::get, target, 11 /* http 1.1 */ };
+        req.set(http::field::host, host);
+        req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
 
-        // Gracefully close the stream
-        beast::error_code ec;
-        stream.shutdown(ec);
-        if (ec == net::error::eof) {
-            // Rationale:
-            // http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-            ec = {};
-        }
+        auto res = Client().Request(host, port, req);
 
         if (status) {
             *status = res.base().result_int();
         }
-
-        // ignore ec
-
-        // If we get here then the connection is closed gracefully
         return std::string(res.body());
     } catch (std::exception const& e) {
         Application::Console().Write(__func__ + std::string(": ") + e.what());
@@ -93,45 +361,43 @@ std::string Http::GET(const std::string& host, int port, const std::string& targ
     }
 }
 
-std::string Http::POST(const std::string& host, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status) {
-    try {
-        net::io_context io;
+void Http::TCancellation::Cancel() {
+    std::unique_lock Lock(mMutex);
+    if (mCancelled) {
+        return;
+    }
+    mCancelled = true;
+    if (mAbort) {
+        mAbort();
+    }
+}
+
+bool Http::TCancellation::IsCancelled() const {
+    std::unique_lock Lock(mMutex);
+    return mCancelled;
+}
 
-        // The SSL context is required, and holds certificates
-        ssl::context ctx(ssl::context::tlsv13);
+bool Http::TCancellation::Attach(std::function<void()> Abort) {
+    std::unique_lock Lock(mMutex);
+    if (mCancelled) {
+        return false;
+    }
+    mAbort = std::move(Abort);
+    return true;
+}
 
-        ctx.set_verify_mode(ssl::verify_none);
+bool Http::TCancellation::Detach() {
+    std::unique_lock Lock(mMutex);
+    mAbort = nullptr;
+    return mCancelled;
+}
 
-        tcp::resolver resolver(io);
-        beast::ssl_stream<beast::tcp_stream> stream(io, ctx);
-        decltype(resolver)::results_type results;
-        auto try_connect_with_protocol = [&](tcp protocol) {
-            try {
-                results = resolver.resolve(protocol, host, std::to_string(443));
-                if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str())) {
-                    boost::system::error_code ec { static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category() };
-                    // FIXME: we could throw and crash, if we like
-                    // throw boost::system::system_error { ec };
-                    //debug("POST " + host + target + " failed.");
-                    return false;
-                }
-                beast::get_lowest_layer(stream).connect(results);
-            } catch (const boost::system::system_error&) {
-                return false;
-            }
-            return true;
-        };
-        //bool ok = try_connect_with_protocol(tcp::v6());
-        //if (!ok) {
-        //debug("IPv6 connect failed, trying IPv4");
-        bool ok = try_connect_with_protocol(tcp::v4());
-        if (!ok) {
-            Application::Console().Write("[ERROR] failed to resolve or connect in POST " + host + target);
-            Sentry.AddErrorBreadcrumb("failed to resolve or connect to " + host + target, __FILE__, std::to_string(__LINE__)); // FIXME: this is ugly.
-            return "-1";
-        }
-        //}
-        stream.handshake(ssl::stream_base::client);
+std::string Http::POST(const std::string& host, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status, TCancellation* cancel) {
+    return POST(host, 443, target, fields, body, json, status, cancel);
+}
+
+std::string Http::POST(const std::string& host, int port, const std::string& target, const std::unordered_map<std::string, std::string>& fields, const std::string& body, bool json, int* status, TCancellation* cancel, bool tls) {
+    try {
         http::request<http::string_body> req { http::verb::post, target, 11 /* http 1.1 */ };
 
         req.set(http::field::host, host);
@@ -143,11 +409,8 @@ std::string Http::POST(const std::string& host, const std::string& target, const
             }
             req.set(http::field::content_length, std::to_string(body.size()));
             req.body() = body;
-            // info("body is " + body + " (" + req.body() + ")");
-            // info("content size is " + std::to_string(body.size()) + " (" + boost::lexical_cast<std::string>(body.size()) + ")");
         }
         for (const auto& pair : fields) {
-            // info("setting " + pair.first + " to " + pair.second);
             req.set(pair.first, pair.second);
         }
 
@@ -161,18 +424,7 @@ std::string Http::POST(const std::string& host, const std::string& target, const
         }
         Sentry.SetContext("https-post-request-data", request_data);
 
-        std::stringstream oss;
-        oss << req;
-
-        beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(5));
-
-        http::write(stream, req);
-
-        // used for reading
-        beast::flat_buffer buffer;
-        http::response<http::string_body> response;
-
-        http::read(stream, buffer, response);
+        auto response = Client().Request(host, port, req, cancel, tls);
 
         std::unordered_map<std::string, std::string> response_data;
         response_data["reponse-code"] = std::to_string(response.result_int());
@@ -188,26 +440,23 @@ std::string Http::POST(const std::string& host, const std::string& target, const
         }
         Sentry.SetContext("https-post-response-data", response_data);
 
-        std::stringstream result;
-        result << response;
-
-        beast::error_code ec;
-        stream.shutdown(ec);
-        // IGNORING ec
-
-        // info(result.str());
-        std::string debug_response_str;
-        std::getline(result, debug_response_str);
-        //debug("POST " + host + target + ": " + debug_response_str);
         return std::string(response.body());
 
     } catch (const std::exception& e) {
-        Application::Console().Write(e.what());
+        if (cancel && cancel->IsCancelled()) {
+            // whoever cancelled it doesn't need it anymore
+            return "-1";
+        }
+        Application::Console().Write("[ERROR] POST " + host + target + " failed: " + e.what());
         Sentry.AddErrorBreadcrumb(e.what(), __FILE__, std::to_string(__LINE__)); // FIXME: this is ugly.
         return "-1";
     }
 }
 
+void Http::ResetConnectionPool() {
+    Client().Reset();
+}
+
 // RFC 2616, RFC 7231
 static std::map<size_t, const char*> Map = {
     { -1, "Invalid Response Code"},
@@ -0,0 +1,117 @@
+#include "Process.h"
+
+#include <charconv>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif // __linux__
+
+namespace {
+
+bool ReadInt(std::string_view Text, int& Out) {
+    auto [End, Error] = std::from_chars(Text.data(), Text.data() + Text.size(), Out);
+    return Error == std::errc() && End == Text.data() + Text.size();
+}
+
+}
+
+std::optional<int> Process::ReadVariable(const char* Name) {
+    int Value;
+    if (const char* Text = std::getenv(Name); Text && ReadInt(Text, Value) && Value >= 0) {
+        return Value;
+    }
+    return std::nullopt;
+}
+
+#ifdef __linux__
+
+std::vector<std::string> Process::Environment(std::initializer_list<std::string_view> Without) {
+    std::vector<std::string> Env;
+    for (char** Var = environ; *Var; ++Var) {
+        std::string_view Entry(*Var);
+        bool Keep = true;
+        for (auto Name : Without) {
+            if (Entry.size() > Name.size() && Entry.substr(0, Name.size()) == Name && Entry[Name.size()] == '=') {
+                Keep = false;
+            }
+        }
+        if (Keep) {
+            Env.emplace_back(Entry);
+        }
+    }
+    return Env;
+}
+
+std::vector<std::string> Process::CommandLine() {
+    std::ifstream File("/proc/self/cmdline", std::ios::binary);
+    std::string Content((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+    std::vector<std::string> Args;
+    for (size_t Start = 0; Start < Content.size();) {
+        auto End = Content.find('\0', Start);
+        if (End == std::string::npos) {
+            End = Content.size();
+        }
+        Args.push_back(Content.substr(Start, End - Start));
+        Start = End + 1;
+    }
+    return Args;
+}
+
+std::vector<char*> Process::Pointers(std::vector<std::string>& Strings) {
+    std::vector<char*> Result;
+    for (auto& String : Strings) {
+        Result.push_back(String.data());
+    }
+    Result.push_back(nullptr);
+    return Result;
+}
+
+std::vector<int> Process::OpenFds() {
+    std::vector<int> Fds;
+    if (DIR* Dir = opendir("/proc/self/fd")) {
+        while (dirent* Entry = readdir(Dir)) {
+            if (int Fd; ReadInt(Entry->d_name, Fd) && Fd != dirfd(Dir)) {
+                Fds.push_back(Fd);
+            }
+        }
+        closedir(Dir);
+    }
+    return Fds;
+}
+
+void Process::CloseOnExec(const std::vector<int>& Listed, std::initializer_list<int> Kept) {
+    bool Done = false;
+#ifdef SYS_close_range
+    // CLOSE_RANGE_CLOEXEC, linux 5.11 and newer, the headers may be older
+    constexpr unsigned CloseRangeCloexec = 1u << 2;
+    Done = syscall(SYS_close_range, unsigned(STDERR_FILENO + 1), ~0u, CloseRangeCloexec) == 0;
+#endif // SYS_close_range
+    if (!Done) {
+        for (int Fd : Listed) {
+            if (Fd > STDERR_FILENO) {
+                fcntl(Fd, F_SETFD, FD_CLOEXEC);
+            }
+        }
+    }
+    for (int Fd : Kept) {
+        fcntl(Fd, F_SETFD, 0);
+    }
+}
+
+#else
+
+std::vector<std::string> Process::Environment(std::initializer_list<std::string_view>) { return {}; }
+std::vector<std::string> Process::CommandLine() { return {}; }
+std::vector<char*> Process::Pointers(std::vector<std::string>&) { return {}; }
+std::vector<int> Process::OpenFds() { return {}; }
+void Process::CloseOnExec(const std::vector<int>&, std::initializer_list<int>) { }
+
+#endif // __linux__
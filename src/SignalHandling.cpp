@@ -2,7 +2,30 @@
 #include "Common.h"
 
 #ifdef __unix
+#include <cerrno>
 #include <csignal>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+// the handler may only write to this, an upgrade is started from UpgradeSignalMain
+static int UpgradePipe[2] = { -1, -1 };
+
+static void UpgradeSignalMain() {
+    RegisterThread("UpgradeSignal");
+    char Byte;
+    while (true) {
+        auto Read = read(UpgradePipe[0], &Byte, 1);
+        if (Read < 0 && errno == EINTR) {
+            continue;
+        } else if (Read <= 0) {
+            break;
+        }
+        info("upgrading via SIGUSR2");
+        Application::HotUpgrade();
+    }
+}
+
 static void UnixSignalHandler(int sig) {
     switch (sig) {
     case SIGPIPE:
@@ -16,6 +39,13 @@ static void UnixSignalHandler(int sig) {
         info("gracefully shutting down via SIGINT");
         Application::GracefullyShutdown();
         break;
+    case SIGUSR2: {
+        int SavedErrno = errno;
+        char Byte = 'U';
+        (void)write(UpgradePipe[1], &Byte, 1);
+        errno = SavedErrno;
+        break;
+    }
     default:
         debug("unhandled signal: " + std::to_string(sig));
         break;
@@ -49,9 +79,17 @@ BOOL WINAPI Win32CtrlC_Handler(DWORD CtrlType) {
 void SetupSignalHandlers() {
     // signal handlers for unix#include <windows.h>
 #ifdef __unix
-    trace("registering handlers for SIGINT, SIGTERM, SIGPIPE");
+    trace("registering handlers for SIGINT, SIGTERM, SIGPIPE, SIGUSR2");
     signal(SIGPIPE, UnixSignalHandler);
     signal(SIGTERM, UnixSignalHandler);
+    if (pipe(UpgradePipe) == 0) {
+        fcntl(UpgradePipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(UpgradePipe[1], F_SETFD, FD_CLOEXEC);
+        std::thread(UpgradeSignalMain).detach();
+        signal(SIGUSR2, UnixSignalHandler);
+    } else {
+        warn("can't create a pipe for SIGUSR2, upgrade via the console instead");
+    }
 #ifndef DEBUG
     signal(SIGINT, UnixSignalHandler);
 #endif // DEBUG
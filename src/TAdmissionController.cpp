@@ -0,0 +1,122 @@
+#include "TAdmissionController.h"
+
+#include "Client.h"
+#include "TServer.h"
+
+#include <algorithm>
+
+TAdmissionController::TTicket::TTicket(TAdmissionController& Controller, TPhase Phase)
+    : mController(&Controller)
+    , mPhase(Phase) {
+}
+
+TAdmissionController::TTicket::TTicket(TTicket&& Other) noexcept
+    : mController(Other.mController)
+    , mPhase(Other.mPhase) {
+    Other.mController = nullptr;
+}
+
+TAdmissionController::TTicket::~TTicket() {
+    if (mController) {
+        mController->Leave(mPhase);
+    }
+}
+
+TAdmissionController::TAdmissionController(TServer& Server)
+    : mServer(Server) {
+    Application::RegisterShutdownHandler([&] {
+        {
+            std::unique_lock Lock(mMutex);
+            mShutdown = true;
+        }
+        mCondition.notify_all();
+    });
+}
+
+TAdmissionController::TTicket TAdmissionController::Enter(TPhase Phase, TClient& Client, const TPositionFn& OnPosition) {
+    std::unique_lock Lock(mMutex);
+    auto& State = mPhases[size_t(Phase)];
+    auto Ticket = mNextTicket++;
+    State.Queue.push_back(Ticket);
+    size_t LastPosition = 0;
+    while (true) {
+        if (mShutdown || Client.GetStatus() < 0) {
+            State.Queue.erase(std::find(State.Queue.begin(), State.Queue.end(), Ticket));
+            // whoever was behind us moved up
+            mCondition.notify_all();
+            return {};
+        }
+        if (State.Queue.front() == Ticket && State.Active < State.Capacity) {
+            State.Queue.pop_front();
+            ++State.Active;
+            // there may be room for the next one, too
+            mCondition.notify_all();
+            return TTicket(*this, Phase);
+        }
+        size_t Position = size_t(std::find(State.Queue.begin(), State.Queue.end(), Ticket) - State.Queue.begin()) + 1;
+        if (Position != LastPosition) {
+            LastPosition = Position;
+            Lock.unlock();
+            OnPosition(Position);
+            Lock.lock();
+            continue;
+        }
+        // wake up now and then even without a change, to notice disconnects and adapt
+        mCondition.wait_for(Lock, AdaptInterval);
+        AdaptIfDue(Lock);
+    }
+}
+
+void TAdmissionController::Leave(TPhase Phase) {
+    {
+        std::unique_lock Lock(mMutex);
+        --mPhases[size_t(Phase)].Active;
+    }
+    mCondition.notify_all();
+}
+
+void TAdmissionController::AdaptIfDue(std::unique_lock<std::mutex>& Lock) {
+    auto Now = std::chrono::steady_clock::now();
+    if (Now - mLastAdapt < AdaptInterval) {
+        return;
+    }
+    mLastAdapt = Now;
+    Lock.unlock();
+    auto CurrentBacklog = Backlog();
+    Lock.lock();
+    bool Grew = false;
+    for (auto& State : mPhases) {
+        auto Old = State.Capacity;
+        if (CurrentBacklog > HighBacklog) {
+            State.Capacity = std::max(MinCapacity, State.Capacity / 2);
+        } else if (CurrentBacklog < LowBacklog && !State.Queue.empty() && State.Active >= State.Capacity) {
+            // only grow while someone is actually waiting for more room
+            State.Capacity = std::min(MaxCapacity, State.Capacity + 1);
+            Grew = true;
+        }
+        if (State.Capacity != Old) {
+            debug("admission capacity " + std::to_string(Old) + " -> " + std::to_string(State.Capacity) + " (send backlog: " + std::to_string(CurrentBacklog) + " packets)");
+        }
+    }
+    if (Grew) {
+        mCondition.notify_all();
+    }
+}
+
+size_t TAdmissionController::Backlog() {
+    size_t Total = 0;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        std::shared_ptr<TClient> Client;
+        {
+            ReadLock Lock(mServer.GetClientMutex());
+            if (!ClientPtr.expired()) {
+                Client = ClientPtr.lock();
+            } else
+                return true;
+        }
+        std::unique_lock QueueLock(Client->MissedPacketQueueMutex());
+        Total += Client->MissedPacketQueueSize();
+        return true;
+    });
+    return Total;
+}
@@ -0,0 +1,166 @@
+#include "TAuthCache.h"
+
+#include "Common.h"
+
+#include <openssl/evp.h>
+
+#include <fstream>
+#include <sstream>
+
+#undef GetObject //Fixes Windows
+
+#include "Json.h"
+
+static const char* AuthCacheFileName = static_cast<const char*>("AuthCache.json");
+
+TAuthCache::TAuthCache() {
+    if (Enabled() && Application::Settings.AuthCachePersist) {
+        Load();
+        Application::RegisterShutdownHandler([&] { Save(); });
+    }
+}
+
+bool TAuthCache::Enabled() {
+    return Application::Settings.AuthCacheTTL > 0 && Application::Settings.AuthCacheSize > 0;
+}
+
+std::string TAuthCache::Hash(const std::string& Key) {
+    unsigned char Digest[EVP_MAX_MD_SIZE];
+    unsigned int Length = 0;
+    EVP_Digest(Key.data(), Key.size(), Digest, &Length, EVP_sha256(), nullptr);
+    static constexpr char Hex[] = "0123456789abcdef";
+    std::string Result;
+    Result.reserve(Length * 2);
+    for (unsigned int i = 0; i < Length; ++i) {
+        Result += Hex[Digest[i] >> 4];
+        Result += Hex[Digest[i] & 0xf];
+    }
+    return Result;
+}
+
+std::optional<TAuthResult> TAuthCache::Get(const std::string& Key) {
+    if (!Enabled()) {
+        return std::nullopt;
+    }
+    auto KeyHash = Hash(Key);
+    std::unique_lock Lock(mMutex);
+    auto Iter = mEntries.find(KeyHash);
+    if (Iter == mEntries.end()) {
+        return std::nullopt;
+    }
+    if (TClock::now() >= Iter->second.Expiry) {
+        mRecentlyUsed.erase(Iter->second.Position);
+        mEntries.erase(Iter);
+        return std::nullopt;
+    }
+    mRecentlyUsed.splice(mRecentlyUsed.begin(), mRecentlyUsed, Iter->second.Position);
+    return Iter->second.Result;
+}
+
+void TAuthCache::Put(const std::string& Key, const TAuthResult& Result) {
+    if (!Enabled()) {
+        return;
+    }
+    auto KeyHash = Hash(Key);
+    std::unique_lock Lock(mMutex);
+    Insert(KeyHash, Result, TClock::now() + std::chrono::seconds(Application::Settings.AuthCacheTTL));
+}
+
+void TAuthCache::Insert(const std::string& KeyHash, const TAuthResult& Result, TClock::time_point Expiry) {
+    auto Iter = mEntries.find(KeyHash);
+    if (Iter != mEntries.end()) {
+        mRecentlyUsed.erase(Iter->second.Position);
+        mEntries.erase(Iter);
+    }
+    mRecentlyUsed.push_front(KeyHash);
+    mEntries.emplace(KeyHash, TEntry { Result, Expiry, mRecentlyUsed.begin() });
+    while (mEntries.size() > size_t(Application::Settings.AuthCacheSize)) {
+        mEntries.erase(mRecentlyUsed.back());
+        mRecentlyUsed.pop_back();
+    }
+}
+
+void TAuthCache::Load() {
+    std::ifstream File(AuthCacheFileName);
+    if (!File.good()) {
+        return;
+    }
+    std::stringstream Contents;
+    Contents << File.rdbuf();
+    rapidjson::Document Doc;
+    Doc.Parse(Contents.str().c_str());
+    if (Doc.HasParseError() || !Doc.IsArray()) {
+        warn("Ignoring invalid " + std::string(AuthCacheFileName));
+        return;
+    }
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    // the file is written most recently used first
+    for (rapidjson::SizeType i = Doc.Size(); i-- > 0;) {
+        const auto& Entry = Doc[i];
+        if (!Entry.IsObject() || !Entry.HasMember("hash") || !Entry["hash"].IsString()
+            || !Entry.HasMember("expires") || !Entry["expires"].IsInt64()
+            || !Entry.HasMember("username") || !Entry["username"].IsString()
+            || !Entry.HasMember("roles") || !Entry["roles"].IsString()
+            || !Entry.HasMember("guest") || !Entry["guest"].IsBool()
+            || !Entry.HasMember("identifiers") || !Entry["identifiers"].IsArray()) {
+            continue;
+        }
+        auto Expiry = TClock::from_time_t(std::time_t(Entry["expires"].GetInt64()));
+        if (Expiry <= Now) {
+            continue;
+        }
+        TAuthResult Result;
+        Result.Name = Entry["username"].GetString();
+        Result.Roles = Entry["roles"].GetString();
+        Result.IsGuest = Entry["guest"].GetBool();
+        for (const auto& ID : Entry["identifiers"].GetArray()) {
+            if (ID.IsString()) {
+                Result.Identifiers.insert(ID.GetString());
+            }
+        }
+        Insert(Entry["hash"].GetString(), Result, Expiry);
+    }
+    debug("Loaded " + std::to_string(mEntries.size()) + " cached auth results");
+}
+
+void TAuthCache::Save() {
+    rapidjson::StringBuffer Buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> Writer(Buffer);
+    auto Now = TClock::now();
+    { // locked context
+        std::unique_lock Lock(mMutex);
+        Writer.StartArray();
+        for (const auto& KeyHash : mRecentlyUsed) {
+            const auto& Entry = mEntries.at(KeyHash);
+            if (Entry.Expiry <= Now) {
+                continue;
+            }
+            Writer.StartObject();
+            Writer.Key("hash");
+            Writer.String(KeyHash.c_str());
+            Writer.Key("expires");
+            Writer.Int64(int64_t(TClock::to_time_t(Entry.Expiry)));
+            Writer.Key("username");
+            Writer.String(Entry.Result.Name.c_str());
+            Writer.Key("roles");
+            Writer.String(Entry.Result.Roles.c_str());
+            Writer.Key("guest");
+            Writer.Bool(Entry.Result.IsGuest);
+            Writer.Key("identifiers");
+            Writer.StartArray();
+            for (const auto& ID : Entry.Result.Identifiers) {
+                Writer.String(ID.c_str());
+            }
+            Writer.EndArray();
+            Writer.EndObject();
+        }
+        Writer.EndArray();
+    } // end locked context
+    std::ofstream File(AuthCacheFileName, std::ios::out | std::ios::trunc);
+    if (!File.good()) {
+        error("Couldn't write " + std::string(AuthCacheFileName) + ". Check permissions.");
+        return;
+    }
+    File << Buffer.GetString();
+}
@@ -0,0 +1,525 @@
+#include "TAuthPipeline.h"
+
+#include "Client.h"
+#include "TLuaFile.h"
+#include "TNetwork.h"
+#include "TPacketSchema.h"
+#include "TServer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __unix
+#include <fcntl.h>
+#include <poll.h>
+#endif // __unix
+
+namespace {
+
+void SetNonBlocking(SOCKET Sock, bool NonBlocking) {
+#ifdef WIN32
+    u_long Mode = NonBlocking ? 1 : 0;
+    ioctlsocket(Sock, FIONBIO, &Mode);
+#else // unix
+    int Flags = fcntl(Sock, F_GETFL, 0);
+    fcntl(Sock, F_SETFL, NonBlocking ? (Flags | O_NONBLOCK) : (Flags & ~O_NONBLOCK));
+#endif // WIN32
+}
+
+// takes as long for a wrong secret as for the right one, whatever it has in common with it
+bool IsSameSecret(std::string_view Sent, std::string_view Secret) {
+    unsigned char Difference = Sent.size() == Secret.size() ? 0 : 1;
+    for (size_t i = 0; i < Sent.size(); ++i) {
+        Difference |= (unsigned char)(Sent[i] ^ (Secret.empty() ? 0 : Secret[i % Secret.size()]));
+    }
+    return Difference == 0;
+}
+
+bool WouldBlock() {
+#ifdef WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else // unix
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif // WIN32
+}
+
+int PollSockets(std::vector<pollfd>& Fds, std::chrono::milliseconds Timeout) {
+#ifdef WIN32
+    return WSAPoll(Fds.data(), ULONG(Fds.size()), int(Timeout.count()));
+#else // unix
+    return poll(Fds.data(), nfds_t(Fds.size()), int(Timeout.count()));
+#endif // WIN32
+}
+
+}
+
+TAuthPipeline::TAuthPipeline(TNetwork& Network, TServer& Server)
+    : mNetwork(Network)
+    , mServer(Server)
+    , mAuthProvider(CreateAuthProvider()) {
+    Application::RegisterShutdownHandler([&] {
+        {
+            std::unique_lock Lock(mIncomingMutex);
+            std::unique_lock JobsLock(mJobsMutex);
+            mShutdown = true;
+        }
+        mIncomingCondition.notify_all();
+        mJobsCondition.notify_all();
+        if (mLoopThread.joinable()) {
+            mLoopThread.join();
+        }
+        for (auto& Worker : mWorkers) {
+            if (Worker.joinable()) {
+                Worker.join();
+            }
+        }
+        for (auto& Handshake : mIncoming) {
+            Drop(Handshake);
+        }
+        for (auto& Handshake : mJobs) {
+            Drop(Handshake);
+        }
+    });
+    mLoopThread = std::thread(&TAuthPipeline::LoopMain, this);
+    for (size_t i = 0; i < WorkerCount; ++i) {
+        mWorkers.emplace_back(&TAuthPipeline::WorkerMain, this);
+    }
+}
+
+TAuthPipeline::THandshake::THandshake(TAuthPipeline& Owner, SOCKET Sock, uint32_t Address)
+    : Owner(Owner)
+    , Sock(Sock)
+    , Address(Address) {
+}
+
+TAuthPipeline::THandshake::~THandshake() {
+    std::unique_lock Lock(Owner.mPendingMutex);
+    --Owner.mPendingTotal;
+    auto Iter = Owner.mPendingPerAddress.find(Address);
+    if (Iter != Owner.mPendingPerAddress.end() && --Iter->second == 0) {
+        Owner.mPendingPerAddress.erase(Iter);
+    }
+}
+
+void TAuthPipeline::Submit(SOCKET Sock, const sockaddr_in& Address) {
+    auto IP = uint32_t(Address.sin_addr.s_addr);
+    { // locked context
+        std::unique_lock Lock(mPendingMutex);
+        auto& PerAddress = mPendingPerAddress[IP];
+        auto Limit = size_t(Application::Settings.MaxPendingHandshakesPerIP);
+        if (mPendingTotal >= MaxPendingHandshakes || (Limit > 0 && PerAddress >= Limit)) {
+            if (PerAddress == 0) {
+                mPendingPerAddress.erase(IP);
+            }
+            Lock.unlock();
+            debug("too many pending handshakes, refusing connection from " + std::string(inet_ntoa(Address.sin_addr)));
+            CloseSocketProper(Sock);
+            return;
+        }
+        ++PerAddress;
+        ++mPendingTotal;
+    } // end locked context
+#ifndef __linux__
+    // accept4() already does this on linux
+    SetNonBlocking(Sock, true);
+#endif // __linux__
+    auto Handshake = std::make_unique<THandshake>(*this, Sock, IP);
+    EnterStage(*Handshake, TStage::Code);
+    {
+        std::unique_lock Lock(mIncomingMutex);
+        mIncoming.push_back(std::move(Handshake));
+    }
+    mIncomingCondition.notify_one();
+}
+
+std::chrono::seconds TAuthPipeline::StageTimeout(TStage Stage) {
+    switch (Stage) {
+    case TStage::Code:
+    case TStage::DownloadID:
+        return std::chrono::seconds(5);
+    case TStage::RelayKey:
+    case TStage::Version:
+    case TStage::Key:
+        return std::chrono::seconds(10);
+    case TStage::Lookup:
+    case TStage::Verdict:
+        return std::chrono::seconds(15);
+    }
+    return std::chrono::seconds(10);
+}
+
+void TAuthPipeline::EnterStage(THandshake& Handshake, TStage Stage) {
+    Handshake.Stage = Stage;
+    Handshake.Deadline = std::chrono::steady_clock::now() + StageTimeout(Stage);
+    Handshake.Buffer.clear();
+}
+
+bool TAuthPipeline::IsExpired(const THandshake& Handshake) {
+    return std::chrono::steady_clock::now() > Handshake.Deadline;
+}
+
+void TAuthPipeline::LoopMain() {
+    RegisterThread("AuthPipeline");
+    std::vector<THandshakePtr> Pending;
+    std::vector<pollfd> Fds;
+    while (true) {
+        { // locked context
+            std::unique_lock Lock(mIncomingMutex);
+            if (Pending.empty()) {
+                mIncomingCondition.wait(Lock, [&] { return mShutdown || !mIncoming.empty(); });
+            }
+            if (mShutdown) {
+                break;
+            }
+            for (auto& Handshake : mIncoming) {
+                Pending.push_back(std::move(Handshake));
+            }
+            mIncoming.clear();
+        } // end locked context
+
+        Fds.clear();
+        for (const auto& Handshake : Pending) {
+            Fds.push_back(pollfd { Handshake->Sock, POLLIN, 0 });
+        }
+        if (PollSockets(Fds, PollInterval) < 0) {
+            debug("poll() failed in auth pipeline: " + std::string(std::strerror(errno)));
+            continue;
+        }
+        { // gate scope
+            // a resume takes over a parked client, which a hot upgrade may be saving
+            auto Pass = mNetwork.Gate().Enter();
+            for (size_t i = 0; i < Pending.size(); ++i) {
+                if (Fds[i].revents != 0) {
+                    OnReadable(Pending[i]);
+                } else if (IsExpired(*Pending[i])) {
+                    OnExpired(Pending[i]);
+                }
+            }
+        } // end gate scope
+        // handshakes which left the loop (finished, dropped or handed to a worker) are null now
+        Pending.erase(std::remove(Pending.begin(), Pending.end(), nullptr), Pending.end());
+    }
+    for (auto& Handshake : Pending) {
+        Drop(Handshake);
+    }
+}
+
+void TAuthPipeline::WorkerMain() {
+    RegisterThread("AuthWorker");
+    while (true) {
+        THandshakePtr Handshake;
+        { // locked context
+            std::unique_lock Lock(mJobsMutex);
+            mJobsCondition.wait(Lock, [&] { return mShutdown || !mJobs.empty(); });
+            if (mShutdown) {
+                break;
+            }
+            Handshake = std::move(mJobs.front());
+            mJobs.pop_front();
+        } // end locked context
+        Authenticate(*Handshake);
+    }
+}
+
+bool TAuthPipeline::Receive(THandshake& Handshake, size_t Want) {
+    auto Have = Handshake.Buffer.size();
+    if (Have >= Want) {
+        return true;
+    }
+    Handshake.Buffer.resize(Want);
+    auto Got = recv(Handshake.Sock, &Handshake.Buffer[Have], int(Want - Have), 0);
+    if (Got <= 0) {
+        Handshake.Buffer.resize(Have);
+        // spurious wakeup, nothing there yet
+        return Got < 0 && WouldBlock();
+    }
+    Handshake.Buffer.resize(Have + size_t(Got));
+    return true;
+}
+
+bool TAuthPipeline::ReceivePacket(THandshake& Handshake, std::optional<std::string>& Packet) {
+    // only ever read as much as belongs to this packet, the rest is for the next stage
+    int32_t Header = 0;
+    if (!Receive(Handshake, sizeof(Header))) {
+        return false;
+    }
+    if (Handshake.Buffer.size() < sizeof(Header)) {
+        return true;
+    }
+    std::memcpy(&Header, Handshake.Buffer.data(), sizeof(Header));
+    if (Header < 0 || Header > MaxHandshakePacketSize) {
+        return false;
+    }
+    if (!Receive(Handshake, sizeof(Header) + size_t(Header))) {
+        return false;
+    }
+    if (Handshake.Buffer.size() < sizeof(Header) + size_t(Header)) {
+        return true;
+    }
+    std::string Data = Handshake.Buffer.substr(sizeof(Header));
+    if (Data.compare(0, 4, "ABG:") == 0) {
+        Data = DeComp(Data.substr(4));
+    }
+    Packet = std::move(Data);
+    return true;
+}
+
+void TAuthPipeline::OnReadable(THandshakePtr& Slot) {
+    auto& Handshake = *Slot;
+    switch (Handshake.Stage) {
+    case TStage::Code: {
+        if (!Receive(Handshake, 1)) {
+            return Drop(Slot);
+        }
+        if (Handshake.Buffer.empty()) {
+            return;
+        }
+        char Code = Handshake.Buffer[0];
+        if (Code == 'C') {
+            info("Identifying new client...");
+            Handshake.Client = mNetwork.CreateClient(Handshake.Sock);
+            EnterStage(Handshake, TStage::Version);
+        } else if (Code == 'D') {
+            EnterStage(Handshake, TStage::DownloadID);
+        } else if (Code == 'R' && !Application::Settings.RelaySecret.empty()) {
+            EnterStage(Handshake, TStage::RelayKey);
+        } else {
+            Drop(Slot);
+        }
+        return;
+    }
+    case TStage::DownloadID: {
+        if (!Receive(Handshake, 1)) {
+            return Drop(Slot);
+        }
+        if (Handshake.Buffer.empty()) {
+            return;
+        }
+        // either the ID in a single byte, or the marker followed by the ID in two bytes
+        bool Wide = uint8_t(Handshake.Buffer[0]) == TClient::WideIDMarker;
+        if (Wide && !Receive(Handshake, 3)) {
+            return Drop(Slot);
+        }
+        if (Wide && Handshake.Buffer.size() < 3) {
+            return;
+        }
+        SetNonBlocking(Handshake.Sock, false);
+        mNetwork.HandleDownload(Handshake.Sock, Wide ? TClient::ReadWideID(&Handshake.Buffer[1]) : uint8_t(Handshake.Buffer[0]));
+        Slot.reset();
+        return;
+    }
+    case TStage::RelayKey: {
+        std::optional<std::string> Packet;
+        if (!ReceivePacket(Handshake, Packet)) {
+            return Drop(Slot);
+        }
+        if (!Packet) {
+            return;
+        }
+        if (!IsSameSecret(*Packet, Application::Settings.RelaySecret)) {
+            warn("A relay sent the wrong secret, turning it away");
+            return Drop(Slot);
+        }
+        SetNonBlocking(Handshake.Sock, false);
+        if (!mNetwork.AddRelaySubscriber(Handshake.Sock)) {
+            return Drop(Slot);
+        }
+        Slot.reset();
+        return;
+    }
+    case TStage::Version: {
+        std::optional<std::string> Packet;
+        if (!ReceivePacket(Handshake, Packet)) {
+            return Kick(Slot, "Invalid version header!");
+        }
+        if (!Packet) {
+            return;
+        }
+        if (Packet->size() > 3 && Packet->substr(0, 2) == "VC") {
+            auto Version = Packet->substr(2);
+            // newer clients list what they support after the version
+            if (auto Separator = Version.find(';'); Separator != std::string::npos) {
+                Handshake.Client->SetCapabilities(TClient::ParseCapabilities(std::string_view(Version).substr(Separator + 1)));
+                Version.resize(Separator);
+            }
+            if (Version.length() > 4 || Version != Application::ClientVersion()) {
+                return Kick(Slot, "Outdated Version!");
+            }
+        } else {
+            return Kick(Slot, "Invalid version header!");
+        }
+        if (!mNetwork.TCPSend(*Handshake.Client, "S")) {
+            return Drop(Slot);
+        }
+        EnterStage(Handshake, TStage::Key);
+        return;
+    }
+    case TStage::Key: {
+        std::optional<std::string> Packet;
+        if (!ReceivePacket(Handshake, Packet)) {
+            return Kick(Slot, "Invalid Key!");
+        }
+        if (!Packet) {
+            return;
+        }
+        if (Packet->size() > 50) {
+            return Kick(Slot, "Invalid Key!");
+        }
+        if (auto Request = PacketSchema::Parse<PacketSchema::TResumeRequest>(*Packet)) {
+            return Resume(Slot, std::string(std::get<0>(*Request)));
+        }
+        Handshake.Key = std::move(*Packet);
+        EnterStage(Handshake, TStage::Lookup);
+        {
+            std::unique_lock Lock(mJobsMutex);
+            mJobs.push_back(std::move(Slot));
+        }
+        mJobsCondition.notify_one();
+        return;
+    }
+    case TStage::Lookup:
+    case TStage::Verdict:
+        // not polled anymore
+        return;
+    }
+}
+
+void TAuthPipeline::Resume(THandshakePtr& Slot, const std::string& Token) {
+    auto& Handshake = *Slot;
+    auto Client = mNetwork.TakeParkedClient(Token);
+    if (!Client) {
+        debug("no session to resume, the client has to join as usual");
+        if (!mNetwork.TCPSend(*Handshake.Client, PacketSchema::Serialize<PacketSchema::TResumeRejected>())) {
+            return Drop(Slot);
+        }
+        // the key comes next
+        EnterStage(Handshake, TStage::Key);
+        return;
+    }
+    SetNonBlocking(Handshake.Sock, false);
+    mNetwork.ResumeClient(Client, Handshake.Sock);
+    Slot.reset();
+}
+
+void TAuthPipeline::OnExpired(THandshakePtr& Slot) {
+    debug("handshake timed out");
+    if (Slot->Client) {
+        Kick(Slot, "Handshake timed out!");
+    } else {
+        Drop(Slot);
+    }
+}
+
+void TAuthPipeline::Kick(THandshakePtr& Slot, const std::string& Reason) {
+    mNetwork.ClientKick(*Slot->Client, Reason);
+    Slot.reset();
+}
+
+void TAuthPipeline::Drop(THandshakePtr& Slot) {
+    CloseSocketProper(Slot->Sock);
+    Slot.reset();
+}
+
+void TAuthPipeline::Authenticate(THandshake& Handshake) {
+    auto Client = Handshake.Client;
+    // may have been waiting in the queue for a while
+    if (IsExpired(Handshake)) {
+        mNetwork.ClientKick(*Client, "Authentication timed out!");
+        return;
+    }
+    auto Result = LookupKey(Handshake);
+    if (!Result) {
+        return;
+    }
+    if (IsExpired(Handshake)) {
+        mNetwork.ClientKick(*Client, "Authentication timed out!");
+        return;
+    }
+    Client->SetName(Result->Name);
+    Client->SetRoles(Result->Roles);
+    Client->SetIsGuest(Result->IsGuest);
+    for (const auto& ID : Result->Identifiers) {
+        Client->AddIdentifier(ID);
+    }
+
+    debug("Name -> " + Client->GetName() + ", Guest -> " + std::to_string(Client->IsGuest()) + ", Roles -> " + Client->GetRoles());
+    // the lookup and the verdict take a while, only what changes other clients holds a pass
+    auto Pass = mNetwork.Gate().Enter();
+    std::shared_ptr<TClient> Previous;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        std::shared_ptr<TClient> Cl;
+        {
+            ReadLock Lock(mServer.GetClientMutex());
+            if (!ClientPtr.expired()) {
+                Cl = ClientPtr.lock();
+            } else
+                return true;
+        }
+        if (Cl->GetName() == Client->GetName() && Cl->IsGuest() == Client->IsGuest()) {
+            CloseSocketProper(Cl->GetTCPSock());
+            Cl->SetStatus(-2);
+            Previous = Cl;
+            return false;
+        }
+
+        return true;
+    });
+    // a connected client goes away on its own now, a parked one has nobody to do that
+    if (Previous) {
+        mNetwork.EndParkedSession(Previous);
+    }
+    Pass.Reset();
+
+    EnterStage(Handshake, TStage::Verdict);
+    auto arg = std::make_unique<TLuaArg>(TLuaArg { { Client->GetName(), Client->GetRoles(), Client->IsGuest() } });
+    std::any Res = TriggerLuaEvent("onPlayerAuth", false, nullptr, std::move(arg), true);
+    if (Res.type() == typeid(int) && std::any_cast<int>(Res)) {
+        mNetwork.ClientKick(*Client, "you are not allowed on the server!");
+        return;
+    } else if (Res.type() == typeid(std::string)) {
+        mNetwork.ClientKick(*Client, std::any_cast<std::string>(Res));
+        return;
+    }
+    if (IsExpired(Handshake)) {
+        mNetwork.ClientKick(*Client, "Authentication timed out!");
+        return;
+    }
+    Pass = mNetwork.Gate().Enter();
+    Admit(Handshake);
+}
+
+std::optional<TAuthResult> TAuthPipeline::LookupKey(THandshake& Handshake) {
+    auto Cacheable = mAuthProvider->IsRemote() && !Handshake.Key.empty();
+    if (Cacheable) {
+        if (auto Cached = mAuthCache.Get(Handshake.Key); Cached.has_value()) {
+            debug("Using cached auth result for " + Cached->Name);
+            return Cached;
+        }
+    }
+    auto Verdict = mAuthProvider->Authenticate(Handshake.Key);
+    if (auto* KickReason = std::get_if<std::string>(&Verdict)) {
+        mNetwork.ClientKick(*Handshake.Client, *KickReason);
+        return std::nullopt;
+    }
+    auto& Result = std::get<TAuthResult>(Verdict);
+    if (Cacheable) {
+        mAuthCache.Put(Handshake.Key, Result);
+    }
+    return Result;
+}
+
+void TAuthPipeline::Admit(THandshake& Handshake) {
+    auto Client = Handshake.Client;
+    if (mShutdown) {
+        mNetwork.ClientKick(*Client, "Server shutdown");
+        return;
+    }
+    if (mServer.PlayerCount() < size_t(Application::Settings.MaxPlayers)) {
+        info("Identification success");
+        // from here on the connection thread does blocking reads again
+        SetNonBlocking(Handshake.Sock, false);
+        mServer.InsertClient(Client);
+        std::thread([this, Client] { mNetwork.TCPClient(Client); }).detach();
+    } else
+        mNetwork.ClientKick(*Client, "Server full!");
+}
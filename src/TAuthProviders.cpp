@@ -0,0 +1,155 @@
+#include "TAuthProviders.h"
+
+#include "Common.h"
+#include "Http.h"
+#include "TLuaFile.h"
+
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#undef GetObject //Fixes Windows
+
+#include "Json.h"
+
+static constexpr std::string_view ProviderRemote = "remote";
+static constexpr std::string_view ProviderHttp = "http";
+static constexpr std::string_view ProviderAllowlist = "allowlist";
+static constexpr std::string_view ProviderLua = "lua";
+
+std::unique_ptr<IAuthProvider> CreateAuthProvider() {
+    const auto& Name = Application::Settings.AuthProvider;
+    if (Name == ProviderHttp) {
+        info("Authenticating players with " + std::string(Application::Settings.AuthHttpTls ? "https://" : "http://") + Application::Settings.AuthHttpHost + ":" + std::to_string(Application::Settings.AuthHttpPort));
+        return std::make_unique<TRemoteAuthProvider>(Application::Settings.AuthHttpHost, Application::Settings.AuthHttpPort, Application::Settings.AuthHttpTls);
+    } else if (Name == ProviderAllowlist) {
+        info("Authenticating players with the allowlist in \"" + Application::Settings.AuthAllowlist + "\"");
+        return std::make_unique<TAllowlistAuthProvider>(Application::Settings.AuthAllowlist);
+    } else if (Name == ProviderLua) {
+        info("Authenticating players with the onPlayerKey Lua event");
+        return std::make_unique<TLuaAuthProvider>();
+    } else if (Name != ProviderRemote) {
+        warn("Unknown AuthProvider \"" + Name + "\", using \"" + std::string(ProviderRemote) + "\"");
+    }
+    return std::make_unique<TRemoteAuthProvider>(Application::GetBackendUrlForAuth(), 443, true);
+}
+
+TRemoteAuthProvider::TRemoteAuthProvider(std::string Host, int Port, bool Tls)
+    : mHost(std::move(Host))
+    , mPort(Port)
+    , mTls(Tls) {
+}
+
+IAuthProvider::TVerdict TRemoteAuthProvider::Authenticate(const std::string& Key) {
+    auto RequestString = R"({"key":")" + Key + "\"}";
+
+    auto Target = "/pkToUser";
+    int ResponseCode = -1;
+    std::string Rc;
+    if (!Key.empty()) {
+        Rc = Http::POST(mHost, mPort, Target, {}, RequestString, true, &ResponseCode, nullptr, mTls);
+    }
+
+    // the response is only needed until the result is copied out
+    TScratchArena::TScope ArenaScope;
+    TArenaJsonDocument AuthResponse;
+    AuthResponse.Parse(Rc.c_str());
+    if (Rc == "-1" || AuthResponse.HasParseError()) {
+        return "Invalid key! Please restart your game.";
+    }
+
+    if (!AuthResponse.IsObject()) {
+        auto Lock = Sentry.CreateExclusiveContext();
+        Sentry.SetContext("auth",
+            { { "response-body", Rc },
+                { "key", RequestString } });
+        Sentry.SetTransaction(mHost + Target);
+        if (Rc == "0") {
+            Sentry.Log(SentryLevel::Info, "default", "backend returned 0 instead of json (" + std::to_string(ResponseCode) + ")");
+            return "Invalid key! Please restart your game.";
+        } else { // Rc != "0"
+            error("Backend returned invalid auth response format. This should never happen.");
+            Sentry.Log(SentryLevel::Error, "default", "unexpected backend response (" + std::to_string(ResponseCode) + ")");
+            return "Backend returned invalid auth response format.";
+        }
+    }
+
+    if (AuthResponse["username"].IsString() && AuthResponse["roles"].IsString()
+        && AuthResponse["guest"].IsBool() && AuthResponse["identifiers"].IsArray()) {
+        TAuthResult Result;
+        Result.Name = AuthResponse["username"].GetString();
+        Result.Roles = AuthResponse["roles"].GetString();
+        Result.IsGuest = AuthResponse["guest"].GetBool();
+        for (const auto& ID : AuthResponse["identifiers"].GetArray()) {
+            Result.Identifiers.insert(ID.GetString());
+        }
+        return Result;
+    } else {
+        return "Invalid authentication data!";
+    }
+}
+
+TAllowlistAuthProvider::TAllowlistAuthProvider(const std::string& FileName) {
+    if (!fs::exists(FileName)) {
+        std::ofstream File(FileName);
+        File << "# Players allowed on this server, one per line: <key> <name> [roles]\n"
+                "# A line with * as the key lets everyone in, with the name as a prefix:\n"
+                "# * Player\n";
+        warn("No allowlist found, created an empty one in \"" + FileName + "\". Nobody can join until players are added to it.");
+    }
+    Load(FileName);
+}
+
+void TAllowlistAuthProvider::Load(const std::string& FileName) {
+    std::ifstream File(FileName);
+    std::string Line;
+    while (std::getline(File, Line)) {
+        std::stringstream LineStream(Line);
+        std::string Key;
+        TAuthResult Entry;
+        LineStream >> Key >> Entry.Name >> Entry.Roles;
+        if (Key.empty() || Key.at(0) == '#') {
+            continue;
+        }
+        if (Entry.Name.empty()) {
+            warn("Ignoring allowlist entry without a name");
+            continue;
+        }
+        if (Entry.Roles.empty()) {
+            Entry.Roles = "USER";
+        }
+        if (Key == "*") {
+            mWildcard = Entry;
+        } else {
+            mEntries[Key] = Entry;
+        }
+    }
+    debug("Loaded " + std::to_string(mEntries.size()) + " allowlist entries");
+}
+
+IAuthProvider::TVerdict TAllowlistAuthProvider::Authenticate(const std::string& Key) {
+    if (auto Iter = mEntries.find(Key); Iter != mEntries.end()) {
+        return Iter->second;
+    }
+    if (mWildcard) {
+        // names have to be unique, players with the same name kick each other
+        auto Result = *mWildcard;
+        std::stringstream Name;
+        Name << Result.Name << "-" << std::hex << (std::hash<std::string> {}(Key) & 0xffffff);
+        Result.Name = Name.str();
+        return Result;
+    }
+    return "You are not on the allowlist of this server!";
+}
+
+IAuthProvider::TVerdict TLuaAuthProvider::Authenticate(const std::string& Key) {
+    auto Arg = std::make_unique<TLuaArg>(TLuaArg { { Key } });
+    std::any Res = TriggerLuaEvent("onPlayerKey", false, nullptr, std::move(Arg), true);
+    if (Res.type() == typeid(std::string) && !std::any_cast<std::string>(Res).empty()) {
+        TAuthResult Result;
+        Result.Name = std::any_cast<std::string>(Res);
+        Result.Roles = "USER";
+        return Result;
+    }
+    return "You are not allowed on the server!";
+}
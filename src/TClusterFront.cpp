@@ -0,0 +1,436 @@
+#include "TClusterFront.h"
+
+#ifdef __linux__
+#include "Client.h"
+#include "Common.h"
+#include "Process.h"
+#include "TClusterWorker.h"
+#include "TNetwork.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+TClusterFront::TClusterFront(char** Argv) {
+    for (; *Argv; ++Argv) {
+        mArgv.emplace_back(*Argv);
+    }
+    mSocketPath = TClusterWorker::SocketPath();
+    mWorkers.resize(size_t(Application::Settings.ClusterWorkers));
+
+    sockaddr_in Addr {};
+    Addr.sin_addr.s_addr = INADDR_ANY;
+    Addr.sin_family = AF_INET;
+    Addr.sin_port = htons(uint16_t(Application::Settings.Port));
+    // the workers inherit nothing, they get what they need over the cluster socket
+    mTCPSock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+    int optval = 1;
+    setsockopt(mTCPSock, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (bind(mTCPSock, (sockaddr*)&Addr, sizeof(Addr)) != 0 || listen(mTCPSock, SOMAXCONN) != 0) {
+        throw std::runtime_error("Can't bind socket! " + std::string(strerror(errno)));
+    }
+    mUDPSock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (bind(mUDPSock, (sockaddr*)&Addr, sizeof(Addr)) != 0) {
+        throw std::runtime_error("Can't bind socket! " + std::string(strerror(errno)));
+    }
+    // wakes the UDP thread up now and then to see whether it should stop
+    timeval Timeout { 0, 500000 };
+    setsockopt(mUDPSock, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+    mClusterSock = TUnixChannel::Listen(mSocketPath);
+    if (mClusterSock < 0) {
+        throw std::runtime_error("Can't listen on the cluster socket \"" + mSocketPath + "\"");
+    }
+    // only this user's processes may join the cluster
+    chmod(mSocketPath.c_str(), S_IRUSR | S_IWUSR);
+
+    Application::RegisterShutdownHandler([this] { Stop(); });
+
+    mListenThread = std::thread(&TClusterFront::ListenMain, this);
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        SpawnWorker(i);
+    }
+    mReapThread = std::thread(&TClusterFront::ReapMain, this);
+    mTCPThread = std::thread(&TClusterFront::TCPMain, this);
+    mUDPThread = std::thread(&TClusterFront::UDPMain, this);
+    info("Cluster front online on port " + std::to_string(Application::Settings.Port) + " with " + std::to_string(mWorkers.size()) + " workers");
+}
+
+TClusterFront::~TClusterFront() {
+    Stop();
+    close(mTCPSock);
+    close(mUDPSock);
+    close(mClusterSock);
+    unlink(mSocketPath.c_str());
+}
+
+void TClusterFront::Stop() {
+    std::unique_lock StopLock(mStopMutex);
+    if (mShutdown) {
+        return;
+    }
+    mShutdown = true;
+    {
+        std::unique_lock Lock(mWorkersMutex);
+        for (auto& Worker : mWorkers) {
+            if (Worker.Pid > 0) {
+                kill(Worker.Pid, SIGTERM);
+            }
+        }
+    }
+    // waits for the workers to exit
+    if (mReapThread.joinable()) {
+        mReapThread.join();
+    }
+    {
+        std::unique_lock Lock(mWorkersMutex);
+        for (auto& Worker : mWorkers) {
+            if (Worker.Channel) {
+                Worker.Channel->Shutdown();
+            }
+        }
+    }
+    for (auto* Thread : { &mListenThread, &mTCPThread, &mUDPThread }) {
+        if (Thread->joinable()) {
+            Thread->join();
+        }
+    }
+    std::vector<std::thread> WorkerThreads;
+    {
+        // they take the lock themselves once they're done
+        std::unique_lock Lock(mWorkerThreadsMutex);
+        WorkerThreads = std::move(mWorkerThreads);
+    }
+    for (auto& Thread : WorkerThreads) {
+        if (Thread.joinable()) {
+            Thread.join();
+        }
+    }
+}
+
+void TClusterFront::SpawnWorker(size_t Index) {
+    // everything the child needs is prepared here, between fork and exec it
+    // may only do what's safe in a copy of a multithreaded process
+    auto Env = Process::Environment({ TClusterWorker::IndexVariable });
+    Env.push_back(std::string(TClusterWorker::IndexVariable) + "=" + std::to_string(Index));
+    auto EnvPtrs = Process::Pointers(Env);
+    auto ArgvPtrs = Process::Pointers(mArgv);
+    auto Inherited = Process::OpenFds();
+    pid_t Parent = getpid();
+
+    pid_t Pid = fork();
+    if (Pid == 0) {
+        // a worker doesn't outlive the front
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != Parent) {
+            _exit(1);
+        }
+        Process::CloseOnExec(Inherited, {});
+        // the console is the front's
+        int Null = open("/dev/null", O_RDONLY);
+        if (Null >= 0) {
+            dup2(Null, STDIN_FILENO);
+        }
+        execve("/proc/self/exe", ArgvPtrs.data(), EnvPtrs.data());
+        _exit(127);
+    }
+    if (Pid < 0) {
+        error("Can't start cluster worker " + std::to_string(Index) + ": " + std::string(strerror(errno)));
+        return;
+    }
+    std::unique_lock Lock(mWorkersMutex);
+    mWorkers[Index].Pid = Pid;
+    debug("started cluster worker " + std::to_string(Index) + " (pid " + std::to_string(Pid) + ")");
+}
+
+void TClusterFront::ListenMain() {
+    RegisterThread("ClusterListen");
+    while (!mShutdown) {
+        pollfd Fd { mClusterSock, POLLIN, 0 };
+        if (poll(&Fd, 1, 500) <= 0) {
+            continue;
+        }
+        std::shared_ptr<TUnixChannel> Channel = TUnixChannel::Accept(mClusterSock);
+        if (!Channel) {
+            continue;
+        }
+        std::unique_lock Lock(mWorkerThreadsMutex);
+        // the links of workers which went away, they'd pile up with every restart
+        for (auto Id : mFinishedWorkerThreads) {
+            auto Thread = std::find_if(mWorkerThreads.begin(), mWorkerThreads.end(), [&](const std::thread& Thread) { return Thread.get_id() == Id; });
+            if (Thread != mWorkerThreads.end()) {
+                Thread->join();
+                mWorkerThreads.erase(Thread);
+            }
+        }
+        mFinishedWorkerThreads.clear();
+        mWorkerThreads.emplace_back([this, Channel = std::move(Channel)] {
+            WorkerMain(Channel);
+            std::unique_lock Lock(mWorkerThreadsMutex);
+            mFinishedWorkerThreads.push_back(std::this_thread::get_id());
+        });
+    }
+}
+
+void TClusterFront::WorkerMain(std::shared_ptr<TUnixChannel> Channel) {
+    RegisterThread("ClusterWorkerLink");
+    auto Hello = Channel->Receive();
+    size_t Index;
+    {
+        if (!Hello || Hello->Data.size() < 2 || Hello->Data[0] != ClusterMessage::Hello) {
+            return;
+        }
+        for (int Fd : Hello->Fds) {
+            close(Fd);
+        }
+        Index = size_t(std::atoi(Hello->Data.c_str() + 1));
+        std::unique_lock Lock(mWorkersMutex);
+        if (Index >= mWorkers.size() || mWorkers[Index].Channel) {
+            warn("unexpected cluster worker connection (" + Hello->Data.substr(1) + ")");
+            return;
+        }
+        mWorkers[Index].Channel = Channel;
+        mWorkers[Index].Players = 0;
+    }
+    if (!Channel->Send(std::string(1, ClusterMessage::UDPSocket), { mUDPSock })) {
+        error("cluster worker " + std::to_string(Index) + " went away right after connecting");
+    }
+    info("Cluster worker " + std::to_string(Index) + " connected");
+    // a worker which was started again knows nothing about the others' world
+    for (size_t Other = 0; Other < mWorkers.size(); ++Other) {
+        if (Other != Index) {
+            SendToWorker(Other, ClusterMessage::WorkerJoined + std::to_string(Index));
+        }
+    }
+    while (auto Message = Channel->Receive()) {
+        for (int Fd : Message->Fds) {
+            close(Fd);
+        }
+        if (Message->Data.empty()) {
+            continue;
+        }
+        if (Message->Data[0] == ClusterMessage::Bus) {
+            for (size_t Other = 0; Other < mWorkers.size(); ++Other) {
+                if (Other != Index) {
+                    SendToWorker(Other, Message->Data);
+                }
+            }
+        } else if (Message->Data[0] == ClusterMessage::Catchup) {
+            auto End = Message->Data.find('\n');
+            size_t Target = End == std::string::npos ? mWorkers.size() : size_t(std::atoll(Message->Data.substr(1, End - 1).c_str()));
+            if (Target < mWorkers.size() && Target != Index) {
+                SendToWorker(Target, ClusterMessage::Bus + Message->Data.substr(End + 1));
+            }
+        } else if (Message->Data[0] == ClusterMessage::Load) {
+            std::unique_lock Lock(mWorkersMutex);
+            mWorkers[Index].Players = size_t(std::atoll(Message->Data.c_str() + 1));
+        }
+    }
+    {
+        std::unique_lock Lock(mWorkersMutex);
+        if (mWorkers[Index].Channel == Channel) {
+            mWorkers[Index].Channel.reset();
+        }
+    }
+    if (!mShutdown) {
+        warn("Lost cluster worker " + std::to_string(Index));
+        // the others drop its players
+        for (size_t Other = 0; Other < mWorkers.size(); ++Other) {
+            if (Other != Index) {
+                SendToWorker(Other, ClusterMessage::WorkerLost + std::to_string(Index));
+            }
+        }
+    }
+}
+
+void TClusterFront::SendToWorker(size_t Index, const std::string& Message, const std::vector<int>& Fds) {
+    std::shared_ptr<TUnixChannel> Channel;
+    {
+        std::unique_lock Lock(mWorkersMutex);
+        Channel = mWorkers[Index].Channel;
+    }
+    if (Channel && !Channel->Send(Message, Fds)) {
+        debug("failed to send to cluster worker " + std::to_string(Index));
+    }
+}
+
+size_t TClusterFront::LeastLoadedWorker() {
+    std::unique_lock Lock(mWorkersMutex);
+    size_t Best = mWorkers.size();
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        if (mWorkers[i].Channel && (Best == mWorkers.size() || mWorkers[i].Players < mWorkers[Best].Players)) {
+            Best = i;
+        }
+    }
+    if (Best < mWorkers.size()) {
+        // until it reports back, so a burst of players doesn't all go to the same one
+        ++mWorkers[Best].Players;
+    }
+    return Best;
+}
+
+void TClusterFront::TCPMain() {
+    RegisterThread("ClusterTCP");
+    std::vector<TPending> Pending;
+    std::vector<pollfd> Fds;
+    while (!mShutdown) {
+        Fds.clear();
+        Fds.push_back(pollfd { mTCPSock, POLLIN, 0 });
+        for (const auto& Connection : Pending) {
+            Fds.push_back(pollfd { Connection.Sock, POLLIN, 0 });
+        }
+        if (poll(Fds.data(), Fds.size(), 100) < 0 && errno != EINTR) {
+            error("cluster: poll failed: " + std::string(strerror(errno)));
+            continue;
+        }
+        // the ones which sent enough to tell where they go, closed, or timed out
+        auto Now = TClock::now();
+        std::vector<TPending> StillPending;
+        for (size_t i = 0; i < Pending.size(); ++i) {
+            if (Fds[i + 1].revents == 0 && Now < Pending[i].Deadline) {
+                StillPending.push_back(Pending[i]);
+            } else if (Now >= Pending[i].Deadline) {
+                CloseSocketProper(Pending[i].Sock);
+            } else if (!Route(Pending[i])) {
+                StillPending.push_back(Pending[i]);
+            }
+        }
+        Pending = std::move(StillPending);
+        if ((Fds[0].revents & POLLIN) != 0) {
+            TPending Connection {};
+            socklen_t AddrLen = sizeof(Connection.Addr);
+            // non-blocking like TNetwork's, the worker's auth pipeline expects that
+            Connection.Sock = accept4(mTCPSock, (sockaddr*)&Connection.Addr, &AddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (Connection.Sock < 0) {
+                continue;
+            }
+            if (Pending.size() >= MaxPending) {
+                debug("cluster: too many new connections, refusing one");
+                CloseSocketProper(Connection.Sock);
+                continue;
+            }
+            Connection.Deadline = Now + HandshakeTimeout;
+            Pending.push_back(Connection);
+        }
+    }
+    for (const auto& Connection : Pending) {
+        CloseSocketProper(Connection.Sock);
+    }
+}
+
+bool TClusterFront::Route(const TPending& Pending) {
+    // the first bytes stay in the socket, the worker reads them again
+    std::array<char, 4> Peek {};
+    auto Size = recv(Pending.Sock, Peek.data(), Peek.size(), MSG_PEEK | MSG_DONTWAIT);
+    if (Size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return false;
+    }
+    if (Size <= 0) {
+        CloseSocketProper(Pending.Sock);
+        return true;
+    }
+    size_t Worker;
+    if (Peek[0] == 'D') {
+        // a download connection, its player ID follows like in TAuthPipeline
+        bool Wide = Size >= 2 && uint8_t(Peek[1]) == TClient::WideIDMarker;
+        if (Size < 2 || (Wide && Size < 4)) {
+            return false;
+        }
+        int ID = Wide ? TClient::ReadWideID(&Peek[2]) : uint8_t(Peek[1]);
+        Worker = size_t(ID) % mWorkers.size();
+    } else {
+        Worker = LeastLoadedWorker();
+        if (Worker == mWorkers.size()) {
+            debug("cluster: no worker to take a connection");
+            CloseSocketProper(Pending.Sock);
+            return true;
+        }
+    }
+    std::string Message(1, ClusterMessage::Connection);
+    Message.append(reinterpret_cast<const char*>(&Pending.Addr), sizeof(Pending.Addr));
+    SendToWorker(Worker, Message, { Pending.Sock });
+    // the worker has its own copy of the socket now
+    close(Pending.Sock);
+    return true;
+}
+
+void TClusterFront::UDPMain() {
+    RegisterThread("ClusterUDP");
+    std::array<char, 2048> Buffer {};
+    std::string Message;
+    while (!mShutdown) {
+        sockaddr_in Addr {};
+        socklen_t AddrLen = sizeof(Addr);
+        auto Size = recvfrom(mUDPSock, Buffer.data(), Buffer.size(), 0, (sockaddr*)&Addr, &AddrLen);
+        if (Size <= 0) {
+            continue;
+        }
+        std::string_view Data(Buffer.data(), size_t(Size));
+        int ID;
+        size_t Start;
+        std::optional<uint16_t> Sequence;
+        if (!TNetwork::ReadUDPHeader(Data, ID, Start, Sequence) || ID < 0) {
+            continue;
+        }
+        Message.assign(1, ClusterMessage::Datagram);
+        Message.append(reinterpret_cast<const char*>(&Addr), sizeof(Addr));
+        Message.append(Data);
+        SendToWorker(size_t(ID) % mWorkers.size(), Message);
+    }
+}
+
+void TClusterFront::ReapMain() {
+    RegisterThread("ClusterReap");
+    std::optional<TClock::time_point> KillAt;
+    for (;;) {
+        int Status = 0;
+        pid_t Pid = waitpid(-1, &Status, WNOHANG);
+        if (Pid > 0) {
+            std::optional<size_t> Index;
+            {
+                std::unique_lock Lock(mWorkersMutex);
+                for (size_t i = 0; i < mWorkers.size(); ++i) {
+                    if (mWorkers[i].Pid == Pid) {
+                        mWorkers[i].Pid = -1;
+                        Index = i;
+                    }
+                }
+            }
+            if (Index && !mShutdown) {
+                warn("Cluster worker " + std::to_string(*Index) + " exited (status " + std::to_string(Status) + "), starting it again");
+                // don't spin if it can't start at all
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                SpawnWorker(*Index);
+            }
+            continue;
+        }
+        if (mShutdown) {
+            std::unique_lock Lock(mWorkersMutex);
+            bool AllExited = std::all_of(mWorkers.begin(), mWorkers.end(), [](const TWorker& Worker) { return Worker.Pid <= 0; });
+            if (AllExited) {
+                return;
+            }
+            if (!KillAt) {
+                KillAt = TClock::now() + std::chrono::seconds(10);
+            } else if (TClock::now() > *KillAt) {
+                for (auto& Worker : mWorkers) {
+                    if (Worker.Pid > 0) {
+                        warn("Cluster worker with pid " + std::to_string(Worker.Pid) + " doesn't stop, killing it");
+                        kill(Worker.Pid, SIGKILL);
+                    }
+                }
+                KillAt = TClock::now() + std::chrono::seconds(10);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
+#endif // __linux__
@@ -0,0 +1,163 @@
+#include "TClusterWorker.h"
+
+#include "Client.h"
+#include "Common.h"
+#include "Process.h"
+#include "TNetwork.h"
+#include "TServer.h"
+#include "TWorldMirror.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+bool ReadInt(std::string_view Text, int& Out) {
+    auto [End, Error] = std::from_chars(Text.data(), Text.data() + Text.size(), Out);
+    return Error == std::errc() && End == Text.data() + Text.size();
+}
+
+}
+
+std::optional<int> TClusterWorker::Index() {
+#ifdef __linux__
+    return Process::ReadVariable(IndexVariable);
+#else
+    return std::nullopt;
+#endif // __linux__
+}
+
+std::string TClusterWorker::SocketPath() {
+    if (!Application::Settings.ClusterSocket.empty()) {
+        return Application::Settings.ClusterSocket;
+    }
+    return "/tmp/beammp-cluster-" + std::to_string(Application::Settings.Port) + ".sock";
+}
+
+TClusterWorker::TClusterWorker(TServer& Server, TNetwork& Network, TWorldMirror& Mirror, int Index)
+    : mServer(Server)
+    , mNetwork(Network)
+    , mMirror(Mirror)
+    , mIndex(Index)
+    , mWorkers(std::max(Application::Settings.ClusterWorkers, 1))
+    , mPublisher(Server, true, [this](const std::string& Message) { Publish(Message); }) {
+    mChannel = TUnixChannel::Connect(SocketPath());
+    if (!mChannel || !mChannel->Send(ClusterMessage::Hello + std::to_string(mIndex))) {
+        throw std::runtime_error("can't reach the cluster front at \"" + SocketPath() + "\"");
+    }
+    // the front sends the UDP socket right away, everything else only after Start
+    auto Message = mChannel->Receive();
+    if (!Message || Message->Data.empty() || Message->Data[0] != ClusterMessage::UDPSocket || Message->Fds.size() != 1) {
+        throw std::runtime_error("the cluster front didn't send its UDP socket");
+    }
+    mUDPSock = Message->Fds[0];
+    info("Cluster worker " + std::to_string(mIndex) + " of " + std::to_string(mWorkers) + " online");
+    Application::RegisterShutdownHandler([this] {
+        mShutdown = true;
+        mChannel->Shutdown();
+        if (mThread.joinable()) {
+            if (mThread.get_id() == std::this_thread::get_id()) {
+                mThread.detach();
+            } else {
+                mThread.join();
+            }
+        }
+    });
+}
+
+TClusterWorker::~TClusterWorker() {
+    if (mThread.joinable()) {
+        mChannel->Shutdown();
+        mThread.join();
+    }
+}
+
+void TClusterWorker::Start() {
+    mThread = std::thread(&TClusterWorker::ReceiveMain, this);
+}
+
+bool TClusterWorker::OwnsID(int ID) const {
+    return ID >= 0 && ID % mWorkers == mIndex;
+}
+
+void TClusterWorker::OnPlayerUpdated(const TClient& Client) {
+    mPublisher.OnPlayerUpdated(Client);
+    ReportLoad(mServer.ClientCount());
+}
+
+void TClusterWorker::OnPlayerRemoved(int PlayerID) {
+    mPublisher.OnPlayerRemoved(PlayerID);
+    // it's still in the client list while it's being removed
+    auto Players = mServer.ClientCount();
+    ReportLoad(Players > 0 ? Players - 1 : 0);
+}
+
+void TClusterWorker::OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) {
+    mPublisher.OnVehicleUpdated(Client, VehicleID, Data);
+}
+
+void TClusterWorker::OnVehicleRemoved(int PlayerID, int VehicleID) {
+    mPublisher.OnVehicleRemoved(PlayerID, VehicleID);
+}
+
+void TClusterWorker::OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) {
+    mPublisher.OnBroadcast(Sender, Data, Rel);
+}
+
+void TClusterWorker::Publish(const std::string& Message) {
+    if (!mChannel->Send(ClusterMessage::Bus + Message)) {
+        debug("cluster: failed to send to the front");
+    }
+}
+
+void TClusterWorker::CatchUp(int Index) {
+    for (const auto& Message : mPublisher.Snapshot()) {
+        if (!mChannel->Send(ClusterMessage::Catchup + std::to_string(Index) + "\n" + Message)) {
+            debug("cluster: failed to send to the front");
+            return;
+        }
+    }
+}
+
+void TClusterWorker::ReportLoad(size_t Players) {
+    (void)mChannel->Send(ClusterMessage::Load + std::to_string(Players));
+}
+
+void TClusterWorker::ReceiveMain() {
+    RegisterThread("ClusterWorker");
+    while (auto Message = mChannel->Receive()) {
+        try {
+            std::string_view Data(Message->Data);
+            char Code = Data.empty() ? '\0' : Data[0];
+            Data.remove_prefix(Data.empty() ? 0 : 1);
+            if (Code == ClusterMessage::Datagram && Data.size() >= sizeof(sockaddr_in)) {
+                sockaddr_in Addr;
+                std::memcpy(&Addr, Data.data(), sizeof(Addr));
+                mNetwork.HandleDatagram(Addr, std::string(Data.substr(sizeof(Addr))));
+            } else if (Code == ClusterMessage::Connection && Data.size() >= sizeof(sockaddr_in) && Message->Fds.size() == 1) {
+                sockaddr_in Addr;
+                std::memcpy(&Addr, Data.data(), sizeof(Addr));
+                mNetwork.AcceptConnection(Message->Fds[0], Addr);
+                Message->Fds.clear();
+            } else if (Code == ClusterMessage::Bus) {
+                mMirror.Apply(Data);
+            } else if (int Index; Code == ClusterMessage::WorkerLost && ReadInt(Data, Index) && Index != mIndex) {
+                warn("Cluster worker " + std::to_string(Index) + " is gone, so are its players");
+                mMirror.RemovePlayers([&](int PlayerID) { return PlayerID % mWorkers == Index; }, " lost connection!");
+            } else if (Code == ClusterMessage::WorkerJoined && ReadInt(Data, Index) && Index != mIndex) {
+                CatchUp(Index);
+            }
+        } catch (const std::exception& e) {
+            error("cluster: " + std::string(e.what()));
+        }
+        // anything which wasn't taken over
+        for (int Fd : Message->Fds) {
+            CloseSocketProper(Fd);
+        }
+    }
+    if (!mShutdown) {
+        error("Lost the connection to the cluster front, shutting down");
+        Application::GracefullyShutdown();
+    }
+}
@@ -20,6 +20,26 @@ static constexpr std::string_view StrResourceFolder = "ResourceFolder";
 static constexpr std::string_view StrAuthKey = "AuthKey";
 static constexpr std::string_view StrSendErrors = "SendErrors";
 static constexpr std::string_view StrSendErrorsMessageEnabled = "SendErrorsShowMessage";
+static constexpr std::string_view StrAuthCacheTTL = "AuthCacheTTL";
+static constexpr std::string_view StrAuthCacheSize = "AuthCacheSize";
+static constexpr std::string_view StrAuthCachePersist = "AuthCachePersist";
+static constexpr std::string_view StrAuthProvider = "AuthProvider";
+static constexpr std::string_view StrAuthAllowlist = "AuthAllowlist";
+static constexpr std::string_view StrAuthHttpHost = "AuthHttpHost";
+static constexpr std::string_view StrAuthHttpPort = "AuthHttpPort";
+static constexpr std::string_view StrAuthHttpTls = "AuthHttpTls";
+static constexpr std::string_view StrMaxPendingHandshakesPerIP = "MaxPendingHandshakesPerIP";
+static constexpr std::string_view StrResumeGracePeriod = "ResumeGracePeriod";
+static constexpr std::string_view StrDeadReckoningThreshold = "DeadReckoningThreshold";
+static constexpr std::string_view StrDeadReckoningKeyframe = "DeadReckoningKeyframe";
+static constexpr std::string_view StrRooms = "Rooms";
+static constexpr std::string_view StrRoomAssignment = "RoomAssignment";
+static constexpr std::string_view StrClusterWorkers = "ClusterWorkers";
+static constexpr std::string_view StrClusterSocket = "ClusterSocket";
+static constexpr std::string_view StrRelaySecret = "RelaySecret";
+static constexpr std::string_view StrRelayUpstream = "RelayUpstream";
+static constexpr std::string_view StrRelayUpstreamSecret = "RelayUpstreamSecret";
+static constexpr std::string_view StrStandby = "Standby";
 
 TConfig::TConfig() {
     if (!fs::exists(ConfigFileName) || !fs::is_regular_file(ConfigFileName)) {
@@ -55,6 +75,10 @@ void TConfig::CreateConfigFile(std::string_view name) {
         error("an error occurred and was ignored during config transfer: " + std::string(e.what()));
     }
 
+    toml::table Rooms;
+    for (const auto& [Name, Map] : Application::Settings.Rooms) {
+        Rooms.insert(Name, Map);
+    }
     toml::table tbl { {
 
         { "General",
@@ -70,6 +94,26 @@ void TConfig::CreateConfigFile(std::string_view name) {
                 { StrDescription, Application::Settings.ServerDesc },
                 { StrResourceFolder, Application::Settings.Resource },
                 { StrAuthKey, Application::Settings.Key },
+                { StrAuthCacheTTL, Application::Settings.AuthCacheTTL },
+                { StrAuthCacheSize, Application::Settings.AuthCacheSize },
+                { StrAuthCachePersist, Application::Settings.AuthCachePersist },
+                { StrAuthProvider, Application::Settings.AuthProvider },
+                { StrAuthAllowlist, Application::Settings.AuthAllowlist },
+                { StrAuthHttpHost, Application::Settings.AuthHttpHost },
+                { StrAuthHttpPort, Application::Settings.AuthHttpPort },
+                { StrAuthHttpTls, Application::Settings.AuthHttpTls },
+                { StrMaxPendingHandshakesPerIP, Application::Settings.MaxPendingHandshakesPerIP },
+                { StrResumeGracePeriod, Application::Settings.ResumeGracePeriod },
+                { StrDeadReckoningThreshold, Application::Settings.DeadReckoningThreshold },
+                { StrDeadReckoningKeyframe, Application::Settings.DeadReckoningKeyframe },
+                { StrRooms, std::move(Rooms) },
+                { StrRoomAssignment, Application::Settings.RoomAssignment },
+                { StrClusterWorkers, Application::Settings.ClusterWorkers },
+                { StrClusterSocket, Application::Settings.ClusterSocket },
+                { StrRelaySecret, Application::Settings.RelaySecret },
+                { StrRelayUpstream, Application::Settings.RelayUpstream },
+                { StrRelayUpstreamSecret, Application::Settings.RelayUpstreamSecret },
+                { StrStandby, Application::Settings.Standby },
                 //{ StrSendErrors, Application::Settings.SendErrors },
 
             } } },
@@ -159,6 +203,72 @@ void TConfig::ParseFromFile(std::string_view name) {
             // no idea what to do here, ignore...?
             // this entire toml parser sucks and is replaced in the upcoming lua.
         }
+        // optional, older configs don't have these
+        if (auto val = GeneralTable[StrAuthCacheTTL].value<int>(); val.has_value()) {
+            Application::Settings.AuthCacheTTL = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthCacheSize].value<int>(); val.has_value()) {
+            Application::Settings.AuthCacheSize = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthCachePersist].value<bool>(); val.has_value()) {
+            Application::Settings.AuthCachePersist = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthProvider].value<std::string>(); val.has_value()) {
+            Application::Settings.AuthProvider = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthAllowlist].value<std::string>(); val.has_value()) {
+            Application::Settings.AuthAllowlist = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthHttpHost].value<std::string>(); val.has_value()) {
+            Application::Settings.AuthHttpHost = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthHttpPort].value<int>(); val.has_value()) {
+            Application::Settings.AuthHttpPort = val.value();
+        }
+        if (auto val = GeneralTable[StrAuthHttpTls].value<bool>(); val.has_value()) {
+            Application::Settings.AuthHttpTls = val.value();
+        }
+        if (auto val = GeneralTable[StrMaxPendingHandshakesPerIP].value<int>(); val.has_value()) {
+            Application::Settings.MaxPendingHandshakesPerIP = val.value();
+        }
+        if (auto val = GeneralTable[StrResumeGracePeriod].value<int>(); val.has_value()) {
+            Application::Settings.ResumeGracePeriod = val.value();
+        }
+        if (auto val = GeneralTable[StrDeadReckoningThreshold].value<double>(); val.has_value()) {
+            Application::Settings.DeadReckoningThreshold = val.value();
+        }
+        if (auto val = GeneralTable[StrDeadReckoningKeyframe].value<int>(); val.has_value()) {
+            Application::Settings.DeadReckoningKeyframe = val.value();
+        }
+        // Rooms = { name = "/levels/.../info.json", ... }
+        if (auto Rooms = GeneralTable[StrRooms].as_table(); Rooms) {
+            for (const auto& [Name, Map] : *Rooms) {
+                if (auto val = Map.value<std::string>(); val.has_value()) {
+                    Application::Settings.Rooms[std::string(Name)] = val.value();
+                }
+            }
+        }
+        if (auto val = GeneralTable[StrRoomAssignment].value<std::string>(); val.has_value()) {
+            Application::Settings.RoomAssignment = val.value();
+        }
+        if (auto val = GeneralTable[StrClusterWorkers].value<int>(); val.has_value()) {
+            Application::Settings.ClusterWorkers = val.value();
+        }
+        if (auto val = GeneralTable[StrClusterSocket].value<std::string>(); val.has_value()) {
+            Application::Settings.ClusterSocket = val.value();
+        }
+        if (auto val = GeneralTable[StrRelaySecret].value<std::string>(); val.has_value()) {
+            Application::Settings.RelaySecret = val.value();
+        }
+        if (auto val = GeneralTable[StrRelayUpstream].value<std::string>(); val.has_value()) {
+            Application::Settings.RelayUpstream = val.value();
+        }
+        if (auto val = GeneralTable[StrRelayUpstreamSecret].value<std::string>(); val.has_value()) {
+            Application::Settings.RelayUpstreamSecret = val.value();
+        }
+        if (auto val = GeneralTable[StrStandby].value<bool>(); val.has_value()) {
+            Application::Settings.Standby = val.value();
+        }
     } catch (const std::exception& err) {
         error("Error parsing config file value: " + std::string(err.what()));
         mFailed = true;
@@ -182,6 +292,28 @@ void TConfig::PrintDebug() {
     debug(std::string(StrName) + ": \"" + Application::Settings.ServerName + "\"");
     debug(std::string(StrDescription) + ": \"" + Application::Settings.ServerDesc + "\"");
     debug(std::string(StrResourceFolder) + ": \"" + Application::Settings.Resource + "\"");
+    debug(std::string(StrAuthCacheTTL) + ": " + std::to_string(Application::Settings.AuthCacheTTL));
+    debug(std::string(StrAuthCacheSize) + ": " + std::to_string(Application::Settings.AuthCacheSize));
+    debug(std::string(StrAuthCachePersist) + ": " + std::string(Application::Settings.AuthCachePersist ? "true" : "false"));
+    debug(std::string(StrAuthProvider) + ": \"" + Application::Settings.AuthProvider + "\"");
+    debug(std::string(StrAuthAllowlist) + ": \"" + Application::Settings.AuthAllowlist + "\"");
+    debug(std::string(StrAuthHttpHost) + ": \"" + Application::Settings.AuthHttpHost + "\"");
+    debug(std::string(StrAuthHttpPort) + ": " + std::to_string(Application::Settings.AuthHttpPort));
+    debug(std::string(StrAuthHttpTls) + ": " + std::string(Application::Settings.AuthHttpTls ? "true" : "false"));
+    debug(std::string(StrMaxPendingHandshakesPerIP) + ": " + std::to_string(Application::Settings.MaxPendingHandshakesPerIP));
+    debug(std::string(StrResumeGracePeriod) + ": " + std::to_string(Application::Settings.ResumeGracePeriod));
+    debug(std::string(StrDeadReckoningThreshold) + ": " + std::to_string(Application::Settings.DeadReckoningThreshold));
+    debug(std::string(StrDeadReckoningKeyframe) + ": " + std::to_string(Application::Settings.DeadReckoningKeyframe));
+    for (const auto& [Name, Map] : Application::Settings.Rooms) {
+        debug(std::string(StrRooms) + "." + Name + ": \"" + Map + "\"");
+    }
+    debug(std::string(StrRoomAssignment) + ": \"" + Application::Settings.RoomAssignment + "\"");
+    debug(std::string(StrClusterWorkers) + ": " + std::to_string(Application::Settings.ClusterWorkers));
+    debug(std::string(StrClusterSocket) + ": \"" + Application::Settings.ClusterSocket + "\"");
+    debug(std::string(StrRelaySecret) + " Length: " + std::to_string(Application::Settings.RelaySecret.length()));
+    debug(std::string(StrRelayUpstream) + ": \"" + Application::Settings.RelayUpstream + "\"");
+    debug(std::string(StrRelayUpstreamSecret) + " Length: " + std::to_string(Application::Settings.RelayUpstreamSecret.length()));
+    debug(std::string(StrStandby) + ": " + std::string(Application::Settings.Standby ? "true" : "false"));
     // special!
     debug("Key Length: " + std::to_string(Application::Settings.Key.length()) + "");
 }
@@ -0,0 +1,50 @@
+#include "TConnectionGate.h"
+
+void TConnectionGate::TPass::Reset() {
+    if (mGate) {
+        std::exchange(mGate, nullptr)->Leave();
+    }
+}
+
+TConnectionGate::TPass TConnectionGate::Enter() {
+    while (true) {
+        ++mActive;
+        if (!mClosed) {
+            return TPass(this);
+        }
+        Leave();
+        std::unique_lock Lock(mMutex);
+        mCondition.wait(Lock, [&] { return !mClosed; });
+    }
+}
+
+TConnectionGate::TPass TConnectionGate::Join() {
+    ++mActive;
+    return TPass(this);
+}
+
+void TConnectionGate::Leave() {
+    if (--mActive == 0 && mClosed) {
+        std::unique_lock Lock(mMutex);
+        mCondition.notify_all();
+    }
+}
+
+bool TConnectionGate::Close(std::chrono::milliseconds Timeout) {
+    std::unique_lock Lock(mMutex);
+    mClosed = true;
+    if (mCondition.wait_for(Lock, Timeout, [&] { return mActive == 0; })) {
+        return true;
+    }
+    mClosed = false;
+    mCondition.notify_all();
+    return false;
+}
+
+void TConnectionGate::Open() {
+    {
+        std::unique_lock Lock(mMutex);
+        mClosed = false;
+    }
+    mCondition.notify_all();
+}
@@ -1,9 +1,18 @@
 #include "TConsole.h"
 #include "Common.h"
 #include "Compat.h"
+#include "Process.h"
+#include "TClusterWorker.h"
+#include "THotUpgrade.h"
+#include "TScratchArena.h"
+#include "TStandby.h"
 
+#include <cstdio>
 #include <ctime>
 #include <sstream>
+#ifdef __linux__
+#include <unistd.h>
+#endif // __linux__
 
 std::string GetDate() {
     std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
@@ -43,9 +52,19 @@ TConsole::TConsole() {
     mCommandline.enable_history();
     mCommandline.set_history_limit(20);
     mCommandline.set_prompt("> ");
-    bool success = mCommandline.enable_write_to_file("Server.log");
-    if (!success) {
-        error("unable to open file for writing: \"Server.log\"");
+    // the workers of a cluster each have their own
+    std::string LogFile = "Server.log";
+    if (auto Worker = TClusterWorker::Index()) {
+        LogFile = "Server-worker" + std::to_string(*Worker) + ".log";
+    } else if (TStandby::Channel()) {
+        LogFile = "Server-standby.log";
+    }
+    // what's left after a hot upgrade only waits, the log is the new process'
+    if (!THotUpgrade::IsStub()) {
+        bool success = mCommandline.enable_write_to_file(LogFile);
+        if (!success) {
+            error("unable to open file for writing: \"" + LogFile + "\"");
+        }
     }
     mCommandline.on_command = [this](Commandline& c) {
         auto cmd = c.get_command();
@@ -53,6 +72,10 @@ TConsole::TConsole() {
         if (cmd == "exit") {
             info("gracefully shutting down");
             Application::GracefullyShutdown();
+        } else if (cmd == "upgrade") {
+            Application::HotUpgrade();
+        } else if (cmd == "arena") {
+            info("scratch arena high-water mark: " + std::to_string(TScratchArena::GlobalHighWaterMark()) + " bytes");
         } else if (cmd == "clear" || cmd == "cls") {
             // TODO: clear screen
         } else {
@@ -73,6 +96,20 @@ void TConsole::Write(const std::string& str) {
 void TConsole::InitializeLuaConsole(TLuaEngine& Engine) {
     mLuaConsole = std::make_unique<TLuaFile>(Engine, true);
 }
+void TConsole::TakeOverFromServer() {
+    // what the crashed server logged is kept next to it
+    std::rename("Server.log", "Server-crashed.log");
+    if (!mCommandline.enable_write_to_file("Server.log")) {
+        error("unable to open file for writing: \"Server.log\"");
+    }
+#ifdef __linux__
+    if (auto Console = Process::ReadVariable(TStandby::ConsoleVariable)) {
+        dup2(*Console, STDIN_FILENO);
+        close(*Console);
+        clearerr(stdin);
+    }
+#endif // __linux__
+}
 void TConsole::WriteRaw(const std::string& str) {
     mCommandline.write(str);
 }
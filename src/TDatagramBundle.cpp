@@ -0,0 +1,35 @@
+#include "TDatagramBundle.h"
+
+#include "TPacketSchema.h"
+
+bool TDatagramBundle::Fits(std::string_view Packet) {
+    return HeaderSize + LengthSize + Packet.size() <= MaxSize;
+}
+
+std::optional<std::string> TDatagramBundle::Add(std::string_view Packet, bool& WasEmpty) {
+    std::optional<std::string> Full;
+    std::unique_lock Lock(mMutex);
+    if (!mPending.empty() && mPending.size() + LengthSize + Packet.size() > MaxSize) {
+        Full = std::move(mPending);
+        mPending.clear();
+    }
+    WasEmpty = mPending.empty();
+    if (WasEmpty) {
+        mPending.reserve(MaxSize);
+        mPending = PacketSchema::TBundle::Prefix;
+    }
+    mPending += char((Packet.size() >> 8) & 0xff);
+    mPending += char(Packet.size() & 0xff);
+    mPending += Packet;
+    return Full;
+}
+
+std::optional<std::string> TDatagramBundle::Take() {
+    std::unique_lock Lock(mMutex);
+    if (mPending.empty()) {
+        return std::nullopt;
+    }
+    auto Bundle = std::move(mPending);
+    mPending.clear();
+    return Bundle;
+}
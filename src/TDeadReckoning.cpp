@@ -0,0 +1,59 @@
+#include "TDeadReckoning.h"
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cmath>
+
+bool TDeadReckoning::NeedsUpdate(const TVehicleTransform& Transform) const {
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    auto Iter = mSent.find(Key(Transform));
+    if (Iter == mSent.end()) {
+        return true;
+    }
+    const auto& Last = Iter->second;
+    std::chrono::duration<double> Elapsed = Now - Last.SentAt;
+    if (Elapsed.count() * 1000.0 >= Application::Settings.DeadReckoningKeyframe) {
+        return true;
+    }
+    // the sender's clock says best how far apart the two updates are, the
+    // server's is thrown off by jitter. it's a fallback for clients without it.
+    double Delta = Elapsed.count();
+    if (Transform.Time && Last.Transform.Time) {
+        auto SenderDelta = *Transform.Time - *Last.Transform.Time;
+        if (SenderDelta >= 0 && SenderDelta <= Delta + 1.0) {
+            Delta = SenderDelta;
+        }
+    }
+    double Error = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        double Predicted = Last.Transform.Position[i] + Last.Transform.Velocity[i] * Delta;
+        Error += (Transform.Position[i] - Predicted) * (Transform.Position[i] - Predicted);
+    }
+    if (std::sqrt(Error) > Application::Settings.DeadReckoningThreshold) {
+        return true;
+    }
+    // angle between the two orientations
+    double Dot = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        Dot += Transform.Rotation[i] * Last.Transform.Rotation[i];
+    }
+    return 2.0 * std::acos(std::min(1.0, std::abs(Dot))) > RotationThreshold;
+}
+
+void TDeadReckoning::OnSent(const TVehicleTransform& Transform) {
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    mSent[Key(Transform)] = TSent { Transform, Now };
+    if (Now - mLastCleanup > ForgetAfter) {
+        mLastCleanup = Now;
+        for (auto Iter = mSent.begin(); Iter != mSent.end();) {
+            if (Now - Iter->second.SentAt > ForgetAfter) {
+                Iter = mSent.erase(Iter);
+            } else {
+                ++Iter;
+            }
+        }
+    }
+}
@@ -2,13 +2,12 @@
 
 #include "Client.h"
 #include "Http.h"
+#include "Json.h"
 //#include "SocketIO.h"
-#include <rapidjson/document.h>
-#include <rapidjson/rapidjson.h>
+#include <algorithm>
+#include <optional>
 #include <sstream>
 
-namespace json = rapidjson;
-
 void THeartbeatThread::operator()() {
     RegisterThread("Heartbeat");
     std::string Body;
@@ -17,21 +16,36 @@ void THeartbeatThread::operator()() {
     // these are "hot-change" related variables
     static std::string Last;
 
-    static std::chrono::high_resolution_clock::time_point LastNormalUpdateTime = std::chrono::high_resolution_clock::now();
+    auto LastNormalUpdateTime = std::chrono::steady_clock::now();
+    // state version the last body was generated from, nothing generated yet if empty
+    std::optional<uint64_t> GeneratedVersion;
     bool isAuth = false;
     while (!mShutdown) {
-        Body = GenerateCall();
-        // a hot-change occurs when a setting has changed, to update the backend of that change.
-        auto Now = std::chrono::high_resolution_clock::now();
-        bool Unchanged = Last == Body;
+        // a hot-change occurs when a setting, a player or a mod has changed, to update the backend of that change.
+        // we only look at the body once something changed or the regular update is due, and sleep otherwise.
+        auto Version = Application::StateVersion();
+        bool Changed = !GeneratedVersion || *GeneratedVersion != Version;
+        auto Now = std::chrono::steady_clock::now();
         auto TimePassed = (Now - LastNormalUpdateTime);
-        auto Threshold = Unchanged ? 30 : 5;
+        auto Threshold = Changed ? 5 : 30;
         if (TimePassed < std::chrono::seconds(Threshold)) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            Application::WaitForStateChange(Version, LastNormalUpdateTime + std::chrono::seconds(Threshold));
+            continue;
+        }
+        { // gate scope
+            // the players are read in between two packets, a hot upgrade waits for that
+            auto Pass = mNetwork.Gate().Enter();
+            Body = GenerateCall();
+        } // end gate scope
+        GeneratedVersion = Version;
+        if (Last == Body && TimePassed < std::chrono::seconds(30)) {
+            // something changed and changed back (e.g. a player joined and left again), nothing to tell
             continue;
         }
         debug("heartbeat (after " + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(TimePassed).count()) + "s)");
 
+        // the response document lives in the scratch arena until the end of this iteration
+        TScratchArena::TScope ArenaScope;
         Last = Body;
         LastNormalUpdateTime = Now;
         if (!Application::Settings.CustomIP.empty())
@@ -49,32 +63,28 @@ void THeartbeatThread::operator()() {
         };
 
         auto Target = "/heartbeat";
-        int ResponseCode = -1;
-        const std::vector<std::string> Urls = {
-            Application::GetBackendHostname(),
-            Application::GetBackup1Hostname(),
-            Application::GetBackup2Hostname(),
-        };
+        auto Result = PostHedged(Target, Body);
 
-        json::Document Doc;
-        bool Ok = false;
-        for (const auto& Url : Urls) {
-            T = Http::POST(Url, Target, { { "api-v", "2" } }, Body, false, &ResponseCode);
+        TArenaJsonDocument Doc;
+        // report the hosts which answered with garbage, even if another one answered properly
+        for (const auto& Failed : Result.Failed) {
+            T = Failed.Response;
             trace(T);
             Doc.Parse(T.data(), T.size());
             if (Doc.HasParseError() || !Doc.IsObject()) {
                 error("Backend response failed to parse as valid json");
                 debug("Response was: `" + T + "`");
                 Sentry.SetContext("JSON Response", { { "reponse", T } });
-                SentryReportError(Url + Target, ResponseCode);
-            } else if (ResponseCode != 200) {
-                SentryReportError(Url + Target, ResponseCode);
-            } else {
-                // all ok
-                Ok = true;
-                break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            SentryReportError(Failed.Url + Target, Failed.ResponseCode);
+        }
+        bool Ok = false;
+        if (Result.Winner) {
+            T = Result.Winner->Response;
+            trace(T);
+            Doc.Parse(T.data(), T.size());
+            // all ok
+            Ok = true;
         }
         std::string Status {};
         std::string Code {};
@@ -125,11 +135,134 @@ void THeartbeatThread::operator()() {
     }
 }
 
+std::vector<std::string> THeartbeatThread::OrderedHosts() const {
+    std::vector<std::string> Hosts = {
+        Application::GetBackendHostname(),
+        Application::GetBackup1Hostname(),
+        Application::GetBackup2Hostname(),
+    };
+    // fastest first, hosts we haven't heard from yet count as slow-ish but keep their order
+    std::unique_lock Lock(mHostStats->Mutex);
+    auto Latency = [&](const std::string& Host) {
+        auto Iter = mHostStats->AverageLatencyMs.find(Host);
+        return Iter != mHostStats->AverageLatencyMs.end() ? Iter->second : double(DefaultHedgeDelay.count());
+    };
+    std::stable_sort(Hosts.begin(), Hosts.end(), [&](const auto& A, const auto& B) { return Latency(A) < Latency(B); });
+    return Hosts;
+}
+
+std::chrono::milliseconds THeartbeatThread::HedgeDelay(const std::string& Host) const {
+    std::unique_lock Lock(mHostStats->Mutex);
+    auto Iter = mHostStats->AverageLatencyMs.find(Host);
+    if (Iter == mHostStats->AverageLatencyMs.end()) {
+        return DefaultHedgeDelay;
+    }
+    // give the host twice its usual time before asking the next one as well
+    auto Delay = std::chrono::milliseconds(int64_t(Iter->second * 2));
+    return std::clamp(Delay, MinHedgeDelay, MaxHedgeDelay);
+}
+
+void THeartbeatThread::THostStats::Record(const std::string& Host, double LatencyMs) {
+    std::unique_lock Lock(Mutex);
+    auto [Iter, Inserted] = AverageLatencyMs.try_emplace(Host, LatencyMs);
+    if (!Inserted) {
+        // exponentially weighted, so a host which got slow (or fast) again moves in a few heartbeats
+        Iter->second = Iter->second * 0.8 + LatencyMs * 0.2;
+    }
+}
+
+THeartbeatThread::THedgedResult THeartbeatThread::PostHedged(const std::string& Target, const std::string& Body) {
+    auto Hosts = OrderedHosts();
+    auto Round = std::make_shared<TRound>();
+    Round->Attempts.resize(Hosts.size());
+    for (size_t i = 0; i < Hosts.size(); ++i) {
+        Round->Attempts[i].Url = Hosts[i];
+        Round->Cancellations.push_back(std::make_unique<Http::TCancellation>());
+    }
+    // requests run on their own threads, so a slow host doesn't hold up the others.
+    // once we have an answer, the ones still running are cancelled.
+    std::vector<std::thread> Requests;
+    auto Launch = [&](size_t Index) {
+        Requests.emplace_back([Round, Index, Target, Body, Stats = mHostStats] {
+            RegisterThread("HeartbeatRequest");
+            const auto& Url = Round->Attempts[Index].Url;
+            auto& Cancellation = *Round->Cancellations[Index];
+            auto Start = std::chrono::steady_clock::now();
+            int ResponseCode = -1;
+            auto Response = Http::POST(Url, Target, { { "api-v", "2" } }, Body, false, &ResponseCode, &Cancellation);
+            if (Cancellation.IsCancelled()) {
+                // says nothing about the host
+                return;
+            }
+            bool Valid = false;
+            {
+                TScratchArena::TScope ArenaScope;
+                TArenaJsonDocument Doc;
+                Doc.Parse(Response.data(), Response.size());
+                Valid = !Doc.HasParseError() && Doc.IsObject() && ResponseCode == 200;
+            }
+            auto Elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+            Stats->Record(Url, Valid ? Elapsed : double(FailedRequestPenalty.count()));
+            {
+                std::unique_lock Lock(Round->Mutex);
+                auto& Attempt = Round->Attempts[Index];
+                Attempt.Response = std::move(Response);
+                Attempt.ResponseCode = ResponseCode;
+                Attempt.Valid = Valid;
+                Attempt.Done = true;
+                ++Round->Finished;
+                if (Valid && !Round->Winner) {
+                    Round->Winner = Index;
+                }
+            }
+            Round->Condition.notify_all();
+        });
+    };
+
+    size_t Launched = 0;
+    Launch(Launched++);
+    std::unique_lock Lock(Round->Mutex);
+    while (!Round->Winner && Round->Finished < Hosts.size()) {
+        auto AllLaunchedFailed = [&] { return Round->Winner || Round->Finished == Launched; };
+        if (Launched < Hosts.size()) {
+            // fire the next host once the last one took too long, or right away if everyone we asked failed
+            Round->Condition.wait_for(Lock, HedgeDelay(Hosts[Launched - 1]), AllLaunchedFailed);
+            if (!Round->Winner) {
+                debug("heartbeat: also asking " + Hosts[Launched]);
+                Launch(Launched++);
+            }
+        } else {
+            Round->Condition.wait(Lock, AllLaunchedFailed);
+        }
+    }
+    Lock.unlock();
+    for (size_t i = 0; i < Launched; ++i) {
+        if (Round->Winner != i) {
+            Round->Cancellations[i]->Cancel();
+        }
+    }
+    for (auto& Request : Requests) {
+        Request.join();
+    }
+    Lock.lock();
+
+    THedgedResult Result;
+    for (size_t i = 0; i < Launched; ++i) {
+        const auto& Attempt = Round->Attempts[i];
+        if (Round->Winner == i) {
+            Result.Winner = Attempt;
+        } else if (Attempt.Done && !Attempt.Valid) {
+            Result.Failed.push_back(Attempt);
+        }
+    }
+    return Result;
+}
+
 std::string THeartbeatThread::GenerateCall() {
     std::stringstream Ret;
 
     Ret << "uuid=" << Application::Settings.Key
-        << "&players=" << mServer.ClientCount()
+        << "&players=" << mServer.PlayerCount()
         << "&maxplayers=" << Application::Settings.MaxPlayers
         << "&port=" << Application::Settings.Port
         << "&map=" << Application::Settings.MapName
@@ -144,27 +277,22 @@ std::string THeartbeatThread::GenerateCall() {
         << "&desc=" << Application::Settings.ServerDesc;
     return Ret.str();
 }
-THeartbeatThread::THeartbeatThread(TResourceManager& ResourceManager, TServer& Server)
+THeartbeatThread::THeartbeatThread(TResourceManager& ResourceManager, TServer& Server, TNetwork& Network)
     : mResourceManager(ResourceManager)
-    , mServer(Server) {
+    , mServer(Server)
+    , mNetwork(Network) {
     Application::RegisterShutdownHandler([&] {
         if (mThread.joinable()) {
             mShutdown = true;
+            // wake up the heartbeat thread, it might be waiting for a change
+            Application::NotifyStateChanged();
             mThread.join();
         }
     });
     Start();
 }
 std::string THeartbeatThread::GetPlayers() {
-    std::string Return;
-    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
-        ReadLock Lock(mServer.GetClientMutex());
-        if (!ClientPtr.expired()) {
-            Return += ClientPtr.lock()->GetName() + ";";
-        }
-        return true;
-    });
-    return Return;
+    return mServer.GetPlayerList()->HeartbeatList;
 }
 /*THeartbeatThread::~THeartbeatThread() {
 }*/
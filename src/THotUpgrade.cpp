@@ -0,0 +1,368 @@
+#include "THotUpgrade.h"
+
+#include "Client.h"
+#include "Common.h"
+#include "Process.h"
+#include "TClusterWorker.h"
+#include "TLuaEngine.h"
+#include "TNetwork.h"
+#include "TServer.h"
+#include "TStandby.h"
+#include "TStateBuffer.h"
+#include "TUnixChannel.h"
+
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#ifdef __linux__
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// where the binary is now, which is the new one if it was replaced while this one ran
+std::string BinaryPath() {
+    std::string Path(4096, '\0');
+    auto Length = readlink("/proc/self/exe", Path.data(), Path.size());
+    if (Length <= 0) {
+        return "/proc/self/exe";
+    }
+    Path.resize(size_t(Length));
+    constexpr std::string_view Deleted = " (deleted)";
+    if (Path.size() > Deleted.size() && Path.compare(Path.size() - Deleted.size(), Deleted.size(), Deleted) == 0) {
+        Path.resize(Path.size() - Deleted.size());
+    }
+    return Path;
+}
+
+std::atomic<pid_t> SuccessorPid { -1 };
+
+void ForwardSignal(int Signal) {
+    if (pid_t Pid = SuccessorPid; Pid > 0) {
+        kill(Pid, Signal);
+    }
+}
+
+// what the stub does, until the new process exits
+int WaitFor(pid_t Pid) {
+    SuccessorPid = Pid;
+    for (int Signal : { SIGTERM, SIGHUP, SIGUSR2 }) {
+        signal(Signal, ForwardSignal);
+    }
+    // the terminal sends it to the new process as well
+    signal(SIGINT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    int Status = 0;
+    while (waitpid(Pid, &Status, 0) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+    if (WIFEXITED(Status)) {
+        return WEXITSTATUS(Status);
+    }
+    if (WIFSIGNALED(Status)) {
+        return 128 + WTERMSIG(Status);
+    }
+    return 1;
+}
+
+}
+#endif // __linux__
+
+std::optional<int> THotUpgrade::Channel() {
+#ifdef __linux__
+    return Process::ReadVariable(ChannelVariable);
+#else
+    return std::nullopt;
+#endif // __linux__
+}
+
+bool THotUpgrade::IsStub() {
+#ifdef __linux__
+    return Process::ReadVariable(SuccessorVariable).has_value();
+#else
+    return false;
+#endif // __linux__
+}
+
+std::optional<int> THotUpgrade::WaitForSuccessor() {
+#ifdef __linux__
+    if (auto Pid = Process::ReadVariable(SuccessorVariable); Pid && *Pid > 0) {
+        return WaitFor(*Pid);
+    }
+#endif // __linux__
+    return std::nullopt;
+}
+
+THotUpgrade::THotUpgrade(char** Argv, TServer& Server, TNetwork& Network, TLuaEngine& LuaEngine)
+    : mServer(Server)
+    , mNetwork(Network)
+    , mLuaEngine(LuaEngine) {
+    for (; *Argv; ++Argv) {
+        mArgv.emplace_back(*Argv);
+    }
+#ifdef __linux__
+    if (auto Fd = Channel()) {
+        try {
+            TakeOver(*Fd);
+        } catch (const std::exception& e) {
+            // the old process carries on as the server
+            error("Taking over from the previous process failed: " + std::string(e.what()));
+            Application::GracefullyShutdown();
+            return;
+        }
+    }
+    Application::SetUpgradeHandler([this] { HandOver(); });
+#endif // __linux__
+}
+
+#ifdef __linux__
+
+void THotUpgrade::TakeOver(int Fd) {
+    TUnixChannel Channel(Fd);
+    if (!Channel.Send(UpgradeMessage::Hello + std::to_string(FormatVersion))) {
+        throw std::runtime_error("the process to take over from is gone");
+    }
+    SOCKET TCPListener = -1;
+    SOCKET UDPSock = -1;
+    std::vector<std::pair<std::shared_ptr<TClient>, std::optional<TSessionStore::TSavedSession>>> Clients;
+    for (bool Done = false; !Done;) {
+        auto Message = Channel.Receive();
+        if (!Message) {
+            throw std::runtime_error("the process to take over from went away during the upgrade");
+        }
+        std::string_view Data(Message->Data);
+        char Code = Data.empty() ? '\0' : Data[0];
+        Data.remove_prefix(Data.empty() ? 0 : 1);
+        if (Code == UpgradeMessage::Sockets && Message->Fds.size() == 2) {
+            TCPListener = Message->Fds[0];
+            UDPSock = Message->Fds[1];
+            Message->Fds.clear();
+        } else if (Code == UpgradeMessage::Client) {
+            TStateReader Reader(Data);
+            std::optional<TSessionStore::TSavedSession> Session;
+            if (Reader.Bool()) {
+                Session = TSessionStore::TSavedSession { Reader.String(), Reader.Bool(), std::chrono::milliseconds(Reader.Int()) };
+            }
+            auto Client = std::make_shared<TClient>(mServer);
+            Client->Restore(Reader);
+            // a parked client has no connection, it's waiting to resume its session
+            if (Session && Session->Parked) {
+                Client->SetTCPSock(-1);
+                Client->SetDownSock(0);
+            } else if (!Message->Fds.empty()) {
+                Client->SetTCPSock(Message->Fds[0]);
+                Client->SetDownSock(Message->Fds.size() > 1 ? Message->Fds[1] : 0);
+                Message->Fds.clear();
+            } else {
+                throw std::runtime_error("client " + std::to_string(Client->GetID()) + " came without its connection");
+            }
+            Clients.emplace_back(std::move(Client), std::move(Session));
+        } else if (Code == UpgradeMessage::End) {
+            Done = true;
+        } else if (Code == UpgradeMessage::Abort) {
+            throw std::runtime_error("the upgrade was called off");
+        }
+        for (int Unused : Message->Fds) {
+            CloseSocketProper(Unused);
+        }
+    }
+    if (TCPListener == -1 || UDPSock == -1) {
+        throw std::runtime_error("the process to take over from didn't send its sockets");
+    }
+    if (!Channel.Send(std::string(1, UpgradeMessage::Ack))) {
+        throw std::runtime_error("the process to take over from went away during the upgrade");
+    }
+    // it closes its end once it's the stub, until then it's still the server
+    while (Channel.Receive()) { }
+    mNetwork.AdoptSockets(TCPListener, UDPSock);
+    for (auto& [Client, Session] : Clients) {
+        mNetwork.AdoptClient(Client, Session);
+    }
+    info("Took over " + std::to_string(Clients.size()) + " players from the previous process");
+}
+
+void THotUpgrade::HandOver() {
+    RegisterThread("HotUpgrade");
+    std::unique_lock Lock(mMutex, std::try_to_lock);
+    if (!Lock) {
+        warn("An upgrade is already in progress");
+        return;
+    }
+    if (Application::Settings.ClusterWorkers > 0 || TClusterWorker::Index()) {
+        error("Hot upgrades don't work in cluster mode, restart the server instead");
+        return;
+    }
+    int Ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Ends) != 0) {
+        error("Upgrade failed, can't create a socket: " + std::string(std::strerror(errno)));
+        return;
+    }
+    auto Channel = std::make_unique<TUnixChannel>(Ends[0]);
+    pid_t Pid = Spawn(Ends[1]);
+    close(Ends[1]);
+    if (Pid < 0) {
+        error("Upgrade failed, can't start the new process: " + std::string(std::strerror(errno)));
+        return;
+    }
+    info("Upgrading, started the new process " + std::to_string(Pid));
+
+    // cuts the new process off if it takes too long, which ends the upgrade
+    std::mutex WatchdogMutex;
+    std::condition_variable WatchdogCondition;
+    bool Finished = false;
+    bool TimedOut = false;
+    std::thread Watchdog([&] {
+        std::unique_lock WatchdogLock(WatchdogMutex);
+        if (!WatchdogCondition.wait_for(WatchdogLock, HandOverTimeout, [&] { return Finished; })) {
+            TimedOut = true;
+            Channel->Shutdown();
+        }
+    });
+    // true if the upgrade went through
+    auto Finish = [&](bool Success) {
+        {
+            std::unique_lock WatchdogLock(WatchdogMutex);
+            Success = Success && !TimedOut;
+            Finished = true;
+        }
+        WatchdogCondition.notify_all();
+        Watchdog.join();
+        if (!Success) {
+            (void)Channel->Send(std::string(1, UpgradeMessage::Abort));
+            kill(Pid, SIGKILL);
+            while (waitpid(Pid, nullptr, 0) < 0 && errno == EINTR) { }
+        }
+        return Success;
+    };
+
+    auto Hello = Channel->Receive();
+    if (!Hello || Hello->Data != UpgradeMessage::Hello + std::to_string(FormatVersion)) {
+        Finish(false);
+        error("Upgrade failed, the new process didn't start up or can't take this version's state");
+        return;
+    }
+    if (!mNetwork.PauseConnections(PauseTimeout)) {
+        Finish(false);
+        error("Upgrade failed, the network threads didn't stop in time");
+        return;
+    }
+    // after the network, which may still be waiting for a lua event to finish
+    if (!mLuaEngine.Gate().Close(PauseTimeout)) {
+        mNetwork.ResumeConnections();
+        Finish(false);
+        error("Upgrade failed, the lua plugins didn't stop in time");
+        return;
+    }
+
+    std::vector<std::shared_ptr<TClient>> Clients;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        if (auto Client = ClientPtr.lock()) {
+            Clients.push_back(std::move(Client));
+        }
+        return true;
+    });
+    bool Sent = Channel->Send(std::string(1, UpgradeMessage::Sockets), { mNetwork.TCPListener(), mNetwork.UDPSocket() });
+    std::vector<std::shared_ptr<TClient>> Left;
+    size_t HandedOver = 0;
+    for (auto& Client : Clients) {
+        auto Session = mNetwork.SaveSession(*Client);
+        bool Parked = Session && Session->Parked;
+        bool InGame = Client->GetStatus() >= 0 && Client->IsSynced() && Client->GetTCPSock() != -1;
+        if (!Parked && !InGame) {
+            Left.push_back(Client);
+            continue;
+        }
+        TStateWriter Writer;
+        Writer.Bool(Session.has_value());
+        if (Session) {
+            Writer.String(Session->Token);
+            Writer.Bool(Session->Parked);
+            Writer.Int(Session->Remaining.count());
+        }
+        Client->Save(Writer);
+        std::vector<int> Fds;
+        if (!Parked) {
+            Fds.push_back(Client->GetTCPSock());
+            if (Client->GetDownSock() > 0) {
+                Fds.push_back(Client->GetDownSock());
+            }
+        }
+        Sent = Sent && Channel->Send(UpgradeMessage::Client + Writer.Data(), Fds);
+        ++HandedOver;
+    }
+    Sent = Sent && Channel->Send(std::string(1, UpgradeMessage::End));
+    auto Ack = Sent ? Channel->Receive() : std::nullopt;
+    if (!Finish(Ack && Ack->Data == std::string(1, UpgradeMessage::Ack))) {
+        mLuaEngine.Gate().Open();
+        mNetwork.ResumeConnections();
+        error("Upgrade failed, the new process didn't take the players over");
+        return;
+    }
+
+    info("Handed " + std::to_string(HandedOver) + " players over to the new process " + std::to_string(Pid) + ", this one is done");
+    for (auto& Client : Left) {
+        mNetwork.ClientKick(*Client, "Server is restarting, please join again");
+    }
+    // the new process has its own, this one's would take over once this process is a stub
+    mNetwork.StopStandby();
+    BecomeStub(Pid);
+    // the new process serves everyone as soon as this one's end of the socket is closed
+    error("Can't become a stub for the new process, waiting for it in here: " + std::string(std::strerror(errno)));
+    Channel.reset();
+    std::_Exit(WaitFor(Pid));
+}
+
+int THotUpgrade::Spawn(int ChannelFd) {
+    // everything the child needs is prepared here, between fork and exec it
+    // may only do what's safe in a copy of a multithreaded process
+    std::string Binary = BinaryPath();
+    auto Env = Process::Environment({ ChannelVariable, SuccessorVariable, TStandby::ChannelVariable, TStandby::ConsoleVariable });
+    Env.push_back(std::string(ChannelVariable) + "=" + std::to_string(ChannelFd));
+    auto EnvPtrs = Process::Pointers(Env);
+    auto ArgvPtrs = Process::Pointers(mArgv);
+    auto Inherited = Process::OpenFds();
+
+    pid_t Pid = fork();
+    if (Pid == 0) {
+        // the sockets go over the channel, a copy of them in the new process would
+        // keep connections open which this one closes
+        Process::CloseOnExec(Inherited, { ChannelFd });
+        execve(Binary.c_str(), ArgvPtrs.data(), EnvPtrs.data());
+        _exit(127);
+    }
+    return Pid;
+}
+
+void THotUpgrade::BecomeStub(int Successor) {
+    auto Env = Process::Environment({ ChannelVariable, SuccessorVariable, TStandby::ChannelVariable, TStandby::ConsoleVariable });
+    Env.push_back(std::string(SuccessorVariable) + "=" + std::to_string(Successor));
+    auto EnvPtrs = Process::Pointers(Env);
+    auto ArgvPtrs = Process::Pointers(mArgv);
+    // the sockets, the log and the channel, which tells the new process that this one is gone
+    Process::CloseOnExec(Process::OpenFds(), {});
+    // the console is the new process'
+    if (int Null = open("/dev/null", O_RDONLY); Null >= 0) {
+        dup2(Null, STDIN_FILENO);
+    }
+    execve("/proc/self/exe", ArgvPtrs.data(), EnvPtrs.data());
+}
+
+#else
+
+void THotUpgrade::TakeOver(int) { }
+void THotUpgrade::HandOver() { }
+int THotUpgrade::Spawn(int) { return -1; }
+void THotUpgrade::BecomeStub(int) { }
+
+#endif // __linux__
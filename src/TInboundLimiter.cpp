@@ -0,0 +1,116 @@
+#include "TInboundLimiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+TInboundLimiter::TInboundLimiter() {
+    auto Now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < mBuckets.size(); ++i) {
+        mBuckets[i] = TBucket { LimitOf(TInboundClass(i)).Burst, Now };
+    }
+    mThrottledUpdate = Now;
+}
+
+const TInboundLimiter::TLimit& TInboundLimiter::LimitOf(TInboundClass Class) {
+    // generous enough for a client with lots of vehicles, far below what a flood looks like
+    static const std::array<TLimit, size_t(TInboundClass::Count)> Limits { {
+        { 300, 600 }, // Position
+        { 30, 60 }, // Vehicle
+        { 60, 120 }, // Event
+        { 5, 20 }, // Chat
+        { 30, 60 }, // Compressed
+        { 20, 40 }, // Control
+    } };
+    return Limits[size_t(Class)];
+}
+
+TInboundClass TInboundLimiter::Classify(std::string_view Packet) {
+    if (Packet.empty()) {
+        return TInboundClass::Control;
+    }
+    if (Packet.compare(0, 4, "ABG:") == 0) {
+        return TInboundClass::Compressed;
+    }
+    switch (Packet.front()) {
+    case 'V':
+    case 'W':
+    case 'X':
+    case 'Y':
+    case 'Z':
+        return TInboundClass::Position;
+    case 'O':
+        return TInboundClass::Vehicle;
+    case 'E':
+    case 'N':
+    case 'J':
+        return TInboundClass::Event;
+    case 'C':
+        return TInboundClass::Chat;
+    default:
+        return TInboundClass::Control;
+    }
+}
+
+std::string_view TInboundLimiter::ClassName(TInboundClass Class) {
+    switch (Class) {
+    case TInboundClass::Position:
+        return "position";
+    case TInboundClass::Vehicle:
+        return "vehicle";
+    case TInboundClass::Event:
+        return "event";
+    case TInboundClass::Chat:
+        return "chat";
+    case TInboundClass::Compressed:
+        return "compressed";
+    case TInboundClass::Control:
+    case TInboundClass::Count:
+        break;
+    }
+    return "control";
+}
+
+double TInboundLimiter::Take(TInboundClass Class, std::chrono::steady_clock::time_point Now) {
+    const auto& Limit = LimitOf(Class);
+    auto& Bucket = mBuckets[size_t(Class)];
+    std::chrono::duration<double> Elapsed = Now - Bucket.LastRefill;
+    Bucket.Tokens = std::min(Limit.Burst, Bucket.Tokens + Elapsed.count() * Limit.Rate);
+    Bucket.LastRefill = Now;
+    Bucket.Tokens -= 1.0;
+    return Bucket.Tokens;
+}
+
+bool TInboundLimiter::Allow(TInboundClass Class) {
+    auto Now = std::chrono::steady_clock::now();
+    std::unique_lock Lock(mMutex);
+    if (Take(Class, Now) < 0.0) {
+        // dropped, so it doesn't cost anything
+        mBuckets[size_t(Class)].Tokens += 1.0;
+        Lock.unlock();
+        ++mDrops[size_t(Class)];
+        return false;
+    }
+    return true;
+}
+
+std::chrono::steady_clock::duration TInboundLimiter::Throttle(TInboundClass Class) {
+    auto Now = std::chrono::steady_clock::now();
+    std::unique_lock Lock(mMutex);
+    double Tokens = Take(Class, Now);
+    if (Tokens >= 0.0) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+    // until the bucket is back at zero
+    std::chrono::duration<double> Delay(-Tokens / LimitOf(Class).Rate);
+    std::chrono::duration<double> Elapsed = Now - mThrottledUpdate;
+    mThrottledSeconds = mThrottledSeconds * std::exp(-Elapsed.count() / 60.0) + Delay.count();
+    mThrottledUpdate = Now;
+    Lock.unlock();
+    ++mThrottles[size_t(Class)];
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(Delay);
+}
+
+bool TInboundLimiter::IsFlooding() const {
+    std::unique_lock Lock(mMutex);
+    return mThrottledSeconds > FloodThreshold;
+}
@@ -0,0 +1,85 @@
+#include "TInboundScheduler.h"
+
+#include "Client.h"
+#include "TServer.h"
+
+#include <vector>
+
+TInboundScheduler::TInboundScheduler(TNetwork& Network, TPPSMonitor& PPSMonitor, TConnectionGate& Gate)
+    : mNetwork(Network)
+    , mPPSMonitor(PPSMonitor)
+    , mGate(Gate) {
+    Application::RegisterShutdownHandler([&] {
+        {
+            std::unique_lock Lock(mMutex);
+            mShutdown = true;
+        }
+        mCondition.notify_all();
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        mBusy.Reset();
+    });
+    mThread = std::thread(&TInboundScheduler::Loop, this);
+}
+
+void TInboundScheduler::Submit(const std::shared_ptr<TClient>& Client, std::string Packet, bool Reliable) {
+    { // locked context
+        std::unique_lock Lock(mMutex);
+        auto [Iter, IsNew] = mQueues.try_emplace(Client.get());
+        auto& Queue = Iter->second;
+        if (!Reliable && Queue.Packets.size() >= MaxQueuedPackets) {
+            Lock.unlock();
+            Client->InboundLimiter().CountQueueDrop();
+            return;
+        }
+        if (IsNew) {
+            Queue.Client = Client;
+            mTurns.push_back(Client.get());
+        }
+        if (!mBusy) {
+            mBusy = mGate.Join();
+        }
+        Queue.Packets.push_back(std::move(Packet));
+    } // end locked context
+    mCondition.notify_one();
+}
+
+void TInboundScheduler::Loop() {
+    RegisterThread("InboundScheduler");
+    std::vector<std::string> Batch;
+    while (true) {
+        std::shared_ptr<TClient> Client;
+        { // locked context
+            std::unique_lock Lock(mMutex);
+            mCondition.wait(Lock, [&] { return mShutdown || !mTurns.empty(); });
+            if (mShutdown) {
+                break;
+            }
+            auto Key = mTurns.front();
+            mTurns.pop_front();
+            auto& Queue = mQueues.at(Key);
+            Queue.Deficit += Quantum;
+            while (!Queue.Packets.empty() && Queue.Packets.front().size() <= Queue.Deficit) {
+                Queue.Deficit -= Queue.Packets.front().size();
+                Batch.push_back(std::move(Queue.Packets.front()));
+                Queue.Packets.pop_front();
+            }
+            Client = Queue.Client;
+            if (Queue.Packets.empty()) {
+                // an idle client doesn't save up its turns
+                mQueues.erase(Key);
+            } else {
+                mTurns.push_back(Key);
+            }
+        } // end locked context
+        for (auto& Packet : Batch) {
+            TServer::GlobalParser(Client, std::move(Packet), mPPSMonitor, mNetwork);
+        }
+        Batch.clear();
+        std::unique_lock Lock(mMutex);
+        if (mTurns.empty()) {
+            mBusy.Reset();
+        }
+    }
+}
@@ -0,0 +1,134 @@
+#include "TLinkEstimator.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#endif // __linux__
+
+TLinkEstimator::TLinkEstimator()
+    : mLastUpdate(std::chrono::steady_clock::now()) {
+}
+
+void TLinkEstimator::CountSent(size_t Bytes, bool Reliable) {
+    std::unique_lock Lock(mMutex);
+    mSentSinceUpdate += Bytes;
+    if (Reliable) {
+        mReliableSentSinceUpdate += Bytes;
+    }
+}
+
+void TLinkEstimator::OnUDPSequence(uint16_t Sequence) {
+    std::unique_lock Lock(mMutex);
+    ++mSequenceReceived;
+    if (!mHasSequence) {
+        mHasSequence = true;
+        mLastSequence = Sequence;
+        ++mSequenceExpected;
+        return;
+    }
+    auto Delta = uint16_t(Sequence - mLastSequence);
+    if (Delta == 0 || Delta > 0x8000) {
+        // duplicate or late, it was counted as missing already
+        mSequenceExpected = std::max(mSequenceExpected, mSequenceReceived);
+        return;
+    }
+    if (Delta > 1000) {
+        // the client restarted its numbering, start over
+        ++mSequenceExpected;
+    } else {
+        mSequenceExpected += Delta;
+    }
+    mLastSequence = Sequence;
+}
+
+bool TLinkEstimator::Update([[maybe_unused]] SOCKET TCPSock) {
+    auto Now = std::chrono::steady_clock::now();
+    std::unique_lock Lock(mMutex);
+    std::chrono::duration<double> Elapsed = Now - mLastUpdate;
+    if (Elapsed.count() <= 0.0) {
+        return false;
+    }
+    mLastUpdate = Now;
+    double TcpLoss = 0;
+    size_t Backlog = 0;
+#ifdef __linux__
+    tcp_info Info {};
+    socklen_t InfoSize = sizeof(Info);
+    if (TCPSock > 0 && getsockopt(TCPSock, IPPROTO_TCP, TCP_INFO, &Info, &InfoSize) == 0) {
+        double RttMs = Info.tcpi_rtt / 1000.0;
+        if (RttMs > 0) {
+            mStats.RttMs = mStats.RttMs == 0 ? RttMs : mStats.RttMs * 0.75 + RttMs * 0.25;
+            mMinRttMs = mMinRttMs == 0 ? RttMs : std::min(mMinRttMs, RttMs);
+        }
+        // the counter starts over with a new connection (resumed session)
+        if (mHasTcpSample && Info.tcpi_total_retrans >= mLastRetransmissions) {
+            auto Retransmissions = Info.tcpi_total_retrans - mLastRetransmissions;
+            // roughly how many segments went out since the last sample
+            auto Segments = mReliableSentSinceUpdate / std::max<uint32_t>(1, Info.tcpi_snd_mss);
+            if (Segments >= MinLossSamples) {
+                TcpLoss = std::min(1.0, double(Retransmissions) / double(Segments));
+            }
+        }
+        mHasTcpSample = true;
+        mLastRetransmissions = Info.tcpi_total_retrans;
+    }
+    int Queued = 0;
+    if (TCPSock > 0 && ioctl(TCPSock, TIOCOUTQ, &Queued) == 0 && Queued > 0) {
+        Backlog = size_t(Queued);
+    }
+#endif // __linux__
+    double UdpLoss = 0;
+    if (mSequenceExpected >= MinLossSamples) {
+        UdpLoss = 1.0 - std::min(1.0, double(mSequenceReceived) / double(mSequenceExpected));
+    }
+    mSequenceExpected = 0;
+    mSequenceReceived = 0;
+
+    // whatever didn't pile up in the send buffer made it out
+    double Drained = double(mSentSinceUpdate) - (double(Backlog) - double(mStats.Backlog));
+    double Delivered = std::max(0.0, Drained) / Elapsed.count();
+    mStats.Bandwidth = mStats.Bandwidth == 0 ? Delivered : mStats.Bandwidth * 0.75 + Delivered * 0.25;
+    mStats.Loss = std::max(TcpLoss, UdpLoss);
+    bool BacklogGrowing = Backlog > CongestedBacklog && Backlog >= mStats.Backlog;
+    mStats.Backlog = Backlog;
+    mSentSinceUpdate = 0;
+    mReliableSentSinceUpdate = 0;
+
+    bool RttInflated = mMinRttMs > 0 && mStats.RttMs > mMinRttMs * CongestedRttFactor + CongestedRttSlackMs;
+    bool Congested = mStats.Loss > CongestedLoss || BacklogGrowing || RttInflated;
+    if (Congested) {
+        mStats.RateScale = std::max(MinRateScale, mStats.RateScale * DecreaseFactor);
+    } else {
+        mStats.RateScale = std::min(1.0, mStats.RateScale + IncreaseStep);
+    }
+    bool Changed = Congested != mCongested;
+    mCongested = Congested;
+    return Changed;
+}
+
+bool TLinkEstimator::ShouldSendPosition(int SenderID) {
+    std::unique_lock Lock(mMutex);
+    if (mStats.RateScale >= 1.0) {
+        return true;
+    }
+    auto& Credit = mPositionCredit[SenderID];
+    Credit += mStats.RateScale;
+    if (Credit < 1.0) {
+        return false;
+    }
+    Credit -= 1.0;
+    return true;
+}
+
+TLinkEstimator::TStats TLinkEstimator::Stats() const {
+    std::unique_lock Lock(mMutex);
+    return mStats;
+}
+
+bool TLinkEstimator::IsCongested() const {
+    std::unique_lock Lock(mMutex);
+    return mCongested;
+}
@@ -5,6 +5,7 @@
 #include "Defer.h"
 #include "TLuaEngine.h"
 #include "TNetwork.h"
+#include "TPacketSchema.h"
 #include "TServer.h"
 
 #include <future>
@@ -23,6 +24,24 @@ static TLuaEngine& Engine() {
     return *TheEngine;
 }
 
+// how many lua passes this thread holds, lua which calls into lua on the same thread
+// joins the outer pass, a closing gate would wait for it otherwise
+static thread_local int LuaPasses = 0;
+
+class TLuaPass final {
+public:
+    explicit TLuaPass(TLuaEngine& Engine)
+        : mPass(LuaPasses > 0 ? Engine.Gate().Join() : Engine.Gate().Enter()) {
+        ++LuaPasses;
+    }
+    ~TLuaPass() { --LuaPasses; }
+    TLuaPass(const TLuaPass&) = delete;
+    TLuaPass& operator=(const TLuaPass&) = delete;
+
+private:
+    TConnectionGate::TPass mPass;
+};
+
 std::shared_ptr<TLuaArg> CreateArg(lua_State* L, int T, int S) {
     if (S > T)
         return nullptr;
@@ -83,7 +102,7 @@ std::any TriggerLuaEvent(const std::string& Event, bool local, TLuaFile* Caller,
                     if (R.type() == typeid(int)) {
                         if (std::any_cast<int>(R))
                             Ret++;
-                    } else if (Event == "onPlayerAuth")
+                    } else if (Event == "onPlayerAuth" || Event == "onPlayerKey")
                         return R;
                 }
             } else {
@@ -91,7 +110,7 @@ std::any TriggerLuaEvent(const std::string& Event, bool local, TLuaFile* Caller,
                 if (R.type() == typeid(int)) {
                     if (std::any_cast<int>(R))
                         Ret++;
-                } else if (Event == "onPlayerAuth")
+                } else if (Event == "onPlayerAuth" || Event == "onPlayerKey")
                     return R;
             }
         }
@@ -183,6 +202,7 @@ int lua_TriggerEventG(lua_State* L) {
 }
 
 void SafeExecution(TLuaFile* lua, const std::string& FuncName) {
+    TLuaPass Pass(lua->Engine());
     lua_State* luaState = lua->GetState();
     lua_getglobal(luaState, FuncName.c_str());
     if (lua_isfunction(luaState, -1)) {
@@ -363,6 +383,155 @@ int lua_GetIdentifiers(lua_State* L) {
     return 1;
 }
 
+int lua_GetDropCounts(lua_State* L) {
+    if (lua_isnumber(L, 1)) {
+        auto MaybeClient = GetClient(Engine().Server(), int(lua_tonumber(L, 1)));
+        if (MaybeClient && !MaybeClient.value().expired()) {
+            auto Client = MaybeClient.value().lock();
+            auto& Limiter = Client->InboundLimiter();
+            lua_newtable(L);
+            for (size_t i = 0; i < size_t(TInboundClass::Count); ++i) {
+                lua_pushstring(L, std::string(TInboundLimiter::ClassName(TInboundClass(i))).c_str());
+                lua_pushinteger(L, lua_Integer(Limiter.Drops(TInboundClass(i))));
+                lua_settable(L, -3);
+            }
+            lua_pushstring(L, "queue");
+            lua_pushinteger(L, lua_Integer(Limiter.QueueDrops()));
+            lua_settable(L, -3);
+            // reliable packets aren't dropped, the player is slowed down instead
+            uint64_t Throttles = 0;
+            for (size_t i = 0; i < size_t(TInboundClass::Count); ++i) {
+                Throttles += Limiter.Throttles(TInboundClass(i));
+            }
+            lua_pushstring(L, "throttled");
+            lua_pushinteger(L, lua_Integer(Throttles));
+            lua_settable(L, -3);
+        } else
+            return 0;
+    } else {
+        SendError(Engine(), L, "GetPlayerDropCounts wrong arguments");
+        return 0;
+    }
+    return 1;
+}
+
+int lua_GetLinkStats(lua_State* L) {
+    if (lua_isnumber(L, 1)) {
+        auto MaybeClient = GetClient(Engine().Server(), int(lua_tonumber(L, 1)));
+        if (MaybeClient && !MaybeClient.value().expired()) {
+            auto Stats = MaybeClient.value().lock()->Link().Stats();
+            lua_newtable(L);
+            lua_pushstring(L, "rtt");
+            lua_pushnumber(L, Stats.RttMs);
+            lua_settable(L, -3);
+            lua_pushstring(L, "loss");
+            lua_pushnumber(L, Stats.Loss);
+            lua_settable(L, -3);
+            lua_pushstring(L, "backlog");
+            lua_pushinteger(L, lua_Integer(Stats.Backlog));
+            lua_settable(L, -3);
+            lua_pushstring(L, "bandwidth");
+            lua_pushnumber(L, Stats.Bandwidth);
+            lua_settable(L, -3);
+            lua_pushstring(L, "rate");
+            lua_pushnumber(L, Stats.RateScale);
+            lua_settable(L, -3);
+        } else
+            return 0;
+    } else {
+        SendError(Engine(), L, "GetPlayerLinkStats wrong arguments");
+        return 0;
+    }
+    return 1;
+}
+
+int lua_GetVehiclePosition(lua_State* L) {
+    if (lua_isnumber(L, 1) && lua_isnumber(L, 2)) {
+        auto Transform = Engine().Server().VehicleTransforms().Find(int(lua_tointeger(L, 1)), int(lua_tointeger(L, 2)));
+        if (!Transform)
+            return 0;
+        lua_newtable(L);
+        const char* Axes[] = { "x", "y", "z" };
+        for (size_t i = 0; i < 3; ++i) {
+            lua_pushstring(L, Axes[i]);
+            lua_pushnumber(L, Transform->Position[i]);
+            lua_settable(L, -3);
+        }
+    } else {
+        SendError(Engine(), L, "GetVehiclePosition wrong arguments");
+        return 0;
+    }
+    return 1;
+}
+
+int lua_GetVehiclesInRadius(lua_State* L) {
+    if (lua_isnumber(L, 1) && lua_isnumber(L, 2) && lua_isnumber(L, 3) && lua_isnumber(L, 4)) {
+        std::array<double, 3> Position { lua_tonumber(L, 1), lua_tonumber(L, 2), lua_tonumber(L, 3) };
+        // only ever one room's vehicles, the default one's unless it's given
+        std::string Room(lua_isstring(L, 5) ? lua_tostring(L, 5) : std::string(TServer::DefaultRoom));
+        auto Found = Engine().Server().VehicleTransforms().FindInRadius(Room, Position, lua_tonumber(L, 4));
+        lua_newtable(L);
+        lua_Integer Index = 1;
+        for (const auto& [PlayerID, VehicleID] : Found) {
+            lua_pushinteger(L, Index++);
+            lua_newtable(L);
+            lua_pushstring(L, "playerID");
+            lua_pushinteger(L, PlayerID);
+            lua_settable(L, -3);
+            lua_pushstring(L, "vehicleID");
+            lua_pushinteger(L, VehicleID);
+            lua_settable(L, -3);
+            lua_settable(L, -3);
+        }
+    } else {
+        SendError(Engine(), L, "GetVehiclesInRadius wrong arguments");
+        return 0;
+    }
+    return 1;
+}
+
+int lua_GetPlayerRoom(lua_State* L) {
+    if (lua_isnumber(L, 1)) {
+        auto MaybeClient = GetClient(Engine().Server(), int(lua_tonumber(L, 1)));
+        if (MaybeClient && !MaybeClient.value().expired()) {
+            lua_pushstring(L, Engine().Server().RoomOf(*MaybeClient.value().lock()).c_str());
+        } else
+            return 0;
+    } else {
+        SendError(Engine(), L, "GetPlayerRoom wrong arguments");
+        return 0;
+    }
+    return 1;
+}
+
+int lua_SetPlayerRoom(lua_State* L) {
+    if (!lua_isnumber(L, 1) || !lua_isstring(L, 2)) {
+        SendError(Engine(), L, "SetPlayerRoom wrong arguments");
+        return 0;
+    }
+    auto MaybeClient = GetClient(Engine().Server(), int(lua_tonumber(L, 1)));
+    if (!MaybeClient || MaybeClient.value().expired()) {
+        SendError(Engine(), L, "SetPlayerRoom invalid Player ID");
+        return 0;
+    }
+    auto Client = MaybeClient.value().lock();
+    std::string Room = lua_tostring(L, 2);
+    auto Map = TServer::RoomMap(Room);
+    if (!Map) {
+        SendError(Engine(), L, "SetPlayerRoom no room called \"" + Room + "\"");
+        return 0;
+    }
+    auto& Server = Engine().Server();
+    if (Client->IsMapSent() && TServer::RoomMap(Server.RoomOf(*Client)) != Map) {
+        SendError(Engine(), L, "SetPlayerRoom \"" + Room + "\" has another map than the one the player loaded, move them in onPlayerConnecting instead");
+        return 0;
+    }
+    if (Server.RoomOf(*Client) != Room) {
+        Engine().Network().MoveToRoom(Client, Room);
+    }
+    return 0;
+}
+
 int lua_GetCars(lua_State* L) {
     if (lua_isnumber(L, 1)) {
         int ID = int(lua_tonumber(L, 1));
@@ -457,8 +626,8 @@ int lua_RemoveVehicle(lua_State* L) {
         }
         auto c = MaybeClient.value().lock();
         if (!c->GetCarData(VID).empty()) {
-            std::string Destroy = "Od:" + std::to_string(PID) + "-" + std::to_string(VID);
-            Engine().Network().SendToAll(nullptr, Destroy, true, true);
+            std::string Destroy = PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { PID, VID });
+            Engine().Network().SendToAll(c.get(), Destroy, true, true);
             c->DeleteCar(VID);
         }
     } else
@@ -490,7 +659,7 @@ int lua_RemoteEvent(lua_State* L) {
         return 0;
     }
     int ID = int(lua_tointeger(L, 1));
-    std::string Packet = "E:" + std::string(lua_tostring(L, 2)) + ":" + std::string(lua_tostring(L, 3));
+    std::string Packet = PacketSchema::Serialize<PacketSchema::TEvent>(lua_tostring(L, 2), lua_tostring(L, 3));
     if (ID == -1)
         Engine().Network().SendToAll(nullptr, Packet, true, true);
     else {
@@ -582,6 +751,8 @@ int lua_Set(lua_State* L) {
         warn(("Invalid config ID : ") + std::to_string(C));
         break;
     }
+    // settings are part of the heartbeat
+    Application::NotifyStateChanged();
 
     return 0;
 }
@@ -654,12 +825,14 @@ TLuaFile::TLuaFile(TLuaEngine& Engine, bool Console)
 }
 
 void TLuaFile::Execute(const std::string& Command) {
+    TLuaPass Pass(mEngine);
     if (ConsoleCheck(mLuaState, luaL_dostring(mLuaState, Command.c_str()))) {
         lua_settop(mLuaState, 0);
     }
 }
 
 void TLuaFile::Reload() {
+    TLuaPass Pass(mEngine);
     if (CheckLua(mLuaState, luaL_dofile(mLuaState, mFileName.c_str()))) {
         CallFunction(this, ("onInit"), nullptr);
     }
@@ -670,6 +843,7 @@ std::string TLuaFile::GetOrigin() {
 }
 
 std::any CallFunction(TLuaFile* lua, const std::string& FuncName, std::shared_ptr<TLuaArg> Arg) {
+    TLuaPass Pass(lua->Engine());
     lua_State* luaState = lua->GetState();
     lua_getglobal(luaState, FuncName.c_str());
     if (lua_isfunction(luaState, -1)) {
@@ -718,6 +892,12 @@ void TLuaFile::Load() {
     lua_register(mLuaState, "GetPlayerDiscordID", lua_TempFix);
     lua_register(mLuaState, "CreateThread", lua_CreateThread);
     lua_register(mLuaState, "GetPlayerVehicles", lua_GetCars);
+    lua_register(mLuaState, "GetVehiclePosition", lua_GetVehiclePosition);
+    lua_register(mLuaState, "GetVehiclesInRadius", lua_GetVehiclesInRadius);
+    lua_register(mLuaState, "GetPlayerRoom", lua_GetPlayerRoom);
+    lua_register(mLuaState, "SetPlayerRoom", lua_SetPlayerRoom);
+    lua_register(mLuaState, "GetPlayerDropCounts", lua_GetDropCounts);
+    lua_register(mLuaState, "GetPlayerLinkStats", lua_GetLinkStats);
     lua_register(mLuaState, "SendChatMessage", lua_sendChat);
     lua_register(mLuaState, "GetPlayers", lua_GetAllPlayers);
     lua_register(mLuaState, "GetPlayerGuest", lua_GetGuest);
@@ -1,14 +1,33 @@
 #include "TNetwork.h"
 #include "Client.h"
+#include "THotUpgrade.h"
+#include "TStandby.h"
 #include <CustomAssert.h>
-#include <Http.h>
+#include <TPacketSchema.h>
+#include <algorithm>
 #include <array>
 #include <cstring>
+#include <limits>
+#include <optional>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/ioctl.h>
+
+// the processes this one starts don't inherit the sockets, the standby is sent them
+constexpr int CloseOnExec = SOCK_CLOEXEC;
+#else
+constexpr int CloseOnExec = 0;
+#endif // __linux__
 
 TNetwork::TNetwork(TServer& Server, TPPSMonitor& PPSMonitor, TResourceManager& ResourceManager)
     : mServer(Server)
     , mPPSMonitor(PPSMonitor)
-    , mResourceManager(ResourceManager) {
+    , mResourceManager(ResourceManager)
+    , mAdmission(Server)
+    , mInbound(*this, PPSMonitor, mGate)
+    , mAuthPipeline(*this, Server) {
     Application::RegisterShutdownHandler([&] {
         debug("Kicking all players due to shutdown");
         Server.ForEachClient([&](std::weak_ptr<TClient> client) -> bool {
@@ -30,10 +49,80 @@ TNetwork::TNetwork(TServer& Server, TPPSMonitor& PPSMonitor, TResourceManager& R
             mTCPThread.detach();
         }
     });
+    Application::RegisterShutdownHandler([&] {
+        if (mUDPTimerThread.joinable()) {
+            mShutdown = true;
+            mUDPTimerThread.join();
+        }
+    });
+    if (!Application::Settings.RelaySecret.empty()) {
+        mRelayHub = std::make_unique<TRelayHub>(Server);
+        Server.AddObserver(*mRelayHub);
+    }
+    auto Index = TClusterWorker::Index();
+    if (Index || !Application::Settings.RelayUpstream.empty()) {
+        mMirror = std::make_unique<TWorldMirror>(Server, *this);
+    }
+    if (!Application::Settings.RelayUpstream.empty()) {
+        mRelayLink = std::make_unique<TRelayLink>(*mMirror, mGate, Application::Settings.RelayUpstream);
+    }
+#ifdef __linux__
+    if (Application::Settings.Standby && !Index && !mRelayLink) {
+        mStandby = std::make_unique<TStandbyFeed>(Server, *this);
+        Server.AddObserver(*mStandby);
+    }
+#endif // __linux__
+    if (Index) {
+        // the front takes the connections and datagrams and passes them on
+        mCluster = std::make_unique<TClusterWorker>(Server, *this, *mMirror, *Index);
+        mUDPSock = mCluster->UDPSocket();
+        Server.AddObserver(*mCluster);
+        mCluster->Start();
+    } else if (THotUpgrade::Channel() || TStandby::Channel()) {
+        // the sockets come from the process this one takes over from, see AdoptSockets
+    } else {
+        mTCPThread = std::thread(&TNetwork::TCPServerMain, this);
+        mUDPThread = std::thread(&TNetwork::UDPServerMain, this);
+    }
+    mUDPTimerThread = std::thread(&TNetwork::UDPTimerMain, this);
+}
+
+void TNetwork::AdoptSockets(SOCKET TCPListener, SOCKET UDPSock) {
+    mTCPListener = TCPListener;
+    mUDPSock = UDPSock;
     mTCPThread = std::thread(&TNetwork::TCPServerMain, this);
     mUDPThread = std::thread(&TNetwork::UDPServerMain, this);
 }
 
+void TNetwork::AdoptClient(const std::shared_ptr<TClient>& Client, const std::optional<TSessionStore::TSavedSession>& Session) {
+    mServer.InsertClient(Client);
+    if (Session) {
+        mSessions.Restore(Client, *Session);
+    }
+    // the observers of this process haven't seen it yet
+    mServer.NotifyPlayerUpdated(*Client);
+    TClient::TSetOfVehicleData VehicleData;
+    { // Vehicle Data Lock Scope
+        auto LockedData = Client->GetAllCars();
+        VehicleData = *LockedData.VehicleData;
+    } // End Vehicle Data Lock Scope
+    for (auto& v : VehicleData) {
+        mServer.NotifyVehicleUpdated(*Client, v.ID(), v.Data());
+    }
+    if (Session) {
+        mServer.NotifySessionIssued(*Client, Session->Token);
+    }
+    if (Client->HasCapability(TClient::CapReliableUDP) && Client->Reliable().Activate()) {
+        std::unique_lock Lock(mReliableMutex);
+        mReliableClients.push_back(Client);
+    }
+    if (Session && Session->Parked) {
+        // it may still resume its session here
+        return;
+    }
+    std::thread([this, Client] { TCPClient(Client, true); }).detach();
+}
+
 void TNetwork::UDPServerMain() {
     RegisterThread("UDPServer");
 #ifdef WIN32
@@ -58,21 +147,27 @@ void TNetwork::UDPServerMain() {
         //return;
     }
 #else // unix
-    mUDPSock = socket(AF_INET, SOCK_DGRAM, 0);
-    // Create a server hint structure for the server
-    sockaddr_in serverAddr {};
-    serverAddr.sin_addr.s_addr = INADDR_ANY; //Any Local
-    serverAddr.sin_family = AF_INET; // Address format is IPv4
-    serverAddr.sin_port = htons(uint16_t(Application::Settings.Port)); // Convert from little to big endian
-
-    // Try and bind the socket to the IP and port
-    if (bind(mUDPSock, (sockaddr*)&serverAddr, sizeof(serverAddr)) != 0) {
-        error(("Can't bind socket!") + std::string(strerror(errno)));
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        exit(-1);
-        //return;
+    // a hot upgrade hands the bound socket over
+    if (!mUDPSock) {
+        mUDPSock = socket(AF_INET, SOCK_DGRAM | CloseOnExec, 0);
+        // Create a server hint structure for the server
+        sockaddr_in serverAddr {};
+        serverAddr.sin_addr.s_addr = INADDR_ANY; //Any Local
+        serverAddr.sin_family = AF_INET; // Address format is IPv4
+        serverAddr.sin_port = htons(uint16_t(Application::Settings.Port)); // Convert from little to big endian
+
+        // Try and bind the socket to the IP and port
+        if (bind(mUDPSock, (sockaddr*)&serverAddr, sizeof(serverAddr)) != 0) {
+            error(("Can't bind socket!") + std::string(strerror(errno)));
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+            exit(-1);
+            //return;
+        }
     }
 #endif
+    if (mStandby) {
+        mStandby->ShareUDPSocket(mUDPSock);
+    }
 
     info(("Vehicle data network online on port ") + std::to_string(Application::Settings.Port) + (" with a Max of ")
         + std::to_string(Application::Settings.MaxPlayers) + (" Clients"));
@@ -80,37 +175,75 @@ void TNetwork::UDPServerMain() {
         try {
             sockaddr_in client {};
             std::string Data = UDPRcvFromClient(client); //Receives any data from Socket
-            size_t Pos = Data.find(':');
-            if (Data.empty() || Pos > 2)
+            if (Data.empty())
                 continue;
             /*char clientIp[256];
             ZeroMemory(clientIp, 256); ///Code to get IP we don't need that yet
             inet_ntop(AF_INET, &client.sin_addr, clientIp, 256);*/
-            uint8_t ID = uint8_t(Data.at(0)) - 1;
-            mServer.ForEachClient([&](std::weak_ptr<TClient> ClientPtr) -> bool {
-                std::shared_ptr<TClient> Client;
-                {
-                    ReadLock Lock(mServer.GetClientMutex());
-                    if (!ClientPtr.expired()) {
-                        Client = ClientPtr.lock();
-                    } else
-                        return true;
-                }
-
-                if (Client->GetID() == ID) {
-                    Client->SetUDPAddr(client);
-                    Client->SetIsConnected(true);
-                    TServer::GlobalParser(ClientPtr, Data.substr(2), mPPSMonitor, *this);
-                }
-
-                return true;
-            });
+            auto Pass = mGate.Enter();
+            HandleDatagram(client, std::move(Data));
         } catch (const std::exception& e) {
             error(("fatal: ") + std::string(e.what()));
         }
     }
 }
 
+bool TNetwork::ReadUDPHeader(std::string_view Data, int& ID, size_t& Start, std::optional<uint16_t>& Sequence) {
+    // <id + 1> or <marker><id, 2 bytes>, then either :<packet>
+    // or ;<sequence, 2 bytes><packet> from clients which number their packets
+    if (Data.empty()) {
+        return false;
+    }
+    if (uint8_t(Data[0]) == TClient::WideIDMarker) {
+        if (Data.size() < 4)
+            return false;
+        ID = TClient::ReadWideID(&Data[1]);
+        Start = 3;
+    } else {
+        ID = uint8_t(Data[0]) - 1;
+        Start = 1;
+    }
+    // a 0 byte would be ID -1, which is what clients without an ID yet have
+    if (ID < 0) {
+        return false;
+    }
+    Sequence.reset();
+    if (Data.size() > Start + 2 && Data[Start] == ';') {
+        Sequence = uint16_t(TClient::ReadWideID(&Data[Start + 1]));
+        Start += 3;
+    } else if (Data.size() > Start && Data[Start] == ':') {
+        Start += 1;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void TNetwork::HandleDatagram(const sockaddr_in& Addr, std::string Data) {
+    int ID;
+    size_t Start;
+    std::optional<uint16_t> Sequence;
+    if (!ReadUDPHeader(Data, ID, Start, Sequence)) {
+        return;
+    }
+    auto Client = mServer.FindClient(ID);
+    // only clients which said they number their packets may send them numbered
+    if (Client && (!Sequence || Client->HasCapability(TClient::CapUDPSequence))) {
+        Client->SetUDPAddr(Addr);
+        Client->SetIsConnected(true);
+        if (Sequence) {
+            Client->Link().OnUDPSequence(*Sequence);
+        }
+        auto Packet = Data.substr(Start);
+        if (Client->HasCapability(TClient::CapReliableUDP) && HandleReliableUDP(Client, Packet)) {
+            return;
+        }
+        if (AllowInbound(*Client, Packet)) {
+            mInbound.Submit(Client, std::move(Packet));
+        }
+    }
+}
+
 void TNetwork::TCPServerMain() {
     RegisterThread("TCPServer");
 #ifdef WIN32
@@ -142,13 +275,14 @@ void TNetwork::TCPServerMain() {
     info("Vehicle event network online");
     do {
         try {
-            client = accept(Listener, nullptr, nullptr);
+            sockaddr_in ClientAddr {};
+            int AddrLen = sizeof(ClientAddr);
+            client = accept(Listener, (sockaddr*)&ClientAddr, &AddrLen);
             if (client == -1) {
                 warn("Got an invalid client socket on connect! Skipping...");
                 continue;
             }
-            std::thread ID(&TNetwork::Identify, this, client);
-            ID.detach();
+            mAuthPipeline.Submit(client, ClientAddr);
         } catch (const std::exception& e) {
             error("fatal: " + std::string(e.what()));
         }
@@ -160,27 +294,35 @@ void TNetwork::TCPServerMain() {
     // wondering why we need slightly different implementations of this?
     // ask ms.
     SOCKET client = -1;
-    SOCKET Listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    int optval = 1;
-    setsockopt(Listener, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
-    // TODO: check optval or return value idk
-    sockaddr_in addr {};
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(uint16_t(Application::Settings.Port));
-    if (bind(Listener, (sockaddr*)&addr, sizeof(addr)) != 0) {
-        error(("Can't bind socket! ") + std::string(strerror(errno)));
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        exit(-1);
-    }
+    // a hot upgrade hands the listening socket over
+    SOCKET Listener = mTCPListener;
     if (Listener == -1) {
-        error(("Invalid listening socket"));
-        return;
+        Listener = socket(AF_INET, SOCK_STREAM | CloseOnExec, IPPROTO_TCP);
+        int optval = 1;
+        setsockopt(Listener, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+        // TODO: check optval or return value idk
+        sockaddr_in addr {};
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(uint16_t(Application::Settings.Port));
+        if (bind(Listener, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            error(("Can't bind socket! ") + std::string(strerror(errno)));
+            std::this_thread::sleep_for(std::chrono::seconds(5));
+            exit(-1);
+        }
+        if (Listener == -1) {
+            error(("Invalid listening socket"));
+            return;
+        }
+        if (listen(Listener, SOMAXCONN)) {
+            error(("listener failed ") + std::string(strerror(errno)));
+            //TODO fix me leak Listener
+            return;
+        }
+        mTCPListener = Listener;
     }
-    if (listen(Listener, SOMAXCONN)) {
-        error(("listener failed ") + std::string(strerror(errno)));
-        //TODO fix me leak Listener
-        return;
+    if (mStandby) {
+        mStandby->ShareTCPListener(Listener);
     }
     info(("Vehicle event network online"));
     do {
@@ -189,13 +331,19 @@ void TNetwork::TCPServerMain() {
                 debug("shutdown during TCP wait for accept loop");
                 break;
             }
-            client = accept(Listener, nullptr, nullptr);
+            sockaddr_in ClientAddr {};
+            socklen_t AddrLen = sizeof(ClientAddr);
+#ifdef __linux__
+            // non-blocking right away, the handshake is driven by the auth pipeline's poll loop
+            client = accept4(Listener, (sockaddr*)&ClientAddr, &AddrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+            client = accept(Listener, (sockaddr*)&ClientAddr, &AddrLen);
+#endif // __linux__
             if (client == -1) {
                 warn(("Got an invalid client socket on connect! Skipping..."));
                 continue;
             }
-            std::thread ID(&TNetwork::Identify, this, client);
-            ID.detach(); // TODO: Add to a queue and attempt to join periodically
+            AcceptConnection(client, ClientAddr);
         } catch (const std::exception& e) {
             error(("fatal: ") + std::string(e.what()));
         }
@@ -207,160 +355,18 @@ void TNetwork::TCPServerMain() {
 #endif
 }
 
-#undef GetObject //Fixes Windows
-
-#include "Json.h"
-namespace json = rapidjson;
-
-void TNetwork::Identify(SOCKET TCPSock) {
-    RegisterThreadAuto();
-    char Code;
-    if (recv(TCPSock, &Code, 1, 0) != 1) {
-        CloseSocketProper(TCPSock);
-        return;
-    }
-    if (Code == 'C') {
-        Authentication(TCPSock);
-    } else if (Code == 'D') {
-        HandleDownload(TCPSock);
-    } else {
-        CloseSocketProper(TCPSock);
-    }
-}
-
-void TNetwork::HandleDownload(SOCKET TCPSock) {
-    char D;
-    if (recv(TCPSock, &D, 1, 0) != 1) {
-        CloseSocketProper(TCPSock);
-        return;
-    }
-    auto ID = uint8_t(D);
-    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
-        ReadLock Lock(mServer.GetClientMutex());
-        if (!ClientPtr.expired()) {
-            auto c = ClientPtr.lock();
-            if (c->GetID() == ID) {
-                c->SetDownSock(TCPSock);
-            }
-        }
-        return true;
-    });
+void TNetwork::AcceptConnection(SOCKET TCPSock, const sockaddr_in& Addr) {
+    mAuthPipeline.Submit(TCPSock, Addr);
 }
 
-void TNetwork::Authentication(SOCKET TCPSock) {
-    auto Client = CreateClient(TCPSock);
-
-    std::string Rc;
-    info("Identifying new client...");
-
-    Rc = TCPRcv(*Client);
-
-    if (Rc.size() > 3 && Rc.substr(0, 2) == "VC") {
-        Rc = Rc.substr(2);
-        if (Rc.length() > 4 || Rc != Application::ClientVersion()) {
-            ClientKick(*Client, "Outdated Version!");
-            return;
-        }
+void TNetwork::HandleDownload(SOCKET TCPSock, int ID) {
+    auto Client = mServer.FindClient(ID);
+    if (Client) {
+        Client->SetDownSock(TCPSock);
     } else {
-        ClientKick(*Client, "Invalid version header!");
-        return;
-    }
-    if (!TCPSend(*Client, "S")) {
-        // TODO: handle
-    }
-
-    Rc = TCPRcv(*Client);
-
-    if (Rc.size() > 50) {
-        ClientKick(*Client, "Invalid Key!");
-        return;
-    }
-
-    auto RequestString = R"({"key":")" + Rc + "\"}";
-
-    auto Target = "/pkToUser";
-    int ResponseCode = -1;
-    if (!Rc.empty()) {
-        Rc = Http::POST(Application::GetBackendUrlForAuth(), Target, {}, RequestString, true, &ResponseCode);
-    }
-
-    json::Document AuthResponse;
-    AuthResponse.Parse(Rc.c_str());
-    if (Rc == "-1" || AuthResponse.HasParseError()) {
-        ClientKick(*Client, "Invalid key! Please restart your game.");
-        return;
-    }
-
-    if (!AuthResponse.IsObject()) {
-        if (Rc == "0") {
-            auto Lock = Sentry.CreateExclusiveContext();
-            Sentry.SetContext("auth",
-                { { "response-body", Rc },
-                    { "key", RequestString } });
-            Sentry.SetTransaction(Application::GetBackendUrlForAuth() + Target);
-            Sentry.Log(SentryLevel::Info, "default", "backend returned 0 instead of json (" + std::to_string(ResponseCode) + ")");
-        } else { // Rc != "0"
-            ClientKick(*Client, "Backend returned invalid auth response format.");
-            error("Backend returned invalid auth response format. This should never happen.");
-            auto Lock = Sentry.CreateExclusiveContext();
-            Sentry.SetContext("auth",
-                { { "response-body", Rc },
-                    { "key", RequestString } });
-            Sentry.SetTransaction(Application::GetBackendUrlForAuth() + Target);
-            Sentry.Log(SentryLevel::Error, "default", "unexpected backend response (" + std::to_string(ResponseCode) + ")");
-        }
-        return;
-    }
-
-    if (AuthResponse["username"].IsString() && AuthResponse["roles"].IsString()
-        && AuthResponse["guest"].IsBool() && AuthResponse["identifiers"].IsArray()) {
-
-        Client->SetName(AuthResponse["username"].GetString());
-        Client->SetRoles(AuthResponse["roles"].GetString());
-        Client->SetIsGuest(AuthResponse["guest"].GetBool());
-        for (const auto& ID : AuthResponse["identifiers"].GetArray()) {
-            Client->AddIdentifier(ID.GetString());
-        }
-    } else {
-        ClientKick(*Client, "Invalid authentication data!");
-        return;
-    }
-
-    debug("Name -> " + Client->GetName() + ", Guest -> " + std::to_string(Client->IsGuest()) + ", Roles -> " + Client->GetRoles());
-    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
-        std::shared_ptr<TClient> Cl;
-        {
-            ReadLock Lock(mServer.GetClientMutex());
-            if (!ClientPtr.expired()) {
-                Cl = ClientPtr.lock();
-            } else
-                return true;
-        }
-        if (Cl->GetName() == Client->GetName() && Cl->IsGuest() == Client->IsGuest()) {
-            CloseSocketProper(Cl->GetTCPSock());
-            Cl->SetStatus(-2);
-            return false;
-        }
-
-        return true;
-    });
-
-    auto arg = std::make_unique<TLuaArg>(TLuaArg { { Client->GetName(), Client->GetRoles(), Client->IsGuest() } });
-    std::any Res = TriggerLuaEvent("onPlayerAuth", false, nullptr, std::move(arg), true);
-    if (Res.type() == typeid(int) && std::any_cast<int>(Res)) {
-        ClientKick(*Client, "you are not allowed on the server!");
-        return;
-    } else if (Res.type() == typeid(std::string)) {
-        ClientKick(*Client, std::any_cast<std::string>(Res));
-        return;
+        debug("download socket for unknown client ID " + std::to_string(ID));
+        CloseSocketProper(TCPSock);
     }
-
-    if (mServer.ClientCount() < size_t(Application::Settings.MaxPlayers)) {
-        info("Identification success");
-        mServer.InsertClient(Client);
-        TCPClient(Client);
-    } else
-        ClientKick(*Client, "Server full!");
 }
 
 std::shared_ptr<TClient> TNetwork::CreateClient(SOCKET TCPSock) {
@@ -409,6 +415,7 @@ bool TNetwork::TCPSend(TClient& c, const std::string& Data, bool IsSync) {
         Sent += Temp;
         c.UpdatePingTime();
     } while (Sent < Size);
+    c.Link().CountSent(size_t(Size), true);
     return true;
 }
 
@@ -475,7 +482,7 @@ std::string TNetwork::TCPRcv(TClient& c) {
 
 void TNetwork::ClientKick(TClient& c, const std::string& R) {
     info("Client kicked: " + R);
-    if (!TCPSend(c, "E" + R)) {
+    if (!TCPSend(c, PacketSchema::Serialize<PacketSchema::TKick>(R))) {
         // TODO handle
     }
     c.SetStatus(-2);
@@ -495,46 +502,55 @@ void TNetwork::Looper(const std::weak_ptr<TClient>& c) {
         }
         if (!Client->IsSyncing() && Client->IsSynced() && Client->MissedPacketQueueSize() != 0) {
             //debug("sending " + std::to_string(Client->MissedPacketQueueSize()) + " queued packets");
-            while (Client->MissedPacketQueueSize() > 0) {
-                std::string QData {};
-                { // locked context
-                    std::unique_lock lock(Client->MissedPacketQueueMutex());
-                    if (Client->MissedPacketQueueSize() <= 0) {
-                        break;
-                    }
-                    QData = Client->MissedPacketQueue().front();
-                    Client->MissedPacketQueue().pop();
-                } // end locked context
-                // debug("sending a missed packet: " + QData);
-                if (!TCPSend(*Client, QData, true)) {
+            while (true) {
+                // what's still queued when a hot upgrade stops this is sent by the new process.
+                // a packet waits until there's room for it in the socket, so the pass isn't
+                // held while the send blocks on a client which doesn't read.
+                auto Pass = mGate.Enter();
+                auto QData = Client->DequeuePacket(TCPSendRoom(*Client));
+                if (!QData) {
+                    break;
+                }
+                // debug("sending a missed packet: " + QData->Data);
+                // a stream stays on the transport it's on, so its packets can't overtake each
+                // other. it only moves to UDP once everything sent over TCP has arrived.
+                auto Stream = TReliableChannel::StreamOf(QData->Code);
+                if (Stream && !Client->Reliable().Carries(*Stream) && UsesReliableUDP(*Client) && IsTCPDrained(*Client)) {
+                    Client->Reliable().Carry(*Stream);
+                }
+                bool Sent = Stream && Client->Reliable().Carries(*Stream)
+                    ? ReliableUDPSend(Client, *Stream, QData->Data)
+                    : TCPSend(*Client, QData->Data, true);
+                if (!Sent) {
                     if (Client->GetStatus() > -1)
                         Client->SetStatus(-1);
-                    {
-                        std::unique_lock lock(Client->MissedPacketQueueMutex());
-                        while (!Client->MissedPacketQueue().empty()) {
-                            Client->MissedPacketQueue().pop();
-                        }
-                    }
+                    // the rest stays queued, in case the client resumes its session
                     CloseSocketProper(Client->GetTCPSock());
                     break;
                 }
             }
+            if (Client->MissedPacketQueueSize() != 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
         } else {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
     }
 }
-void TNetwork::TCPClient(const std::weak_ptr<TClient>& c) {
+void TNetwork::TCPClient(const std::weak_ptr<TClient>& c, bool Resumed) {
     // TODO: the c.expired() might cause issues here, remove if you end up here with your debugger
     if (c.expired() || c.lock()->GetTCPSock() == -1) {
         mServer.RemoveClient(c);
         return;
     }
-    OnConnect(c);
+    if (!Resumed)
+        OnConnect(c);
     RegisterThread("(" + std::to_string(c.lock()->GetID()) + ") \"" + c.lock()->GetName() + "\"");
 
     std::thread QueueSync(&TNetwork::Looper, this, c);
 
+    // a client over its rate limit isn't read from for a while, so TCP slows it down
+    std::chrono::steady_clock::duration Throttled {};
     while (true) {
         if (c.expired())
             break;
@@ -543,13 +559,27 @@ void TNetwork::TCPClient(const std::weak_ptr<TClient>& c) {
             debug("client status < 0, breaking client loop");
             break;
         }
+        if (Throttled.count() > 0) {
+            std::this_thread::sleep_for(Throttled);
+        }
 
+        WaitForPacket(*Client);
+        auto Pass = mGate.Enter();
         auto res = TCPRcv(*Client);
         if (res == "") {
             debug("TCPRcv error, break client loop");
             break;
         }
-        TServer::GlobalParser(c, res, mPPSMonitor, *this);
+        Throttled = ThrottleInbound(*Client, res);
+        if (res.compare(0, 4, "ABG:") == 0) {
+            res = DeComp(res.substr(4));
+        }
+        if (!res.empty() && res.front() == 'H') {
+            // joining waits in line and then sends the whole world, a hot upgrade mustn't
+            // wait for that. SyncClient takes the gate itself where it changes the state.
+            Pass.Reset();
+        }
+        TServer::GlobalParser(c, std::move(res), mPPSMonitor, *this);
     }
     if (QueueSync.joinable())
         QueueSync.join();
@@ -562,18 +592,64 @@ void TNetwork::TCPClient(const std::weak_ptr<TClient>& c) {
     }
 }
 
-void TNetwork::UpdatePlayer(TClient& Client) {
-    std::string Packet = ("Ss") + std::to_string(mServer.ClientCount()) + "/" + std::to_string(Application::Settings.MaxPlayers) + ":";
-    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
-        ReadLock Lock(mServer.GetClientMutex());
-        if (!ClientPtr.expired()) {
-            auto c = ClientPtr.lock();
-            Packet += c->GetName() + ",";
+void TNetwork::WaitForPacket(TClient& c) {
+#ifdef __linux__
+    // a hot upgrade closes the gate, what the client sends in the meantime stays in the
+    // socket for the new process. the gate is only entered once the whole packet is there,
+    // so the pass isn't held while the read blocks on a client which sends half of one.
+    // errors are left for the recv to find.
+    SOCKET Sock = c.GetTCPSock();
+    int LowWater = 1;
+    while (true) {
+        // poll() only says it's readable once LowWater bytes are there
+        pollfd Fd { Sock, POLLIN | POLLRDHUP, 0 };
+        if (poll(&Fd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
         }
-        return true;
-    });
-    Packet = Packet.substr(0, Packet.length() - 1);
-    Client.EnqueuePacket(Packet);
+        if ((Fd.revents & POLLIN) == 0 || (Fd.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0) {
+            break;
+        }
+        int32_t Header = 0;
+        auto Peeked = recv(Sock, &Header, sizeof(Header), MSG_PEEK | MSG_DONTWAIT);
+        if (Peeked <= 0) {
+            break;
+        }
+        int Needed = sizeof(Header);
+        if (Peeked == sizeof(Header)) {
+            // TCPRcv kicks the client for that
+            if (Header < 0 || Header >= 100 * MB) {
+                break;
+            }
+            // the kernel caps the low water mark at half the buffer, a packet bigger than
+            // that is read as soon as that much of it is there
+            int Buffer = 0;
+            socklen_t Length = sizeof(Buffer);
+            int MaxLowWater = getsockopt(Sock, SOL_SOCKET, SO_RCVBUF, &Buffer, &Length) == 0 ? std::max(Buffer / 2, Needed) : Needed;
+            Needed = int(std::min<int64_t>(int64_t(sizeof(Header)) + Header, MaxLowWater));
+        }
+        int Available = 0;
+        if (ioctl(Sock, FIONREAD, &Available) != 0 || Available >= Needed) {
+            break;
+        }
+        LowWater = Needed;
+        setsockopt(Sock, SOL_SOCKET, SO_RCVLOWAT, &LowWater, sizeof(LowWater));
+    }
+    if (LowWater != 1) {
+        LowWater = 1;
+        setsockopt(Sock, SOL_SOCKET, SO_RCVLOWAT, &LowWater, sizeof(LowWater));
+    }
+#else
+    // hot upgrades are linux only, the gate never closes here, so it doesn't matter that
+    // the pass is held while the recv blocks
+    (void)c;
+#endif // __linux__
+}
+
+void TNetwork::UpdatePlayer(TClient& Client) {
+    Client.EnqueuePacket(mServer.GetPlayerList()->Packet);
     //(void)Respond(Client, Packet, true);
 }
 
@@ -582,6 +658,24 @@ void TNetwork::OnDisconnect(const std::weak_ptr<TClient>& ClientPtr, bool kicked
     auto LockedClientPtr = ClientPtr.lock();
     TClient& c = *LockedClientPtr;
     info(c.GetName() + (" Connection Terminated"));
+    if (!kicked && c.IsSynced() && mSessions.Park(c)) {
+        // everyone else keeps seeing the player and their vehicles until the grace period is over
+        info("Keeping the session of " + c.GetName() + " for " + std::to_string(Application::Settings.ResumeGracePeriod) + " seconds");
+        if (c.GetTCPSock())
+            CloseSocketProper(c.GetTCPSock());
+        if (c.GetDownSock())
+            CloseSocketProper(c.GetDownSock());
+        // the numbers may belong to someone else's sockets soon
+        c.SetTCPSock(-1);
+        c.SetDownSock(0);
+        c.SetIsConnected(false);
+        return;
+    }
+    RemoveFromGame(LockedClientPtr, kicked);
+}
+
+void TNetwork::RemoveFromGame(const std::shared_ptr<TClient>& Client, bool Kicked) {
+    TClient& c = *Client;
     std::string Packet;
     TClient::TSetOfVehicleData VehicleData;
     { // Vehicle Data Lock Scope
@@ -589,13 +683,13 @@ void TNetwork::OnDisconnect(const std::weak_ptr<TClient>& ClientPtr, bool kicked
         VehicleData = *LockedData.VehicleData;
     } // End Vehicle Data Lock Scope
     for (auto& v : VehicleData) {
-        Packet = "Od:" + std::to_string(c.GetID()) + "-" + std::to_string(v.ID());
+        Packet = PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { c.GetID(), v.ID() });
         SendToAll(&c, Packet, false, true);
     }
-    if (kicked)
-        Packet = ("L") + c.GetName() + (" was kicked!");
+    if (Kicked)
+        Packet = PacketSchema::Serialize<PacketSchema::TLeaveMessage>(c.GetName() + " was kicked!");
     else
-        Packet = ("L") + c.GetName() + (" left the server!");
+        Packet = PacketSchema::Serialize<PacketSchema::TLeaveMessage>(c.GetName() + " left the server!");
     SendToAll(&c, Packet, false, true);
     Packet.clear();
     TriggerLuaEvent(("onPlayerDisconnect"), false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { c.GetID() } }), false);
@@ -603,40 +697,153 @@ void TNetwork::OnDisconnect(const std::weak_ptr<TClient>& ClientPtr, bool kicked
         CloseSocketProper(c.GetTCPSock());
     if (c.GetDownSock())
         CloseSocketProper(c.GetDownSock());
-    mServer.RemoveClient(ClientPtr);
+    mSessions.Forget(c);
+    mServer.RemoveClient(Client);
 }
 
-int TNetwork::OpenID() {
-    int ID = 0;
-    bool found;
-    do {
-        found = true;
-        mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
-            ReadLock Lock(mServer.GetClientMutex());
-            if (!ClientPtr.expired()) {
-                auto c = ClientPtr.lock();
-                if (c->GetID() == ID) {
-                    found = false;
-                    ID++;
-                }
+std::string TNetwork::IssueSession(const std::shared_ptr<TClient>& Client) {
+    auto Token = mSessions.Issue(Client);
+    mServer.NotifySessionIssued(*Client, Token);
+    return Token;
+}
+
+std::shared_ptr<TClient> TNetwork::TakeParkedClient(const std::string& Token) {
+    return mSessions.Resume(Token);
+}
+
+void TNetwork::ResumeClient(const std::shared_ptr<TClient>& Client, SOCKET TCPSock) {
+    Client->SetTCPSock(TCPSock);
+    Client->SetStatus(0);
+    // it may have been gone for longer than the ping timeout allows
+    Client->UpdatePingTime();
+    // the client starts its reliable UDP channel over, too
+    Client->Reliable().Reset();
+    info(Client->GetName() + " resumed their session");
+    // the UDP address is picked up again with the client's next UDP packet
+    if (!TCPSend(*Client, PacketSchema::Serialize<PacketSchema::TResumeAccepted>(Client->GetID()))
+        || !TCPSend(*Client, PacketSchema::Serialize<PacketSchema::TResumeToken>(IssueSession(Client)))) {
+        Client->SetStatus(-1);
+    }
+    // the queue sync thread sends everything the client missed in the meantime
+    std::thread([this, Client] { TCPClient(Client, true); }).detach();
+}
+
+bool TNetwork::EndParkedSession(const std::shared_ptr<TClient>& Client) {
+    if (!mSessions.Unpark(*Client)) {
+        return false;
+    }
+    RemoveFromGame(Client, true);
+    return true;
+}
+
+void TNetwork::ExpireParkedClients() {
+    for (auto& Client : mSessions.TakeExpired()) {
+        info(Client->GetName() + " didn't resume their session in time");
+        RemoveFromGame(Client, Client->GetStatus() == -2);
+    }
+}
+
+std::chrono::steady_clock::duration TNetwork::ThrottleInbound(TClient& Client, std::string_view Packet) {
+    auto Class = TInboundLimiter::Classify(Packet);
+    auto Delay = Client.InboundLimiter().Throttle(Class);
+    if (Delay.count() == 0) {
+        return Delay;
+    }
+    if (Client.InboundLimiter().IsFlooding() && Client.GetStatus() > -2) {
+        ClientKick(Client, "Sending too much, too fast");
+        return std::chrono::steady_clock::duration::zero();
+    }
+    auto Throttles = Client.InboundLimiter().Throttles(Class);
+    if (Throttles == 1 || Throttles % 1000 == 0) {
+        debug("rate limit: throttled " + Client.GetName() + " for " + std::string(TInboundLimiter::ClassName(Class)) + " packets " + std::to_string(Throttles) + " times so far");
+    }
+    return Delay;
+}
+
+bool TNetwork::AllowInbound(TClient& Client, std::string_view Packet) {
+    auto Class = TInboundLimiter::Classify(Packet);
+    if (Client.InboundLimiter().Allow(Class)) {
+        return true;
+    }
+    auto Drops = Client.InboundLimiter().Drops(Class);
+    if (Drops == 1 || Drops % 1000 == 0) {
+        debug("rate limit: dropped " + std::to_string(Drops) + " " + std::string(TInboundLimiter::ClassName(Class)) + " packets from " + Client.GetName() + " so far");
+    }
+    return false;
+}
+
+int TNetwork::OpenID(bool Wide) {
+    std::unordered_set<int> Taken;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        ReadLock Lock(mServer.GetClientMutex());
+        if (!ClientPtr.expired()) {
+            Taken.insert(ClientPtr.lock()->GetID());
+        }
+        return true;
+    });
+    // a cluster worker only has every ClusterWorkers-th ID
+    int First = mCluster ? mCluster->FirstID() : 0;
+    int Step = mCluster ? std::max(Application::Settings.ClusterWorkers, 1) : 1;
+    // a relay's players only get the IDs its upstream keeps free for them, so they never
+    // get one of the upstream's players
+    int FirstLegacy = First, LastLegacy = TClient::MaxLegacyID;
+    int FirstWide = TClient::MaxLegacyID + 1, LastWide = TClient::MaxWideID;
+    if (mRelayLink) {
+        FirstLegacy = TClient::MaxLegacyID - TClient::RelayLegacyIDs + 1;
+        FirstWide = TClient::FirstRelayWideID;
+    } else if (mRelayHub) {
+        LastLegacy = TClient::MaxLegacyID - TClient::RelayLegacyIDs;
+        LastWide = TClient::FirstRelayWideID - 1;
+    }
+    auto FirstFree = [&](int ID, int Last) -> std::optional<int> {
+        // the first one of this process at or after ID
+        ID = First + (std::max(ID, First) - First + Step - 1) / Step * Step;
+        for (; ID <= Last; ID += Step) {
+            if (Taken.count(ID) == 0) {
+                return ID;
             }
-            return true;
-        });
-    } while (!found);
-    return ID;
+        }
+        return std::nullopt;
+    };
+    // clients which can take wide IDs get those first, the legacy ones are all old clients can get
+    if (Wide) {
+        if (auto ID = FirstFree(FirstWide, LastWide)) {
+            return *ID;
+        }
+    }
+    // none left, the caller turns the player away
+    return FirstFree(FirstLegacy, LastLegacy).value_or(TClient::MaxWideID + 1);
 }
 
 void TNetwork::OnConnect(const std::weak_ptr<TClient>& c) {
     Assert(!c.expired());
     info("Client connected");
     auto LockedClient = c.lock();
-    LockedClient->SetID(OpenID());
+    auto ID = OpenID(LockedClient->HasCapability(TClient::CapWideID));
+    if (ID > (LockedClient->HasCapability(TClient::CapWideID) ? TClient::MaxWideID : TClient::MaxLegacyID)) {
+        ClientKick(*LockedClient, "Server full for your client version!");
+        return;
+    }
+    LockedClient->SetID(ID);
     info("Assigned ID " + std::to_string(LockedClient->GetID()) + " to " + LockedClient->GetName());
+    if (Application::Settings.RoomAssignment == "balanced") {
+        mServer.SetClientRoom(LockedClient, mServer.EmptiestRoom());
+    }
     TriggerLuaEvent("onPlayerConnecting", false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID() } }), false);
-    SyncResources(*LockedClient);
+    { // resource sync slot scope
+        // the client is still in the launcher here, which doesn't understand anything we could tell it while it waits
+        auto Ticket = mAdmission.Enter(TAdmissionController::TPhase::ResourceSync, *LockedClient, [&](size_t Position) {
+            debug(LockedClient->GetName() + " is waiting for the resource sync, position " + std::to_string(Position));
+        });
+        if (!Ticket)
+            return;
+        SyncResources(*LockedClient);
+    } // end resource sync slot scope
     if (LockedClient->GetStatus() < 0)
         return;
-    (void)Respond(*LockedClient, "M" + Application::Settings.MapName, true); //Send the Map on connect
+    auto Map = TServer::RoomMap(mServer.RoomOf(*LockedClient));
+    LockedClient->SetIsMapSent(true);
+    (void)Respond(*LockedClient, PacketSchema::Serialize<PacketSchema::TMap>(Map.value_or(Application::Settings.MapName)), true); //Send the Map on connect
     info(LockedClient->GetName() + " : Connected");
     TriggerLuaEvent("onPlayerJoining", false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID() } }), false);
 }
@@ -645,7 +852,7 @@ void TNetwork::SyncResources(TClient& c) {
 #ifndef DEBUG
     try {
 #endif
-        if (!TCPSend(c, "P" + std::to_string(c.GetID()))) {
+        if (!TCPSend(c, PacketSchema::Serialize<PacketSchema::TPlayerID>(c.GetID()))) {
             // TODO handle
         }
         std::string Data;
@@ -666,15 +873,15 @@ void TNetwork::SyncResources(TClient& c) {
 void TNetwork::Parse(TClient& c, const std::string& Packet) {
     if (Packet.empty())
         return;
-    char Code = Packet.at(0), SubCode = 0;
-    if (Packet.length() > 1)
-        SubCode = Packet.at(1);
+    char Code = Packet.at(0);
     switch (Code) {
     case 'f':
-        SendFile(c, Packet.substr(1));
+        if (auto FileRequest = PacketSchema::Parse<PacketSchema::TFileRequest>(Packet)) {
+            SendFile(c, std::string(std::get<0>(*FileRequest)));
+        }
         return;
     case 'S':
-        if (SubCode == 'R') {
+        if (PacketSchema::Parse<PacketSchema::TModListRequest>(Packet)) {
             debug("Sending Mod Info");
             std::string ToSend = mResourceManager.FileList() + mResourceManager.FileSizes();
             if (ToSend.empty())
@@ -811,8 +1018,8 @@ bool TNetwork::SendLarge(TClient& c, std::string Data, bool isSync) {
 
 bool TNetwork::Respond(TClient& c, const std::string& MSG, bool Rel, bool isSync) {
     char C = MSG.at(0);
-    if (Rel || C == 'W' || C == 'Y' || C == 'V' || C == 'E') {
-        if (C == 'O' || C == 'T' || MSG.length() > 1000) {
+    if (PacketSchema::IsReliable(C, Rel)) {
+        if (MSG.length() > PacketSchema::Info(C).CompressAbove) {
             return SendLarge(c, MSG, isSync);
         } else {
             return TCPSend(c, MSG, isSync);
@@ -829,19 +1036,29 @@ bool TNetwork::SyncClient(const std::weak_ptr<TClient>& c) {
     auto LockedClient = c.lock();
     if (LockedClient->IsSynced())
         return true;
+    auto Ticket = mAdmission.Enter(TAdmissionController::TPhase::WorldSync, *LockedClient, [&](size_t Position) {
+        (void)Respond(*LockedClient, PacketSchema::Serialize<PacketSchema::TJoinMessage>("Waiting to join, position " + std::to_string(Position) + " in line"), true);
+    });
+    if (!Ticket)
+        return false;
     // Syncing, later set isSynced
     // after syncing is done, we apply all packets they missed
-    if (!Respond(*LockedClient, ("Sn") + LockedClient->GetName(), true)) {
+    if (!Respond(*LockedClient, PacketSchema::Serialize<PacketSchema::TPlayerName>(LockedClient->GetName()), true)) {
         return false;
     }
-    // ignore error
-    (void)SendToAll(LockedClient.get(), ("JWelcome ") + LockedClient->GetName() + "!", false, true);
-
-    TriggerLuaEvent(("onPlayerJoin"), false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID() } }), false);
+    { // gate scope
+        auto Pass = mGate.Enter();
+        // ignore error
+        (void)SendToAll(LockedClient.get(), PacketSchema::Serialize<PacketSchema::TJoinMessage>("Welcome " + LockedClient->GetName() + "!"), false, true);
+
+        TriggerLuaEvent(("onPlayerJoin"), false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID() } }), false);
+    } // end gate scope
+    // no pass is held while the world is sent, a hot upgrade kicks a client which isn't
+    // synced yet anyway
     LockedClient->SetIsSyncing(true);
     bool Return = false;
     bool res = true;
-    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+    mServer.ForEachClientInRoom(*LockedClient, [&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
         std::shared_ptr<TClient> client;
         {
             ReadLock Lock(mServer.GetClientMutex());
@@ -868,21 +1085,63 @@ bool TNetwork::SyncClient(const std::weak_ptr<TClient>& c) {
 
         return true;
     });
+    if (mMirror && !Return) {
+        for (const auto& Vehicle : mMirror->Vehicles(mServer.RoomOf(*LockedClient))) {
+            if (LockedClient->GetStatus() < 0) {
+                Return = true;
+                res = false;
+                break;
+            }
+            res = Respond(*LockedClient, Vehicle.Data, true, true);
+        }
+    }
     LockedClient->SetIsSyncing(false);
     if (Return) {
         return res;
     }
+    auto Pass = mGate.Enter();
     LockedClient->SetIsSynced(true);
+    mServer.NotifyPlayerUpdated(*LockedClient);
     info(LockedClient->GetName() + (" is now synced!"));
+    if (Application::Settings.ResumeGracePeriod > 0 && LockedClient->HasCapability(TClient::CapResume)) {
+        (void)Respond(*LockedClient, PacketSchema::Serialize<PacketSchema::TResumeToken>(IssueSession(LockedClient)), true);
+    }
     return true;
 }
 
-void TNetwork::SendToAll(TClient* c, const std::string& Data, bool Self, bool Rel) {
+void TNetwork::SendToAll(TClient* c, const std::string& Data, bool Self, bool Rel, const TVehicleTransform* Transform) {
     if (!Self)
         Assert(c);
+    mServer.NotifyBroadcast(c, Data, Rel);
+    if (c) {
+        auto Room = mServer.RoomOf(*c);
+        SendToClients(c, c->GetID(), &Room, Data, Self, Rel, Transform);
+    } else {
+        SendToClients(nullptr, -1, nullptr, Data, Self, Rel, Transform);
+    }
+}
+
+bool TNetwork::AddRelaySubscriber(SOCKET Sock) {
+    if (!mRelayHub) {
+        return false;
+    }
+    mRelayHub->Subscribe(Sock);
+    return true;
+}
+
+void TNetwork::DeliverBroadcast(int SenderID, const std::string* Room, const std::string& Data, bool Rel) {
+    SendToClients(nullptr, SenderID, Room, Data, true, Rel, nullptr);
+}
+
+void TNetwork::SendToClients(TClient* c, int SenderID, const std::string* Room, const std::string& Data, bool Self, bool Rel, const TVehicleTransform* Transform) {
     char C = Data.at(0);
+    auto Priority = PacketSchema::PriorityOf(Data);
+    bool IsPosition = SenderID >= 0 && C >= 'V' && C <= 'Z';
+    if (Application::Settings.DeadReckoningThreshold <= 0) {
+        Transform = nullptr;
+    }
     bool ret = true;
-    mServer.ForEachClient([&](std::weak_ptr<TClient> ClientPtr) -> bool {
+    auto Visit = [&](std::weak_ptr<TClient> ClientPtr) -> bool {
         std::shared_ptr<TClient> Client;
         {
             ReadLock Lock(mServer.GetClientMutex());
@@ -893,32 +1152,113 @@ void TNetwork::SendToAll(TClient* c, const std::string& Data, bool Self, bool Re
         }
         if (Self || Client.get() != c) {
             if (Client->IsSynced() || Client->IsSyncing()) {
-                if (Rel || C == 'W' || C == 'Y' || C == 'V' || C == 'E') {
-                    if (C == 'O' || C == 'T' || Data.length() > 1000) {
-                        if (Data.length() > 400) {
-                            std::string CMP(Comp(Data));
-                            Client->EnqueuePacket("ABG:" + CMP);
-                        } else {
-                            Client->EnqueuePacket(Data);
-                        }
+                if (PacketSchema::IsReliable(C, Rel)) {
+                    if (Data.length() > PacketSchema::Info(C).CompressAbove) {
+                        std::string CMP(Comp(Data));
+                        Client->EnqueuePacket("ABG:" + CMP, Priority, C);
                         //ret = SendLarge(*Client, Data);
                     } else {
-                        Client->EnqueuePacket(Data);
+                        Client->EnqueuePacket(Data, Priority, C);
                         //ret = TCPSend(*Client, Data);
                     }
                 } else {
-                    ret = UDPSend(*Client, Data);
+                    // position updates the client can extrapolate well enough are skipped (TDeadReckoning),
+                    // a congested client gets fewer of the rest (TLinkEstimator)
+                    bool Skip = Transform && !Client->DeadReckoning().NeedsUpdate(*Transform);
+                    if (!Skip && IsPosition) {
+                        Skip = !Client->Link().ShouldSendPosition(SenderID);
+                    }
+                    if (!Skip) {
+                        ret = UDPSendBundled(Client, Data);
+                        if (Transform) {
+                            Client->DeadReckoning().OnSent(*Transform);
+                        }
+                    }
                 }
             }
         }
         return true;
-    });
+    };
+    if (Room) {
+        mServer.ForEachClientInRoom(*Room, Visit);
+    } else {
+        mServer.ForEachClient(Visit);
+    }
     if (!ret) {
         // TODO: handle
     }
     return;
 }
 
+void TNetwork::MoveToRoom(const std::shared_ptr<TClient>& Client, const std::string& Room) {
+    if (!Client->IsSynced() && !Client->IsSyncing()) {
+        // the world sync happens in the new room then
+        mServer.SetClientRoom(Client, Room);
+        return;
+    }
+    TClient::TSetOfVehicleData VehicleData;
+    { // Vehicle Data Lock Scope
+        auto LockedData = Client->GetAllCars();
+        VehicleData = *LockedData.VehicleData;
+    } // End Vehicle Data Lock Scope
+    // the old room forgets about the client's vehicles, the client about the old room's
+    for (auto& v : VehicleData) {
+        SendToAll(Client.get(), PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { Client->GetID(), v.ID() }), false, true);
+    }
+    SendToAll(Client.get(), PacketSchema::Serialize<PacketSchema::TLeaveMessage>(Client->GetName() + " left the room"), false, true);
+    auto ForEachOtherVehicle = [&](const std::function<void(TClient&, const TVehicleData&)>& Fn) {
+        mServer.ForEachClientInRoom(*Client, [&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+            auto Other = ClientPtr.lock();
+            if (!Other || Other == Client) {
+                return true;
+            }
+            TClient::TSetOfVehicleData OtherVehicles;
+            { // Vehicle Data Lock Scope
+                auto LockedData = Other->GetAllCars();
+                OtherVehicles = *LockedData.VehicleData;
+            } // End Vehicle Data Lock Scope
+            for (auto& v : OtherVehicles) {
+                Fn(*Other, v);
+            }
+            return true;
+        });
+    };
+    // queued behind what the old room sent the client before, vehicle packets stay in order there
+    auto Enqueue = [&](const std::string& Data) {
+        char C = Data.at(0);
+        if (Data.length() > PacketSchema::Info(C).CompressAbove) {
+            Client->EnqueuePacket("ABG:" + Comp(Data), PacketSchema::PriorityOf(Data), C);
+        } else {
+            Client->EnqueuePacket(Data, PacketSchema::PriorityOf(Data), C);
+        }
+    };
+    ForEachOtherVehicle([&](TClient& Other, const TVehicleData& v) {
+        Enqueue(PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { Other.GetID(), v.ID() }));
+    });
+    if (mMirror) {
+        for (const auto& Vehicle : mMirror->Vehicles(mServer.RoomOf(*Client))) {
+            Enqueue(PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { Vehicle.PlayerID, Vehicle.VehicleID }));
+        }
+    }
+
+    mServer.SetClientRoom(Client, Room);
+    mServer.NotifyPlayerUpdated(*Client);
+    info(Client->GetName() + " moved to room \"" + Room + "\"");
+
+    ForEachOtherVehicle([&](TClient&, const TVehicleData& v) {
+        Enqueue(v.Data());
+    });
+    if (mMirror) {
+        for (const auto& Vehicle : mMirror->Vehicles(Room)) {
+            Enqueue(Vehicle.Data);
+        }
+    }
+    for (auto& v : VehicleData) {
+        SendToAll(Client.get(), v.Data(), false, true);
+    }
+    SendToAll(Client.get(), PacketSchema::Serialize<PacketSchema::TJoinMessage>(Client->GetName() + " joined the room"), false, true);
+}
+
 bool TNetwork::UDPSend(TClient& Client, std::string Data) const {
     if (!Client.IsConnected() || Client.GetStatus() < 0) {
         // this can happen if we try to send a packet to a client that is either
@@ -929,7 +1269,7 @@ bool TNetwork::UDPSend(TClient& Client, std::string Data) const {
     }
     sockaddr_in Addr = Client.GetUDPAddr();
     auto AddrSize = sizeof(Client.GetUDPAddr());
-    if (Data.length() > 400) {
+    if (Data.length() > PacketSchema::UnreliableCompressAbove) {
         std::string CMP(Comp(Data));
         Data = "ABG:" + CMP;
     }
@@ -967,12 +1307,168 @@ bool TNetwork::UDPSend(TClient& Client, std::string Data) const {
         return false;
     }
 #endif // WIN32
+    Client.Link().CountSent(size_t(sendOk), false);
+    return true;
+}
+
+bool TNetwork::UDPSendBundled(const std::shared_ptr<TClient>& Client, const std::string& Data) {
+    if (!Client->HasCapability(TClient::CapBundle) || !TDatagramBundle::Fits(Data)) {
+        return UDPSend(*Client, Data);
+    }
+    if (!Client->IsConnected() || Client->GetStatus() < 0) {
+        // same as in UDPSend, nowhere to send it to (yet)
+        return true;
+    }
+    bool WasEmpty = false;
+    auto Full = Client->Bundle().Add(Data, WasEmpty);
+    if (WasEmpty) {
+        std::unique_lock Lock(mBundleMutex);
+        mPendingBundles.push_back(Client);
+    }
+    if (Full) {
+        return UDPSend(*Client, std::move(*Full));
+    }
     return true;
 }
 
+bool TNetwork::ReliableUDPSend(const std::shared_ptr<TClient>& Client, TReliableChannel::TStream Stream, const std::string& Data) {
+    if (Client->Reliable().Activate()) {
+        std::unique_lock Lock(mReliableMutex);
+        mReliableClients.push_back(Client);
+    }
+    for (auto& Datagram : Client->Reliable().Send(Stream, Data)) {
+        if (!UDPSend(*Client, std::move(Datagram))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TNetwork::UsesReliableUDP(TClient& Client) {
+    return Client.HasCapability(TClient::CapReliableUDP) && Client.IsSynced() && Client.IsConnected();
+}
+
+size_t TNetwork::TCPSendRoom(TClient& Client) {
+#ifdef __linux__
+    // unsent and unacked bytes, against what the socket takes before send() blocks. that
+    // counts the kernel's overhead as well, half of the buffer is what's left for data.
+    int Queued = 0;
+    int Buffer = 0;
+    socklen_t Length = sizeof(Buffer);
+    if (ioctl(Client.GetTCPSock(), TIOCOUTQ, &Queued) != 0 || getsockopt(Client.GetTCPSock(), SOL_SOCKET, SO_SNDBUF, &Buffer, &Length) != 0
+        || Queued == 0) {
+        // a packet which doesn't fit into the buffer at all goes once it's empty
+        return std::numeric_limits<size_t>::max();
+    }
+    // the 4 bytes of the size in front
+    auto Room = int64_t(Buffer / 2) - Queued - int64_t(sizeof(int32_t));
+    return Room > 0 ? size_t(Room) : 0;
+#else
+    // can't tell, so it's sent as before
+    (void)Client;
+    return std::numeric_limits<size_t>::max();
+#endif // __linux__
+}
+
+bool TNetwork::IsTCPDrained(TClient& Client) {
+#ifdef __linux__
+    // unsent and unacked bytes
+    int Queued = 0;
+    return ioctl(Client.GetTCPSock(), TIOCOUTQ, &Queued) == 0 && Queued == 0;
+#else
+    // can't tell, so it all stays on TCP
+    (void)Client;
+    return false;
+#endif // __linux__
+}
+
+bool TNetwork::HandleReliableUDP(const std::shared_ptr<TClient>& Client, const std::string& Packet) {
+    std::string Decompressed;
+    std::string_view Datagram = Packet;
+    if (Packet.compare(0, 4, "ABG:") == 0) {
+        Decompressed = DeComp(Packet.substr(4));
+        Datagram = Decompressed;
+    }
+    if (Datagram.empty()) {
+        return false;
+    }
+    if (Datagram.front() == 'K') {
+        Client->Reliable().OnAck(Datagram);
+        return true;
+    }
+    if (Datagram.front() != 'U') {
+        return false;
+    }
+    std::vector<std::string> Delivered;
+    auto Ack = Client->Reliable().OnData(Datagram, Delivered);
+    if (!Ack.empty()) {
+        (void)UDPSend(*Client, std::move(Ack));
+    }
+    for (auto& Delivery : Delivered) {
+        // it's acked already, so it can't be dropped or held back anymore. it only counts
+        // towards the limit, the channel's window keeps the client from getting far ahead.
+        (void)ThrottleInbound(*Client, Delivery);
+        mInbound.Submit(Client, std::move(Delivery), true);
+    }
+    return true;
+}
+
+void TNetwork::UDPTimerMain() {
+    RegisterThread("UDPTimer");
+    std::vector<std::weak_ptr<TClient>> Pending;
+    std::vector<std::shared_ptr<TClient>> Reliable;
+    while (!mShutdown) {
+        std::this_thread::sleep_for(UDPTimerInterval);
+        auto Pass = mGate.Enter();
+        {
+            std::unique_lock Lock(mBundleMutex);
+            std::swap(Pending, mPendingBundles);
+        }
+        for (auto& ClientPtr : Pending) {
+            auto Client = ClientPtr.lock();
+            if (!Client) {
+                continue;
+            }
+            if (auto Bundle = Client->Bundle().Take()) {
+                (void)UDPSend(*Client, std::move(*Bundle));
+            }
+        }
+        Pending.clear();
+
+        { // locked context
+            std::unique_lock Lock(mReliableMutex);
+            mReliableClients.erase(std::remove_if(mReliableClients.begin(), mReliableClients.end(),
+                                       [&](const std::weak_ptr<TClient>& ClientPtr) {
+                                           auto Client = ClientPtr.lock();
+                                           if (Client) {
+                                               Reliable.push_back(std::move(Client));
+                                           }
+                                           return !Client;
+                                       }),
+                mReliableClients.end());
+        } // end locked context
+        auto Now = TReliableChannel::TClock::now();
+        for (auto& Client : Reliable) {
+            if (Client->GetStatus() < 0) {
+                continue;
+            }
+            for (auto& Datagram : Client->Reliable().TakeDue(Now)) {
+                (void)UDPSend(*Client, std::move(Datagram));
+            }
+            if (Client->Reliable().Failed()) {
+                debug("reliable UDP channel of " + Client->GetName() + " gave up, dropping the connection");
+                Client->SetStatus(-1);
+                CloseSocketProper(Client->GetTCPSock());
+            }
+        }
+        Reliable.clear();
+    }
+}
+
 std::string TNetwork::UDPRcvFromClient(sockaddr_in& client) const {
     size_t clientLength = sizeof(client);
-    std::array<char, 1024> Ret {};
+    // big enough for a full reliable UDP datagram, see TReliableChannel::MaxPayload
+    std::array<char, 2048> Ret {};
 #ifdef WIN32
     auto Rcv = recvfrom(mUDPSock, Ret.data(), int(Ret.size()), 0, (sockaddr*)&client, (int*)&clientLength);
 #else // unix
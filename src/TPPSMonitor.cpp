@@ -23,6 +23,7 @@ void TPPSMonitor::operator()() {
     std::vector<std::shared_ptr<TClient>> TimedOutClients;
     while (!mShutdown) {
         std::this_thread::sleep_for(std::chrono::seconds(1));
+        Network().ExpireParkedClients();
         int C = 0, V = 0;
         if (mServer.ClientCount() == 0) {
             Application::SetPPS("-");
@@ -37,6 +38,13 @@ void TPPSMonitor::operator()() {
                 } else
                     return true;
             }
+            if (c->Link().Update(c->GetTCPSock())) {
+                auto Stats = c->Link().Stats();
+                debug(c->GetName() + (c->Link().IsCongested() ? "'s link is congested" : "'s link recovered")
+                    + ": rtt " + std::to_string(int(Stats.RttMs)) + "ms, loss " + std::to_string(int(Stats.Loss * 100))
+                    + "%, backlog " + std::to_string(Stats.Backlog) + " bytes, position updates at "
+                    + std::to_string(int(Stats.RateScale * 100)) + "%");
+            }
             if (c->GetCarCount() > 0) {
                 C++;
                 V += c->GetCarCount();
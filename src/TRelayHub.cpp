@@ -0,0 +1,147 @@
+#include "TRelayHub.h"
+
+#include "Common.h"
+
+#include <algorithm>
+
+TRelayHub::TRelayHub(TServer& Server)
+    : mPublisher(Server, true, [this](const std::string& Message) { Publish(Message); }) {
+    Application::RegisterShutdownHandler([this] { Stop(); });
+}
+
+TRelayHub::~TRelayHub() {
+    Stop();
+}
+
+void TRelayHub::Subscribe(SOCKET Sock) {
+    auto Subscriber = std::make_shared<TSubscriber>();
+    Subscriber->Sock = Sock;
+    { // locked context
+        std::unique_lock Lock(mSubscribersMutex);
+        if (mShutdown) {
+            CloseSocketProper(Sock);
+            return;
+        }
+        Subscriber->Thread = std::thread(&TRelayHub::SenderMain, Subscriber);
+        mSubscribers.push_back(Subscriber);
+    } // end locked context
+    // what changes from here on is queued already, so whatever the snapshot misses comes after it
+    auto Snapshot = mPublisher.Snapshot();
+    {
+        std::unique_lock Lock(Subscriber->Mutex);
+        for (auto Iter = Snapshot.rbegin(); Iter != Snapshot.rend(); ++Iter) {
+            Subscriber->QueuedBytes += Iter->size();
+            Subscriber->Queue.push_front(std::move(*Iter));
+        }
+        Subscriber->Ready = true;
+    }
+    Subscriber->Condition.notify_one();
+    info("Relay subscribed, sent a snapshot of " + std::to_string(Snapshot.size()) + " entries");
+}
+
+void TRelayHub::OnPlayerUpdated(const TClient& Client) {
+    mPublisher.OnPlayerUpdated(Client);
+}
+
+void TRelayHub::OnPlayerRemoved(int PlayerID) {
+    mPublisher.OnPlayerRemoved(PlayerID);
+}
+
+void TRelayHub::OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) {
+    mPublisher.OnVehicleUpdated(Client, VehicleID, Data);
+}
+
+void TRelayHub::OnVehicleRemoved(int PlayerID, int VehicleID) {
+    mPublisher.OnVehicleRemoved(PlayerID, VehicleID);
+}
+
+void TRelayHub::OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) {
+    mPublisher.OnBroadcast(Sender, Data, Rel);
+}
+
+void TRelayHub::Publish(const std::string& Message) {
+    std::unique_lock Lock(mSubscribersMutex);
+    if (mSubscribers.empty()) {
+        return;
+    }
+    auto Iter = std::remove_if(mSubscribers.begin(), mSubscribers.end(), [&](const std::shared_ptr<TSubscriber>& Subscriber) {
+        std::unique_lock SubscriberLock(Subscriber->Mutex);
+        if (!Subscriber->Closed && Subscriber->QueuedBytes + Message.size() > MaxBacklog) {
+            warn("Dropping a relay which is too far behind");
+            Close(*Subscriber);
+        }
+        if (Subscriber->Closed) {
+            SubscriberLock.unlock();
+            Subscriber->Condition.notify_one();
+            // it only has the subscriber left to finish up with
+            Subscriber->Thread.detach();
+            return true;
+        }
+        Subscriber->QueuedBytes += Message.size();
+        Subscriber->Queue.push_back(Message);
+        SubscriberLock.unlock();
+        Subscriber->Condition.notify_one();
+        return false;
+    });
+    mSubscribers.erase(Iter, mSubscribers.end());
+}
+
+void TRelayHub::Stop() {
+    std::vector<std::shared_ptr<TSubscriber>> Subscribers;
+    { // locked context
+        std::unique_lock Lock(mSubscribersMutex);
+        mShutdown = true;
+        Subscribers.swap(mSubscribers);
+    } // end locked context
+    for (auto& Subscriber : Subscribers) {
+        {
+            std::unique_lock Lock(Subscriber->Mutex);
+            Close(*Subscriber);
+        }
+        Subscriber->Condition.notify_one();
+        if (Subscriber->Thread.joinable()) {
+            Subscriber->Thread.join();
+        }
+    }
+}
+
+void TRelayHub::Close(TSubscriber& Subscriber) {
+    // wakes up a blocking send, the sender thread closes the socket
+    Subscriber.Closed = true;
+    shutdown(Subscriber.Sock, 2); // 2 == SHUT_RDWR == SD_BOTH
+}
+
+void TRelayHub::SenderMain(std::shared_ptr<TSubscriber> Subscriber) {
+    RegisterThread("RelaySender");
+    while (true) {
+        std::string Message;
+        {
+            std::unique_lock Lock(Subscriber->Mutex);
+            Subscriber->Condition.wait(Lock, [&] { return Subscriber->Closed || (Subscriber->Ready && !Subscriber->Queue.empty()); });
+            if (Subscriber->Closed) {
+                break;
+            }
+            Message = std::move(Subscriber->Queue.front());
+            Subscriber->Queue.pop_front();
+            Subscriber->QueuedBytes -= Message.size();
+        }
+        auto Size = int32_t(Message.size());
+        std::string Frame(reinterpret_cast<const char*>(&Size), sizeof(Size));
+        Frame += Message;
+        size_t Sent = 0;
+        while (Sent < Frame.size()) {
+            auto Temp = send(Subscriber->Sock, &Frame[Sent], int(Frame.size() - Sent), 0);
+            if (Temp < 1) {
+                break;
+            }
+            Sent += size_t(Temp);
+        }
+        if (Sent < Frame.size()) {
+            info("Relay disconnected");
+            std::unique_lock Lock(Subscriber->Mutex);
+            Subscriber->Closed = true;
+            break;
+        }
+    }
+    CloseSocketProper(Subscriber->Sock);
+}
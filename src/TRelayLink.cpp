@@ -0,0 +1,148 @@
+#include "TRelayLink.h"
+
+#include "Common.h"
+#include "TWorldMirror.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef WIN32
+#include <ws2tcpip.h>
+#else // unix
+#include <netdb.h>
+#endif // WIN32
+
+namespace {
+
+bool ReceiveAll(SOCKET Sock, char* Data, size_t Size) {
+    size_t Received = 0;
+    while (Received < Size) {
+        auto Temp = recv(Sock, &Data[Received], int(Size - Received), 0);
+        if (Temp < 1) {
+            return false;
+        }
+        Received += size_t(Temp);
+    }
+    return true;
+}
+
+}
+
+TRelayLink::TRelayLink(TWorldMirror& Mirror, TConnectionGate& Gate, const std::string& Upstream)
+    : mMirror(Mirror)
+    , mGate(Gate) {
+    auto Separator = Upstream.rfind(':');
+    if (Separator == std::string::npos || Separator == 0 || Separator + 1 == Upstream.size()) {
+        throw std::runtime_error("RelayUpstream has to be \"host:port\", not \"" + Upstream + "\"");
+    }
+    mHost = Upstream.substr(0, Separator);
+    mPort = Upstream.substr(Separator + 1);
+    Application::RegisterShutdownHandler([this] { Stop(); });
+    mThread = std::thread(&TRelayLink::LinkMain, this);
+}
+
+TRelayLink::~TRelayLink() {
+    Stop();
+}
+
+void TRelayLink::Stop() {
+    {
+        std::unique_lock Lock(mMutex);
+        mShutdown = true;
+        if (mSock != SOCKET(-1)) {
+            // wakes up the blocking recv
+            shutdown(mSock, 2); // 2 == SHUT_RDWR == SD_BOTH
+        }
+    }
+    mCondition.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void TRelayLink::LinkMain() {
+    RegisterThread("RelayLink");
+    while (true) {
+        if (auto Sock = Connect()) {
+            info("Relaying " + mHost + ":" + mPort);
+            Receive(*Sock);
+            {
+                std::unique_lock Lock(mMutex);
+                mSock = SOCKET(-1);
+                if (!mShutdown) {
+                    warn("Lost the relay upstream " + mHost + ":" + mPort);
+                }
+            }
+            CloseSocketProper(*Sock);
+            auto Pass = mGate.Enter();
+            mMirror.RemovePlayers([](int) { return true; }, " left the server!");
+        }
+        std::unique_lock Lock(mMutex);
+        if (mCondition.wait_for(Lock, RetryInterval, [&] { return mShutdown; })) {
+            break;
+        }
+        debug("relay: connecting to " + mHost + ":" + mPort + " again");
+    }
+}
+
+std::optional<SOCKET> TRelayLink::Connect() {
+    addrinfo Hints {};
+    Hints.ai_family = AF_INET;
+    Hints.ai_socktype = SOCK_STREAM;
+    addrinfo* Result = nullptr;
+    if (getaddrinfo(mHost.c_str(), mPort.c_str(), &Hints, &Result) != 0 || !Result) {
+        debug("relay: can't resolve " + mHost);
+        return std::nullopt;
+    }
+    SOCKET Sock = socket(Result->ai_family, Result->ai_socktype, Result->ai_protocol);
+    bool Connected = Sock != SOCKET(-1) && connect(Sock, Result->ai_addr, int(Result->ai_addrlen)) == 0;
+    freeaddrinfo(Result);
+    if (!Connected) {
+        debug("relay: can't connect to " + mHost + ":" + mPort);
+        if (Sock != SOCKET(-1)) {
+            CloseSocketProper(Sock);
+        }
+        return std::nullopt;
+    }
+    // 'R', then the secret like any other handshake packet
+    auto Size = int32_t(Application::Settings.RelayUpstreamSecret.size());
+    std::string Hello = "R";
+    Hello.append(reinterpret_cast<const char*>(&Size), sizeof(Size));
+    Hello += Application::Settings.RelayUpstreamSecret;
+    if (send(Sock, Hello.data(), int(Hello.size()), 0) != int(Hello.size())) {
+        CloseSocketProper(Sock);
+        return std::nullopt;
+    }
+    std::unique_lock Lock(mMutex);
+    if (mShutdown) {
+        CloseSocketProper(Sock);
+        return std::nullopt;
+    }
+    mSock = Sock;
+    return Sock;
+}
+
+void TRelayLink::Receive(SOCKET Sock) {
+    std::string Message;
+    while (true) {
+        int32_t Size = 0;
+        if (!ReceiveAll(Sock, reinterpret_cast<char*>(&Size), sizeof(Size))) {
+            return;
+        }
+        if (Size < 0 || Size > MaxMessageSize) {
+            warn("relay: the upstream sent garbage");
+            return;
+        }
+        Message.resize(size_t(Size));
+        if (!ReceiveAll(Sock, Message.data(), Message.size())) {
+            return;
+        }
+        // the message is read in full before, so a hot upgrade doesn't wait for the upstream
+        auto Pass = mGate.Enter();
+        try {
+            mMirror.Apply(Message);
+        } catch (const std::exception& e) {
+            error("relay: " + std::string(e.what()));
+        }
+    }
+}
@@ -0,0 +1,270 @@
+#include "TReliableChannel.h"
+
+#include "TStateBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+void WriteUInt16(std::string& Out, uint16_t Value) {
+    Out += char(Value >> 8);
+    Out += char(Value & 0xff);
+}
+
+uint16_t ReadUInt16(const char* Data) {
+    return uint16_t((uint8_t(Data[0]) << 8) | uint8_t(Data[1]));
+}
+
+}
+
+std::optional<TReliableChannel::TStream> TReliableChannel::StreamOf(char Code) {
+    switch (Code) {
+    case 'C':
+    case 'J':
+    case 'L':
+        return Messages;
+    case 'E':
+    case 'N':
+        return Events;
+    case 'O':
+        return Vehicles;
+    default:
+        return std::nullopt;
+    }
+}
+
+std::vector<std::string> TReliableChannel::Send(TStream Stream, std::string_view Packet) {
+    std::vector<std::string> Ready;
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    auto& State = mSend[Stream];
+    do {
+        auto Part = Packet.substr(0, MaxPayload);
+        Packet.remove_prefix(Part.size());
+        TOutgoing Out { State.NextSequence++, {}, Now, Now + Rto(0), 0 };
+        Out.Datagram.reserve(5 + Part.size());
+        Out.Datagram += 'U';
+        Out.Datagram += char(Stream);
+        WriteUInt16(Out.Datagram, Out.Sequence);
+        Out.Datagram += char(Packet.empty() ? 0 : More);
+        Out.Datagram += Part;
+        if (State.Waiting.empty() && FitsWindow(State, Out.Sequence)) {
+            Ready.push_back(Out.Datagram);
+            State.InFlight.push_back(std::move(Out));
+        } else {
+            State.Waiting.push_back(std::move(Out));
+        }
+    } while (!Packet.empty());
+    return Ready;
+}
+
+void TReliableChannel::OnAck(std::string_view Datagram) {
+    if (Datagram.size() < 8 || Datagram[0] != 'K' || uint8_t(Datagram[1]) >= StreamCount) {
+        return;
+    }
+    auto Next = ReadUInt16(&Datagram[2]);
+    uint32_t Bitmap = (uint32_t(ReadUInt16(&Datagram[4])) << 16) | ReadUInt16(&Datagram[6]);
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    auto& InFlight = mSend[uint8_t(Datagram[1])].InFlight;
+    auto IsAcked = [&](const TOutgoing& Out) {
+        if (IsBefore(Out.Sequence, Next)) {
+            return true;
+        }
+        auto Offset = uint16_t(Out.Sequence - Next);
+        return Offset >= 1 && Offset <= 32 && (Bitmap & (1u << (Offset - 1))) != 0;
+    };
+    for (const auto& Out : InFlight) {
+        // only datagrams which weren't retransmitted say anything about the RTT (Karn)
+        if (Out.Retries == 0 && IsAcked(Out)) {
+            SampleRtt(Now - Out.SentAt);
+        }
+    }
+    InFlight.erase(std::remove_if(InFlight.begin(), InFlight.end(), IsAcked), InFlight.end());
+}
+
+std::string TReliableChannel::OnData(std::string_view Datagram, std::vector<std::string>& Delivered) {
+    if (Datagram.size() < 5 || Datagram[0] != 'U' || uint8_t(Datagram[1]) >= StreamCount) {
+        return {};
+    }
+    auto Stream = uint8_t(Datagram[1]);
+    auto Sequence = ReadUInt16(&Datagram[2]);
+    std::unique_lock Lock(mMutex);
+    auto& State = mReceive[Stream];
+    auto Offset = uint16_t(Sequence - State.NextExpected);
+    // anything before NextExpected is a duplicate, which only needs another ack
+    if (Offset < Window) {
+        State.Received.try_emplace(Sequence, TIncoming { uint8_t(Datagram[4]), std::string(Datagram.substr(5)) });
+    }
+    for (auto Iter = State.Received.find(State.NextExpected); Iter != State.Received.end(); Iter = State.Received.find(State.NextExpected)) {
+        State.Partial += Iter->second.Payload;
+        if ((Iter->second.Flags & More) == 0) {
+            Delivered.push_back(std::move(State.Partial));
+            State.Partial.clear();
+        } else if (State.Partial.size() > MaxPacketSize) {
+            mFailed = true;
+        }
+        State.Received.erase(Iter);
+        ++State.NextExpected;
+    }
+    uint32_t Bitmap = 0;
+    for (uint16_t i = 0; i < 32; ++i) {
+        if (State.Received.count(uint16_t(State.NextExpected + 1 + i)) != 0) {
+            Bitmap |= 1u << i;
+        }
+    }
+    std::string Ack;
+    Ack.reserve(8);
+    Ack += 'K';
+    Ack += char(Stream);
+    WriteUInt16(Ack, State.NextExpected);
+    WriteUInt16(Ack, uint16_t(Bitmap >> 16));
+    WriteUInt16(Ack, uint16_t(Bitmap & 0xffff));
+    return Ack;
+}
+
+std::vector<std::string> TReliableChannel::TakeDue(TClock::time_point Now) {
+    std::vector<std::string> Due;
+    std::unique_lock Lock(mMutex);
+    for (auto& State : mSend) {
+        for (auto& Out : State.InFlight) {
+            if (Out.Due > Now) {
+                continue;
+            }
+            if (++Out.Retries > MaxRetries) {
+                mFailed = true;
+                return {};
+            }
+            Out.SentAt = Now;
+            Out.Due = Now + Rto(Out.Retries);
+            Due.push_back(Out.Datagram);
+        }
+        while (!State.Waiting.empty() && FitsWindow(State, State.Waiting.front().Sequence)) {
+            auto Out = std::move(State.Waiting.front());
+            State.Waiting.pop_front();
+            Out.SentAt = Now;
+            Out.Due = Now + Rto(0);
+            Due.push_back(Out.Datagram);
+            State.InFlight.push_back(std::move(Out));
+        }
+    }
+    return Due;
+}
+
+bool TReliableChannel::Failed() const {
+    std::unique_lock Lock(mMutex);
+    return mFailed;
+}
+
+void TReliableChannel::Reset() {
+    std::unique_lock Lock(mMutex);
+    for (auto& State : mSend) {
+        State = TSendStream {};
+    }
+    for (auto& State : mReceive) {
+        State = TReceiveStream {};
+    }
+    mSrttMs.reset();
+    mRttVarMs = 0;
+    mFailed = false;
+}
+
+bool TReliableChannel::Activate() {
+    std::unique_lock Lock(mMutex);
+    return !std::exchange(mActive, true);
+}
+
+bool TReliableChannel::Carries(TStream Stream) const {
+    std::unique_lock Lock(mMutex);
+    return mSend[Stream].Carried;
+}
+
+void TReliableChannel::Carry(TStream Stream) {
+    std::unique_lock Lock(mMutex);
+    mSend[Stream].Carried = true;
+}
+
+void TReliableChannel::Save(TStateWriter& Writer) const {
+    std::unique_lock Lock(mMutex);
+    for (const auto& State : mSend) {
+        Writer.Bool(State.Carried);
+        Writer.Int(State.NextSequence);
+        Writer.Int(int64_t(State.InFlight.size() + State.Waiting.size()));
+        for (const auto* Queue : { &State.InFlight, &State.Waiting }) {
+            for (const auto& Out : *Queue) {
+                Writer.Bool(Queue == &State.InFlight);
+                Writer.Int(Out.Sequence);
+                Writer.Int(Out.Retries);
+                Writer.String(Out.Datagram);
+            }
+        }
+    }
+    for (const auto& State : mReceive) {
+        Writer.Int(State.NextExpected);
+        Writer.String(State.Partial);
+        Writer.Int(int64_t(State.Received.size()));
+        for (const auto& [Sequence, In] : State.Received) {
+            Writer.Int(Sequence);
+            Writer.Int(In.Flags);
+            Writer.String(In.Payload);
+        }
+    }
+    // in microseconds, negative without a sample
+    Writer.Int(mSrttMs ? int64_t(*mSrttMs * 1000) : -1);
+    Writer.Int(int64_t(mRttVarMs * 1000));
+}
+
+void TReliableChannel::Restore(TStateReader& Reader) {
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    for (auto& State : mSend) {
+        State = TSendStream {};
+        State.Carried = Reader.Bool();
+        State.NextSequence = uint16_t(Reader.Int());
+        for (auto Count = Reader.Int(); Count > 0; --Count) {
+            bool InFlight = Reader.Bool();
+            TOutgoing Out { uint16_t(Reader.Int()), {}, Now, Now, 0 };
+            // counts as retransmitted, so it doesn't give an RTT sample from the old process' clock
+            Out.Retries = std::max(int(Reader.Int()), 1);
+            Out.Datagram = Reader.String();
+            (InFlight ? State.InFlight : State.Waiting).push_back(std::move(Out));
+        }
+    }
+    for (auto& State : mReceive) {
+        State = TReceiveStream {};
+        State.NextExpected = uint16_t(Reader.Int());
+        State.Partial = Reader.String();
+        for (auto Count = Reader.Int(); Count > 0; --Count) {
+            auto Sequence = uint16_t(Reader.Int());
+            auto Flags = uint8_t(Reader.Int());
+            State.Received.emplace(Sequence, TIncoming { Flags, Reader.String() });
+        }
+    }
+    auto SrttUs = Reader.Int();
+    mSrttMs = SrttUs < 0 ? std::nullopt : std::optional<double>(double(SrttUs) / 1000);
+    mRttVarMs = double(Reader.Int()) / 1000;
+    mFailed = false;
+    mActive = false;
+}
+
+TReliableChannel::TClock::duration TReliableChannel::Rto(int Retries) const {
+    // no RTT sample yet: a conservative guess
+    double RtoMs = mSrttMs ? *mSrttMs + 4 * mRttVarMs : 200.0;
+    RtoMs = std::clamp(RtoMs, double(MinRto.count()), double(MaxRto.count()));
+    RtoMs = std::min(RtoMs * std::pow(2.0, Retries), double(MaxRto.count()) * 4);
+    return std::chrono::duration_cast<TClock::duration>(std::chrono::duration<double, std::milli>(RtoMs));
+}
+
+void TReliableChannel::SampleRtt(TClock::duration Rtt) {
+    double SampleMs = std::chrono::duration<double, std::milli>(Rtt).count();
+    if (!mSrttMs) {
+        mSrttMs = SampleMs;
+        mRttVarMs = SampleMs / 2;
+    } else {
+        // RFC 6298
+        mRttVarMs = 0.75 * mRttVarMs + 0.25 * std::abs(*mSrttMs - SampleMs);
+        mSrttMs = 0.875 * *mSrttMs + 0.125 * SampleMs;
+    }
+}
@@ -0,0 +1,101 @@
+#include "TScratchArena.h"
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+TScratchArena::TScope::TScope()
+    : mArena(TScratchArena::ThreadLocal()) {
+    ++mArena.mScopeDepth;
+}
+
+TScratchArena::TScope::~TScope() {
+    if (--mArena.mScopeDepth == 0) {
+        mArena.Reset();
+    }
+}
+
+TScratchArena& TScratchArena::ThreadLocal() {
+    thread_local TScratchArena Arena;
+    return Arena;
+}
+
+void* TScratchArena::Allocate(size_t Size, size_t Align) {
+    if (mBlocks.empty()) {
+        AddBlock(Size + Align);
+    }
+    while (true) {
+        auto& Block = mBlocks[mCurrentBlock];
+        auto Base = reinterpret_cast<uintptr_t>(Block.Data.get());
+        size_t Start = ((Base + mOffset + Align - 1) & ~(uintptr_t(Align) - 1)) - Base;
+        if (Start + Size <= Block.Size) {
+            mOffset = Start + Size;
+            mLastAllocation = Block.Data.get() + Start;
+            return mLastAllocation;
+        }
+        // doesn't fit, continue in the next block
+        mUsedInPreviousBlocks += mOffset;
+        mOffset = 0;
+        if (mCurrentBlock + 1 == mBlocks.size()) {
+            AddBlock(Size + Align);
+        }
+        ++mCurrentBlock;
+    }
+}
+
+void* TScratchArena::Reallocate(void* Ptr, size_t OldSize, size_t NewSize) {
+    if (!Ptr) {
+        return Allocate(NewSize);
+    }
+    if (NewSize <= OldSize) {
+        return Ptr;
+    }
+    if (Ptr == mLastAllocation) {
+        auto& Block = mBlocks[mCurrentBlock];
+        size_t Start = size_t(static_cast<std::byte*>(Ptr) - Block.Data.get());
+        if (Start + NewSize <= Block.Size) {
+            mOffset = Start + NewSize;
+            return Ptr;
+        }
+    }
+    void* NewPtr = Allocate(NewSize);
+    std::memcpy(NewPtr, Ptr, OldSize);
+    return NewPtr;
+}
+
+void TScratchArena::Reset() {
+    if (Used() > mHighWaterMark) {
+        mHighWaterMark = Used();
+        size_t Global = mGlobalHighWaterMark;
+        while (mHighWaterMark > Global && !mGlobalHighWaterMark.compare_exchange_weak(Global, mHighWaterMark)) { }
+    }
+    if (mBlocks.size() > 1) {
+        // merge everything into one block, so the next packet of this size fits without growing
+        size_t Total = Capacity();
+        mBlocks.clear();
+        AddBlock(Total);
+        debug("scratch arena grew to " + std::to_string(Total / KB) + " KiB (high-water mark: " + std::to_string(mHighWaterMark) + " bytes)");
+    }
+    mCurrentBlock = 0;
+    mOffset = 0;
+    mUsedInPreviousBlocks = 0;
+    mLastAllocation = nullptr;
+}
+
+size_t TScratchArena::Capacity() const {
+    size_t Total = 0;
+    for (const auto& Block : mBlocks) {
+        Total += Block.Size;
+    }
+    return Total;
+}
+
+void TScratchArena::AddBlock(size_t MinSize) {
+    size_t Size = std::max(InitialBlockSize, MinSize);
+    if (!mBlocks.empty()) {
+        Size = std::max(Size, mBlocks.back().Size * 2);
+    }
+    mBlocks.push_back(TBlock { std::unique_ptr<std::byte[]>(new std::byte[Size]), Size });
+}
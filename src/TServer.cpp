@@ -3,6 +3,8 @@
 #include "Common.h"
 #include "TNetwork.h"
 #include "TPPSMonitor.h"
+#include "TPacketSchema.h"
+#include "TScratchArena.h"
 #include <TLuaFile.h>
 #include <any>
 #include <sstream>
@@ -33,8 +35,20 @@ void TServer::RemoveClient(const std::weak_ptr<TClient>& WeakClientPtr) {
         TClient& Client = *WeakClientPtr.lock();
         debug("removing client " + Client.GetName() + " (" + std::to_string(ClientCount()) + ")");
         Client.ClearCars();
+        if (Client.GetID() >= 0) {
+            for (auto* Observer : mObservers) {
+                Observer->OnPlayerRemoved(Client.GetID());
+            }
+        }
         WriteLock Lock(mClientsMutex);
         mClients.erase(WeakClientPtr.lock());
+        if (auto Room = mRooms.find(Client.GetRoom()); Room != mRooms.end()) {
+            Room->second.erase(WeakClientPtr.lock());
+            if (Room->second.empty()) {
+                mRooms.erase(Room);
+            }
+        }
+        InvalidatePlayerList();
     }
 }
 
@@ -42,6 +56,7 @@ std::weak_ptr<TClient> TServer::InsertNewClient() {
     debug("inserting new client (" + std::to_string(ClientCount()) + ")");
     WriteLock Lock(mClientsMutex);
     auto [Iter, Replaced] = mClients.insert(std::make_shared<TClient>(*this));
+    InvalidatePlayerList();
     return *Iter;
 }
 
@@ -63,11 +78,183 @@ size_t TServer::ClientCount() const {
     return mClients.size();
 }
 
+void TServer::SetRemotePlayer(int ID, const std::string& Name) {
+    WriteLock Lock(mClientsMutex);
+    mRemotePlayers[ID] = Name;
+    InvalidatePlayerList();
+}
+
+void TServer::RemoveRemotePlayer(int ID) {
+    WriteLock Lock(mClientsMutex);
+    if (mRemotePlayers.erase(ID) > 0) {
+        InvalidatePlayerList();
+    }
+}
+
+size_t TServer::PlayerCount() const {
+    ReadLock Lock(mClientsMutex);
+    return mClients.size() + mRemotePlayers.size();
+}
+
+std::shared_ptr<TClient> TServer::FindClient(int ID) const {
+    // clients which don't have an ID yet are -1, nobody gets to pick one of those
+    if (ID < 0) {
+        return nullptr;
+    }
+    ReadLock Lock(mClientsMutex);
+    for (const auto& Client : mClients) {
+        if (Client->GetID() == ID) {
+            return Client;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<std::string> TServer::RoomMap(const std::string& Room) {
+    if (Room == DefaultRoom) {
+        return Application::Settings.MapName;
+    }
+    if (auto Iter = Application::Settings.Rooms.find(Room); Iter != Application::Settings.Rooms.end()) {
+        return Iter->second;
+    }
+    return std::nullopt;
+}
+
+std::string TServer::RoomOf(const TClient& Client) const {
+    ReadLock Lock(mClientsMutex);
+    return Client.GetRoom();
+}
+
+void TServer::SetClientRoom(const std::shared_ptr<TClient>& Client, const std::string& Room) {
+    WriteLock Lock(mClientsMutex);
+    if (mClients.count(Client) != 0) {
+        if (auto Old = mRooms.find(Client->GetRoom()); Old != mRooms.end()) {
+            Old->second.erase(Client);
+            if (Old->second.empty()) {
+                mRooms.erase(Old);
+            }
+        }
+        mRooms[Room].insert(Client);
+    }
+    // a client which isn't inserted yet is put into its room then
+    Client->SetRoom(Room);
+}
+
+void TServer::ForEachClientInRoom(const TClient& Client, const std::function<bool(std::weak_ptr<TClient>)>& Fn) {
+    ForEachClientInRoom(RoomOf(Client), Fn);
+}
+
+void TServer::ForEachClientInRoom(const std::string& RoomName, const std::function<bool(std::weak_ptr<TClient>)>& Fn) {
+    TClientSet Clients;
+    {
+        ReadLock Lock(mClientsMutex);
+        if (auto Room = mRooms.find(RoomName); Room != mRooms.end()) {
+            Clients = Room->second;
+        }
+    }
+    for (auto& Other : Clients) {
+        if (!Fn(Other)) {
+            break;
+        }
+    }
+}
+
+std::string TServer::EmptiestRoom() const {
+    ReadLock Lock(mClientsMutex);
+    auto PlayersIn = [&](const std::string& Room) {
+        auto Iter = mRooms.find(Room);
+        return Iter == mRooms.end() ? size_t(0) : Iter->second.size();
+    };
+    std::string Emptiest(DefaultRoom);
+    for (const auto& [Room, Map] : Application::Settings.Rooms) {
+        if (PlayersIn(Room) < PlayersIn(Emptiest)) {
+            Emptiest = Room;
+        }
+    }
+    return Emptiest;
+}
+
+void TServer::NotifyPlayerUpdated(const TClient& Client) {
+    for (auto* Observer : mObservers) {
+        Observer->OnPlayerUpdated(Client);
+    }
+}
+
+void TServer::NotifyVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) {
+    for (auto* Observer : mObservers) {
+        Observer->OnVehicleUpdated(Client, VehicleID, Data);
+    }
+}
+
+void TServer::NotifyVehicleRemoved(int PlayerID, int VehicleID) {
+    for (auto* Observer : mObservers) {
+        Observer->OnVehicleRemoved(PlayerID, VehicleID);
+    }
+}
+
+void TServer::NotifyBroadcast(const TClient* Sender, const std::string& Data, bool Rel) {
+    for (auto* Observer : mObservers) {
+        Observer->OnBroadcast(Sender, Data, Rel);
+    }
+}
+
+void TServer::NotifySessionIssued(const TClient& Client, const std::string& Token) {
+    for (auto* Observer : mObservers) {
+        Observer->OnSessionIssued(Client, Token);
+    }
+}
+
+void TServer::InvalidatePlayerList() {
+    ++mPlayerListVersion;
+    // the player list is part of the heartbeat
+    Application::NotifyStateChanged();
+}
+
+std::shared_ptr<const TServer::TPlayerListSnapshot> TServer::GetPlayerList() {
+    std::unique_lock Lock(mPlayerListMutex);
+    // read the version before looking at the clients, so a change during the rebuild causes another one
+    uint64_t Version = mPlayerListVersion;
+    int MaxPlayers = Application::Settings.MaxPlayers;
+    if (mPlayerList && mPlayerList->Version == Version && mPlayerList->MaxPlayers == MaxPlayers) {
+        return mPlayerList;
+    }
+    auto List = std::make_shared<TPlayerListSnapshot>();
+    List->Version = Version;
+    List->MaxPlayers = MaxPlayers;
+    std::string Names;
+    size_t Count;
+    {
+        ReadLock ClientsLock(mClientsMutex);
+        Count = mClients.size() + mRemotePlayers.size();
+        for (const auto& Client : mClients) {
+            auto Name = Client->GetName();
+            Names += Name + ",";
+            List->HeartbeatList += Name + ";";
+        }
+        for (const auto& [ID, Name] : mRemotePlayers) {
+            Names += Name + ",";
+            List->HeartbeatList += Name + ";";
+        }
+    }
+    if (!Names.empty()) {
+        Names.pop_back();
+    }
+    List->Packet = PacketSchema::Serialize<PacketSchema::TPlayerList>(std::to_string(Count) + "/" + std::to_string(MaxPlayers), Names);
+    if (Names.empty()) {
+        // no trailing separator without names
+        List->Packet.pop_back();
+    }
+    mPlayerList = std::move(List);
+    return mPlayerList;
+}
+
 void TServer::GlobalParser(const std::weak_ptr<TClient>& Client, std::string Packet, TPPSMonitor& PPSMonitor, TNetwork& Network) {
+    // everything allocated from the scratch arena while handling this packet is released at the end
+    TScratchArena::TScope ArenaScope;
     if (Packet.find("Zp") != std::string::npos && Packet.size() > 500) {
         //abort();
     }
-    if (Packet.substr(0, 4) == "ABG:") {
+    if (Packet.compare(0, 4, "ABG:") == 0) {
         Packet = DeComp(Packet.substr(4));
     }
     if (Packet.empty()) {
@@ -82,10 +269,22 @@ void TServer::GlobalParser(const std::weak_ptr<TClient>& Client, std::string Pac
     std::any Res;
     char Code = Packet.at(0);
 
+    // a relay's players only get to join and spawn, which is turned down below
+    if (Network.IsReadOnly() && Code != 'H' && Code != 'p' && Packet.compare(0, 2, "Os") != 0) {
+        return;
+    }
     //V to Z
     if (Code <= 90 && Code >= 86) {
         PPSMonitor.IncrementInternalPPS();
-        Network.SendToAll(LockedClient.get(), Packet, false, false);
+        auto Transform = TVehicleTransform::Parse(Packet);
+        // nobody gets to move other players' vehicles
+        if (Transform && Transform->PlayerID != LockedClient->GetID()) {
+            Transform.reset();
+        }
+        if (Transform) {
+            LockedClient->Server().VehicleTransforms().Update(*Transform, LockedClient->Server().RoomOf(*LockedClient));
+        }
+        Network.SendToAll(LockedClient.get(), Packet, false, false, Transform ? &*Transform : nullptr);
         return;
     }
     switch (Code) {
@@ -115,16 +314,19 @@ void TServer::GlobalParser(const std::weak_ptr<TClient>& Client, std::string Pac
         trace(std::string(("got 'J' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
         Network.SendToAll(LockedClient.get(), Packet, false, true);
         return;
-    case 'C':
+    case 'C': {
         trace(std::string(("got 'C' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        if (Packet.length() < 4 || Packet.find(':', 3) == std::string::npos)
+        auto Chat = PacketSchema::Parse<PacketSchema::TChat>(Packet);
+        if (!Chat)
             break;
-        Res = TriggerLuaEvent("onChatMessage", false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID(), LockedClient->GetName(), Packet.substr(Packet.find(':', 3) + 1) } }), true);
-        LogChatMessage(LockedClient->GetName(), LockedClient->GetID(), Packet.substr(Packet.find(':', 3) + 1)); // FIXME: this needs to be adjusted once lua is merged
+        std::string Message(std::get<1>(*Chat));
+        Res = TriggerLuaEvent("onChatMessage", false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { LockedClient->GetID(), LockedClient->GetName(), Message } }), true);
+        LogChatMessage(LockedClient->GetName(), LockedClient->GetID(), Message); // FIXME: this needs to be adjusted once lua is merged
         if (std::any_cast<int>(Res))
             break;
-        Network.SendToAll(nullptr, Packet, true, true);
+        Network.SendToAll(LockedClient.get(), Packet, true, true);
         return;
+    }
     case 'E':
         trace(std::string(("got 'E' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
         HandleEvent(*LockedClient, Packet);
@@ -139,36 +341,24 @@ void TServer::GlobalParser(const std::weak_ptr<TClient>& Client, std::string Pac
 }
 
 void TServer::HandleEvent(TClient& c, const std::string& Data) {
-    std::stringstream ss(Data);
-    std::string t, Name;
-    int a = 0;
-    while (std::getline(ss, t, ':')) {
-        switch (a) {
-        case 1:
-            Name = t;
-            break;
-        case 2:
-            TriggerLuaEvent(Name, false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), t } }), false);
-            break;
-        default:
-            break;
-        }
-        if (a == 2)
-            break;
-        a++;
+    auto Event = PacketSchema::Parse<PacketSchema::TEvent>(Data);
+    if (!Event || std::get<1>(*Event).empty()) {
+        return;
     }
+    auto [Name, EventData] = *Event;
+    TriggerLuaEvent(std::string(Name), false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), std::string(EventData) } }), false);
 }
-bool TServer::IsUnicycle(TClient& c, const std::string& CarJson) {
-    rapidjson::Document Car;
-    Car.Parse(CarJson.c_str(), CarJson.size());
+bool TServer::IsUnicycle(TClient& c, std::string_view CarJson) {
+    TArenaJsonDocument Car;
+    Car.Parse(CarJson.data(), CarJson.size());
     if (Car.HasParseError()) {
-        error("Failed to parse vehicle data -> " + CarJson);
+        error("Failed to parse vehicle data -> " + std::string(CarJson));
     } else if (Car["jbm"].IsString() && std::string(Car["jbm"].GetString()) == "unicycle") {
         return true;
     }
     return false;
 }
-bool TServer::ShouldSpawn(TClient& c, const std::string& CarJson, int ID) {
+bool TServer::ShouldSpawn(TClient& c, std::string_view CarJson, int ID) {
 
     if (c.GetUnicycleID() > -1 && (c.GetCarCount() - 1) < Application::Settings.MaxCars) {
         return true;
@@ -183,55 +373,50 @@ bool TServer::ShouldSpawn(TClient& c, const std::string& CarJson, int ID) {
 }
 
 void TServer::ParseVehicle(TClient& c, const std::string& Pckt, TNetwork& Network) {
+    using namespace PacketSchema;
     if (Pckt.length() < 4)
         return;
     std::string Packet = Pckt;
-    char Code = Packet.at(1);
-    int PID = -1;
-    int VID = -1, Pos;
-    std::string Data = Packet.substr(3), pid, vid;
-    switch (Code) { //Spawned Destroyed Switched/Moved NotFound Reset
-    case 's':
-        trace(std::string(("got 'Os' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        if (Data.at(0) == '0') {
+    trace(std::string(("got '")) + Packet.substr(0, 2) + ("' packet: '") + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
+    //Spawned Destroyed Switched/Moved NotFound Reset
+    bool Handled = Dispatch(Packet, TSchemaList<TVehicleSpawnRequest, TVehicleEdit, TVehicleDelete, TVehicleReset, TVehicleOther> {}, THandlers {
+        [&](TVehicleSpawnRequest, const TValues<TVehicleSpawnRequest>& Spawn) {
+            if (std::get<0>(Spawn) != "0") {
+                return;
+            }
             int CarID = c.GetOpenCarID();
             debug(c.GetName() + (" created a car with ID ") + std::to_string(CarID));
 
-            std::string CarJson = Packet.substr(5);
-            Packet = "Os:" + c.GetRoles() + ":" + c.GetName() + ":" + std::to_string(c.GetID()) + "-" + std::to_string(CarID) + ":" + CarJson;
+            std::string CarJson(std::get<1>(Spawn));
+            Packet = Serialize<TVehicleSpawn>(c.GetRoles(), c.GetName(), TVehicleIDValue { c.GetID(), CarID }, CarJson);
             auto Res = TriggerLuaEvent(("onVehicleSpawn"), false, nullptr, std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), CarID, Packet.substr(3) } }), true);
 
-            if (ShouldSpawn(c, CarJson, CarID) && std::any_cast<int>(Res) == 0) {
+            if (!Network.IsReadOnly() && ShouldSpawn(c, CarJson, CarID) && std::any_cast<int>(Res) == 0) {
                 c.AddNewCar(CarID, Packet);
-                Network.SendToAll(nullptr, Packet, true, true);
+                Network.SendToAll(&c, Packet, true, true);
             } else {
                 if (!Network.Respond(c, Packet, true)) {
                     // TODO: handle
                 }
-                std::string Destroy = "Od:" + std::to_string(c.GetID()) + "-" + std::to_string(CarID);
+                std::string Destroy = Serialize<TVehicleDelete>(TVehicleIDValue { c.GetID(), CarID });
                 if (!Network.Respond(c, Destroy, true)) {
                     // TODO: handle
                 }
                 debug(c.GetName() + (" (force : car limit/lua) removed ID ") + std::to_string(CarID));
             }
-        }
-        return;
-    case 'c':
-        trace(std::string(("got 'Oc' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        pid = Data.substr(0, Data.find('-'));
-        vid = Data.substr(Data.find('-') + 1, Data.find(':', 1) - Data.find('-') - 1);
-        if (pid.find_first_not_of("0123456789") == std::string::npos && vid.find_first_not_of("0123456789") == std::string::npos) {
-            PID = stoi(pid);
-            VID = stoi(vid);
-        }
-        if (PID != -1 && VID != -1 && PID == c.GetID()) {
+        },
+        [&](TVehicleEdit, const TValues<TVehicleEdit>& Edit) {
+            if (std::get<0>(Edit).PlayerID != c.GetID()) {
+                return;
+            }
+            int VID = std::get<0>(Edit).VehicleID;
             auto Res = TriggerLuaEvent(("onVehicleEdited"), false, nullptr,
                 std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), VID, Packet.substr(3) } }),
                 true);
 
             auto FoundPos = Packet.find('{');
             FoundPos = FoundPos == std::string::npos ? 0 : FoundPos; // attempt at sanitizing this
-            if ((c.GetUnicycleID() != VID || IsUnicycle(c, Packet.substr(FoundPos)))
+            if ((c.GetUnicycleID() != VID || IsUnicycle(c, std::string_view(Packet).substr(FoundPos)))
                 && std::any_cast<int>(Res) == 0) {
                 Network.SendToAll(&c, Packet, false, true);
                 Apply(c, VID, Packet);
@@ -239,59 +424,47 @@ void TServer::ParseVehicle(TClient& c, const std::string& Pckt, TNetwork& Networ
                 if (c.GetUnicycleID() == VID) {
                     c.SetUnicycleID(-1);
                 }
-                std::string Destroy = "Od:" + std::to_string(c.GetID()) + "-" + std::to_string(VID);
+                std::string Destroy = Serialize<TVehicleDelete>(TVehicleIDValue { c.GetID(), VID });
                 if (!Network.Respond(c, Destroy, true)) {
                     // TODO: handle
                 }
                 c.DeleteCar(VID);
             }
-        }
-        return;
-    case 'd':
-        trace(std::string(("got 'Od' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        pid = Data.substr(0, Data.find('-'));
-        vid = Data.substr(Data.find('-') + 1);
-        if (pid.find_first_not_of("0123456789") == std::string::npos && vid.find_first_not_of("0123456789") == std::string::npos) {
-            PID = stoi(pid);
-            VID = stoi(vid);
-        }
-        if (PID != -1 && VID != -1 && PID == c.GetID()) {
+        },
+        [&](TVehicleDelete, const TValues<TVehicleDelete>& Delete) {
+            if (std::get<0>(Delete).PlayerID != c.GetID()) {
+                return;
+            }
+            int VID = std::get<0>(Delete).VehicleID;
             if (c.GetUnicycleID() == VID) {
                 c.SetUnicycleID(-1);
             }
-            Network.SendToAll(nullptr, Packet, true, true);
+            Network.SendToAll(&c, Packet, true, true);
             TriggerLuaEvent(("onVehicleDeleted"), false, nullptr,
                 std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), VID } }), false);
             c.DeleteCar(VID);
             debug(c.GetName() + (" deleted car with ID ") + std::to_string(VID));
-        }
-        return;
-    case 'r':
-        trace(std::string(("got 'Or' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        Pos = int(Data.find('-'));
-        pid = Data.substr(0, Pos++);
-        vid = Data.substr(Pos, Data.find(':') - Pos);
-
-        if (pid.find_first_not_of("0123456789") == std::string::npos && vid.find_first_not_of("0123456789") == std::string::npos) {
-            PID = stoi(pid);
-            VID = stoi(vid);
-        }
-
-        if (PID != -1 && VID != -1 && PID == c.GetID()) {
-            Data = Data.substr(Data.find('{'));
+        },
+        [&](TVehicleReset, const TValues<TVehicleReset>& Reset) {
+            if (std::get<0>(Reset).PlayerID != c.GetID()) {
+                return;
+            }
+            int VID = std::get<0>(Reset).VehicleID;
+            auto Data = std::get<1>(Reset);
+            auto FoundPos = Data.find('{');
+            if (FoundPos == std::string_view::npos) {
+                return;
+            }
             TriggerLuaEvent("onVehicleReset", false, nullptr,
-                std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), VID, Data } }),
+                std::make_unique<TLuaArg>(TLuaArg { { c.GetID(), VID, std::string(Data.substr(FoundPos)) } }),
                 false);
             Network.SendToAll(&c, Packet, false, true);
-        }
-        return;
-    case 't':
-        trace(std::string(("got 'Ot' packet: '")) + Packet + ("' (") + std::to_string(Packet.size()) + (")"));
-        Network.SendToAll(&c, Packet, false, true);
-        return;
-    default:
+        },
+        [&](TVehicleOther, const TValues<TVehicleOther>&) {
+            Network.SendToAll(&c, Packet, false, true);
+        } });
+    if (!Handled) {
         trace(std::string(("possibly not implemented: '") + Packet + ("' (") + std::to_string(Packet.size()) + (")")));
-        return;
     }
 }
 
@@ -301,7 +474,7 @@ void TServer::Apply(TClient& c, int VID, const std::string& pckt) {
         error("Malformed packet received, no '{' found");
         return;
     }
-    std::string Packet = pckt.substr(FoundPos);
+    const char* Packet = pckt.c_str() + FoundPos;
     std::string VD = c.GetCarData(VID);
     if (VD.empty()) {
         error("Tried to apply change to vehicle that does not exist");
@@ -313,7 +486,6 @@ void TServer::Apply(TClient& c, int VID, const std::string& pckt) {
         Sentry.LogError("attempt to apply change to nonexistent vehicle", _file_basename, _line);
         return;
     }
-    std::string Header = VD.substr(0, VD.find('{'));
 
     FoundPos = VD.find('{');
     if (FoundPos == std::string::npos) {
@@ -324,14 +496,13 @@ void TServer::Apply(TClient& c, int VID, const std::string& pckt) {
         error("Malformed packet received, no '{' found");
         return;
     }
-    VD = VD.substr(FoundPos);
-    rapidjson::Document Veh, Pack;
-    Veh.Parse(VD.c_str());
+    TArenaJsonDocument Veh, Pack;
+    Veh.Parse(VD.c_str() + FoundPos);
     if (Veh.HasParseError()) {
         error("Could not get vehicle config!");
         return;
     }
-    Pack.Parse(Packet.c_str());
+    Pack.Parse(Packet);
     if (Pack.HasParseError() || Pack.IsNull()) {
         error("Could not get active vehicle config!");
         return;
@@ -344,14 +515,18 @@ void TServer::Apply(TClient& c, int VID, const std::string& pckt) {
             Veh[M.name] = Pack[M.name];
         }
     }
-    rapidjson::StringBuffer Buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(Buffer);
+    TArenaJsonStringBuffer Buffer;
+    TArenaJsonWriter writer(Buffer, TArenaJsonAllocator::Get());
     Veh.Accept(writer);
-    c.SetCarData(VID, Header + Buffer.GetString());
+    // keep the header, replace the json
+    VD.replace(FoundPos, std::string::npos, Buffer.GetString(), Buffer.GetSize());
+    c.SetCarData(VID, VD);
 }
 
 void TServer::InsertClient(const std::shared_ptr<TClient>& NewClient) {
     debug("inserting client (" + std::to_string(ClientCount()) + ")");
     WriteLock Lock(mClientsMutex); //TODO why is there 30+ threads locked here
     (void)mClients.insert(NewClient);
+    mRooms[NewClient->GetRoom()].insert(NewClient);
+    InvalidatePlayerList();
 }
@@ -0,0 +1,121 @@
+#include "TSessionStore.h"
+
+#include "Client.h"
+
+#include <algorithm>
+#include <openssl/rand.h>
+#include <random>
+
+std::string TSessionStore::GenerateToken() {
+    static constexpr char HexDigits[] = "0123456789abcdef";
+    unsigned char Bytes[16];
+    if (RAND_bytes(Bytes, sizeof(Bytes)) != 1) {
+        // falls back to a token which can't be guessed quite as well, but still works
+        std::random_device Device;
+        for (auto& Byte : Bytes) {
+            Byte = static_cast<unsigned char>(Device());
+        }
+    }
+    std::string Token;
+    Token.reserve(sizeof(Bytes) * 2);
+    for (auto Byte : Bytes) {
+        Token += HexDigits[Byte >> 4];
+        Token += HexDigits[Byte & 0xf];
+    }
+    return Token;
+}
+
+std::string TSessionStore::Issue(const std::shared_ptr<TClient>& Client) {
+    auto Token = GenerateToken();
+    std::unique_lock Lock(mMutex);
+    EraseToken(*Client);
+    mSessions[Token] = TSession { Client, false, {} };
+    mTokens[Client.get()] = Token;
+    return Token;
+}
+
+bool TSessionStore::Park(const TClient& Client) {
+    std::unique_lock Lock(mMutex);
+    auto Iter = mTokens.find(&Client);
+    if (Iter == mTokens.end()) {
+        return false;
+    }
+    auto& Session = mSessions.at(Iter->second);
+    Session.Parked = true;
+    Session.Expiry = std::chrono::steady_clock::now() + std::chrono::seconds(Application::Settings.ResumeGracePeriod);
+    return true;
+}
+
+std::shared_ptr<TClient> TSessionStore::Resume(const std::string& Token) {
+    std::unique_lock Lock(mMutex);
+    auto Iter = mSessions.find(Token);
+    if (Iter == mSessions.end() || !Iter->second.Parked || std::chrono::steady_clock::now() > Iter->second.Expiry) {
+        return nullptr;
+    }
+    auto Client = Iter->second.Client.lock();
+    if (Client) {
+        mTokens.erase(Client.get());
+    }
+    mSessions.erase(Iter);
+    return Client;
+}
+
+bool TSessionStore::Unpark(const TClient& Client) {
+    std::unique_lock Lock(mMutex);
+    auto Iter = mTokens.find(&Client);
+    if (Iter == mTokens.end() || !mSessions.at(Iter->second).Parked) {
+        return false;
+    }
+    EraseToken(Client);
+    return true;
+}
+
+std::vector<std::shared_ptr<TClient>> TSessionStore::TakeExpired() {
+    std::vector<std::shared_ptr<TClient>> Expired;
+    auto Now = std::chrono::steady_clock::now();
+    std::unique_lock Lock(mMutex);
+    for (auto Iter = mSessions.begin(); Iter != mSessions.end();) {
+        auto& Session = Iter->second;
+        if (Session.Parked && Now > Session.Expiry) {
+            if (auto Client = Session.Client.lock()) {
+                mTokens.erase(Client.get());
+                Expired.push_back(std::move(Client));
+            }
+            Iter = mSessions.erase(Iter);
+        } else {
+            ++Iter;
+        }
+    }
+    return Expired;
+}
+
+void TSessionStore::Forget(const TClient& Client) {
+    std::unique_lock Lock(mMutex);
+    EraseToken(Client);
+}
+
+std::optional<TSessionStore::TSavedSession> TSessionStore::Save(const TClient& Client) {
+    std::unique_lock Lock(mMutex);
+    auto Iter = mTokens.find(&Client);
+    if (Iter == mTokens.end()) {
+        return std::nullopt;
+    }
+    const auto& Session = mSessions.at(Iter->second);
+    auto Remaining = std::chrono::duration_cast<std::chrono::milliseconds>(Session.Expiry - std::chrono::steady_clock::now());
+    return TSavedSession { Iter->second, Session.Parked, Session.Parked ? std::max(Remaining, std::chrono::milliseconds(0)) : std::chrono::milliseconds(0) };
+}
+
+void TSessionStore::Restore(const std::shared_ptr<TClient>& Client, const TSavedSession& Session) {
+    std::unique_lock Lock(mMutex);
+    EraseToken(*Client);
+    mSessions[Session.Token] = TSession { Client, Session.Parked, std::chrono::steady_clock::now() + Session.Remaining };
+    mTokens[Client.get()] = Session.Token;
+}
+
+void TSessionStore::EraseToken(const TClient& Client) {
+    auto Iter = mTokens.find(&Client);
+    if (Iter != mTokens.end()) {
+        mSessions.erase(Iter->second);
+        mTokens.erase(Iter);
+    }
+}
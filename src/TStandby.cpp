@@ -0,0 +1,152 @@
+#include "TStandby.h"
+
+#include "Client.h"
+#include "Common.h"
+#include "Process.h"
+#include "TNetwork.h"
+#include "TServer.h"
+#include "TStateBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string_view>
+
+std::optional<int> TStandby::Channel() {
+#ifdef __linux__
+    return Process::ReadVariable(ChannelVariable);
+#else
+    return std::nullopt;
+#endif // __linux__
+}
+
+TStandby::TStandby(int Fd)
+    : mChannel(std::make_unique<TUnixChannel>(Fd)) {
+}
+
+bool TStandby::WaitForFailover() {
+    RegisterThread("Standby");
+    info("Standing by, this process takes over if the server crashes");
+    bool Quit = false;
+    while (!Quit) {
+        auto Message = mChannel->Receive();
+        if (!Message) {
+            break;
+        }
+        std::string_view Data(Message->Data);
+        char Code = Data.empty() ? '\0' : Data[0];
+        Data.remove_prefix(Data.empty() ? 0 : 1);
+        if (Code == StandbyMessage::TCPListener && Message->Fds.size() == 1) {
+            if (mTCPListener != -1) {
+                CloseSocketProper(mTCPListener);
+            }
+            mTCPListener = Message->Fds[0];
+            Message->Fds.clear();
+        } else if (Code == StandbyMessage::UDPSocket && Message->Fds.size() == 1) {
+            if (mUDPSock != -1) {
+                CloseSocketProper(mUDPSock);
+            }
+            mUDPSock = Message->Fds[0];
+            Message->Fds.clear();
+        } else if (Code == StandbyMessage::Quit) {
+            Quit = true;
+        } else {
+            try {
+                TStateReader Reader(Data);
+                Apply(Code, Reader);
+            } catch (const std::exception& e) {
+                error("standby: " + std::string(e.what()));
+            }
+        }
+        for (int Unused : Message->Fds) {
+            CloseSocketProper(Unused);
+        }
+    }
+    if (Quit) {
+        debug("standby: the server shut down");
+        return false;
+    }
+    // it went away before it served anything, there's nothing to take over
+    if (mTCPListener == -1 || mUDPSock == -1) {
+        warn("The server exited before it was up, the standby exits too");
+        return false;
+    }
+    warn("Lost the server, taking over its " + std::to_string(mPlayers.size()) + " players");
+    return true;
+}
+
+void TStandby::Apply(char Code, TStateReader& Reader) {
+    int ID = int(Reader.Int());
+    if (Code == StandbyMessage::Player) {
+        auto& Player = mPlayers[ID];
+        Player.Name = Reader.String();
+        Player.Roles = Reader.String();
+        Player.Guest = Reader.Bool();
+        Player.Identifiers.clear();
+        for (auto Count = Reader.Int(); Count > 0; --Count) {
+            Player.Identifiers.push_back(Reader.String());
+        }
+        Player.Capabilities = uint32_t(Reader.Int());
+        Player.Room = Reader.String();
+    } else if (Code == StandbyMessage::Left) {
+        mPlayers.erase(ID);
+    } else if (Code == StandbyMessage::Vehicle) {
+        int VehicleID = int(Reader.Int());
+        bool Unicycle = Reader.Bool();
+        auto& Player = mPlayers[ID];
+        Player.Vehicles[VehicleID] = Reader.String();
+        if (Unicycle) {
+            Player.UnicycleID = VehicleID;
+        }
+    } else if (Code == StandbyMessage::Removed) {
+        if (auto Iter = mPlayers.find(ID); Iter != mPlayers.end()) {
+            int VehicleID = int(Reader.Int());
+            Iter->second.Vehicles.erase(VehicleID);
+            if (Iter->second.UnicycleID == VehicleID) {
+                Iter->second.UnicycleID = -1;
+            }
+        }
+    } else if (Code == StandbyMessage::Session) {
+        mPlayers[ID].Token = Reader.String();
+    }
+}
+
+void TStandby::TakeOver(TServer& Server, TNetwork& Network) {
+    Network.AdoptSockets(mTCPListener, mUDPSock);
+    std::chrono::milliseconds GracePeriod = std::chrono::seconds(std::max(Application::Settings.ResumeGracePeriod, 0));
+    size_t Resumable = 0;
+    for (auto& [ID, Player] : mPlayers) {
+        // vehicles of a player who wasn't in game yet
+        if (Player.Name.empty()) {
+            continue;
+        }
+        auto Client = std::make_shared<TClient>(Server);
+        Client->SetID(ID);
+        Client->SetName(Player.Name);
+        Client->SetRoles(Player.Roles);
+        Client->SetIsGuest(Player.Guest);
+        for (const auto& Identifier : Player.Identifiers) {
+            Client->AddIdentifier(Identifier);
+        }
+        Client->SetCapabilities(Player.Capabilities);
+        Client->SetRoom(Player.Room);
+        Client->SetIsMapSent(true);
+        Client->SetIsSynced(true);
+        Client->SetIsConnected(false);
+        Client->SetTCPSock(-1);
+        Client->SetDownSock(0);
+        Client->SetUnicycleID(Player.UnicycleID);
+        // who can't resume is parked with a token nobody knows, and removed as soon as the
+        // parked sessions are checked next, which tells the others to remove their vehicles
+        bool CanResume = !Player.Token.empty() && GracePeriod.count() > 0;
+        Network.AdoptClient(Client, TSessionStore::TSavedSession {
+                                        CanResume ? Player.Token : TSessionStore::GenerateToken(),
+                                        true,
+                                        CanResume ? GracePeriod : std::chrono::milliseconds(0) });
+        // after it's in, so the observers hear about it in order
+        for (const auto& [VehicleID, Data] : Player.Vehicles) {
+            Client->AddNewCar(VehicleID, Data);
+        }
+        Resumable += CanResume ? 1 : 0;
+    }
+    info("Took over from the server which crashed, " + std::to_string(Resumable) + " of " + std::to_string(mPlayers.size()) + " players may resume their sessions");
+}
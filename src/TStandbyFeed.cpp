@@ -0,0 +1,340 @@
+#include "TStandbyFeed.h"
+
+#include "Client.h"
+#include "Common.h"
+#include "Process.h"
+#include "TClusterWorker.h"
+#include "THotUpgrade.h"
+#include "TNetwork.h"
+#include "TServer.h"
+#include "TStandby.h"
+#include "TStateBuffer.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+TStandbyFeed::TStandbyFeed(TServer& Server, TNetwork& Network)
+    : mServer(Server)
+    , mNetwork(Network)
+    , mArgv(Process::CommandLine()) {
+    mThread = std::thread(&TStandbyFeed::WatchMain, this);
+    mWriter = std::thread(&TStandbyFeed::WriteMain, this);
+    Application::RegisterShutdownHandler([this] { Stop(); });
+}
+
+TStandbyFeed::~TStandbyFeed() {
+    Stop();
+}
+
+void TStandbyFeed::ShareTCPListener(SOCKET Listener) {
+    std::unique_lock Lock(mMutex);
+    mTCPListener = Listener;
+    Send(std::string(1, StandbyMessage::TCPListener), { Listener });
+}
+
+void TStandbyFeed::ShareUDPSocket(SOCKET UDPSock) {
+    std::unique_lock Lock(mMutex);
+    mUDPSock = UDPSock;
+    Send(std::string(1, StandbyMessage::UDPSocket), { UDPSock });
+}
+
+void TStandbyFeed::Stop() {
+    {
+        std::unique_lock Lock(mMutex);
+        if (mShutdown) {
+            return;
+        }
+        mShutdown = true;
+        // past the limit, it's the last one
+        if (mChannel) {
+            mQueue.push_back({ std::string(1, StandbyMessage::Quit), {} });
+        }
+    }
+    mQueued.notify_all();
+    mStopped.notify_all();
+    { // standby scope
+        std::unique_lock Lock(mMutex);
+        // the standby exits once it got that
+        if (!mStopped.wait_for(Lock, StopTimeout, [this] { return mPid == -1; })) {
+            warn("The standby process didn't exit in time, killing it");
+            kill(mPid, SIGKILL);
+        }
+    } // end standby scope
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mWriter.joinable()) {
+        mWriter.join();
+    }
+}
+
+void TStandbyFeed::OnPlayerUpdated(const TClient& Client) {
+    auto Message = PlayerMessage(Client);
+    std::unique_lock Lock(mMutex);
+    Send(std::move(Message));
+}
+
+void TStandbyFeed::OnPlayerRemoved(int PlayerID) {
+    TStateWriter Writer;
+    Writer.Int(PlayerID);
+    std::unique_lock Lock(mMutex);
+    Send(StandbyMessage::Left + Writer.Data());
+}
+
+void TStandbyFeed::OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) {
+    auto Message = VehicleMessage(Client, VehicleID, Data);
+    std::unique_lock Lock(mMutex);
+    Send(std::move(Message));
+}
+
+void TStandbyFeed::OnVehicleRemoved(int PlayerID, int VehicleID) {
+    TStateWriter Writer;
+    Writer.Int(PlayerID);
+    Writer.Int(VehicleID);
+    std::unique_lock Lock(mMutex);
+    Send(StandbyMessage::Removed + Writer.Data());
+}
+
+void TStandbyFeed::OnSessionIssued(const TClient& Client, const std::string& Token) {
+    TStateWriter Writer;
+    Writer.Int(Client.GetID());
+    Writer.String(Token);
+    std::unique_lock Lock(mMutex);
+    Send(StandbyMessage::Session + Writer.Data());
+}
+
+std::string TStandbyFeed::PlayerMessage(const TClient& Client) const {
+    TStateWriter Writer;
+    Writer.Int(Client.GetID());
+    Writer.String(Client.GetName());
+    Writer.String(Client.GetRoles());
+    Writer.Bool(Client.IsGuest());
+    auto Identifiers = Client.GetIdentifiers();
+    Writer.Int(int64_t(Identifiers.size()));
+    for (const auto& Identifier : Identifiers) {
+        Writer.String(Identifier);
+    }
+    Writer.Int(Client.Capabilities());
+    Writer.String(mServer.RoomOf(Client));
+    return StandbyMessage::Player + Writer.Data();
+}
+
+std::string TStandbyFeed::VehicleMessage(const TClient& Client, int VehicleID, const std::string& Data) {
+    TStateWriter Writer;
+    Writer.Int(Client.GetID());
+    Writer.Int(VehicleID);
+    Writer.Bool(Client.GetUnicycleID() == VehicleID);
+    Writer.String(Data);
+    return StandbyMessage::Vehicle + Writer.Data();
+}
+
+void TStandbyFeed::Send(std::string Message, std::vector<int> Fds) {
+    // while there's no standby, it catches up once there is one
+    if (!mChannel) {
+        return;
+    }
+    if (mQueue.size() >= MaxQueued) {
+        Restart("it fell too far behind");
+        return;
+    }
+    mQueue.push_back({ std::move(Message), std::move(Fds) });
+    mQueued.notify_one();
+}
+
+void TStandbyFeed::Restart(const std::string& Reason) {
+    warn("The standby process is restarted, " + Reason);
+    mChannel.reset();
+    mQueue.clear();
+    mCatchingUp = false;
+    // WatchMain notices it's gone and starts another one
+    if (mPid > 0) {
+        kill(mPid, SIGKILL);
+    }
+}
+
+bool TStandbyFeed::Spawn() {
+    int Ends[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, Ends) != 0) {
+        return false;
+    }
+    // everything the child needs is prepared here, between fork and exec it
+    // may only do what's safe in a copy of a multithreaded process
+    auto Env = Process::Environment({ TStandby::ChannelVariable, TStandby::ConsoleVariable, THotUpgrade::ChannelVariable,
+        THotUpgrade::SuccessorVariable, TClusterWorker::IndexVariable });
+    Env.push_back(std::string(TStandby::ChannelVariable) + "=" + std::to_string(Ends[1]));
+    // the console, for once it takes over
+    int Console = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    if (Console >= 0) {
+        Env.push_back(std::string(TStandby::ConsoleVariable) + "=" + std::to_string(Console));
+    }
+    auto EnvPtrs = Process::Pointers(Env);
+    auto ArgvPtrs = Process::Pointers(mArgv);
+    auto Inherited = Process::OpenFds();
+
+    pid_t Pid = fork();
+    if (Pid == 0) {
+        // a copy of the players' sockets would keep their connections open after a crash
+        Process::CloseOnExec(Inherited, { Ends[1], Console });
+        // the console is the server's until then
+        int Null = open("/dev/null", O_RDONLY);
+        if (Null >= 0) {
+            dup2(Null, STDIN_FILENO);
+        }
+        execve("/proc/self/exe", ArgvPtrs.data(), EnvPtrs.data());
+        _exit(127);
+    }
+    close(Ends[1]);
+    if (Console >= 0) {
+        close(Console);
+    }
+    if (Pid < 0) {
+        close(Ends[0]);
+        return false;
+    }
+    mChannel = std::make_shared<TUnixChannel>(Ends[0]);
+    mPid = Pid;
+    mQueue.clear();
+    mCatchingUp = true;
+    debug("standby: started process " + std::to_string(Pid));
+    return true;
+}
+
+std::vector<TStandbyFeed::TOutgoing> TStandbyFeed::Snapshot() {
+    std::vector<TOutgoing> Messages;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        auto Client = ClientPtr.lock();
+        if (!Client || !Client->IsSynced() || Client->GetID() < 0) {
+            return true;
+        }
+        Messages.push_back({ PlayerMessage(*Client), {} });
+        TClient::TSetOfVehicleData VehicleData;
+        { // Vehicle Data Lock Scope
+            auto LockedData = Client->GetAllCars();
+            VehicleData = *LockedData.VehicleData;
+        } // End Vehicle Data Lock Scope
+        for (auto& v : VehicleData) {
+            Messages.push_back({ VehicleMessage(*Client, v.ID(), v.Data()), {} });
+        }
+        if (auto Session = mNetwork.SaveSession(*Client)) {
+            TStateWriter Writer;
+            Writer.Int(Client->GetID());
+            Writer.String(Session->Token);
+            Messages.push_back({ StandbyMessage::Session + Writer.Data(), {} });
+        }
+        return true;
+    });
+    return Messages;
+}
+
+void TStandbyFeed::WatchMain() {
+    RegisterThread("StandbyFeed");
+    while (true) {
+        std::shared_ptr<TUnixChannel> Channel;
+        pid_t Pid = -1;
+        {
+            std::unique_lock Lock(mMutex);
+            if (mShutdown) {
+                break;
+            }
+            if (Spawn()) {
+                Channel = mChannel;
+                Pid = mPid;
+            } else {
+                error("Can't start the standby process: " + std::string(std::strerror(errno)));
+            }
+        }
+        if (Pid > 0) {
+            // taken without mMutex, what changes meanwhile is queued and replayed on top of it,
+            // the messages only ever set or remove
+            auto Messages = Snapshot();
+            {
+                std::unique_lock Lock(mMutex);
+                if (mChannel == Channel) {
+                    if (mUDPSock != -1) {
+                        Messages.insert(Messages.begin(), TOutgoing { std::string(1, StandbyMessage::UDPSocket), { mUDPSock } });
+                    }
+                    if (mTCPListener != -1) {
+                        Messages.insert(Messages.begin(), TOutgoing { std::string(1, StandbyMessage::TCPListener), { mTCPListener } });
+                    }
+                    mQueue.insert(mQueue.begin(), std::make_move_iterator(Messages.begin()), std::make_move_iterator(Messages.end()));
+                    mCatchingUp = false;
+                }
+            }
+            mQueued.notify_one();
+            // the standby never sends anything, this returns once it's gone
+            while (Channel->Receive()) { }
+            while (waitpid(Pid, nullptr, 0) < 0 && errno == EINTR) { }
+        }
+        std::unique_lock Lock(mMutex);
+        if (mChannel == Channel) {
+            mChannel.reset();
+            mQueue.clear();
+            mCatchingUp = false;
+        }
+        mPid = -1;
+        mStopped.notify_all();
+        if (mShutdown) {
+            break;
+        }
+        warn("The standby process exited, starting it again in " + std::to_string(RespawnDelay.count()) + " seconds");
+        mStopped.wait_for(Lock, RespawnDelay, [this] { return mShutdown.load(); });
+    }
+}
+
+void TStandbyFeed::WriteMain() {
+    RegisterThread("StandbyWriter");
+    while (true) {
+        std::deque<TOutgoing> Batch;
+        std::shared_ptr<TUnixChannel> Channel;
+        {
+            std::unique_lock Lock(mMutex);
+            mQueued.wait(Lock, [this] { return (!mQueue.empty() && !mCatchingUp) || (mShutdown && mQueue.empty()); });
+            if (mQueue.empty()) {
+                break;
+            }
+            Batch.swap(mQueue);
+            Channel = mChannel;
+        }
+        for (const auto& Message : Batch) {
+            if (!Channel->Send(Message.Data, Message.Fds)) {
+                std::unique_lock Lock(mMutex);
+                // unless it was restarted meanwhile, or is gone already
+                if (mChannel == Channel) {
+                    Restart("a message to it couldn't be sent");
+                }
+                break;
+            }
+        }
+    }
+}
+
+#else
+
+TStandbyFeed::TStandbyFeed(TServer& Server, TNetwork& Network)
+    : mServer(Server)
+    , mNetwork(Network) { }
+TStandbyFeed::~TStandbyFeed() = default;
+void TStandbyFeed::ShareTCPListener(SOCKET) { }
+void TStandbyFeed::ShareUDPSocket(SOCKET) { }
+void TStandbyFeed::Stop() { }
+void TStandbyFeed::OnPlayerUpdated(const TClient&) { }
+void TStandbyFeed::OnPlayerRemoved(int) { }
+void TStandbyFeed::OnVehicleUpdated(const TClient&, int, const std::string&) { }
+void TStandbyFeed::OnVehicleRemoved(int, int) { }
+void TStandbyFeed::OnSessionIssued(const TClient&, const std::string&) { }
+std::string TStandbyFeed::PlayerMessage(const TClient&) const { return ""; }
+std::string TStandbyFeed::VehicleMessage(const TClient&, int, const std::string&) { return ""; }
+void TStandbyFeed::Send(std::string, std::vector<int>) { }
+void TStandbyFeed::Restart(const std::string&) { }
+bool TStandbyFeed::Spawn() { return false; }
+std::vector<TStandbyFeed::TOutgoing> TStandbyFeed::Snapshot() { return {}; }
+void TStandbyFeed::WatchMain() { }
+void TStandbyFeed::WriteMain() { }
+
+#endif // __linux__
@@ -0,0 +1,33 @@
+#include "TStateBuffer.h"
+
+#include <cstring>
+#include <stdexcept>
+
+void TStateWriter::Int(int64_t Value) {
+    mData.append(reinterpret_cast<const char*>(&Value), sizeof(Value));
+}
+
+void TStateWriter::String(std::string_view Value) {
+    Int(int64_t(Value.size()));
+    mData.append(Value);
+}
+
+int64_t TStateReader::Int() {
+    int64_t Value;
+    if (mData.size() < sizeof(Value)) {
+        throw std::runtime_error("state ends early");
+    }
+    std::memcpy(&Value, mData.data(), sizeof(Value));
+    mData.remove_prefix(sizeof(Value));
+    return Value;
+}
+
+std::string TStateReader::String() {
+    auto Size = Int();
+    if (Size < 0 || uint64_t(Size) > mData.size()) {
+        throw std::runtime_error("state ends early");
+    }
+    std::string Value(mData.substr(0, size_t(Size)));
+    mData.remove_prefix(size_t(Size));
+    return Value;
+}
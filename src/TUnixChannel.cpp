@@ -0,0 +1,228 @@
+#include "TUnixChannel.h"
+
+#include "Common.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+bool MakeAddress(const std::string& Path, sockaddr_un& Addr) {
+    Addr = {};
+    Addr.sun_family = AF_UNIX;
+    if (Path.empty() || Path.size() >= sizeof(Addr.sun_path)) {
+        error("unix socket path too long: \"" + Path + "\"");
+        return false;
+    }
+    std::memcpy(Addr.sun_path, Path.data(), Path.size());
+    return true;
+}
+
+bool SendAll(int Fd, const char* Data, size_t Size) {
+    while (Size > 0) {
+        auto Sent = send(Fd, Data, Size, MSG_NOSIGNAL);
+        if (Sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (Sent <= 0) {
+            return false;
+        }
+        Data += Sent;
+        Size -= size_t(Sent);
+    }
+    return true;
+}
+
+bool ReceiveAll(int Fd, char* Data, size_t Size) {
+    while (Size > 0) {
+        auto Received = recv(Fd, Data, Size, MSG_WAITALL);
+        if (Received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (Received <= 0) {
+            return false;
+        }
+        Data += Received;
+        Size -= size_t(Received);
+    }
+    return true;
+}
+
+}
+
+TUnixChannel::TUnixChannel(int Fd)
+    : mFd(Fd) {
+}
+
+TUnixChannel::~TUnixChannel() {
+    close(mFd);
+}
+
+std::unique_ptr<TUnixChannel> TUnixChannel::Connect(const std::string& Path) {
+    sockaddr_un Addr;
+    if (!MakeAddress(Path, Addr)) {
+        return nullptr;
+    }
+    int Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Fd < 0) {
+        return nullptr;
+    }
+    if (connect(Fd, reinterpret_cast<sockaddr*>(&Addr), sizeof(Addr)) != 0) {
+        close(Fd);
+        return nullptr;
+    }
+    return std::make_unique<TUnixChannel>(Fd);
+}
+
+int TUnixChannel::Listen(const std::string& Path) {
+    sockaddr_un Addr;
+    if (!MakeAddress(Path, Addr)) {
+        return -1;
+    }
+    int Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Fd < 0) {
+        return -1;
+    }
+    // left behind by a process which didn't get to clean up
+    unlink(Path.c_str());
+    if (bind(Fd, reinterpret_cast<sockaddr*>(&Addr), sizeof(Addr)) != 0 || listen(Fd, SOMAXCONN) != 0) {
+        error("can't listen on unix socket \"" + Path + "\": " + std::string(std::strerror(errno)));
+        close(Fd);
+        return -1;
+    }
+    return Fd;
+}
+
+std::unique_ptr<TUnixChannel> TUnixChannel::Accept(int ListenFd) {
+    for (;;) {
+        int Fd = accept4(ListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (Fd >= 0) {
+            return std::make_unique<TUnixChannel>(Fd);
+        }
+        if (errno != EINTR && errno != ECONNABORTED) {
+            return nullptr;
+        }
+    }
+}
+
+bool TUnixChannel::Send(std::string_view Data, const std::vector<int>& Fds) {
+    if (Fds.size() > MaxFds) {
+        return false;
+    }
+    auto Size = uint32_t(Data.size());
+    char Header[sizeof(Size)];
+    std::memcpy(Header, &Size, sizeof(Size));
+    std::unique_lock Lock(mSendMutex);
+    // the fds go along with the header, which the receiver reads on its own, so they
+    // can't end up with the bytes of another message
+    iovec Iov { Header, sizeof(Header) };
+    msghdr Msg {};
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    char Control[CMSG_SPACE(sizeof(int) * MaxFds)] {};
+    if (!Fds.empty()) {
+        Msg.msg_control = Control;
+        Msg.msg_controllen = CMSG_SPACE(sizeof(int) * Fds.size());
+        auto* Cmsg = CMSG_FIRSTHDR(&Msg);
+        Cmsg->cmsg_level = SOL_SOCKET;
+        Cmsg->cmsg_type = SCM_RIGHTS;
+        Cmsg->cmsg_len = CMSG_LEN(sizeof(int) * Fds.size());
+        std::memcpy(CMSG_DATA(Cmsg), Fds.data(), sizeof(int) * Fds.size());
+    }
+    ssize_t Sent;
+    do {
+        Sent = sendmsg(mFd, &Msg, MSG_NOSIGNAL);
+    } while (Sent < 0 && errno == EINTR);
+    if (Sent <= 0) {
+        return false;
+    }
+    return SendAll(mFd, Header + Sent, sizeof(Header) - size_t(Sent)) && SendAll(mFd, Data.data(), Data.size());
+}
+
+std::optional<TUnixChannel::TMessage> TUnixChannel::Receive() {
+    char Header[sizeof(uint32_t)];
+    iovec Iov { Header, sizeof(Header) };
+    msghdr Msg {};
+    Msg.msg_iov = &Iov;
+    Msg.msg_iovlen = 1;
+    char Control[CMSG_SPACE(sizeof(int) * MaxFds)];
+    Msg.msg_control = Control;
+    Msg.msg_controllen = sizeof(Control);
+    ssize_t Received;
+    do {
+        Received = recvmsg(mFd, &Msg, MSG_CMSG_CLOEXEC);
+    } while (Received < 0 && errno == EINTR);
+    if (Received <= 0) {
+        return std::nullopt;
+    }
+    TMessage Message;
+    for (auto* Cmsg = CMSG_FIRSTHDR(&Msg); Cmsg; Cmsg = CMSG_NXTHDR(&Msg, Cmsg)) {
+        if (Cmsg->cmsg_level == SOL_SOCKET && Cmsg->cmsg_type == SCM_RIGHTS) {
+            auto Count = (Cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            Message.Fds.resize(Count);
+            std::memcpy(Message.Fds.data(), CMSG_DATA(Cmsg), sizeof(int) * Count);
+        }
+    }
+    auto Fail = [&] {
+        for (int Fd : Message.Fds) {
+            close(Fd);
+        }
+        return std::nullopt;
+    };
+    if ((Msg.msg_flags & MSG_CTRUNC) != 0 || !ReceiveAll(mFd, Header + Received, sizeof(Header) - size_t(Received))) {
+        return Fail();
+    }
+    uint32_t Size;
+    std::memcpy(&Size, Header, sizeof(Size));
+    if (Size > MaxMessageSize) {
+        error("unix socket message too large (" + std::to_string(Size) + " bytes), closing the channel");
+        return Fail();
+    }
+    Message.Data.resize(Size);
+    if (!ReceiveAll(mFd, Message.Data.data(), Size)) {
+        return Fail();
+    }
+    return Message;
+}
+
+void TUnixChannel::Shutdown() {
+    shutdown(mFd, SHUT_RDWR);
+}
+
+#else // not linux
+
+TUnixChannel::TUnixChannel(int Fd)
+    : mFd(Fd) {
+}
+
+TUnixChannel::~TUnixChannel() = default;
+
+std::unique_ptr<TUnixChannel> TUnixChannel::Connect(const std::string&) {
+    return nullptr;
+}
+
+int TUnixChannel::Listen(const std::string&) {
+    error("unix sockets are only supported on linux");
+    return -1;
+}
+
+std::unique_ptr<TUnixChannel> TUnixChannel::Accept(int) {
+    return nullptr;
+}
+
+bool TUnixChannel::Send(std::string_view, const std::vector<int>&) {
+    return false;
+}
+
+std::optional<TUnixChannel::TMessage> TUnixChannel::Receive() {
+    return std::nullopt;
+}
+
+void TUnixChannel::Shutdown() {
+}
+
+#endif // __linux__
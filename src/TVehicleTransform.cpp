@@ -0,0 +1,61 @@
+#include "TVehicleTransform.h"
+
+#include "Json.h"
+
+#include <charconv>
+
+namespace {
+
+template <size_t Size>
+bool ReadVector(const TArenaJsonDocument& Doc, const char* Name, std::array<double, Size>& Out) {
+    auto Member = Doc.FindMember(Name);
+    if (Member == Doc.MemberEnd() || !Member->value.IsArray() || Member->value.Size() != Size) {
+        return false;
+    }
+    std::array<double, Size> Values;
+    for (rapidjson::SizeType i = 0; i < Size; ++i) {
+        if (!Member->value[i].IsNumber()) {
+            return false;
+        }
+        Values[i] = Member->value[i].GetDouble();
+    }
+    Out = Values;
+    return true;
+}
+
+bool ReadInt(std::string_view Text, int& Out) {
+    auto [End, Error] = std::from_chars(Text.data(), Text.data() + Text.size(), Out);
+    return Error == std::errc() && End == Text.data() + Text.size();
+}
+
+}
+
+std::optional<TVehicleTransform> TVehicleTransform::Parse(std::string_view Packet) {
+    if (Packet.compare(0, 3, "Zp:") != 0) {
+        return std::nullopt;
+    }
+    Packet.remove_prefix(3);
+    auto IDEnd = Packet.find(':');
+    auto Dash = Packet.find('-');
+    if (IDEnd == std::string_view::npos || Dash == std::string_view::npos || Dash > IDEnd) {
+        return std::nullopt;
+    }
+    TVehicleTransform Transform;
+    if (!ReadInt(Packet.substr(0, Dash), Transform.PlayerID)
+        || !ReadInt(Packet.substr(Dash + 1, IDEnd - Dash - 1), Transform.VehicleID)) {
+        return std::nullopt;
+    }
+    auto Json = Packet.substr(IDEnd + 1);
+    TArenaJsonDocument Doc;
+    Doc.Parse(Json.data(), Json.size());
+    if (Doc.HasParseError() || !Doc.IsObject() || !ReadVector(Doc, "pos", Transform.Position)) {
+        return std::nullopt;
+    }
+    // the others are optional, a vehicle without them simply stands still
+    ReadVector(Doc, "vel", Transform.Velocity);
+    ReadVector(Doc, "rot", Transform.Rotation);
+    if (auto Time = Doc.FindMember("tim"); Time != Doc.MemberEnd() && Time->value.IsNumber()) {
+        Transform.Time = Time->value.GetDouble();
+    }
+    return Transform;
+}
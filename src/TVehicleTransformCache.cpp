@@ -0,0 +1,194 @@
+#include "TVehicleTransformCache.h"
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cmath>
+
+TVehicleTransformCache::TPin::TPin(const TVehicleTransformCache& Cache) {
+    while (true) {
+        auto Current = Cache.mCurrent.load();
+        mReaders = &Cache.mReaders[Current];
+        mReaders->fetch_add(1);
+        // the buffer may have been flipped away from in between, then the publisher
+        // might be refilling it already
+        if (Cache.mCurrent.load() == Current) {
+            mSnapshot = &Cache.mSnapshots[Current];
+            return;
+        }
+        mReaders->fetch_sub(1);
+    }
+}
+
+TVehicleTransformCache::TPin::~TPin() {
+    mReaders->fetch_sub(1);
+}
+
+TVehicleTransformCache::TVehicleTransformCache()
+    : mLastCleanup(TClock::now())
+    , mLastPublish(mLastCleanup) {
+    mThread = std::thread(&TVehicleTransformCache::PublishMain, this);
+}
+
+TVehicleTransformCache::~TVehicleTransformCache() {
+    {
+        std::unique_lock Lock(mMutex);
+        mShutdown = true;
+    }
+    mUpdated.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void TVehicleTransformCache::Update(const TVehicleTransform& Transform, const std::string& Room) {
+    auto Now = TClock::now();
+    std::unique_lock Lock(mMutex);
+    auto& Entry = mEntries[Key(Transform.PlayerID, Transform.VehicleID)];
+    Entry.Transform = Transform;
+    Entry.Room = Room;
+    Entry.UpdatedAt = Now;
+    if (!mDirty) {
+        mDirty = true;
+        mUpdated.notify_one();
+    }
+}
+
+void TVehicleTransformCache::Remove(int PlayerID, int VehicleID) {
+    std::unique_lock Lock(mMutex);
+    if (mEntries.erase(Key(PlayerID, VehicleID)) > 0) {
+        // a deleted vehicle shouldn't show up in queries anymore
+        PublishLocked(TClock::now());
+    }
+}
+
+void TVehicleTransformCache::RemovePlayer(int PlayerID) {
+    std::unique_lock Lock(mMutex);
+    size_t Removed = 0;
+    for (auto Iter = mEntries.begin(); Iter != mEntries.end();) {
+        if (Iter->second.Transform.PlayerID == PlayerID) {
+            Iter = mEntries.erase(Iter);
+            ++Removed;
+        } else {
+            ++Iter;
+        }
+    }
+    if (Removed > 0) {
+        PublishLocked(TClock::now());
+    }
+}
+
+std::optional<TVehicleTransform> TVehicleTransformCache::Find(int PlayerID, int VehicleID) const {
+    TPin Current(*this);
+    auto Iter = Current->Vehicles.find(Key(PlayerID, VehicleID));
+    if (Iter == Current->Vehicles.end()) {
+        return std::nullopt;
+    }
+    return Iter->second;
+}
+
+std::vector<TVehicleTransformCache::TVehicleID> TVehicleTransformCache::FindInRadius(const std::string& Room, const std::array<double, 3>& Position, double Radius) const {
+    std::vector<TVehicleID> Found;
+    if (!(Radius >= 0)) {
+        return Found;
+    }
+    TPin Current(*this);
+    auto InRoom = Current->Rooms.find(Room);
+    if (InRoom == Current->Rooms.end()) {
+        return Found;
+    }
+    auto IsInRadius = [&](const TVehicleTransform& Transform) {
+        double Distance = 0;
+        for (size_t i = 0; i < 3; ++i) {
+            Distance += (Transform.Position[i] - Position[i]) * (Transform.Position[i] - Position[i]);
+        }
+        return Distance <= Radius * Radius;
+    };
+    auto MinX = CellOf(Position[0] - Radius), MaxX = CellOf(Position[0] + Radius);
+    auto MinY = CellOf(Position[1] - Radius), MaxY = CellOf(Position[1] + Radius);
+    // a radius covering more cells than there are vehicles is quicker to check one by one
+    if (double(MaxX - MinX + 1) * double(MaxY - MinY + 1) > double(InRoom->second.Vehicles.size())) {
+        for (auto VehicleKey : InRoom->second.Vehicles) {
+            const auto& Transform = Current->Vehicles.at(VehicleKey);
+            if (IsInRadius(Transform)) {
+                Found.emplace_back(Transform.PlayerID, Transform.VehicleID);
+            }
+        }
+        return Found;
+    }
+    for (auto X = MinX; X <= MaxX; ++X) {
+        for (auto Y = MinY; Y <= MaxY; ++Y) {
+            auto Cell = InRoom->second.Cells.find(CellKey(X, Y));
+            if (Cell == InRoom->second.Cells.end()) {
+                continue;
+            }
+            for (auto VehicleKey : Cell->second) {
+                const auto& Transform = Current->Vehicles.at(VehicleKey);
+                if (IsInRadius(Transform)) {
+                    Found.emplace_back(Transform.PlayerID, Transform.VehicleID);
+                }
+            }
+        }
+    }
+    return Found;
+}
+
+int64_t TVehicleTransformCache::CellOf(double Coordinate) {
+    // keeps absurd coordinates from overflowing, they all end up in the outermost cells
+    return int64_t(std::floor(std::clamp(Coordinate / CellSize, -1e9, 1e9)));
+}
+
+void TVehicleTransformCache::PublishMain() {
+    RegisterThread("VehicleTransforms");
+    std::unique_lock Lock(mMutex);
+    while (!mShutdown) {
+        // without updates it still comes by now and then, for the vehicles which went stale
+        mUpdated.wait_for(Lock, StaleAfter, [this] { return mShutdown || mDirty; });
+        // what comes in until then goes into the same snapshot
+        mUpdated.wait_until(Lock, mLastPublish + PublishInterval, [this] { return mShutdown; });
+        if (mShutdown) {
+            break;
+        }
+        auto Now = TClock::now();
+        if (Now - mLastCleanup > StaleAfter) {
+            mLastCleanup = Now;
+            for (auto Iter = mEntries.begin(); Iter != mEntries.end();) {
+                if (Now - Iter->second.UpdatedAt > StaleAfter) {
+                    Iter = mEntries.erase(Iter);
+                    mDirty = true;
+                } else {
+                    ++Iter;
+                }
+            }
+        }
+        if (mDirty) {
+            PublishLocked(Now);
+        }
+    }
+}
+
+void TVehicleTransformCache::PublishLocked(TClock::time_point Now) {
+    auto NextIndex = 1 - mCurrent.load();
+    // readers which pinned it before the last flip
+    while (mReaders[NextIndex].load() > 0) {
+        std::this_thread::yield();
+    }
+    auto* Next = &mSnapshots[NextIndex];
+    // keeps the buckets from last time
+    Next->Vehicles.clear();
+    Next->Rooms.clear();
+    Next->Vehicles.reserve(mEntries.size());
+    for (const auto& [Key, Entry] : mEntries) {
+        if (Now - Entry.UpdatedAt > StaleAfter) {
+            continue;
+        }
+        Next->Vehicles.emplace(Key, Entry.Transform);
+        auto& Room = Next->Rooms[Entry.Room];
+        Room.Vehicles.push_back(Key);
+        Room.Cells[CellKey(CellOf(Entry.Transform.Position[0]), CellOf(Entry.Transform.Position[1]))].push_back(Key);
+    }
+    mCurrent.store(NextIndex);
+    mLastPublish = Now;
+    mDirty = false;
+}
+
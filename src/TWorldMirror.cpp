@@ -0,0 +1,157 @@
+#include "TWorldMirror.h"
+
+#include "TNetwork.h"
+#include "TPacketSchema.h"
+#include "TScratchArena.h"
+#include "TServer.h"
+#include "TVehicleTransform.h"
+
+#include <charconv>
+#include <optional>
+
+namespace {
+
+bool ReadInt(std::string_view Text, int& Out) {
+    auto [End, Error] = std::from_chars(Text.data(), Text.data() + Text.size(), Out);
+    return Error == std::errc() && End == Text.data() + Text.size();
+}
+
+// the first Count - 1 fields separated by '\n', and the rest of the message as the
+// last one. nothing if there are fewer fields.
+std::optional<std::vector<std::string_view>> Fields(std::string_view Message, size_t Count) {
+    std::vector<std::string_view> Result;
+    while (Result.size() + 1 < Count) {
+        auto End = Message.find('\n');
+        if (End == std::string_view::npos) {
+            return std::nullopt;
+        }
+        Result.push_back(Message.substr(0, End));
+        Message.remove_prefix(End + 1);
+    }
+    Result.push_back(Message);
+    return Result;
+}
+
+}
+
+TWorldMirror::TWorldMirror(TServer& Server, TNetwork& Network)
+    : mServer(Server)
+    , mNetwork(Network) {
+}
+
+void TWorldMirror::Apply(std::string_view Message) {
+    if (Message.empty()) {
+        return;
+    }
+    char Code = Message[0];
+    if (Code == 'S') {
+        // S, reliable, sender ID, room scoped, room, packet
+        auto Parts = Fields(Message, 6);
+        int SenderID;
+        if (!Parts || !ReadInt((*Parts)[2], SenderID) || (*Parts)[5].empty()) {
+            return;
+        }
+        std::string Room((*Parts)[4]);
+        // V to Z, where the other worker's vehicles are, for the plugins here
+        if (char Packet = (*Parts)[5][0]; (*Parts)[3] == "1" && Packet >= 'V' && Packet <= 'Z') {
+            TScratchArena::TScope ArenaScope;
+            if (auto Transform = TVehicleTransform::Parse((*Parts)[5]); Transform && Transform->PlayerID == SenderID) {
+                mServer.VehicleTransforms().Update(*Transform, Room);
+            }
+        }
+        mNetwork.DeliverBroadcast(SenderID, (*Parts)[3] == "1" ? &Room : nullptr, std::string((*Parts)[5]), (*Parts)[1] == "1");
+    } else if (Code == 'P') {
+        // P, player ID, room, name
+        auto Parts = Fields(Message, 4);
+        int PlayerID;
+        if (!Parts || !ReadInt((*Parts)[1], PlayerID)) {
+            return;
+        }
+        std::string Room((*Parts)[2]), Name((*Parts)[3]);
+        {
+            std::unique_lock Lock(mMutex);
+            mPlayers[PlayerID] = TPlayer { Name, Room };
+            // the vehicles moved rooms with the player
+            for (auto Iter = mVehicles.lower_bound({ PlayerID, 0 }); Iter != mVehicles.end() && Iter->first.first == PlayerID; ++Iter) {
+                Iter->second.Room = Room;
+            }
+        }
+        mServer.SetRemotePlayer(PlayerID, Name);
+    } else if (Code == 'L') {
+        // L, player ID. the players here were told by the broadcasts already
+        auto Parts = Fields(Message, 2);
+        int PlayerID;
+        if (!Parts || !ReadInt((*Parts)[1], PlayerID)) {
+            return;
+        }
+        {
+            std::unique_lock Lock(mMutex);
+            mPlayers.erase(PlayerID);
+            mVehicles.erase(mVehicles.lower_bound({ PlayerID, 0 }), mVehicles.lower_bound({ PlayerID + 1, 0 }));
+        }
+        mServer.VehicleTransforms().RemovePlayer(PlayerID);
+        mServer.RemoveRemotePlayer(PlayerID);
+    } else if (Code == 'V') {
+        // V, player ID, vehicle ID, room, spawn packet
+        auto Parts = Fields(Message, 5);
+        int PlayerID, VehicleID;
+        if (!Parts || !ReadInt((*Parts)[1], PlayerID) || !ReadInt((*Parts)[2], VehicleID)) {
+            return;
+        }
+        std::unique_lock Lock(mMutex);
+        mVehicles[{ PlayerID, VehicleID }] = TMirroredVehicle { std::string((*Parts)[3]), std::string((*Parts)[4]) };
+    } else if (Code == 'R') {
+        // R, player ID, vehicle ID
+        auto Parts = Fields(Message, 3);
+        int PlayerID, VehicleID;
+        if (!Parts || !ReadInt((*Parts)[1], PlayerID) || !ReadInt((*Parts)[2], VehicleID)) {
+            return;
+        }
+        {
+            std::unique_lock Lock(mMutex);
+            mVehicles.erase({ PlayerID, VehicleID });
+        }
+        mServer.VehicleTransforms().Remove(PlayerID, VehicleID);
+    }
+}
+
+std::vector<TWorldMirror::TVehicle> TWorldMirror::Vehicles(const std::string& Room) const {
+    std::vector<TVehicle> Result;
+    std::unique_lock Lock(mMutex);
+    for (const auto& [Key, Vehicle] : mVehicles) {
+        if (Vehicle.Room == Room) {
+            Result.push_back(TVehicle { Key.first, Key.second, Vehicle.Data });
+        }
+    }
+    return Result;
+}
+
+void TWorldMirror::RemovePlayers(const std::function<bool(int PlayerID)>& Fn, const std::string& Reason) {
+    std::vector<std::pair<int, TPlayer>> Removed;
+    std::vector<std::pair<std::string, TVehicle>> Vehicles;
+    {
+        std::unique_lock Lock(mMutex);
+        for (auto Iter = mPlayers.begin(); Iter != mPlayers.end();) {
+            if (!Fn(Iter->first)) {
+                ++Iter;
+                continue;
+            }
+            int PlayerID = Iter->first;
+            auto Begin = mVehicles.lower_bound({ PlayerID, 0 }), End = mVehicles.lower_bound({ PlayerID + 1, 0 });
+            for (auto Vehicle = Begin; Vehicle != End; ++Vehicle) {
+                Vehicles.emplace_back(Vehicle->second.Room, TVehicle { PlayerID, Vehicle->first.second, {} });
+            }
+            mVehicles.erase(Begin, End);
+            Removed.emplace_back(PlayerID, std::move(Iter->second));
+            Iter = mPlayers.erase(Iter);
+        }
+    }
+    for (auto& [Room, Vehicle] : Vehicles) {
+        mNetwork.DeliverBroadcast(Vehicle.PlayerID, &Room, PacketSchema::Serialize<PacketSchema::TVehicleDelete>(PacketSchema::TVehicleIDValue { Vehicle.PlayerID, Vehicle.VehicleID }), true);
+    }
+    for (auto& [PlayerID, Player] : Removed) {
+        mServer.VehicleTransforms().RemovePlayer(PlayerID);
+        mServer.RemoveRemotePlayer(PlayerID);
+        mNetwork.DeliverBroadcast(PlayerID, &Player.Room, PacketSchema::Serialize<PacketSchema::TLeaveMessage>(Player.Name + Reason), true);
+    }
+}
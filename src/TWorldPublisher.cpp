@@ -0,0 +1,70 @@
+#include "TWorldPublisher.h"
+
+#include "Client.h"
+#include "TServer.h"
+
+TWorldPublisher::TWorldPublisher(TServer& Server, bool Broadcasts, TSink Sink)
+    : mServer(Server)
+    , mBroadcasts(Broadcasts)
+    , mSink(std::move(Sink)) {
+}
+
+std::vector<std::string> TWorldPublisher::Snapshot() {
+    std::vector<std::string> Messages;
+    mServer.ForEachClient([&](const std::weak_ptr<TClient>& ClientPtr) -> bool {
+        auto Client = ClientPtr.lock();
+        if (!Client || !Client->IsSynced()) {
+            return true;
+        }
+        Messages.push_back(PlayerMessage(*Client));
+        TClient::TSetOfVehicleData VehicleData;
+        { // Vehicle Data Lock Scope
+            auto LockedData = Client->GetAllCars();
+            VehicleData = *LockedData.VehicleData;
+        } // End Vehicle Data Lock Scope
+        for (auto& v : VehicleData) {
+            Messages.push_back(VehicleMessage(*Client, v.ID(), v.Data()));
+        }
+        return true;
+    });
+    return Messages;
+}
+
+void TWorldPublisher::OnPlayerUpdated(const TClient& Client) {
+    mSink(PlayerMessage(Client));
+}
+
+void TWorldPublisher::OnPlayerRemoved(int PlayerID) {
+    mSink("L\n" + std::to_string(PlayerID));
+}
+
+void TWorldPublisher::OnVehicleUpdated(const TClient& Client, int VehicleID, const std::string& Data) {
+    mSink(VehicleMessage(Client, VehicleID, Data));
+}
+
+void TWorldPublisher::OnVehicleRemoved(int PlayerID, int VehicleID) {
+    mSink("R\n" + std::to_string(PlayerID) + "\n" + std::to_string(VehicleID));
+}
+
+void TWorldPublisher::OnBroadcast(const TClient* Sender, const std::string& Data, bool Rel) {
+    if (!mBroadcasts) {
+        return;
+    }
+    std::string Message = "S\n";
+    Message += Rel ? "1\n" : "0\n";
+    if (Sender) {
+        Message += std::to_string(Sender->GetID()) + "\n1\n" + mServer.RoomOf(*Sender) + "\n";
+    } else {
+        Message += "-1\n0\n\n";
+    }
+    Message += Data;
+    mSink(Message);
+}
+
+std::string TWorldPublisher::PlayerMessage(const TClient& Client) const {
+    return "P\n" + std::to_string(Client.GetID()) + "\n" + mServer.RoomOf(Client) + "\n" + Client.GetName();
+}
+
+std::string TWorldPublisher::VehicleMessage(const TClient& Client, int VehicleID, const std::string& Data) const {
+    return "V\n" + std::to_string(Client.GetID()) + "\n" + std::to_string(VehicleID) + "\n" + mServer.RoomOf(Client) + "\n" + Data;
+}
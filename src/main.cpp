@@ -4,15 +4,20 @@
 #include "CustomAssert.h"
 #include "Http.h"
 #include "SignalHandling.h"
+#include "TClusterFront.h"
+#include "TClusterWorker.h"
 #include "TConfig.h"
 #include "THeartbeatThread.h"
+#include "THotUpgrade.h"
 #include "TLuaEngine.h"
 #include "TNetwork.h"
 #include "TPPSMonitor.h"
 #include "TResourceManager.h"
 #include "TServer.h"
+#include "TStandby.h"
 
 #include <iostream>
+#include <optional>
 #include <thread>
 
 // this is provided by the build system, leave empty for source builds
@@ -22,6 +27,11 @@ TSentry Sentry {};
 int main(int argc, char** argv) try {
     setlocale(LC_ALL, "C");
 
+    // this process handed the server over to a new one and only waits for it
+    if (auto ExitCode = THotUpgrade::WaitForSuccessor()) {
+        return *ExitCode;
+    }
+
     SetupSignalHandlers();
 
     bool Shutdown = false;
@@ -45,12 +55,41 @@ int main(int argc, char** argv) try {
 
     Sentry.SetupUser();
     Sentry.PrintWelcome();
+#ifdef __linux__
+    if (Application::Settings.ClusterWorkers > 0 && !TClusterWorker::Index()) {
+        // the workers run the game, this process only passes their players on to them
+        TClusterFront Front(argv);
+        while (!Shutdown) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        info("Shutdown.");
+        return 0;
+    }
+#endif // __linux__
+    // a standby only keeps a copy of the players until the server it stands by for is gone
+    std::optional<TStandby> Standby;
+    if (auto Fd = TStandby::Channel()) {
+        Standby.emplace(*Fd);
+        if (!Standby->WaitForFailover()) {
+            return 0;
+        }
+        Application::Console().TakeOverFromServer();
+    }
     TResourceManager ResourceManager;
     TPPSMonitor PPSMonitor(Server);
-    THeartbeatThread Heartbeat(ResourceManager, Server);
     TNetwork Network(Server, PPSMonitor, ResourceManager);
+    // a cluster is announced once, by its first worker
+    std::optional<THeartbeatThread> Heartbeat;
+    if (TClusterWorker::Index().value_or(0) == 0) {
+        Heartbeat.emplace(ResourceManager, Server, Network);
+    }
     TLuaEngine LuaEngine(Server, Network);
     PPSMonitor.SetNetwork(Network);
+    // takes the players over, if this process is started by a hot upgrade
+    THotUpgrade HotUpgrade(argv, Server, Network, LuaEngine);
+    if (Standby) {
+        Standby->TakeOver(Server, Network);
+    }
     Application::Console().InitializeLuaConsole(LuaEngine);
     Application::CheckForUpdates();
 